@@ -22,14 +22,42 @@ Module summary:
 This class holds information about clients connected to the server. 
 Framework uses this class to add/remove client whenever client connects/disconnects. 
 Also when it needs to add or remove request/response counts to the client.
+
+Clients are spread over CLIENTS_POOL_SHARDS shards by registration number, each with its own hash map and lock.
+So threads looking up different clients (e.g. SendResponse from multiple request processors) don't contend on single lock.
+Registration numbers are assigned sequentially (See stClient c'tor), hence lower bits of it are enough to spread clients evenly.
+
+Clients are also kept in hashed timer wheel of KEEP_ALIVE_WHEEL_SLOTS one second slots, by time they'd become idle for keep alive. 
+Request/response counters only stamp activity time (cached loop time, no system call). Main loop advances the wheel every second (GetIdleClients)
+and looks only at clients of expiring slots. Client found active meanwhile is moved to slot of its new expiry, idle one gets keep alive.
+So keep alive costs in proportion to expiring clients rather than all clients.
 */
 
-class ClientsPool
+#define CLIENTS_POOL_SHARDS 64 // Must be power of 2
+#define KEEP_ALIVE_WHEEL_SLOTS 64 // Must be power of 2. Keep alive frequency beyond these many seconds just takes clients around the wheel more than once.
+
+struct CACHE_ALIGNED ClientsPoolShard
 {
-	std::map<UINT64, stClient*> m_ClientsMap;
+	std::unordered_map<UINT64, stClient*> m_ClientsMap;
 	uv_rwlock_t m_ClientsMapLock;
+};
+
+class ClientsPool
+{
+	ClientsPoolShard m_Shards[CLIENTS_POOL_SHARDS];
 	BOOL m_bIsServerShuttingDown;
 
+	ClientsPoolShard& GetShard(UINT64 ClientRegistrationNumber);
+
+	/* Keep Alive Related */
+	stClient* m_pWheelSlots[KEEP_ALIVE_WHEEL_SLOTS]; // Doubly linked lists of clients (See stClient::m_pNextInWheel) 
+	uv_rwlock_t m_WheelLock; // Clients are added and removed by their event loops, whereas wheel is advanced by main loop
+	UINT64 m_WheelTime; // Second (of loop time) up to which wheel has been advanced
+	std::atomic<UINT64> m_CurrentTime; // Loop time (milliseconds) of main loop cached by SetCurrentTime. Read by threads to stamp activity.
+
+	void AddToWheel(stClient* pClient, UINT64 ExpiryTime);
+	void RemoveFromWheel(stClient* pClient);
+
 	public:
 		ClientsPool(); 
 		~ClientsPool(); 
@@ -37,8 +65,9 @@ class ClientsPool
 		BOOL RemoveClient(stClient* pClient);
 		int IncreaseCountForClient (ClientHandle* clienthandle, stClient* &pClient, BOOL RequestORResponse); // pClient is out param (See definition for details)
 		int DecreaseCountForClient (stClient* pClient, BOOL RequestORResponse);
-		void GetClients(Clients& vClients); 
-		void GetIdleClients(ClientHandles& vClientHandles, ClientType Type); 
+		void GetClients(Clients& vClients, struct stEventLoop* pEventLoop); // Clients accepted by given event loop
+		void SetCurrentTime(UINT64 LoopTime); // Called by main loop with uv_now
+		void GetIdleClients(ClientHandles& vVersionedClients, ClientHandles& vVersionlessClients); // Called by main loop. Advances the wheel.
 		// BOOL IsClientIdle(int ClientIndex, ClientHandle& clienthandle, USHORT& version); // Returns TRUE if stClient at ClientIndex is NOT NULL and has no pending requests and responses. FALSE otherwise.
 		unsigned int GetClientsCount();
 		void SetServerShuttingDown(); // Called only thru event loop after it reads keystrokes to shutdown
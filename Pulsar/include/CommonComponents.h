@@ -51,6 +51,13 @@ class DLL_API CommonComponents
 #else
 		ServerStat m_stServerStat; // Common structure for all clients to store statistical info
 #endif
+		ServerStatCounters m_StatCounters[STAT_COUNTERS_BLOCKS]; // Counters changed by threads without locks (See ServerStatCounters)
+		std::atomic<int> m_StatInterval; // Increased by main loop each time it logs stat. Event loops restart their min/max durations when it changes.
+
+		ServerStatCounters& GetStatCounters(int ThreadIndex); // ThreadIndex is -1 for event loop (block of the event loop calling it)
+		void AddUpStatCounters(ServerStat& stServerStat);
+		static void SetCurrentEventLoopIndex(int EventLoopIndex); // Called once by each event loop thread other than main
+		static int GetCurrentEventLoopIndex();
 
 		BOOL m_bResponseDirectionFlag;
 		BOOL after_send_response_called_by_send_response;
@@ -61,7 +68,7 @@ class DLL_API CommonComponents
 		virtual void DoPeriodicActivities()=0;
 		virtual void SendResponses()=0;
 		virtual void IncreaseExceptionCount(BOOL bType, char* filename, int linenumber)=0; 
-		virtual int AddResponseToQueues(class Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException)=0;
+		virtual int AddResponseToQueues(class Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured)=0;
 
 	public:
 		CommonComponents();
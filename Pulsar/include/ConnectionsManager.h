@@ -24,19 +24,30 @@ Application need to use only some of public methods of this class.
 Please refer demo application to see how to use this class to create your server.
 */
 
-class DLL_API ConnectionsManager:public LocalClientsManager, PeerServersManager
+#define SIGNALS_HANDLED 3 // Linux only: SIGINT, SIGTERM and SIGUSR1
+
+class DLL_API ConnectionsManager:public LocalClientsManager, public PeerServersManager // Public, so that peer server callbacks can get to ConnectionsManager (dynamic_cast)
 {
+	// LocalClientsManager hands over DoPeriodicActivities and AddResponseToQueues to request processors. 
+	// (Standard C++ doesn't allow converting pointer to member of virtual base CommonComponents to pointer to member of ConnectionsManager)
+	friend class LocalClientsManager;
+
 	private:
 		Logger* m_pLogger;
 		WriteToFile* m_pWriteToFile;
 
 		BOOL m_bIsServerShutDown;
-		uv_rwlock_t m_rwlResponseDirectionFlagLock; // Used by threads to add remove responses to queue and clients to set
+		uv_rwlock_t m_rwlResponseDirectionFlagLock; // Used by threads to add responses to peer servers queues and servers to set
 		uv_rwlock_t m_rwlMemoryAllocationErrorCounter;
-		uv_rwlock_t m_rwlResponseCountersLock1, m_rwlResponseCountersLock2; // Used by threads as well as event loop to increase/decrease response related counters
 
 		uv_tty_t tty;
 		uv_timer_t tick;
+		BOOL m_bIsStdinTTY; // FALSE when server is launched without terminal. Then key strokes are not read.
+
+#ifndef _WIN32
+		uv_signal_t signals[SIGNALS_HANDLED]; // SIGINT, SIGTERM and SIGUSR1 (See StartServer)
+		static void on_signal(uv_signal_t* handle, int signum);
+#endif
 
 		char keyboard_buffer[KEYBOARD_BUFFER_LEN];
 
@@ -49,11 +60,13 @@ class DLL_API ConnectionsManager:public LocalClientsManager, PeerServersManager
 		static void after_timer_closed(uv_handle_t* handle);
 
 		void GetCopyOfServerStat (ServerStat& stServerStatCopy);
+#ifdef _WIN32
 		static BOOL CtrlHandler( DWORD fdwCtrlType );
+#endif
 		int GetResponsesInQueue();
 		void DoPeriodicActivities();
 		void SendResponses();
-		int AddResponseToQueues(class Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException);
+		int AddResponseToQueues(class Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured);
 		void AfterSendingResponse(Response* pResponse, stNode* pNode, int status);
 		void Shutdown();
 
@@ -68,10 +81,13 @@ class DLL_API ConnectionsManager:public LocalClientsManager, PeerServersManager
 		int StartServer (char* IPAddress, unsigned short int IPv4Port, bool bDisableConsoleWindowCloseButton = true);  // Calls LocalClientsManagers StartListening
 		INT64 GetMemoryConsumptionByResponsesInQueue();
 		void IncreaseExceptionCount(BOOL bType, char* filename, int linenumber); 
+		void AddCompressionDetailsToServerStat(ULONG PayloadLength, ULONG CompressedLength, double CompressionTime);
+		void AddDecompressionDetailsToServerStat(BOOL bIsDecompressed, double DecompressionTime);
 		void StopServer (); 
 		VersionParameters* GetVersionParameters(USHORT version);
 
 		static void after_send_responses(uv_write_t* write_req, int status);
 		static double GetHighPrecesionTime();
 		static long long GetProcessPrivateBytes(); 
+		static DWORD GetProcessHandleCount(); 
 };
@@ -25,8 +25,110 @@ Primary responsibilities are:
 	3. Validate incoming requests
 	4. Create request objects and queue them
 	5. Send responses from responses queue for client
+
+Clients' I/O can be spread over multiple event loops (CommonParameters::EventLoops). Each loop has its own listening socket
+bound to same port with SO_REUSEPORT, so kernel distributes incoming connections among them. Client stays with the loop which
+accepted it. Main loop (index 0) additionally runs timers, stat, keep alive and peer servers. Other loops run in their own threads.
+Threads (and other loops) hand over responses to client's loop through its pending clients list and wake it up with uv_async.
+Loop isn't woken up for every response. First response queued after a flush rings flush doorbell of the loop, which flushes either
+right away or, when CommonParameters::FlushLatencyInMilliseconds is set, after that latency unless FlushBatchResponses are queued
+earlier. Responses queued meanwhile go out with the same flush, so burst of them makes few large writes rather than many small ones.
+Requests, disconnections and keep alives are processed by threads of Scheduler, which hand them back to loop which queued them.
+
+When version allows pipelining (VersionParameters::m_MaxPipelinedRequests > 1) client's next requests are read while previous ones are 
+still being processed. Each request then owns its buffer and gets sequence number. Responses a request sends to its own client are held 
+in request's pipeline slot until all earlier requests of the client have finished and their responses are queued. Thus client receives 
+responses in order of its requests.
+
+Client's responses queue has a lane for each priority (See RESPONSE_PRIORITY_NORMAL). Each write of client takes ready responses of higher
+lane first, so keep alive or interactive response isn't held behind bulk multicast updates queued before it. Order is kept only within lane.
+Hence response of request still goes out after responses (of same priority) of earlier requests of pipelining client.
+
+Bytes of responses waiting to be sent are budgeted per client (VersionParameters::m_MaxPendingResponseBytes) and for all clients of
+server together (CommonParameters::MaxPendingResponseBytes), besides count of them (MaxPendingResponses). Thread adding response checks
+budgets in AddResponseToQueue and event loop releases bytes as responses are done (AfterSendingLocalClientsResponses). So fan out storm to
+slow clients can't grow queued memory without bound. Beyond global budget response is always dropped. Beyond client's budget version's
+BACKPRESSURE_* policy decides: thread drops newest itself, whereas dropping oldest and disconnecting are done by event loop which owns
+client's queue and connection (flagged by m_bOverResponseBytesBudget), and stopping reading is done by event loop too (See PauseOrResumeReading). Budgets are
+checked without locks, so concurrent threads can overshoot them by a response each.
+
+When CommonParameters::ReadRingSize is non-zero, client's bytes are read into its read ring, as many as socket has and ring can take.
+ExtractRequestsFromReadRing then carves out all complete requests the ring holds (as many as pipeline allows) copying each into its own 
+buffer. Bytes of incomplete request are moved to the front of the ring before next read. Ring is released as soon as it is empty, so idle 
+clients don't hold it. A request bigger than ring is read into its own buffer, as it is when ring is not used.
+
+Request processors and version parameters are looked up for every request in two levels: high byte of version selects page and low byte 
+its slot in page. Table is built once from versions whose global request processors have registered themselves, and only pages those 
+versions fall in are allocated.
+
+Request suspended by its processor (See RequestProcessor::SuspendRequestProcessing) stays with event loop of its client, in client's list 
+of suspended requests, without any thread. It counts as being processed, so its client's following requests and their responses wait just 
+as they do behind request being processed. Client whose pipeline is full isn't read at all meanwhile (See PauseOrResumeReading), so
+long wait costs no CPU. Whoever resumes it pushes it to resumed requests of the event loop (lock-free) and wakes the 
+loop through its resume handle. Loop then queues it to threads again. Suspended requests of client being disconnected are abandoned: 
+they are queued without being processed further, so that client can be deleted (and server can shut down).
 */
 
+struct stRequestContinuation;
+
+struct stEventLoop
+{
+	int m_Index; // 0 for main loop
+	uv_loop_t* m_pLoop;
+	uv_thread_t m_Thread; // Not used for main loop
+	uv_tcp_t m_tcp_server; // Listening socket of this loop
+	uv_async_t m_AsyncHandle; // Used only when there are more than one event loops. Wakes loop up to send responses, to shutdown or to stop.
+	std::atomic<BOOL> m_bShutdownRequested, m_bStopRequested; // Set by main loop before waking this loop up
+	std::atomic<BOOL> m_bDisconnectRequested; // Set by main loop to have this loop disconnect its clients without shutting down
+	BOOL m_bShutdownInitiated; // Listening socket is being closed
+	class LocalClientsManager* m_pLocalClientsManager;
+	ServerStatCounters* m_pStatCounters; // Counters block of this loop
+	stDoneWorks m_DoneWorks; // Works this loop has queued to Scheduler and workers have finished
+
+	/* Responses Related */
+	std::atomic<struct stClient*> m_pPendingClients; // Clients having responses to be sent. Threads push clients (lock-free), event loop takes whole list at once.
+	struct stClient* m_pDeferredClients; // Used only by event loop. Clients whose first response in queue wasn't ready to send yet.
+	std::atomic<int> m_ResponsesToFlush; // Queued since last flush. Whoever makes it 1 (or FlushBatchResponses) rings flush doorbell.
+	uv_async_t m_FlushDoorbell; // Wakes loop up to flush responses. Unlike m_AsyncHandle, initialized for main loop too.
+	uv_timer_t m_FlushTimer; // Flushes FlushLatencyInMilliseconds after doorbell, unless batch fills up earlier
+	BOOL m_bAfterSendCalledBySendResponses;
+
+	/* Suspended Requests Related (See Module summary) */
+	uv_async_t m_ResumeHandle; // Wakes loop up to queue resumed requests. Unlike m_AsyncHandle, initialized for main loop too.
+	std::atomic<stRequestContinuation*> m_pResumedRequests; // Pushed by any thread (lock-free), event loop takes whole list at once
+};
+
+#define CONTINUATION_SUSPENDING 0 // ProcessRequest which suspended request has not returned yet
+#define CONTINUATION_SUSPENDED 1 // Request is in its client's list of suspended requests
+#define CONTINUATION_RESUMED 2 // Resumed by application, or abandoned by event loop
+
+// Created when request processor suspends request. Shared by framework (till request is queued again) and application (till it resumes it).
+// Last of them to release it deletes it, so that application can resume it even after request was abandoned.
+struct stRequestContinuation
+{
+	class Request* m_pRequest;
+	struct stClient* m_pClient;
+	stEventLoop* m_pEventLoop; // Of client. Resumed request is queued again by it.
+	std::atomic<int> m_State; // CONTINUATION_SUSPENDING etc.
+	std::atomic<int> m_References;
+	stRequestContinuation* m_pNextResumed; // Link in event loop's resumed requests
+	stRequestContinuation* m_pPrevSuspended; // Links in client's suspended requests (Used only by event loop)
+	stRequestContinuation* m_pNextSuspended;
+
+	ALLOCATE_FROM_SLAB // Created by request processing threads, deleted by event loop or by thread resuming request
+
+	stRequestContinuation(class Request* pRequest, struct stClient* pClient);
+	void Release();
+};
+
+// Responses held for one in-flight request of a pipelining client (See stClient::m_pPipelineSlots)
+struct stPipelineSlot
+{
+	std::vector<class Response*> m_HeldResponses; // Added by request processing thread, queued by event loop in order
+	size_t m_QueuedResponses; // Count of m_HeldResponses already pushed to client's responses queue
+	BOOL m_bCompleted; // Request has been processed
+};
+
 struct stClient:public stNode
 {
 	uv_tcp_t m_client; // Initiated in AcceptConnection after each client connects
@@ -34,8 +136,10 @@ struct stClient:public stNode
 	/* Connection Related */
 	class LocalClientsManager* m_pLocalClientsManager ;
 	BOOL m_bIsAccepted, m_bIsReadStarted, m_bIsAddedToPool;
-	stClient(uv_tcp_t* server, ServerStat& stServerStat, IPv4Address& ServerIPv4Address);
-	uv_tcp_t* m_server ; // Listening server which is common to all clients. Gets initiated in uv_tcp_init in main.
+	BOOL m_bIsReadPaused; // Reading stopped till pipeline has room or client is within its budget (See PauseOrResumeReading)
+	stClient(stEventLoop* pEventLoop, UINT64 RegistrationNumber, IPv4Address& ServerIPv4Address);
+	stEventLoop* m_pEventLoop; // Event loop which accepted this client. All I/O of client happens on it.
+	uv_tcp_t* m_server ; // Listening server of the event loop. Gets initiated in StartListening.
 	ClientHandle m_ClientHandle;
 	bool m_bDeleted ; // Used only for debugging
 
@@ -45,11 +149,26 @@ struct stClient:public stNode
 	USHORT m_Version ; // Version of master protocol used by this client
 	uv_buf_t m_Request;
 	ULONG m_Request_Index; // Index in the m_Request.base buffer
-	BOOL m_bRequestIsBeingProcessed; // Flag that when true indicates request is being processed for this client. Used to process requests synchronously.
+	int m_RequestsBeingProcessed; // Requests of this client queued to threads. At most one unless version allows pipelining.
 	BOOL m_bRequestProcessingFinished;
+	int m_MaxPipelinedRequests; // Taken from version parameters when first request is created. Zero till then.
+
+	/* Pipelining Related (See Module summary) */
+	stPipelineSlot* m_pPipelineSlots; // One per in-flight request (indexed by sequence). Allocated only when version allows pipelining.
+	uv_rwlock_t m_rwlPipelineLock; // Guards m_pPipelineSlots and m_OldestRequestSequence between threads and event loop
+	UINT64 m_NextRequestSequence; // Sequence of next request to be created. Used only by event loop.
+	UINT64 m_OldestRequestSequence; // Oldest request whose responses are not yet all queued
+	std::atomic<UINT64> m_DirectResponsesSequence; // Request which can queue its responses to client directly (without holding them). Published by event loop.
+	BOOL m_bPipelineQueueingBlocked; // Responses queue got full while queueing held responses. Event loop retries after sending.
+	stRequestContinuation* m_pSuspendedRequests; // Requests of client suspended by their processors (Used only by event loop)
+
 	int m_RequestSizeFound;
 	bool m_bStreaming, m_bRequestMemoryAllocatedForStreaming;
 
+	/* Read Ring Related (See Module summary) */
+	char* m_pReadRing; // Non NULL only while client's bytes are being read into ring. Then m_Request is unused.
+	ULONG m_ReadRingStart, m_ReadRingEnd; // Unparsed bytes of ring
+
 	/* Request Processing Related */
 	LockRequestsResponses m_LockRequestsResponses;
 	void LoopBack(int RequestLength); // Loops back request to client thus producing quick echo thru event loop itself. Only used for debugging.
@@ -57,14 +176,19 @@ struct stClient:public stNode
 
 	/* Responses Related */
 	uv_write_t m_write_req ;
-	std::deque<class Response*> m_ResponsesQueue1, m_ResponsesQueue2;
-	uv_rwlock_t m_rwlResponsesQueueLock;
-	BOOL m_bResponseQueueFull;
+	ResponseQueue m_ResponsesQueues[RESPONSE_PRIORITIES]; // Lanes indexed by priority. Threads push responses, event loop pops them to send (higher lane first).
+	std::atomic<BOOL> m_bHasPendingResponses; // TRUE while client is in pending (or deferred) clients list of its event loop
+	stClient* m_pNextPendingClient; // Link in pending clients list
+	BOOL m_bResponseQueueFull; // Only to avoid overlogging. Races between threads are harmless.
+	std::atomic<INT64> m_PendingResponseBytes; // Of responses queued and not yet done with (See Module summary)
+	std::atomic<INT64> m_MaxPendingResponseBytes; // Taken from version parameters along with m_MaxPipelinedRequests. Zero (no budget) till then.
+	int m_BackpressurePolicy; // Set before m_MaxPendingResponseBytes is published
+	std::atomic<BOOL> m_bOverResponseBytesBudget; // Set by threads for event loop to drop oldest responses or disconnect client
 	uv_buf_t* m_pResponsesBuffersBeingSent;
 	int m_SizeReservedForResponsesBeingSend;
 
 	/* Disconnection Processing Related */
-	uv_work_t m_disconnect_work_t;
+	stWork m_disconnect_work_t;
 	bool m_bDisconnectInitiated;
 	BOOL m_bToBeDisconnected; // Mark this client to be disconnected and deleted
 	uv_rwlock_t m_rwlLockForDisconnectionFlag;
@@ -76,9 +200,16 @@ struct stClient:public stNode
 #endif
 
 	/* Logging and Stat Related */
-	ServerStat* m_pServerStat ;
+	ServerStatCounters* m_pStatCounters ; // Counters block of client's event loop
+
+	/* Keep Alive Related (See ClientsPool.h) */
+	stClient* m_pNextInWheel;
+	stClient* m_pPrevInWheel;
+	UINT64 m_WheelExpiryTime; // Second (of loop time) when client would be idle. Zero when client isn't in the wheel.
 
 	public:
+		ALLOCATE_FROM_SLAB // Created and deleted by client's event loop
+
 		/* METHODS TO BE CALLED BY REQUEST PROCESSORS */
 		void MarkToDisconnect(BOOL bIsByServer);
 		BOOL IsMarkedToDisconnect();
@@ -90,12 +221,24 @@ struct stClient:public stNode
 		class ConnectionsManager* GetConnectionsManager();
 };
 
+#define VERSIONS_PER_PAGE 256
+#define VERSION_PAGES ((0xFFFF / VERSIONS_PER_PAGE) + 1)
+
+// Request processors of a version (See LocalClientsManager::m_pVersionPages)
+struct stVersionProcessors
+{
+	VersionParameters* m_pVersionParameters; // Of processor of first thread. NULL if it couldn't be created.
+	class RequestProcessor* m_pRequestProcessors[MAX_WORK_THREADS]; // Indexed by thread index
+};
+
 // LocalClientsManager deals with Clients (struct stClient per each incoming connection) as well as with peer Servers (struct stPeerServer per each remote server) 
 // It has private static data shared by all connections.
 class DLL_API LocalClientsManager:protected virtual CommonComponents
 {
 	/* Connection Related */
-	uv_tcp_t m_tcp_server ;
+	stEventLoop m_EventLoops[MAX_EVENT_LOOPS];
+	int m_EventLoopsCount;
+	std::atomic<UINT64> m_ClientRegistrationNumber; // Clients of all event loops get unique registration numbers
 	IPv4Address m_ServerIPv4Address;
 	int m_ConnectionCallbackError;
 	const char* m_HostName;
@@ -103,40 +246,68 @@ class DLL_API LocalClientsManager:protected virtual CommonComponents
 	int AcceptConnection(stClient* pClient);
 	uv_getnameinfo_t m_nameinfo_t;
 	static void getnameinfo_cb(uv_getnameinfo_t* req, int status, const char* hostname, const char* service);
+	int StartEventLoop(stEventLoop* pEventLoop, int Index, struct sockaddr_in& bind_addr);
+	static void event_loop_thread(void* arg);
+	static void on_event_loop_async(uv_async_t* handle);
+	static void on_requests_resumed(uv_async_t* handle);
+	static void on_flush_doorbell(uv_async_t* handle);
+	static void on_flush_timer(uv_timer_t* handle);
 
 	/* Keep Alive Related */
-	uv_work_t m_keep_alive_work_t;
-	static void send_keepalive_thread(uv_work_t* work_t);
-	static void after_send_keepalive_thread(uv_work_t* work_t, int status);
+	stWork m_keep_alive_work_t;
+	ClientHandles m_IdleClients[VersionlessClient+1]; // Per ClientType. Filled by main loop (SendKeepAlive), used by send_keepalive_thread.
+	static void send_keepalive_thread(stWork* work_t);
+	static void after_send_keepalive_thread(stWork* work_t, int status);
 	class RequestProcessor* m_pReqProcessorToSendKepAlive;
 	
 	/* Request Processing Related */
-	std::map <USHORT, RequestProcessor*> m_RequestProcessors[MAX_WORK_THREADS];
-	uv_rwlock_t m_rwlThreadIndexCounterLock; 
+	Scheduler m_Scheduler; // Runs request processing, disconnection processing and keep alive threads
+	stVersionProcessors** m_pVersionPages[VERSION_PAGES]; // Page is VERSIONS_PER_PAGE slots, NULL for version without processors
+	std::vector<USHORT> m_RegisteredVersions; // Versions having request processors, in ascending order
 	int m_MaxRequestSizeOfAllVersions, m_MaxResponseSizeOfAllVersions;
-	int ThreadIndexCounter;
-	uv_rwlock_t m_rwlRequestCountersLock1;
 	class Request* CreateRequestAndQueue(uv_buf_t* request, stClient* pClient);
 	BOOL IsRequestBeingProcessed(stClient* pClient) ;
+	int GetMaxPipelinedRequests(stClient* pClient);
+	BOOL IsPipelineFull(stClient* pClient);
 	int InitiateRequestProcessorsAndValidateParameters();
 	RequestProcessor* GetRequestProcessor(unsigned short version, int threadindex);
+	stVersionProcessors* GetVersionProcessors(unsigned short Version);
 	void ExtractRequestOffTheBuffer(stClient* pClient, ssize_t nread);
+	void ExtractRequestsFromReadRing(stClient* pClient);
+	void ReleaseReadRing(stClient* pClient);
 	void GetRequestBuffer(stClient* pClient, uv_buf_t& request_buffer);
 	void ResetRequestBuffer(stClient* pClient);
+	void SuspendRequest(stClient* pClient, Request* pRequest);
+	void QueueResumedRequest(stClient* pClient, Request* pRequest);
+	void QueueResumedRequests(stEventLoop* pEventLoop);
+	void AbandonSuspendedRequests(stClient* pClient);
 
 	/* Responses Related */
-	std::set <stClient*> m_RecevingClientsSet1,  m_RecevingClientsSet2;
-	uv_rwlock_t m_rwlClientSetLock;
 	uv_rwlock_t m_rwlWaitTillResponseForClientIsBeingAdded;
-	BOOL AddResponseToQueue(Response* pResponse, stClient* pClient, BOOL& bHasEncounteredMemoryAllocationException);
-	BOOL AddToClientSet(std::set<stClient*>* pClientsSet, stClient* pClient, BOOL bTobeLocked);
+	int m_FlushLatencyInMilliseconds, m_FlushBatchResponses; // Copied from CommonParameters, as they are read for every response
+	INT64 m_MaxPendingResponseBytes; // Copied from CommonParameters
+	std::atomic<INT64> m_PendingResponseBytes; // Of all clients (See Module summary)
+	BOOL IsOverResponseBytesBudget(stClient* pClient);
+	void AddPendingResponseBytes(stClient* pClient, INT64 Bytes);
+	BOOL ReserveResponseBytes(Response* pResponse, stClient* pClient, BOOL& bIsBackpressured, BOOL& bToDropOldest);
+	void DropOldestResponses(stClient* pClient);
+	BOOL AreResponsesQueuesEmpty(stClient* pClient);
+	BOOL IsResponseReadyToSend(stClient* pClient);
+	void FlushResponses(stEventLoop* pEventLoop);
+	BOOL AddResponseToQueue(Response* pResponse, stClient* pClient, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured);
+	void AddToPendingClients(stClient* pClient);
+	BOOL AddResponseToQueueInOrder(Response* pResponse, stClient* pClient, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured);
+	void CompletePipelinedRequest(stClient* pClient, Request* pRequest);
+	void QueueHeldResponses(stClient* pClient);
 	
 	/* Disconnection Processing Related */
-	int QueuedDisconnections;
-	BOOL m_bServerStopped; // Turned TRUE by on_server_stopped callback. Accessed by DoPeriodicActivities() via IsServerStopped() to proceed with shutdown when TRUE.
-	int m_ClientsClosing ;
-	BOOL m_bAllClientsDisconnectedForShutdown ;
+	std::atomic<int> QueuedDisconnections; // Atomic as all event loops change it
+	std::atomic<int> m_ServersStopped; // Increased by on_server_stopped callback of each event loop. Accessed by DoPeriodicActivities() via IsServerStopped() to proceed with shutdown when all are stopped.
+	std::atomic<int> m_ClientsClosing ;
+	std::atomic<BOOL> m_bAllClientsDisconnectedForShutdown ;
+	void ShutdownEventLoop(stEventLoop* pEventLoop);
 	void StopReading(stClient* pClient);
+	void PauseOrResumeReading(stClient* pClient);
 	BOOL DisconnectAndDelete(stClient* pClient, BOOL bIsByServer=TRUE);
 	void Shutdown(uv_tcp_t* server);
 	void ProcessHeaderError(stClient* pClient, UCHAR ErrorCode);
@@ -144,28 +315,32 @@ class DLL_API LocalClientsManager:protected virtual CommonComponents
 	static void on_server_stopped(uv_handle_t* client);
 
 	protected:
-		uv_rwlock_t m_rwlRequestCountersLock2;
-
 		/* Calls/Callbacks to be called by ConnectionsManager */
 		int StartListening(char* IPAddress, unsigned short int IPv4Port);
 		void InitiateServerShutdown(); // Calls DisconnectAndDelete for each client to initiate server shutdown. Called through event loop.
+		void StopEventLoops(); // Stops event loops other than main and waits till their threads finish. Called through main loop at last stage of shutdown.
+		stEventLoop* GetMainEventLoop();
+		void WakeUpEventLoop(stEventLoop* pEventLoop); // Called from any thread. Does nothing when main loop is the only event loop.
+		void RequestFlush(stEventLoop* pEventLoop); // Called from any thread after response has been queued to be sent by the loop
+		void DoPeriodicActivitiesOfEventLoop(stEventLoop* pEventLoop);
 		void DeleteRequestProcessors();
 		void SendKeepAlive();
 		unsigned int GetClientsConnectedCount();
-		void SendLocalClientsResponses();
+		void SendLocalClientsResponses(stEventLoop* pEventLoop);
 		BOOL IsServerStopped ();
 		BOOL HasAllClientsDisconnectedForShutdown();
 		BOOL AreClientsClosing();
 		int GetActiveProcessors();
-		BOOL AddResponseToClientsQueues(Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException);
+		BOOL AddResponseToClientsQueues(Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured);
 		void AfterSendingLocalClientsResponses(stClient* pClient, Response* pResponse, int status);
-		bool DisconnectAllClients();
+		bool DisconnectAllClients(stEventLoop* pEventLoop); // Disconnects clients of given event loop. Returns true if pool has any client (of any loop).
+		void DisconnectClientsOfAllEventLoops(); // Called by main loop. Other loops disconnect their clients when woken up.
 		static void on_new_client(uv_stream_t* server, int status); 
-		static void disconnection_processing_thread(uv_work_t* work_t);
-		static void after_disconnection_processing_thread(uv_work_t* work_t, int status);
+		static void disconnection_processing_thread(stWork* work_t);
+		static void after_disconnection_processing_thread(stWork* work_t, int status);
 		static void alloc_buffer(uv_handle_t *handle, uv_buf_t* buf);
-		static void request_processing_thread(uv_work_t* work_t);
-		static void after_request_processing_thread(uv_work_t* work_t, int status);
+		static void request_processing_thread(stWork* work_t);
+		static void after_request_processing_thread(stWork* work_t, int status);
 		static void on_read (uv_stream_t *client, ssize_t nread, const uv_buf_t* read_bytes);
 
 	public:
@@ -179,4 +354,7 @@ class DLL_API LocalClientsManager:protected virtual CommonComponents
 		int GetMaxResponseSizeOfAllVersions() ;
 		std::string GetHostName();
 		int GetCurrentThreadIndex();
+
+		/* Method to be called by RequestProcessor (from any thread) */
+		static BOOL ResumeRequest(stRequestContinuation* pContinuation);
 };
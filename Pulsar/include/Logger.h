@@ -23,8 +23,101 @@ Module summary:
 		1. Needs to derive this class and create static global instance of the derived class.
 		2. Can call Logger::GetInstance()->LogMessage OR simply can use LOG macro defined in Pulsar.h to log errors/warnings/info etc.
 		3. Needs to derive and write its own defination of ProcessLog which is virtual here. ProcessLog is called by log processing thread.
+
+	Logging thread doesn't take any lock or allocate memory. Nor does it format message. It copies raw arguments (as format string of
+	call site tells their types) into next record of its own log ring (single producer, single consumer) which log processing thread
+	drains. Arguments are truncated to DEFAULT_LOG_MSG_LENGTH bytes. When ring is full debug record is dropped and counted (reported as
+	error). Any other record is spilled to list of the ring instead, which only then takes lock and allocates memory. So errors, exceptions,
+	notes and info are never lost and counts of their call sites are exact. Log processing thread sleeps till stat is logged, some ring has
+	1/LOG_RING_WAKE_UP_DIVISOR of its records pending or some thread has spilled, so it isn't polling.
+
+	LOG macro gives each call site its own static stLogCallSite, address of which identifies the call site. Log processing thread counts
+	messages per call site (and not per formatted message) and formats only latest message of each call site, which it hands ProcessLog
+	with its count. Notes are exception to it: Each distinct note is kept once, as they were.
+
+	Binary log:
+		When application sets binary log file (SetBinaryLogFile) log processing thread also writes every record to it as it is (format
+		string of each call site is written once). Pulsar_LogDecoder turns the file into text offline. Debug logs are recorded (only to the
+		file) when binary log is on even if PROCESS_DEBUG_LOGS is FALSE, as they cost only a copy of arguments. Rings are bigger then
+		(BINARY_LOG_RING_SIZE), and debug record is spilled too when ring is full (upto BINARY_LOG_SPILL_LIMIT records), so that hot
+		path debug logs aren't dropped under load. Ring is sized when its thread logs first time, hence binary log is set before Start
+		(and before application logs). File is flushed with every stat and when it is closed.
+		File has header (BINARY_LOG_MAGIC, UINT version, INT64 start time in seconds since epoch, UINT64 uv_hrtime at start) followed by
+		entries, each starting with a UCHAR kind:
+			BINARY_LOG_CALL_SITE: UINT ID, int line number, then file name, function name and format (each USHORT length and characters)
+			BINARY_LOG_RECORD: UINT call site ID, UCHAR type, UINT64 uv_hrtime, USHORT arguments length and arguments (See EncodeArguments)
+			BINARY_LOG_DROPPED: UINT64 uv_hrtime, INT64 records dropped since start
+		Numbers are in byte order of the server.
 */
 
+// Call site of LOG. Its address is the call site ID. Format MUST be string literal (LOG macro makes sure).
+struct stLogCallSite
+{
+	const char* m_FileName;
+	int m_LineNumber;
+	const char* m_FunctionName;
+	const char* m_Format;
+};
+
+struct stLogRecord
+{
+	const stLogCallSite* m_pCallSite;
+	int m_Type;
+	UINT64 m_Time; // uv_hrtime when logged. Taken only for binary log.
+	USHORT m_ArgumentsLength;
+	char m_Arguments[DEFAULT_LOG_MSG_LENGTH];
+};
+
+// Conversion specification of format string (See Logger::ParseConversion)
+struct stLogConversion
+{
+	enum { LENGTH_DEFAULT, LENGTH_HH, LENGTH_H, LENGTH_L, LENGTH_LL, LENGTH_SIZE, LENGTH_LONG_DOUBLE };
+
+	char m_Flags[8];
+	int m_Width; // -1 when not given. LOG_ARGUMENT_FROM_LIST for '*'
+	int m_Precision; // -1 when not given. LOG_ARGUMENT_FROM_LIST for '*'
+	int m_Length;
+	char m_Conversion; // Zero when format ends before it
+};
+
+#define LOG_ARGUMENT_FROM_LIST -2
+
+// Log ring of a logging thread. Rings are never freed till logger is, as thread might log again anytime.
+struct stLogRing
+{
+	stLogRecord* m_pRecords;
+	UINT m_Size; // LOG_RING_SIZE, or BINARY_LOG_RING_SIZE when binary log was on as thread logged first time
+	UINT m_WakeUp; // Records pending at which log processing thread is woken up
+	std::atomic<UINT> m_Head; // Written only by logging thread
+	std::atomic<UINT> m_Tail; // Written only by log processing thread
+	std::atomic<INT64> m_Dropped; // Debug records dropped as ring was full, and records which couldn't be spilled
+	stLogRing* m_pNext;
+
+	// Records which didn't fit in ring. Once thread has spilled, its records go on being spilled till log processing thread takes them
+	// over (resetting m_bSpilling), so that they are processed in order they were logged.
+	uv_mutex_t m_SpillLock;
+	std::deque<stLogRecord> m_Spilled;
+	std::atomic<BOOL> m_bSpilling;
+};
+
+// Messages of a call site since ProcessLog was called (or since start for errors and exceptions)
+struct stCallSiteLog
+{
+	long long m_Count;
+	std::string m_LastArguments;
+};
+
+typedef std::map<const stLogCallSite*, stCallSiteLog> CallSiteLogMap;
+
+// Call site of message logged through LogMessage with file name and line number. Names are copied, as caller's strings need not outlive the call.
+struct stInternedLogCallSite
+{
+	stLogCallSite m_CallSite; // Points to strings below
+	std::string m_FileName;
+	std::string m_FunctionName;
+};
+
+typedef std::map<std::pair<std::string, int>, stInternedLogCallSite*> InternedLogCallSitesMap; // Keyed by file name (content) and line number
 
 class DLL_API Logger
 {
@@ -36,30 +129,46 @@ class DLL_API Logger
 		uv_rwlock_t m_rwlStatQueue;
 		std::queue <ServerStat> m_StatQueue;
 
-		// To log error messages
-		uv_rwlock_t m_rwlErrorsMap;
-		LoggerMap m_ErrorsMap;
+		std::atomic<stLogRing*> m_pLogRings; // Rings of all threads that have logged. Threads push their ring once (lock-free).
 
-		// To log exception messages
-		uv_rwlock_t m_rwlExceptionsMap;
-		LoggerMap m_ExceptionsMap;
+		// Log processing thread sleeps on m_WakeUpCondition when there is nothing to process (See HasWorkToProcess)
+		uv_mutex_t m_SleepLock;
+		uv_cond_t m_WakeUpCondition;
+		std::atomic<BOOL> m_bSleeping;
 
-		// To log notes
-		uv_rwlock_t m_rwlNotesMap;
-		LoggerMap m_NotesMap;
+		// Call sites of messages logged through LogMessage with file name and line number (and not through LOG). Rarely used.
+		uv_rwlock_t m_rwlCallSitesMap;
+		InternedLogCallSitesMap m_CallSitesMap;
 
-		// To log info messages (messages except Errors/Warnings/Debug)
-		uv_rwlock_t m_rwlInfoMap;
-		LoggerMap m_InfoMap;
+		// Following are touched only by log processing thread, hence no locks
+		CallSiteLogMap m_ErrorsMap;
+		CallSiteLogMap m_ExceptionsMap;
+		LoggerMap m_NotesMap;
+		CallSiteLogMap m_InfoMap; // Info messages (messages except Errors/Warnings/Debug)
+		CallSiteLogMap m_DebugMap;
+		INT64 m_RecordsDropped;
 
-		// To log debug messages
-		uv_rwlock_t m_rwlDebugMap;
-		LoggerMap m_DebugMap;
+		// Binary log. File is set before Start and thereafter written only by log processing thread.
+		FILE* m_pBinaryLogFile;
+		BOOL m_bBinaryLog; // Read by logging threads. Stays TRUE even after log processing thread closes the file.
+		std::map<const stLogCallSite*, UINT> m_BinaryLogCallSiteIDs;
+		INT64 m_BinaryLogRecordsDropped;
+		void WriteToBinaryLog (stLogRecord& Record);
+		void WriteToBinaryLog (const char* String);
+		static const char* ParseConversion (const char* pFormat, stLogConversion& Conversion);
+		static int EncodeArguments (const char* Format, va_list args, char* pArguments, int Size);
+		static void AppendFormatted (std::string& Message, const char* Format, ...);
 		
 		void GetCopyAndProcessLog(ServerStat& stServerStat);
-		void GetMapCopy (LoggerMap& Map, LoggerMap& MapCopy, uv_rwlock_t& Lock, BOOL bEraseOriginalMap=FALSE);
-		void IncreaseMapCounter (LoggerMap& Map, int Type, std::string& Message, uv_rwlock_t& Lock);
-		BOOL m_bStopLoggerThread, m_bLoggerThreadStopped;
+		void GetMapCopy (CallSiteLogMap& Map, int Type, LoggerMap& MapCopy, BOOL bEraseOriginalMap=FALSE);
+		void IncreaseMapCounter (CallSiteLogMap& Map, stLogRecord& Record);
+		void DrainLogRings ();
+		void ProcessLogRecord (stLogRecord& Record);
+		void ComposeMessage (const stLogCallSite* pCallSite, int Type, const char* Message, std::string& ComposedMessage);
+		BOOL HasWorkToProcess ();
+		void WakeUpLogProcessingThread ();
+		stLogRing* GetLogRing ();
+		std::atomic<BOOL> m_bStopLoggerThread, m_bLoggerThreadStopped;
 		void ComputeAdditionalStat (ServerStat& stServerStat);
 		void getClassName(const char* fullFuncName, std::string& csClassName);
 		static void log_processing_thread (uv_work_t* log_work_t);
@@ -72,8 +181,11 @@ class DLL_API Logger
 	public:
 		~Logger();
 		static Logger* GetInstance();
-		void LogMessage (int Type=NULL, char* FileName=NULL, int LineNumber=0, char* FunctionName=NULL, char* LogFormatMsg=NULL, ...);
+		void LogMessage (int Type, const stLogCallSite* pCallSite, const char* LogFormatMsg, ...); // Called through LOG
+		void LogMessage (int Type=NULL, const char* FileName=NULL, int LineNumber=0, const char* FunctionName=NULL, const char* LogFormatMsg=NULL, ...);
 		void LogStatistics (ServerStat& stServerStat);
 		int Start(uv_loop_t* loop);
 		BOOL Stop();
+		BOOL SetBinaryLogFile (const char* FilePathName); // Called by application before Start. FALSE if file couldn't be created.
+		static void DecodeMessage (const char* Format, const char* pArguments, int ArgumentsLength, std::string& Message); // Throws bad_alloc
 };
@@ -0,0 +1,45 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Compression of payloads of forwarded responses (See CommonParameters::PeerCompressionThreshold). Compressed data is in LZ4 block format,
+so that any LZ4 implementation can decompress it. Compressor is kept small and fast rather than compressing hard: single probe hash table
+of positions and skipping ahead faster when data doesn't match (incompressible payload costs little).
+
+Both functions are thread safe (no state outside stack) and never read or write outside buffers they are given.
+*/
+
+#define COMPRESSION_LZ4_BLOCK 1 // Compression method advertised by RESPONSE_COMPRESSION_SUPPORTED
+
+#define LZ4_MIN_MATCH 4 // Shortest match encoded
+#define LZ4_LAST_LITERALS 5 // Last bytes of block are always literals
+#define LZ4_MATCH_FIND_LIMIT 12 // Last match must start at least these many bytes before end of block
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG 12 // Hash table of 4096 positions (16 KB on stack)
+
+class PayloadCompressor
+{
+	public:
+		// Returns compressed length, or 0 if compressed data doesn't fit in DestinationCapacity (payload is not worth compressing then)
+		static int Compress(const char* pSource, int SourceLength, char* pDestination, int DestinationCapacity);
+
+		// Returns decompressed length, or -1 if compressed data is malformed or doesn't fit in DestinationCapacity
+		static int Decompress(const char* pSource, int SourceLength, char* pDestination, int DestinationCapacity);
+};
@@ -18,7 +18,7 @@
 
 /*
 Module summary:
-
+
 class PeerServersManager is responsible to manage peer servers and routing responses to them (intended to clients connected to them)
 Primary responsibilities are:
 	1. Make connection with other peer server when it receives response for client connected to that server
@@ -26,6 +26,19 @@ Primary responsibilities are:
 	3. Validate incoming responses and finally send them to the clients connected to this server
 	4. Validates requests (viz RESPONSE_KEEP_ALIVE, RESPONSE_ERROR or RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP) received by connected peer server
 	5. Sends forwarded responses to appropriate peer server
+
+Forwarding is credit based. Peer server grants (RESPONSE_CREDIT_GRANT) how many forwarded responses and bytes it lets be unacknowledged at a time,
+and each acknowledgement gives credit back. Till then (and for peer servers which don't grant) our own PeerCreditResponses/PeerCreditBytes are assumed.
+Responses beyond credit wait in order. Bytes queued and waiting per peer server are limited to MaxPeerQueueBytes, responses beyond that are not queued
+and the thread storing them gets UPDATE_BACKPRESSURED. Peer server which gives no credit back for MAX_OVERFLOWED_TIME while responses wait is disconnected.
+
+Peer server which supports compression says so (RESPONSE_COMPRESSION_SUPPORTED) right after granting credit. Responses forwarded to it thereafter
+have their payload compressed, if thread storing response compressed it (See CommonParameters::PeerCompressionThreshold). Credit counts bytes as forwarded.
+
+Peer server which supports compact handles says so (RESPONSE_COMPACT_HANDLES_SUPPORTED) right after that. Threads create responses for it with compact handles,
+which lets a response reach far more of its clients. Unlike compression, it is decided when response is created, and such response can't be changed back.
+So it is kept across reconnections (responses created for peer server may be waiting while it reconnects) and cleared only when peer server lists
+what it supports again (RESPONSE_CREDIT_GRANT) without it. Peer server not knowing compact handles rejects such response as too short.
 */
 
 
@@ -39,11 +52,12 @@ struct stPeerServer:public stNode
 									// They won't be able to connect to server that has only ipv6.
 									// Hence it is safe to use ipv4 for interserver communication.
 
-	// Each server will send back a single byte of acknowledgement for each forwarded message.
-	// Unlike requests received by clients, no need to have dynamically allocated buffer here (as the ack size here is fixed)
-	char m_response_buffer[1024*(HEADER_SIZE+1)]; // Reading thousand acknowledgements at a time would serve reasonably good bandwidth for most common purpose servers. Change later if needed.
-	uv_buf_t m_ResponseBuffer;
-	unsigned int m_ResponseBufferIndex;
+	// Each server sends back acknowledgement (single one or batch) for forwarded messages. These are read into circular buffer.
+	// Responses are parsed right in the ring. Only response wrapping around end of ring is copied (into m_WrappedResponse) to parse.
+	// Unlike requests received by clients, no need to have dynamically allocated buffer here (as responses are few bytes only)
+	char m_ResponseRing[PEER_RESPONSE_RING_SIZE];
+	unsigned int m_ResponseRingHead, m_ResponseRingTail; // Free running counters (wrap around UINT). Bytes yet to be parsed are from head to tail.
+	char m_WrappedResponse[HEADER_SIZE+MAX_PEER_RESPONSE_SIZE];
 
 	USHORT m_Version;
 	uv_tcp_t m_server;
@@ -64,6 +78,22 @@ struct stPeerServer:public stNode
 
 	uv_write_t m_write_req;
 	std::vector<uv_buf_t> m_pResponsesBuffersBeingForwarded;
+
+	// Control request (forwarded response with no handles) sent right after connecting, asking peer server to acknowledge cumulatively.
+	// Peer server which doesn't know it acknowledges it as ordinary forwarded response and keeps acknowledging each one.
+	uv_write_t m_control_write_req;
+	char m_ControlRequest[HEADER_SIZE+VERSION_BYTES+HANDLE_BYTES+1];
+	UINT64 m_AcknowledgedSequence; // Sequence received with last RESPONSE_CUMULATIVE_ACKNOWLEDGEMENT on this connection
+	int m_ControlAcknowledgementsPending; // Acknowledgement of control request gives no credit back
+
+	// Credit based flow control (See module summary)
+	std::atomic<INT64> m_QueuedBytes; // Bytes of responses in both queues and waiting for credit. Increased by threads, decreased by event loop.
+	std::deque<class Response*> m_ResponsesWaitingForCredit; // Oldest first. Used only by event loop.
+	std::deque<int> m_UnacknowledgedSizes; // Lengths of forwarded responses not yet acknowledged, oldest first. Used only by event loop.
+	INT64 m_UnacknowledgedBytes;
+	int m_CreditResponses, m_CreditBytes; // Granted by peer server
+	BOOL m_bIsCompressionSupported; // Peer server has sent RESPONSE_COMPRESSION_SUPPORTED on this connection
+	std::atomic<BOOL> m_bIsCompactHandlesSupported; // Peer server has sent RESPONSE_COMPACT_HANDLES_SUPPORTED. Read by threads creating responses.
 };
 
 class DLL_API PeerServersManager:protected virtual CommonComponents
@@ -78,7 +108,12 @@ class DLL_API PeerServersManager:protected virtual CommonComponents
 	uv_rwlock_t m_rwlServerSetLock, m_rwlServersInfoLock;
 	std::set <stPeerServer*> m_RecevingServersSet1, m_RecevingServersSet2 ;
 	void InitiateConnection(stPeerServer* pRemoteSvr);
-	void ProcessResponse(uv_buf_t* response, stPeerServer* pPeerSvr);
+	int ProcessResponse(uv_buf_t* response, stPeerServer* pPeerSvr); // Returns number of forwarded responses acknowledged
+	void AcknowledgeForwardedResponses(stPeerServer* pPeerSvr, int Acknowledgements);
+	int GetResponsesAllowedByCredit(stPeerServer* pPeerSvr);
+	void ResetCredit(stPeerServer* pPeerSvr);
+	void AddToRecevingServersSet(stPeerServer* pPeerSvr);
+	static char* GetResponseFromRing(stPeerServer* pPeerSvr, unsigned int Length);
 
 	int GetServerConnection(stPeerServer* pPeerServer /* input */); // Called by event loop (SendPeerServersResponses)
 	void DisconnectServer(stPeerServer* pPeerServerInfo, BOOL bReduceConnectedServersCount=TRUE); // Called by event loop
@@ -88,12 +123,14 @@ class DLL_API PeerServersManager:protected virtual CommonComponents
 
 	static void after_getaddrinfo(uv_getaddrinfo_t* gai_req, int status, struct addrinfo* ai);
 	static void after_connect(uv_connect_t* connect_req, int status);
+	static void RequestCumulativeAcknowledgements(stPeerServer* pPeerSvr);
+	static void after_control_request(uv_write_t* write_req, int status);
 	static void on_server_closed(uv_handle_t* handle);
 	static void alloc_buffer(uv_handle_t *handle, uv_buf_t* buffer);
 	static void on_read(uv_stream_t* tcp_handle, ssize_t nread, const uv_buf_t* read_bytes);
 
 	protected:
-		BOOL AddResponseToQueue(class Response* pResponse, BOOL& bHasEncounteredMemoryAllocationException);
+		BOOL AddResponseToQueue(class Response* pResponse, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured);
 		void DisconnectAndCloseAllConnections(); // Called by event loop
 		void SendPeerServersResponses();
 		void AfterSendingPeerServersResponses(stPeerServer* pPeerServerInfo, Response* pResponse, int status);
@@ -105,4 +142,5 @@ class DLL_API PeerServersManager:protected virtual CommonComponents
 		
 		int AreServersClosing();
 		int AreServersConnecting();
+		BOOL IsCompactHandlesSupported(IPv4Address& ServerIPv4Address); // Called by threads creating responses to be forwarded
 };
@@ -0,0 +1,157 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Framework was originally written (and is still built) with Microsoft Visual Studio. Its code uses Win32 types (BOOL, DWORD, UINT64 etc.),
+some of secure CRT functions (memcpy_s, sprintf_s etc.) and few console related functions (_getch, Sleep).
+This header provides POSIX equivalents of those so that same framework code builds on Linux (where libuv uses epoll backend).
+It is included by Pulsar.h only when _WIN32 is not defined. Windows builds never see it.
+
+Only what framework (and sample server) actually use is defined here. If you use any other Win32 facility in framework code,
+either add its equivalent here or keep it under #ifdef _WIN32.
+*/
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <typeinfo>
+#include <algorithm>
+
+// Win32 types used throughout framework.
+// Note sizes: DWORD and ULONG are 32-bit on Windows (LLP64) whereas unsigned long is 64-bit on Linux (LP64). Hence fixed width types here.
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef unsigned short USHORT;
+typedef unsigned char UCHAR;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef int64_t LONGLONG;
+typedef int SOCKET;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define __int64 long long
+
+// Windows headers define min and max as macros. Framework code uses them unqualified.
+using std::min;
+using std::max;
+
+// Secure CRT equivalents
+#define _TRUNCATE ((size_t)-1)
+#define sprintf_s snprintf
+#define sscanf_s sscanf // Framework uses sscanf_s only with numeric conversions, which don't take extra size arguments
+
+inline int memcpy_s(void* dest, size_t destsz, const void* src, size_t count)
+{
+	if (count > destsz)
+		return ERANGE;
+
+	memcpy(dest, src, count);
+	return 0;
+}
+
+inline int strcat_s(char* dest, size_t destsz, const char* src)
+{
+	size_t len = strlen(dest);
+
+	if (len + strlen(src) >= destsz)
+		return ERANGE;
+
+	strcpy(dest+len, src);
+	return 0;
+}
+
+// With count as _TRUNCATE, vsnprintf_s writes as much as fits and returns -1 if output was truncated (Logger keeps truncated message)
+inline int vsnprintf_s(char* buffer, size_t sizeOfBuffer, size_t count, const char* format, va_list args)
+{
+	int characters_written = vsnprintf(buffer, sizeOfBuffer, format, args);
+
+	if ((characters_written < 0) || ((size_t)characters_written >= sizeOfBuffer))
+		return -1;
+
+	return characters_written;
+}
+
+inline int localtime_s(struct tm* tmDest, const time_t* sourceTime)
+{
+	return (localtime_r(sourceTime, tmDest) == NULL) ? errno : 0;
+}
+
+inline int asctime_s(char* buffer, size_t numberOfElements, const struct tm* tmSource)
+{
+	if (numberOfElements < 26) // asctime_r needs at least 26 bytes
+		return ERANGE;
+
+	return (asctime_r(tmSource, buffer) == NULL) ? errno : 0;
+}
+
+// Console related
+inline void Sleep(unsigned int Milliseconds)
+{
+	struct timespec Duration;
+	Duration.tv_sec = Milliseconds / 1000;
+	Duration.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+	while ((nanosleep(&Duration, &Duration) == -1) && (errno == EINTR));
+}
+
+// Reads single key stroke without echo (and without waiting for enter key)
+inline int _getch()
+{
+	struct termios OldSettings, NewSettings;
+	BOOL bIsTerminal = (tcgetattr(STDIN_FILENO, &OldSettings) == 0);
+
+	if (bIsTerminal)
+	{
+		NewSettings = OldSettings;
+		NewSettings.c_lflag &= ~(ICANON | ECHO);
+		tcsetattr(STDIN_FILENO, TCSANOW, &NewSettings);
+	}
+
+	unsigned char Character = 0;
+	int Character_read = (read(STDIN_FILENO, &Character, 1) == 1) ? Character : EOF;
+
+	if (bIsTerminal)
+		tcsetattr(STDIN_FILENO, TCSANOW, &OldSettings);
+
+	return Character_read;
+}
+
+#endif
@@ -29,9 +29,9 @@ ADD2PROFILER macro defined for the same purpose.
 class DLL_API Profiler
 {
 	double m_dblStartTime, m_dblEndTime;
-	char* m_strFunctionName;
+	const char* m_strFunctionName;
 
 public:
-	Profiler(char* strFunctionName);
+	Profiler(const char* strFunctionName);
 	~Profiler();
 };
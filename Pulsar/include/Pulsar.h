@@ -66,18 +66,44 @@ Therefore, following are response codes (appear in single byte after header) all
 	01: ERROR (To be received by client. (Total message size is two bytes. ERROR and error code)
 	02: ACKNOWLEDGEMENT_OF_FWD_RESP (To be received only by PeerServer reader)
 	03: FATAL_ERROR (To be intrepretted and used internally by framework to disconnect client before sending the response. Thus client actually never receives it.)
+	04: ACKNOWLEDGEMENTS_OF_FWD_RESPS (To be received only by PeerServer reader. Next 4 bytes (network order) contain number of forwarded responses acknowledged.)
+	05: CUMULATIVE_ACKNOWLEDGEMENT (To be received only by PeerServer reader. Next 8 bytes (network order) contain sequence of last forwarded response acknowledged.
+	    All forwarded responses after previous cumulative acknowledgement till this sequence are acknowledged. Sent only when peer server has asked for it.)
+	06: CREDIT_GRANT (To be received only by PeerServer reader. Next 4+4 bytes (network order) contain number of forwarded responses and their bytes which peer server
+	    may have unacknowledged at a time. Sent right after acknowledging CUMULATIVE_ACKNOWLEDGEMENTS. Acknowledgements give credit back.)
+	07: COMPRESSION_SUPPORTED (To be received only by PeerServer reader. Next byte contains compression method (COMPRESSION_LZ4_BLOCK) peer server may use for
+	    payloads of forwarded responses on this connection. Sent right after CREDIT_GRANT.)
+	08: COMPACT_HANDLES_SUPPORTED (To be received only by PeerServer reader. Peer server may forward responses with compact handles to this server.
+	    Sent right after COMPRESSION_SUPPORTED.)
+Forwarded response having no handles is a control request, its first byte (after version and number of handles) is request code:
+	01: CUMULATIVE_ACKNOWLEDGEMENTS (Peer server asks to acknowledge forwarded responses cumulatively on this connection. It is acknowledged by single ACKNOWLEDGEMENT_OF_FWD_RESP
+	    and doesn't count in sequence. Server not knowing it simply acknowledges it as forwarded response to no client, so peer server sees no difference.)
+Forwarded response having FORWARDED_PAYLOAD_COMPRESSED set in number of handles has payload compressed. Such payload is original payload length (4 bytes
+network order) followed by compressed payload. It is forwarded only to server which has sent COMPRESSION_SUPPORTED.
+Forwarded response having FORWARDED_HANDLES_COMPACT set in number of handles has compact handles. Registration numbers are sorted in ascending order and
+each is stored as difference from previous one (first one as it is) in 7 bits per byte, least significant first, with top bit set in all but last byte.
+It is forwarded only to server which has sent COMPACT_HANDLES_SUPPORTED, and can have up to MAX_COMPACT_HANDLES_IN_FORWARDED_RESPONSE handles.
 */
 #define SPECIAL_COMMUNICATION		(0xFFFF) // Master protocol reserved version value (Version field in response indicating 0xFFFF indicates special communication protocol)
 
 /* Code values (single byte) followed by version SPECIAL_COMMUNICATION */
 // REQUEST Codes (Communicated by Client to Server):
 // (nil): ForwardedResponse (No request code needed as there is only single SPECIAL_COMMUNICATION request as discussed above
+#define REQUEST_CUMULATIVE_ACKNOWLEDGEMENTS 1 // 01: Control request (Forwarded response with no handles) asking cumulative acknowledgements
 //
 // RESPONSE Codes (Communicated by Server to Client when version is SPECIAL_COMMUNICATION):
 #define RESPONSE_KEEP_ALIVE 0 // 00: Keep Alive
 #define RESPONSE_ERROR		1 // 01: Error (Next byte contains application defined eror code)
 #define RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP 2 // 02: AckOfFwd
 #define RESPONSE_FATAL_ERROR 3 // 03: FatalError
+#define RESPONSE_ACKNOWLEDGEMENTS_OF_FORWARDED_RESPS 4 // 04: AcksOfFwd (Batch of acknowledgements)
+#define RESPONSE_CUMULATIVE_ACKNOWLEDGEMENT 5 // 05: CumAckOfFwd (Acknowledges forwarded responses till sequence)
+#define CUMULATIVE_ACKNOWLEDGEMENT_BATCH 64 // Max forwarded responses acknowledged by single cumulative acknowledgement
+#define RESPONSE_CREDIT_GRANT 6 // 06: CreditGrant (Window of unacknowledged forwarded responses and bytes)
+#define RESPONSE_COMPRESSION_SUPPORTED 7 // 07: CompressionSupported (Forwarded responses may have compressed payload)
+#define RESPONSE_COMPACT_HANDLES_SUPPORTED 8 // 08: CompactHandlesSupported (Forwarded responses may have compact handles)
+#define FORWARDED_PAYLOAD_COMPRESSED 0x80000000 // Flag in number of handles of forwarded response
+#define FORWARDED_HANDLES_COMPACT 0x40000000 // Flag in number of handles of forwarded response
 
 #define RESPONSE_ORDINARY 0xFF // Above codes will be treated as response types when version is SPECIAL_COMMUNICATION else type would be considered as ordinary
 
@@ -92,17 +118,25 @@ Therefore, following are response codes (appear in single byte after header) all
 
 // Message buffering related
 #define KEYBOARD_BUFFER_LEN 64		// Max keystrokes buffer can have. Normally we'll get callback every keystrokes unles event loops isn't too busy
+#define PEER_RESPONSE_RING_SIZE (16*1024) // Circular buffer reading responses (acknowledgements mostly) of peer server. Must be power of 2.
+#define MAX_PEER_RESPONSE_SIZE 32 // Responses by peer server are few bytes only (code and its arguments). Bigger one is treated as invalid size.
 
 
 // Request processing related
 #define REQUESTCOUNT 1
 #define RESPONSECOUNT 2
-#define MAX_WORK_THREADS MAX_THREADPOOL_SIZE
+#define MAX_WORK_THREADS 128 // Max value of CommonParameters::MaxRequestProcessingThreads (workers of Scheduler)
+#define MAX_EVENT_LOOPS 16 // Max value of CommonParameters::EventLoops
+#define MAX_PIPELINED_REQUESTS 64 // Max value of VersionParameters::m_MaxPipelinedRequests
+#define MIN_READ_RING_SIZE 256 // Min non-zero value of CommonParameters::ReadRingSize
+#define MAX_READ_RING_SIZE (1024*1024) // Max value of CommonParameters::ReadRingSize
 
 
 // Memory related
 #define DEL(ptr) {if(ptr){delete ptr;ptr=NULL;}}
 #define DEL_ARRAY(ptr) {if(ptr){delete[] ptr; ptr=NULL;}}
+#define DEL_SLAB(ptr) {if(ptr){SlabAllocator::Free(ptr); ptr=NULL;}}
+#define SLAB_SIZE_CLASSES 16 // Block sizes from 32 bytes to 1 MB (See SlabAllocator.h)
 
 
 // Return codes by ValidateProtocolAndExtractRequest after parsing request
@@ -113,6 +147,18 @@ Therefore, following are response codes (appear in single byte after header) all
 #define WAIT_FOR_MORE_BYTES	7
 
 
+// Return codes by SendUpdate and MulticastUpdate
+#define UPDATE_QUEUED			0 // Queued for all recipients
+#define UPDATE_BACKPRESSURED	1 // Not queued for clients of peer server(s) which already have MaxPeerQueueBytes waiting. Application may retry later.
+#define UPDATE_NOT_QUEUED		2 // Invalid update or memory allocation failure
+
+// Priorities of responses to local clients. Each is a lane of client's responses queue. Event loop sends responses of higher lane first,
+// whereas responses within lane are sent in order they were queued.
+#define RESPONSE_PRIORITY_NORMAL	0 // Default. Bulk traffic such as multicast updates.
+#define RESPONSE_PRIORITY_HIGH		1 // Keep alives and small interactive responses which shouldn't wait behind bulk ones
+#define RESPONSE_PRIORITIES			2
+
+
 // Exception handling
 #define MEMORY_ALLOCATION_EXCEPTION		1
 #define REQUST_CREATION_EXCEPTION		2
@@ -136,14 +182,38 @@ Therefore, following are response codes (appear in single byte after header) all
 #define MAX_OVERFLOWED_TIME			90  // Time in seconds. If no acknowledgements received from other server (server was overflowed), this is time limit after which peer server will be disconnected.
 #define WAIT_FOR_CONNECTION		   150  // If connection (to other server) was in CONNECTION_CONNECTING state, this is max time for which response could be hold waiting for connection.
 
+// Log records (See Logger.h)
+//  Sample worst case message for length estimation (e.g. Status message) length could go upto 256 bytes
+//	#Requests received 18446744073709551615 #Requests responded 18446744073709551615 #Clients connected 50000 #Memory consumption: 8388608 KB (8192 MB) #ELTAT 1000 milliseconds #RPT 1000 miliseconds #Requests pending in the queue 10240
+#define DEFAULT_LOG_MSG_LENGTH 256 // Original value 256. Longer log message is truncated.
+#define LOG_RING_SIZE 256 // Log records each logging thread can have pending with log processing thread. Power of 2.
+#define BINARY_LOG_RING_SIZE 4096 // Same when binary log is on, as every debug log is recorded then. Power of 2.
+#define BINARY_LOG_SPILL_LIMIT 65536 // Debug log records each logging thread can have spilled when its ring is full, only with binary log on
+#define LOG_RING_WAKE_UP_DIVISOR 8 // Log processing thread is woken up to drain ring having 1/8 of its records pending
+
+// Binary log file (See Logger.h)
+#define BINARY_LOG_MAGIC "PLOG"
+#define BINARY_LOG_VERSION 1
+#define BINARY_LOG_CALL_SITE 1
+#define BINARY_LOG_RECORD 2
+#define BINARY_LOG_DROPPED 3
 
+
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 #include <stdio.h>
+#ifdef _WIN32
 #include <conio.h>
 #include <tchar.h>
+#endif
 #include <stdlib.h>
-#include <ASSERT.h>
+#include <limits.h>
+#include <assert.h>
+#ifdef _WIN32
 #include <typeinfo.h>
+#include <malloc.h> // _aligned_malloc
+#endif
 #include <time.h>
 
 /*
@@ -160,15 +230,22 @@ std::map : 120000 to 143000 (After having _SECURE_SCL=0;_HAS_ITERATOR_DEBUGGING=
 */
 #include <iostream>
 #include <memory>
+#include <atomic>
 #include <string>
 #include <queue>
+#include <deque>
 #include <map>
 #include <set>
+#include <algorithm>
 #include <unordered_map>
 #include <fstream> 
 
-#include "..\LIBUV\libuv-v1.7.5\include\uv.h"
+#include "../LIBUV/libuv-v1.7.5/include/uv.h"
+#ifdef _WIN32
 #include <psapi.h>
+#else
+#include "PlatformDefinitions.h" // POSIX equivalents of Win32 types and functions used by framework
+#endif
 
 // #define NO_WRITE
 // #define GENERATE_PROFILE_DATA // Defining this would generate function call profile data but it slows down the server
@@ -177,6 +254,7 @@ std::map : 120000 to 143000 (After having _SECURE_SCL=0;_HAS_ITERATOR_DEBUGGING=
 // We must define separate macros for import and export. If we do not we end up in linker error undefined symbol, viz. for static variable clIPv4Address::Port, 
 // even after we've define it in LocalClientsmanager.cpp.
 
+#ifdef _WIN32
 #ifdef DLL_EXPORTS
 #define DLL_API __declspec(dllexport)
 #else
@@ -184,6 +262,24 @@ std::map : 120000 to 143000 (After having _SECURE_SCL=0;_HAS_ITERATOR_DEBUGGING=
 #endif
 
 #pragma warning(disable: 4251) // Disable warning: 'needs to have dll-interface to be used by clients'
+#else
+#define DLL_API __attribute__((visibility("default")))
+#endif
+
+// For thread index we have to use OS specific thread local storage syntax
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// Data written by different threads (e.g. shards of ClientsPool) is aligned to cache line to avoid false sharing
+#define CACHE_LINE_SIZE 64
+#ifdef _WIN32
+#define CACHE_ALIGNED __declspec(align(64))
+#else
+#define CACHE_ALIGNED __attribute__((aligned(64)))
+#endif
 
 #include "TypeDefinitions.h"
 #include "Logger.h"
@@ -194,17 +290,13 @@ std::map : 120000 to 143000 (After having _SECURE_SCL=0;_HAS_ITERATOR_DEBUGGING=
 
 // TO HANDLE WRITE ERRORS
 #define WRITE_OK	0L
+#define WRITE_DROPPED	1L // Response was taken out of client's queue without being written (See BACKPRESSURE_DROP_OLDEST)
 
 // LOGGING RELATED
 // When NO_WRITE is defined and server is bombarded with requests, SendResponse stays most busy and in that case DoPeriodicActivities function takes as max as 0.2 seconds
 // Hence to not to overkill timer let's set threshold to what it can take in worst case
 #define TIMER_INTERVAL_IN_MILLISECONDS 201
 
-//  Sample worst case message for length estimation (e.g. Status message) length could go upto 256 bytes
-//	#Requests received 18446744073709551615 #Requests responded 18446744073709551615 #Clients connected 50000 #Memory consumption: 8388608 KB (8192 MB) #ELTAT 1000 milliseconds #RPT 1000 miliseconds #Requests pending in the queue 10240
-#define DEFAULT_LOG_MSG_LENGTH 256 // Original value 256
-// Most log message should fit in DEFAULT_LOG_MSG_LENGTH. But if any message exceeds, we should try increments of LOG_MSG_INCREMENT bytes
-#define LOG_MSG_INCREMENT 64	// Original value 64
 // #define LOG (Logger::GetInstance()->LogMessage) 
 
 // Types
@@ -220,7 +312,7 @@ std::map : 120000 to 143000 (After having _SECURE_SCL=0;_HAS_ITERATOR_DEBUGGING=
 
 #define PROCESS_DEBUG_LOGS FALSE // If we want to turn ON/OFF all debug logs
 
-#define LOG(Type, Format, ...) Logger::GetInstance()->LogMessage(Type, __FILE__, __LINE__, __FUNCTION__, Format, ##__VA_ARGS__)
+#define LOG(Type, Format, ...) do { static const stLogCallSite _log_call_site = { __FILE__, __LINE__, __FUNCTION__, "" Format }; Logger::GetInstance()->LogMessage(Type, &_log_call_site, Format, ##__VA_ARGS__); } while(0)
 
 // Assertions are to be invoked ONLY when there is abnormal circumstances occurred under which it is not good to keep server running (It normally indicates flaw in logic etc.)
 // In order that before exiting, server should log the failure through logger (so that assertions can be logged to database also), 
@@ -232,8 +324,12 @@ std::map : 120000 to 143000 (After having _SECURE_SCL=0;_HAS_ITERATOR_DEBUGGING=
 // To log errors after checking value
 #define ASSERT_RETURN(_expression) {if(_expression) return _expression;}
 
+#include "SlabAllocator.h"
+#include "PayloadCompressor.h"
 #include "CommonComponents.h"
 #include "ClientsPool.h"
+#include "ResponseQueue.h"
+#include "Scheduler.h"
 #include "LocalClientsManager.h"
 #include "PeerServersManager.h"
 #include "ConnectionsManager.h"
@@ -26,20 +26,25 @@ Module summary:
 */
 
 typedef void (ConnectionsManager::*TimerFunction)();
-typedef int  (ConnectionsManager::*AddResponseToQueuesFunction)(class Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException);
+typedef int  (ConnectionsManager::*AddResponseToQueuesFunction)(class Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured);
 
 // Default 128k to be allocated to store "handles" in SPECIAL_COMMUNICATION version processor (i.e. for forwarded response) 
 // (This in turn means, at a time a server will create and forward response for 16384 clients connected to other server)
 // Processor for forwarded responses (RequestProcessor_ForwardedResponses defined in RequestProcessor.cpp) calculates and returns MaxRequestSize based on this.
 #define BUFFER_SIZE_IN_KILOBYTES_FOR_HANDLES_IN_SPECIAL_COMMUNICATION 128
 #define MAX_HANDLES_IN_FORWARDED_RESPONSE ((1024*BUFFER_SIZE_IN_KILOBYTES_FOR_HANDLES_IN_SPECIAL_COMMUNICATION)/sizeof(((ClientHandle*)0)->m_ClientRegistrationNumber /*We don't include IP address of server in forwarded message*/ ))  // Maximum handles in forwarded response. If there are more handles, multiple responses would be created.
+// Compact handles (See FORWARDED_HANDLES_COMPACT) take at least a byte each, and response with them is trimmed till they fit in same buffer size.
+#define MAX_COMPACT_HANDLES_IN_FORWARDED_RESPONSE (1024*BUFFER_SIZE_IN_KILOBYTES_FOR_HANDLES_IN_SPECIAL_COMMUNICATION)
 #define MAX_POSSIBLE_REQUEST_RESPONSE_SIZE (1024*1024) // Server application request procesors response size cannot exceed this for their request processor
 
+typedef struct stRequestContinuation* RequestContinuation; // Opaque to application (See RequestProcessor::SuspendRequestProcessing)
+
 // Base class for all request versions of request processors
 class DLL_API RequestProcessor
 {
 	uv_async_t m_AsyncHandle; 
 	uv_barrier_t m_Barrier;
+	std::atomic<BOOL> m_bIsWaitingOnBarrier; // Set by SendUpdate/MulticastUpdate. Asynchronous updates wake event loop through same async handle, but don't wait.
 	Lock m_rwlTotalResponseObjectsQueuedCounterLock, m_rwlTotalResponseObjectsSentCounterLock;
 	USHORT m_Version;
 	VersionParameters m_VersionParameters;
@@ -49,6 +54,7 @@ class DLL_API RequestProcessor
 	AddResponseToQueuesFunction m_pAddResponseToQueuesFunction;
 	BOOL m_bRequestIsBeingProcessed, m_bDisconnectionIsBeingProcessed;
 	long m_ResponseCountPerThread;
+	BOOL m_bHasEncounteredBackpressure; // Set by CreateResponseAndAddToQueues when peer server's or local client's queue had no room for response
 	int m_ResponseObjectsQueued, m_ResponseObjectsSent, m_TotalResponseObjectsQueued;
 	static std::map <USHORT, RequestProcessor*> m_VersionAndProcessor; // Contains request processor for its associated version. Populated in c'tor.
 	static CommonParameters m_CommonParameters;
@@ -57,7 +63,8 @@ class DLL_API RequestProcessor
 	void DeleteProcessor();
 	int Initialize (uv_loop_t* loop, ConnectionsManager* pConnMan, TimerFunction pTimerFunction, AddResponseToQueuesFunction pAddResponseToQueuesFunction);
 	VersionParameters& GetVersionParameters (); // Gets version specific parameters (e.g. MaxRequestSize, MaxResponseSize) which derived class set via constructor
-	void CreateResponseAndAddToQueues(const Buffer* response, ClientHandlesPtrs& clienthandle_ptrs, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, double RequestArrivalTime);
+	BOOL CreateResponseAndAddToQueues(const SharedBuffer& pPayload, ULONG PayloadLength, const SharedBuffer& pCompressedPayload, ULONG CompressedPayloadLength, ClientHandlesPtrs& clienthandle_ptrs, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, stUpdateCompletion* pUpdateCompletion, double RequestArrivalTime, int priority);
+	SharedBuffer CompressPayload(const SharedBuffer& pPayload, ULONG PayloadLength, ULONG& CompressedPayloadLength); // Returns NULL when payload isn't worth compressing
 	void IncreaseResponseObjectsQueuedCounter();
 	int GetTotalResponseObjectsQueued();
 	int GetResponseObjectsSent();
@@ -71,8 +78,9 @@ class DLL_API RequestProcessor
 	 can decide how to process the response. This is helpful in scenarios when for e.g. v1 processor sends response to all other clients 
 	 and one of them is v2. Now since v1 woudn't know response format of v2 (and we are not supposed to modify older version processors 
 	 while implementing next version) v1 processor has to mention in response what version of protocol is the response, 
-	 so that v2 client can decide (either process response if it is equipped with older processors, or reject response if it is from newer processors) */
-	void StoreMessage (ClientHandles* clienthandles, const Buffer* response, USHORT version, BOOL bIsUpdate);
+	 so that v2 client can decide (either process response if it is equipped with older processors, or reject response if it is from newer processors)
+	 Update waits till event loop sends it unless it is asynchronous (then pUpdateCompletion is released by each of its responses, NULL otherwise) */
+	int StoreMessage (ClientHandles* clienthandles, const Buffer* response, USHORT version, BOOL bIsUpdate, stUpdateCompletion* pUpdateCompletion, int priority); // Returns UPDATE_QUEUED, UPDATE_BACKPRESSURED or UPDATE_NOT_QUEUED
 
 	static int m_NumberOfActiveProcessors;
 	static void on_async_handle_closed (uv_handle_t* handle);
@@ -83,6 +91,7 @@ class DLL_API RequestProcessor
 	// These functions are not supposed to be called by derived RequestProcessors (for specific versions) hence they are private.
 	friend class LocalClientsManager ;
 	friend class ConnectionsManager ;
+	friend class RequestProcessor_ForwardedResponses ; // Framework's own processor. Reports decompression stat through m_pConnectionsManager.
 
 	/* Application processor must override these funtions and define their own */
 	
@@ -124,7 +133,7 @@ class DLL_API RequestProcessor
 			from constructors if application wants to override default values of common parameters. Common parameters are common 
 			across all versions of protocols (Hence all derived classes of RequestProcessor).
 		*/
-		RequestProcessor(USHORT version, VersionParameters& versionparameters);
+		RequestProcessor(USHORT version, const VersionParameters& versionparameters);
 
 		/* Application defined destructor:
 			If in derived class constructor server application has initiated things which need to be destroyed, it can override destructor.
@@ -168,6 +177,21 @@ class DLL_API RequestProcessor
 		*/
 		void DeferRequestProcessing();
 
+		/* Suspending and resuming request:
+			If request has to wait for something (timer, response from peer server, request of another client etc), ProcessRequest can call 
+			SuspendRequestProcessing and return, rather than waiting in thread or deferring request again and again. Request then waits without 
+			any thread till someone (any thread, even application's own) calls ResumeRequestProcessing with continuation returned. Framework then 
+			calls ProcessRequest for same request again, on any thread, where GetContinuationState returns pState given while suspending (it is 
+			NULL when request is processed first time). So application keeps progress of its processing in pState, rather than in session data.
+			Meanwhile client's following requests wait (and their responses are held) as they do behind request being processed.
+			ResumeRequestProcessing must be called exactly once for every continuation. It returns false when request won't be processed again 
+			because its client was disconnected meanwhile (or server is shutting down). Application then frees pState itself.
+			SuspendRequestProcessing returns NULL (and request is not suspended) if it couldn't allocate memory.
+		*/
+		RequestContinuation SuspendRequestProcessing(void* pState);
+		static bool ResumeRequestProcessing(RequestContinuation Continuation);
+		void* GetContinuationState();
+
 		/* Keep memory allocated:
 			In default mode, when any client connects and starts sending request, Pulsar Server Framework allocates memory of size VersionParameters.MaxRequestSize 
 			(which is 65KB by default) and frees the allocation soon after processing the request. However, if streaming mode turned on, the framework keeps that much memory
@@ -190,6 +214,12 @@ class DLL_API RequestProcessor
 		*/
 		USHORT GetClientProtocolVersion();
 
+		/* Requests pending behind current one:
+			This returns true when client had already sent more bytes (of its next requests) by the time current request was read. Application can use this
+			to coalesce its replies, e.g. acknowledge several requests at once with reply to last of them. (Needs CommonParameters::ReadRingSize to be non-zero, else returns false)
+		*/
+		bool AreMoreRequestsPending();
+
 		/* Session data:
 			Application can use this to store client related session data. This data will remain in memory only till client remains connected. Application can use 
 			GetSessionData to access the stored data. This is useful especially to store session related data between two consecutive requests from same client.
@@ -224,7 +254,13 @@ class DLL_API RequestProcessor
 			It is recommanded to call this function only from constructor of request processor having first version. If application
 			doesn't call this, the framework continues with default values of the parameters. These are common parameters:
 				int MaxPendingResponses: Maximum responses that can remain pending if client doesn't consume them in time (Default: 16)
-				int MaxRequestProcessingThreads: Threads to be allocated for request processing (Max value 255, Default: 5)
+				INT64 MaxPendingResponseBytes: Bytes of responses that can remain pending for all clients together. Responses beyond it are
+					not queued. Budget of each client and what happens beyond it are set per version (See VersionParameters) (Default: 256MB)
+				int MaxRequestProcessingThreads: Threads to be allocated for request processing (Max value 128, Default: 5)
+				int RequestProcessingThreadsFirstCPU: CPU to which first request processing thread is pinned, next ones are pinned to following CPUs
+					(wrapping around). So each processor instance keeps running on same CPU. Negative value leaves them unpinned (Default: -1)
+				int FlushLatencyInMilliseconds: Time responses may wait to be sent together with ones following them (Max value 201, Default: 0)
+				int FlushBatchResponses: Responses waiting which are sent without waiting for FlushLatencyInMilliseconds (Default: 64)
 				int KeepAliveFrequencyInSeconds: Duration (in seconds) which framework send keep alive to each client connected (Default: 30 seconds)
 				int StatusUpdateFrequencyInSeconds: Duration by which Pulsar Server Framework keep calling ProcessLog function to update various status and logs (Default: 5 seconds)
 		*/
@@ -240,19 +276,37 @@ class DLL_API RequestProcessor
 			As mentioned before ClientHandle is client which might have connected to any server hardware/instance.
 			Value of version equal to DEFAULT_VERSION is treated as version of client who is storing this response.
 			Unless request processor wants to set different version, it should call this function without version parameter.
+			Priority is RESPONSE_PRIORITY_NORMAL or RESPONSE_PRIORITY_HIGH. Client gets responses of high priority ahead of normal ones
+			queued before them (e.g. interactive reply isn't held behind bulk updates), whereas responses of same priority reach it in order.
+			Priority applies to clients of this server. Clients of peer servers get response as normal one.
 		*/
-		void SendResponse (ClientHandle* clienthandle, const Buffer* response, USHORT version = DEFAULT_VERSION); // Request processors will use this only, even for current client
+		void SendResponse (ClientHandle* clienthandle, const Buffer* response, USHORT version = DEFAULT_VERSION, int priority = RESPONSE_PRIORITY_NORMAL); // Request processors will use this only, even for current client
 
 		/* Send response to multiple clients:
 			Application can call this to send single response to multiple clients at a time. No limit on number of clients. 
 			Also they can be clients connected to any server hardware/instance.
 			Value of version equal to DEFAULT_VERSION is treated as version of client who is storing this response
 			Unless request processor wants to set different version, it should call this function without version parameter
+			Priority is same as above.
 		*/
-		void SendResponse (ClientHandles* clienthandles, const Buffer* response, USHORT version = DEFAULT_VERSION);
+		void SendResponse (ClientHandles* clienthandles, const Buffer* response, USHORT version = DEFAULT_VERSION, int priority = RESPONSE_PRIORITY_NORMAL);
 
 		/* Functions below are still being evolved as of in their current state, hence not documented. Application should not call them.
+			Both return UPDATE_QUEUED, UPDATE_BACKPRESSURED (some recipients are on peer server whose link has MaxPeerQueueBytes waiting for credit,
+			or are local clients having MaxPendingResponses in their queue) or UPDATE_NOT_QUEUED. Priority is same as of SendResponse.
+		*/
+		int SendUpdate (ClientHandle* clienthandle, const Buffer* response, USHORT version = DEFAULT_VERSION, int priority = RESPONSE_PRIORITY_NORMAL);
+		int MulticastUpdate (ClientHandles* clienthandles, const Buffer* update, USHORT version = DEFAULT_VERSION, int priority = RESPONSE_PRIORITY_NORMAL);
+
+		/* Send update without waiting:
+			Same as SendUpdate and MulticastUpdate (and return same values) except that they return as soon as update is queued, rather than holding
+			request processing thread till event loop sends it. So request which streams many updates keeps its thread only while it creates them.
+			Updates (of same priority) reach each client in order they were sent, and one sent while client has MaxPendingResponses in its queue is not queued for
+			it (UPDATE_BACKPRESSURED), so request should hold further updates till earlier ones complete.
+			pCompletionFunction (can be NULL) is called with pContext exactly once, after every response created for update is done with (sent,
+			forwarded or failed). It is called by event loop, or by this thread itself before function returns if no response was queued.
+			So it must be short and must not call any of the functions of this class. Typically it signals application's own state.
 		*/
-		void SendUpdate (ClientHandle* clienthandle, const Buffer* response, USHORT version = DEFAULT_VERSION);
-		void MulticastUpdate (ClientHandles* clienthandles, const Buffer* update, USHORT version = DEFAULT_VERSION);
+		int SendUpdateAsync (ClientHandle* clienthandle, const Buffer* update, UpdateCompletionFunction pCompletionFunction, void* pContext, USHORT version = DEFAULT_VERSION, int priority = RESPONSE_PRIORITY_NORMAL);
+		int MulticastUpdateAsync (ClientHandles* clienthandles, const Buffer* update, UpdateCompletionFunction pCompletionFunction, void* pContext, USHORT version = DEFAULT_VERSION, int priority = RESPONSE_PRIORITY_NORMAL);
 };
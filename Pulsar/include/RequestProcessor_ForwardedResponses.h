@@ -25,6 +25,13 @@ Module summary:
 
 #include "Pulsar.h"
 
+// Session of peer server which asked for cumulative acknowledgements (REQUEST_CUMULATIVE_ACKNOWLEDGEMENTS). Kept as client's session data.
+struct stForwardingSession
+{
+	UINT64 m_ReceivedSequence; // Forwarded responses received after control request
+	UINT64 m_AcknowledgedSequence; // Sent with last cumulative acknowledgement
+};
+
 // Pulsar Framewors's inbuilt request processor to handle forwarded responses.
 class RequestProcessor_ForwardedResponses : public RequestProcessor
 {
@@ -39,6 +46,10 @@ class RequestProcessor_ForwardedResponses : public RequestProcessor
 
 	// This should return TRUE if it processes request successfully, FALSE otherwise 
 	BOOL ProcessRequest ();
+	BOOL ProcessForwardedResponse ();
+	BOOL ReadCompactHandles (const uv_buf_t& forwarded_response, ULONG& index, UINT NumberOfHandles, ClientHandles& clienthandles);
+	BOOL DecompressPayload (uv_buf_t& payload, SharedBuffer& pPayload);
+	void AcknowledgeCumulatively (stForwardingSession* pSession);
 
 	RequestProcessor_ForwardedResponses* GetAnotherInstance() { return new RequestProcessor_ForwardedResponses(m_Version); }
 
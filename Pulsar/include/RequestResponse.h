@@ -29,11 +29,19 @@ class Request
 	double m_ArrivalTime ;
 	BOOL m_bHasEncounteredMemoryAllocationException;
 	BOOL m_bIsDeferred;
+	UINT64 m_Sequence; // Per client sequence number. Orders responses of pipelined requests.
+	char* m_pRequestBuffer; // Set only when client pipelines requests. Then request owns its buffer and client can read next request meanwhile.
+	ULONG m_RequestBufferSize;
+	BOOL m_bIsFollowedByRequests; // Client's further bytes were already read (in read ring) when request was created
+	struct stRequestContinuation* m_pContinuation; // Non NULL from suspension of request till event loop queues it again (See RequestProcessor::SuspendRequestProcessing)
+	void* m_pContinuationState; // Given by processor while suspending request, given back to it while processing resumed request
+	BOOL m_bIsAbandoned; // Client was being disconnected while request was suspended. Its processing isn't resumed.
 
 	public:
+		ALLOCATE_FROM_SLAB // Created per request by event loop, deleted by after_request_processing_thread
 
 		/* USED BY CLIENT */
-		uv_work_t m_work_t;
+		stWork m_work_t;
 		Request* m_NextRequest;
 
 		Request(uv_buf_t* request, double ArrivalTime, ClientsPool* pClientsPool, ClientHandle* pClientHandle);
@@ -49,12 +57,60 @@ class Request
 
 		void DeferProcessing(BOOL bFlag);
 		BOOL IsDeferred();
+
+		void Suspend(struct stRequestContinuation* pContinuation, void* pContinuationState);
+		struct stRequestContinuation* GetContinuation();
+		void ReleaseContinuation(); // Called by event loop when it queues request again
+		void* GetContinuationState();
+		void Abandon();
+		BOOL IsAbandoned();
+
+		void SetSequence(UINT64 Sequence);
+		UINT64 GetSequence();
+		void TakeOverRequestBuffer(char* pBuffer, ULONG BufferSize); // pBuffer must hold copy of whole request (header included) as client's buffer did
+		ULONG GetRequestBufferSize(); // Zero when request doesn't own its buffer
+		void SetFollowedByRequests(BOOL bFlag);
+		BOOL IsFollowedByRequests();
+};
+
+// Response is sent as two scatter-gather segments: header specific to destination (local clients or peer server) followed by payload.
+#define BUFFERS_PER_RESPONSE 2
+
+// Called once all responses created for update (See RequestProcessor::SendUpdateAsync) are done with
+typedef void (*UpdateCompletionFunction)(void* pContext);
+
+// Shared by all responses created for an update sent by SendUpdateAsync or MulticastUpdateAsync. Last of them releasing it calls completion function.
+struct stUpdateCompletion
+{
+	UpdateCompletionFunction m_pCompletionFunction;
+	void* m_pContext;
+	std::atomic<int> m_PendingResponses; // Responses not yet done with, plus one held by RequestProcessor::StoreMessage till it has created all of them
+
+	ALLOCATE_FROM_SLAB // Created by request processing threads, mostly deleted by event loops (with last response)
+
+	stUpdateCompletion(UpdateCompletionFunction pCompletionFunction, void* pContext);
+	void AddResponse();
+	void Release(); // Last release calls completion function and deletes the object
 };
 
 class Response
 {
-	std::unique_ptr<char[]> base; // This stores m_Response.base pointer. It will be automatically destructed when constructor throws exception.
-	uv_buf_t m_Response ;
+	// Payload is copied only once (in RequestProcessor::StoreMessage) and shared (read only) by all responses created out of it. 
+	// So a multicast to N servers holds single copy of payload. Last response referring to it frees it.
+	SharedBuffer m_pPayload; 
+
+	// Header for local clients fits in m_LocalHeader. Header for forwarded response (with handles) is allocated in m_pForwardHeader.
+	char m_LocalHeader[HEADER_SIZE];
+	std::unique_ptr<char[]> m_pForwardHeader; // It will be automatically destructed when constructor throws exception.
+
+	uv_buf_t m_ResponseBuffers[BUFFERS_PER_RESPONSE]; // Header and payload, in that order
+	ULONG m_ResponseLength; // Header length + payload length
+
+	// Forwarded response can have payload compressed too (original length followed by compressed payload), shared like payload.
+	// It is used instead of payload only for peer server which supports compression (See UseCompressedPayload).
+	SharedBuffer m_pCompressedPayload;
+	ULONG m_CompressedPayloadLength;
+	BOOL m_bIsPayloadCompressed;
 
 	/*
 		Response is communication by server to client. Any type of response can have three distinct attributes: 
@@ -66,6 +122,10 @@ class Response
 	ClientHandlesPtrsIterator m_StartIt, m_EndIt;
 	unsigned int m_NumberOfHandles;
 
+	// Forwarded response can have handles compact (See FORWARDED_HANDLES_COMPACT), when peer server supports them
+	BOOL m_bHasCompactHandles;
+	unsigned int m_HandlesArraySize; // Bytes handles take in forward header
+
 	ConnectionsManager* m_pConnectionsManager;
 
 	// Each response is associated with a server (local or remote). We store this value in construction.
@@ -75,7 +135,10 @@ class Response
 	// uv_write_t write_t;
 	double m_RequestArrivalTime ;
 	int m_ReferenceCount ;
+	std::atomic<BOOL> m_bIsReadyToSend; // Set after reference count is known. Response can be in client's queue before that (see LocalClientsManager::SendLocalClientsResponses)
 	RequestProcessor* m_pRequestProcessor;
+	stUpdateCompletion* m_pUpdateCompletion; // Released in destructor. NULL unless response is of asynchronous update.
+	int m_Priority; // Lane of local clients' queues response goes in (See RESPONSE_PRIORITY_NORMAL). Not forwarded to peer servers.
 
 	void Initialize();
 
@@ -86,26 +149,42 @@ class Response
 	// (either process response if it is equipped with older processors, or reject response if it is from newer processors)
 
 	/* C'tor for response being sent to client(s) to this server */
-	void ConstructResponseForLocalClients(const uv_buf_t* response, int NumberOfClients, USHORT version /* Version of client who is creating/storing the Response */); 
+	void ConstructResponseForLocalClients(ULONG PayloadLength, int NumberOfClients, USHORT version /* Version of client who is creating/storing the Response */); 
 
 	/* C'tor for response being forwarded to another server */
-	void ConstructResponseForRemoteClients(const uv_buf_t* response, USHORT version /* Version of client who is creating/storing the Response */);
+	void ConstructResponseForRemoteClients(ULONG PayloadLength, USHORT version /* Version of client who is creating/storing the Response */);
+	unsigned int SortCompactHandles(std::vector<UINT64>& RegistrationNumbers); // Returns bytes compact handles take. Trims handles till they fit.
 
 	public:
+		ALLOCATE_FROM_SLAB // Created by request processing threads, mostly deleted by event loops (See SlabAllocator::Free)
+
 		/* USED BY CLIENT */
 		int ForwardError ;
 		BOOL bAddedToStat ;
 		int ResponseSentCount;
 		double QueuedTime;
 
-		Response(const uv_buf_t* response, ClientHandlesPtrsIterator& StartIt, ClientHandlesPtrsIterator& EndIt, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, RequestProcessor* pRequestProcessor, double RequestArrivalTime, ConnectionsManager* pConnectionsManager);
+		Response(const SharedBuffer& pPayload, ULONG PayloadLength, ClientHandlesPtrsIterator& StartIt, ClientHandlesPtrsIterator& EndIt, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, BOOL bCompactHandles, RequestProcessor* pRequestProcessor, double RequestArrivalTime, ConnectionsManager* pConnectionsManager);
 		~Response();
 
 		double GetRequestArrivalTime();
 
 		int GetResponseType();
 
-		const uv_buf_t GetResponse();
+		const uv_buf_t* GetResponseBuffers(); // Returns BUFFERS_PER_RESPONSE buffers to be passed to uv_write
+		ULONG GetResponseLength(BOOL bWithCompressedPayload = FALSE); // Length as queued (with payload) or as forwarded with compressed payload (if it has one)
+
+		void SetCompressedPayload(const SharedBuffer& pCompressedPayload, ULONG CompressedPayloadLength); // Called before response is queued
+		BOOL UseCompressedPayload(); // Called by event loop just before forwarding. Returns FALSE if response has no compressed payload.
+		BOOL IsPayloadCompressed();
+
+		void SetUpdateCompletion(stUpdateCompletion* pUpdateCompletion); // Called before response is queued
+		void SetPriority(int Priority); // Called before response is queued
+		int GetPriority();
+
+		BOOL HasCompactHandles();
+		unsigned int GetNumberOfHandles();
+		unsigned int GetHandlesArraySize();
 
 		RequestProcessor* GetRequestProcessor();
 
@@ -114,6 +193,8 @@ class Response
 		BOOL IsFatalErrorForLocallyConnectedClient();
 		void SetReferenceCount(int ReferenceCount);
 		int GetReferenceCount();
+		void SetReadyToSend();
+		BOOL IsReadyToSend();
 
 		BOOL IsMulticast();
 		BOOL IsForward();
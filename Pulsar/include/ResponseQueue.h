@@ -0,0 +1,55 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Bounded lock-free queue of responses for a locally connected client (one per priority lane, see stClient::m_ResponsesQueues).
+Many request processing threads add responses to it (Push) whereas only event loop takes them out (Peek/Pop) to send.
+Neither producers block each other nor they block event loop. When queue is full Push fails (like it used to when client's
+response queue reached MaxPendingResponses).
+
+Each slot carries a sequence number that tells whether slot is ready to be written (sequence == position) or to be
+read (sequence == position+1). Producers claim position by compare-and-swap. Positions are 64 bit so they never wrap.
+*/
+
+class ResponseQueue
+{
+	struct stSlot
+	{
+		std::atomic<UINT64> m_Sequence;
+		class Response* m_pResponse;
+	};
+
+	stSlot* m_pSlots;
+	UINT64 m_Capacity;
+
+	std::atomic<UINT64> m_PushPosition; // Changed by producers (threads)
+	UINT64 m_PopPosition; // Changed only by consumer (event loop)
+
+	public:
+		ResponseQueue();
+		void Initialize(int Capacity); // Throws std::bad_alloc
+		~ResponseQueue();
+
+		BOOL Push(class Response* pResponse); // Called by threads. Returns FALSE if queue is full.
+		class Response* Peek(); // Called by event loop. Returns NULL if queue is empty.
+		void Pop(); // Called by event loop. Removes response returned by Peek.
+		BOOL IsEmpty(); // Called by event loop
+		UINT64 GetCount(); // Called by event loop. Includes responses threads are still pushing.
+};
@@ -0,0 +1,96 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Scheduler runs work of request processors (processing requests, client disconnections and keep alives) on its own threads (workers).
+It replaces libuv threadpool (uv_queue_work) for them. That threadpool is single FIFO queue shared with libuv's own work (uv_getaddrinfo
+of peer servers, file system) and with logger and file writer, so any of those could hold request processing behind it.
+
+Each worker has its own deque of works (intrusive list of stWork, so queueing never allocates and can't fail). Event loop queues work to workers round robin. Worker takes work from front of its own deque
+and, when that is empty, steals from back of deques of other workers before it sleeps. So a worker stuck with long request doesn't hold
+works queued behind it. Index of worker never changes, and request processors and counters block of a thread are indexed by it
+(See LocalClientsManager::GetRequestProcessor and CommonComponents::GetStatCounters). Workers can be pinned to CPUs (See CommonParameters).
+
+Work done is handed back to event loop which queued it. Worker pushes it to done works of the loop (lock-free) and wakes the loop up
+through async handle of the list. Loop then runs its after function, just as libuv would run after_work_cb of uv_queue_work.
+*/
+
+struct stWork;
+typedef void (*WorkFunction)(stWork* work_t); // Run by worker
+typedef void (*AfterWorkFunction)(stWork* work_t, int status); // Run by event loop which queued work. Status is always zero (kept for uv_after_work_cb compatibility).
+
+// Done works of an event loop (See stEventLoop::m_DoneWorks)
+struct stDoneWorks
+{
+	uv_async_t m_AsyncHandle;
+	std::atomic<stWork*> m_pHead; // Workers push works (lock-free), event loop takes whole list at once
+};
+
+// Work queued to scheduler. Embedded in object it works on (as uv_work_t was), which is pointed by data.
+struct stWork
+{
+	void* data;
+	WorkFunction m_pWorkFunction;
+	AfterWorkFunction m_pAfterWorkFunction;
+	stDoneWorks* m_pDoneWorks; // Of event loop which queued the work
+	stWork* m_pPrevious; // Links in deque of worker
+	stWork* m_pNext;
+	stWork* m_pNextDone;
+};
+
+struct CACHE_ALIGNED stWorker
+{
+	class Scheduler* m_pScheduler;
+	int m_Index;
+	uv_thread_t m_Thread;
+	uv_mutex_t m_Lock; // Guards deque of works. Taken by owner, by event loops queueing works and by workers stealing.
+	stWork* m_pFirstWork; // Owner takes from here
+	stWork* m_pLastWork; // Works are queued and stolen here
+	ServerStatCounters* m_pStatCounters; // Counters block of this worker
+};
+
+class Scheduler
+{
+	stWorker m_Workers[MAX_WORK_THREADS];
+	int m_WorkersCount;
+	int m_FirstCPU; // Worker i is pinned to CPU (m_FirstCPU + i) % CPUs. Negative when workers aren't pinned.
+	std::atomic<UINT> m_NextWorker; // Round robin
+	std::atomic<int> m_QueuedWorks; // Works in all deques. Workers sleep only when it is zero.
+	std::atomic<int> m_SleepingWorkers;
+	std::atomic<BOOL> m_bStopRequested;
+	uv_mutex_t m_SleepLock;
+	uv_cond_t m_WakeUpCondition;
+
+	static void worker_thread(void* arg);
+	stWork* TakeWork(stWorker* pWorker); // Own work first, else stolen one. NULL when all deques are empty.
+	void PinToCPU(stWorker* pWorker);
+	static void on_works_done(uv_async_t* handle);
+
+	public:
+		Scheduler();
+
+		int Start(int WorkersCount, int FirstCPU, ServerStatCounters* pStatCounters); // Called by main loop. pStatCounters is array of counters blocks indexed by worker.
+		void Stop(); // Called by main loop at last stage of shutdown. Waits till workers finish works already queued.
+		void QueueWork(stWork* work_t, stDoneWorks* pDoneWorks, WorkFunction pWorkFunction, AfterWorkFunction pAfterWorkFunction); // Called by event loops. Never fails (nothing is allocated).
+
+		static int InitializeDoneWorks(uv_loop_t* pLoop, stDoneWorks* pDoneWorks); // Called by event loop before it queues any work
+		static void CloseDoneWorks(stDoneWorks* pDoneWorks);
+		static int GetCurrentWorkerIndex(); // -1 if called by thread other than worker
+};
@@ -0,0 +1,79 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Per thread slab pools for objects and buffers allocated on hot path (stClient, Request, Response, request buffers and response payloads).
+Sizes are rounded up to power of 2 size classes, from SLAB_MIN_BLOCK_SIZE up to the class which fits largest request or response of all
+versions (See SetMaxBlockSize). Bigger allocations go to heap.
+
+Each thread has its own pool per size class, so allocating never takes lock. Blocks are carved out of SLAB_SIZE chunks, which are never
+returned to heap but reused. Block freed by the thread which allocated it goes back to its pool's free list. Block freed by other thread
+(e.g. response created by request processing thread and deleted by event loop) is pushed on lock-free remote free list of its pool,
+which owner takes over when its own free list runs out.
+*/
+
+#define SLAB_MIN_BLOCK_SIZE 32
+#define SLAB_SIZE (64*1024) // Chunk carved into blocks (or single block, if bigger)
+
+class SlabAllocator
+{
+	struct stSlabPool;
+
+	// Precedes every block. 16 bytes keep blocks aligned as heap does.
+	struct stBlockHeader
+	{
+		stSlabPool* m_pPool; // NULL when allocated from heap
+		stBlockHeader* m_pNext; // Link in free list while block is free
+	};
+
+	struct CACHE_ALIGNED stSlabPool
+	{
+		int m_SizeClass;
+		stBlockHeader* m_pFreeList; // Used only by owner thread
+		std::atomic<stBlockHeader*> m_pRemoteFreeList; // Pushed by other threads, taken over by owner as a whole
+		std::atomic<INT64> m_BlocksReserved, m_Allocations, m_LocalFrees; // Changed only by owner thread. Atomic so that stat can read them.
+		std::atomic<INT64> m_RemoteFrees; // Changed by other threads
+	};
+
+	// Pools of a thread. Never deleted, as blocks of it could still be freed by other threads after thread ends.
+	struct stThreadPools
+	{
+		stSlabPool m_Pools[SLAB_SIZE_CLASSES];
+		stThreadPools* m_pNext; // Link in list of all threads' pools (for stat)
+	};
+
+	static THREAD_LOCAL stThreadPools* m_pThreadPools;
+	static std::atomic<stThreadPools*> m_pAllThreadPools;
+	static int m_MaxSizeClass;
+
+	static stThreadPools* CreateThreadPools();
+	static void Refill(stSlabPool* pPool); // Throws std::bad_alloc
+
+	public:
+		static void SetMaxBlockSize(int MaxBlockSize); // Called once before server starts accepting connections
+		static void* Allocate(size_t Size); // Throws std::bad_alloc, like new does
+		static void Free(void* pMemory);
+		static void AddUpStat(ServerStat& stServerStat); // Adds up occupancy of all threads' pools
+};
+
+// Class specific operator new/delete for objects allocated from slab pools
+#define ALLOCATE_FROM_SLAB \
+	static void* operator new(size_t Size) { return SlabAllocator::Allocate(Size); } \
+	static void operator delete(void* pMemory) { SlabAllocator::Free(pMemory); }
@@ -32,7 +32,7 @@ typedef struct structLockRequestsResponses // It's better we typedef it than jus
 	uv_rwlock_t rwLock;
 	int	Requests;
 	int	Responses;
-	time_t LastActivityTime;
+	UINT64 LastActivityTime; // Loop time in milliseconds (See ClientsPool::m_CurrentTime)
 } LockRequestsResponses;
 
 struct stProfilerData
@@ -135,18 +135,35 @@ typedef struct structServerStat
 
 	INT64 RequestsArrived, RequestsProcesed, RequestsNotAdvicedToProcess, RequestsRejectedByServer, RequestsFailedToProcess, RequestBytesIgnored, TotalRequestBytesProcessed;
 	INT64 RequestsProcessedPerThread[MAX_WORK_THREADS];
+	INT64 RequestsSuspended, RequestsResumed, RequestsAbandoned; // See RequestProcessor::SuspendRequestProcessing
 	INT64 ResponsesAcknowledgementsOfForwardedResponses, ResponsesErrors, ResponsesKeepAlives, ResponsesFatalErrors, ResponsesOrdinary;
 	INT64 ResponsesForwarded, ResponsesMulticasts, ResponsesUpdates;
-	INT64 ResponsesSent, ResponsesFailedToQueue, ResponsesFailedToSend, ResponsesFailedToForward, TotalResponseBytesSent;
+	INT64 ResponsesSent, ResponsesFailedToQueue, ResponsesBackpressured, ResponsesFailedToSend, ResponsesFailedToForward, TotalResponseBytesSent;
+	INT64 ResponseFlushes; // By event loops (See CommonParameters::FlushLatencyInMilliseconds)
+	INT64 ResponsesDroppedByBudget, ClientsDisconnectedByBudget; // See VersionParameters::m_MaxPendingResponseBytes and CommonParameters::MaxPendingResponseBytes
+
+	// Compression of payloads forwarded to peer servers (See CommonParameters::PeerCompressionThreshold)
+	INT64 PayloadsCompressed, PayloadsNotCompressed, PayloadBytesBeforeCompression, PayloadBytesAfterCompression, PayloadsDecompressed, PayloadsFailedToDecompress;
+	double TotalCompressionTime, TotalDecompressionTime;
+	INT64 ResponsesForwardedCompressed, ForwardedBytesSavedByCompression; // Gets changed only through main loop
+
+	// Forwarded responses created with compact handles (See FORWARDED_HANDLES_COMPACT)
+	INT64 ResponsesWithCompactHandles, HandleBytesSavedByCompactHandles;
+
 	INT64 MemoryConsumptionByRequestsInQueue; // Gets changed in event loop
 	INT64 MemoryConsumptionByResponsesInQueue; // Gets changed in request_processing_thread and event loop. Protected by rwlResponseLock.
 	INT64 RequestProcessingThreadsStarted, RequestProcessingThreadsFinished;
+	INT64 WorksStolen; // By request processing threads from each other (See Scheduler)
 	double TotalRequestProcessingTime, AverageRequestProcessingTime, ResponseQueuedDurationMinimum, ResponseQueuedDurationMaximum; 
 
 	// Errors and exceptions
 	UINT64 HeaderErrorInPreamble, HeaderErrorInVersion, HeaderErrorInSize;
 	UINT64 ForwardErrorWritingServer, ForwardErrorConnectingTimedout, ForwardErrorOverflowed, ForwardErrorDisconnecting, ForwardErrorDisconnected;
 	UINT64 MemoryAllocationExceptionCount, RequestCreationExceptionCount, ResponseCreationExceptionCount, ClientCreationExceptionCount, ConnectionCreationExceptionCount;
+
+	// Slab pools occupancy (Added up from all threads' pools in GetCopyOfServerStat)
+	INT64 SlabBlocksReserved[SLAB_SIZE_CLASSES], SlabBlocksInUse[SLAB_SIZE_CLASSES];
+	INT64 MemoryReservedBySlabs;
 	
 
 	/* These values will be computed inside LogStat */
@@ -172,6 +189,41 @@ typedef struct structServerStat
 	time_t Time;
 } ServerStat;
 
+/*
+	Counters of ServerStat those are changed by request processing threads. Instead of guarding them with locks, each thread 
+	changes only its own block (See CommonComponents::GetStatCounters) and LogStat adds up all blocks into ServerStat.
+	Each event loop too has its own block. Besides decreasing response counters when responses are sent, it keeps counters 
+	of its clients' I/O (these are added to the ones main loop keeps in ServerStat for peer servers).
+	Blocks are cache line aligned so that threads updating their own blocks don't invalidate each other's cache lines.
+*/
+typedef struct CACHE_ALIGNED structServerStatCounters
+{
+	INT64 RequestsProcesed, RequestsFailedToProcess, TotalRequestBytesProcessed, MemoryConsumptionByRequestsInQueue;
+	INT64 RequestProcessingThreadsStarted, RequestProcessingThreadsFinished;
+	double TotalRequestProcessingTime;
+	INT64 ResponsesInPeerServersQueues, ResponsesInLocalClientsQueues, ResponsesFailedToQueue, ResponsesBackpressured, MemoryConsumptionByResponsesInQueue;
+	INT64 PayloadsCompressed, PayloadsNotCompressed, PayloadBytesBeforeCompression, PayloadBytesAfterCompression, PayloadsDecompressed, PayloadsFailedToDecompress;
+	double TotalCompressionTime, TotalDecompressionTime;
+	INT64 ResponsesWithCompactHandles, HandleBytesSavedByCompactHandles;
+	INT64 WorksStolen; // Works this (request processing) thread took from deques of other threads (See Scheduler)
+	INT64 ResponsesDroppedByBudget; // Newest ones by threads, oldest ones by event loops
+
+	/* Changed only by event loops */
+	INT64 ClientsConnectedCount, ClientsDisconnectedCount, DisconnectionsByServer, DisconnectionsByClients;
+	INT64 MemoryConsumptionByClients, ActiveClientRequestBuffers, ResponsesBeingSent;
+	INT64 RequestsArrived, RequestsRejectedByServer, RequestBytesIgnored;
+	INT64 RequestsSuspended, RequestsResumed, RequestsAbandoned;
+	INT64 ResponseFlushes, ClientsDisconnectedByBudget;
+	INT64 ResponsesAcknowledgementsOfForwardedResponses, ResponsesErrors, ResponsesKeepAlives, ResponsesFatalErrors, ResponsesOrdinary;
+	INT64 ResponsesForwarded, ResponsesMulticasts, ResponsesUpdates, ResponsesSent, ResponsesFailedToSend, TotalResponseBytesSent;
+	UINT64 HeaderErrorInPreamble, HeaderErrorInVersion, HeaderErrorInSize;
+	double ResponseQueuedDurationMinimum, ResponseQueuedDurationMaximum;
+	int StatInterval; // Min/max durations above belong to this stat interval (See CommonComponents::m_StatInterval)
+} ServerStatCounters;
+
+#define STAT_COUNTERS_BLOCKS (MAX_WORK_THREADS+MAX_EVENT_LOOPS) // One block for each request processing thread plus one for each event loop
+#define EVENT_LOOP_STAT_COUNTERS MAX_WORK_THREADS // Index of main event loop's block. Blocks of other event loops follow it.
+
 typedef struct stClientHandle 
 { 
 	// Huge number of clients can connect to the Server at a time. There is huge theoretical limit to this. 
@@ -211,6 +263,12 @@ typedef struct stClientHandle
 
 } ClientHandle;
 
+// What happens to response for a client which already has VersionParameters::m_MaxPendingResponseBytes waiting to be sent
+#define BACKPRESSURE_DROP_NEWEST	0 // Response is not queued (sender sees it as backpressured, same as when client's queue is full)
+#define BACKPRESSURE_DROP_OLDEST	1 // Response is queued. Event loop drops oldest responses not yet being sent till client is within budget.
+#define BACKPRESSURE_DISCONNECT		2 // Response is not queued and client is disconnected
+#define BACKPRESSURE_STOP_READING	3 // Response is queued. Requests of client are not read till it is within budget.
+
 // Structure to store version specific server paremeters
 typedef struct stVersionParameters
 {
@@ -219,16 +277,33 @@ typedef struct stVersionParameters
 	int m_MaxRequestSize;
 	int m_MaxResponseSize;
 
+	// Number of requests of a client which can be processed at a time (1 to MAX_PIPELINED_REQUESTS). With 1 (default) next request is read only after 
+	// previous one has been processed. With more, client can send next requests without waiting for responses and they are processed in parallel 
+	// by different threads. Hence processor of such version must be able to process requests of same client (and its session data) concurrently. 
+	// Responses to requesting client are still sent in order of requests. Streaming mode always works as 1.
+	int m_MaxPipelinedRequests;
+
+	// Bytes of responses which can wait to be sent to a client of this version, and what to do with response beyond it (one of BACKPRESSURE_*).
+	// Client with nothing pending is always given its response, so single response bigger than budget isn't refused forever.
+	INT64 m_MaxPendingResponseBytes;
+	int m_BackpressurePolicy;
+
 	stVersionParameters()
 	{
 		m_MaxRequestSize = (64*1024);
 		m_MaxResponseSize = (64*1024);
+		m_MaxPipelinedRequests = 1;
+		m_MaxPendingResponseBytes = (1024*1024);
+		m_BackpressurePolicy = BACKPRESSURE_DROP_NEWEST;
 	}
 
-	stVersionParameters(int maxrequestsize, int maxresponsesize)
+	stVersionParameters(int maxrequestsize, int maxresponsesize, int maxpipelinedrequests = 1, INT64 maxpendingresponsebytes = (1024*1024), int backpressurepolicy = BACKPRESSURE_DROP_NEWEST)
 	{
 		m_MaxRequestSize = maxrequestsize;
 		m_MaxResponseSize = maxresponsesize;
+		m_MaxPipelinedRequests = maxpipelinedrequests;
+		m_MaxPendingResponseBytes = maxpendingresponsebytes;
+		m_BackpressurePolicy = backpressurepolicy;
 	}
 } VersionParameters;
 
@@ -236,13 +311,22 @@ typedef struct stVersionParameters
 typedef struct stCommonParameters
 {
 	int MaxPendingResponses;
-	// int MaxPendingRequests; // This was per client number. However we cannot have more than 1 pending requests per client because parallel processing of requests of same client is not desired under any circumstance.
+	// int MaxPendingRequests; // This was per client number. Parallel processing of requests of same client is not desired by default. Version can opt for it by VersionParameters::m_MaxPipelinedRequests.
 	int MaxRequestProcessingThreads;
 	// int MaxClientsPerMulticast;
 	// int MaxVersionNumber;
 	// long MaxResponsesCreatedPerThread;
 	int KeepAliveFrequencyInSeconds;
 	int StatusUpdateFrequencyInSeconds;
+	int EventLoops; // Number of event loops doing clients' I/O. Each has its own listening socket (SO_REUSEPORT) and own clients. Linux only, Windows always uses 1.
+	int ReadRingSize; // Bytes read from client's socket at once. Many small requests are then read by single read. Zero reads header and rest of each request separately.
+	int PeerCreditResponses, PeerCreditBytes; // Forwarded responses (and their bytes) a peer server may send to this server without waiting for acknowledgements (granted to peer servers)
+	int MaxPeerQueueBytes; // Bytes of forwarded responses which can wait for credit per peer server. Responses beyond it are not queued (SendUpdate returns UPDATE_BACKPRESSURED).
+	int PeerCompressionThreshold; // Payloads at least this long are compressed when forwarded to peer servers supporting it. Zero disables compression.
+	int FlushLatencyInMilliseconds; // Responses queued after a flush wait this long to be sent together. Zero (default) flushes as soon as event loop wakes up.
+	int FlushBatchResponses; // Responses queued after which event loop flushes without waiting for FlushLatencyInMilliseconds
+	INT64 MaxPendingResponseBytes; // Bytes of responses waiting to be sent to all local clients together. Responses beyond it are not queued (dropped as newest).
+	int RequestProcessingThreadsFirstCPU; // Request processing thread i is pinned to CPU (RequestProcessingThreadsFirstCPU + i) modulo CPUs. Negative (default) doesn't pin them.
 
 	stCommonParameters()
 	{
@@ -251,6 +335,16 @@ typedef struct stCommonParameters
 		StatusUpdateFrequencyInSeconds = 5;
 		MaxPendingResponses = 16;
 		MaxRequestProcessingThreads = 5;
+		EventLoops = 1;
+		ReadRingSize = 4096;
+		PeerCreditResponses = 1024;
+		PeerCreditBytes = (1024*1024);
+		MaxPeerQueueBytes = (8*1024*1024);
+		PeerCompressionThreshold = 512;
+		FlushLatencyInMilliseconds = 0;
+		FlushBatchResponses = 64;
+		MaxPendingResponseBytes = (256*1024*1024);
+		RequestProcessingThreadsFirstCPU = -1;
 	}
 } CommonParameters;
 
@@ -267,6 +361,7 @@ typedef LoggerMap::iterator LoggerIterator;
 
 typedef uv_rwlock_t Lock;
 typedef uv_buf_t Buffer;
+typedef std::shared_ptr<char> SharedBuffer; // Immutable buffer shared by multiple owners (e.g. payload of multicast responses)
 
 struct RequestCreationException{};
 struct ResponseCreationException{};
@@ -20,14 +20,30 @@
 
 ClientsPool::ClientsPool() 
 { 
-	uv_rwlock_init(&m_ClientsMapLock);
+	for (int i=0; i<CLIENTS_POOL_SHARDS; i++)
+		uv_rwlock_init(&m_Shards[i].m_ClientsMapLock);
 
 	m_bIsServerShuttingDown=FALSE;
+
+	for (int i=0; i<KEEP_ALIVE_WHEEL_SLOTS; i++)
+		m_pWheelSlots[i] = NULL;
+
+	uv_rwlock_init(&m_WheelLock);
+	m_WheelTime = 0;
+	m_CurrentTime = 0;
 }
 
 ClientsPool::~ClientsPool() 
 { 
-	uv_rwlock_destroy(&m_ClientsMapLock);
+	for (int i=0; i<CLIENTS_POOL_SHARDS; i++)
+		uv_rwlock_destroy(&m_Shards[i].m_ClientsMapLock);
+
+	uv_rwlock_destroy(&m_WheelLock);
+}
+
+ClientsPoolShard& ClientsPool::GetShard(UINT64 ClientRegistrationNumber)
+{
+	return m_Shards[ClientRegistrationNumber & (CLIENTS_POOL_SHARDS-1)];
 }
 
 void ClientsPool::SetServerShuttingDown() 
@@ -49,16 +65,28 @@ BOOL ClientsPool::AddClient(stClient* pClient)
 	if (m_bIsServerShuttingDown)
 		return FALSE;
 
-	uv_rwlock_wrlock(&m_ClientsMapLock);
+	ClientsPoolShard& Shard = GetShard(ClientRegistrationNumber);
+
+	uv_rwlock_wrlock(&Shard.m_ClientsMapLock);
 	try
 	{
-		m_ClientsMap[ClientRegistrationNumber] = pClient;
+		Shard.m_ClientsMap[ClientRegistrationNumber] = pClient;
 	}
 	catch(std::bad_alloc&)
 	{
 		bAdded = FALSE;
 	}
-	uv_rwlock_wrunlock(&m_ClientsMapLock);
+
+	if (bAdded)
+	{
+		UINT64 CurrentTime = m_CurrentTime.load(std::memory_order_relaxed);
+		pClient->m_LockRequestsResponses.LastActivityTime = CurrentTime;
+
+		uv_rwlock_wrlock(&m_WheelLock);
+		AddToWheel(pClient, (CurrentTime/1000) + RequestProcessor::GetCommonParameters().KeepAliveFrequencyInSeconds);
+		uv_rwlock_wrunlock(&m_WheelLock);
+	}
+	uv_rwlock_wrunlock(&Shard.m_ClientsMapLock);
 
 	return bAdded;
 }
@@ -71,101 +99,197 @@ BOOL ClientsPool::RemoveClient(stClient* pClient)
 	BOOL RetVal = FALSE;
 	UINT64 ClientRegistrationNumber = pClient->m_ClientHandle.m_ClientRegistrationNumber;
 	
-	uv_rwlock_wrlock(&m_ClientsMapLock);
-	if (m_ClientsMap.find(ClientRegistrationNumber) != m_ClientsMap.end())
+	ClientsPoolShard& Shard = GetShard(ClientRegistrationNumber);
+
+	uv_rwlock_wrlock(&Shard.m_ClientsMapLock);
+	std::unordered_map<UINT64, stClient*>::iterator it = Shard.m_ClientsMap.find(ClientRegistrationNumber);
+	if (it != Shard.m_ClientsMap.end())
 	{
-		ASSERT (m_ClientsMap[ClientRegistrationNumber] == pClient);
+		ASSERT (it->second == pClient);
 
 		// uv_rwlock_wrlock(&pClient->m_LockRequestsResponses.rwLock);  // We don't need this as we getting exclussive access on map itself (incrementor/decrementors need read access to it)
 		if ((pClient->m_LockRequestsResponses.Requests == 0) && (pClient->m_LockRequestsResponses.Responses == 0))
 		{
-			m_ClientsMap.erase (ClientRegistrationNumber);
+			Shard.m_ClientsMap.erase (it);
+
+			uv_rwlock_wrlock(&m_WheelLock);
+			RemoveFromWheel(pClient);
+			uv_rwlock_wrunlock(&m_WheelLock);
+
 			RetVal = TRUE;
 		}
 		// uv_rwlock_wrunlock(&pClient->m_LockRequestsResponses.rwLock);  
 	} 
-	uv_rwlock_wrunlock(&m_ClientsMapLock);
+	uv_rwlock_wrunlock(&Shard.m_ClientsMapLock);
 
 	return RetVal;
 }
 
 unsigned int ClientsPool::GetClientsCount() 
 {
-	uv_rwlock_rdlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
-	unsigned int Count = (int)m_ClientsMap.size(); 
-	uv_rwlock_rdunlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
+	unsigned int Count = 0;
+
+	for (int i=0; i<CLIENTS_POOL_SHARDS; i++)
+	{
+		uv_rwlock_rdlock(&m_Shards[i].m_ClientsMapLock); // So that AddClient cannot resize map, but other threads can still access to read elements
+		Count += (unsigned int)m_Shards[i].m_ClientsMap.size(); 
+		uv_rwlock_rdunlock(&m_Shards[i].m_ClientsMapLock);
+	}
 
 	return Count;
 }
 
-void ClientsPool::GetClients(Clients& vClients) 
+// Clients of other event loops are left out here, under lock. (Once out of lock, they could get deleted by their own loops any moment)
+void ClientsPool::GetClients(Clients& vClients, stEventLoop* pEventLoop) 
 {
-	typedef std::map<UINT64, stClient*>::iterator it_type;
-	it_type iterator_end =  m_ClientsMap.end();
-	uv_rwlock_rdlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
-	for(it_type iterator = m_ClientsMap.begin(); iterator != iterator_end; iterator++) 
-	{
-		// std::map<UINT64, stClient*> m_ClientsMap;
-		UINT64 ClientRegistrationNumber = iterator->first;
-		stClient* p_stClient = iterator->second;
+	typedef std::unordered_map<UINT64, stClient*>::iterator it_type;
 
-		ASSERT(p_stClient);
+	for (int i=0; i<CLIENTS_POOL_SHARDS; i++)
+	{
+		ClientsPoolShard& Shard = m_Shards[i];
 
-		try
-		{
-			vClients.push_back(p_stClient);
-		}
-		catch(std::bad_alloc&)
+		uv_rwlock_rdlock(&Shard.m_ClientsMapLock); // So that AddClient cannot resize map, but other threads can still access to read elements
+		for(it_type iterator = Shard.m_ClientsMap.begin(); iterator != Shard.m_ClientsMap.end(); iterator++) 
 		{
-			p_stClient->GetConnectionsManager()->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+			stClient* p_stClient = iterator->second;
+
+			ASSERT(p_stClient);
+
+			if (p_stClient->m_pEventLoop != pEventLoop)
+				continue;
+
+			try
+			{
+				vClients.push_back(p_stClient);
+			}
+			catch(std::bad_alloc&)
+			{
+				p_stClient->GetConnectionsManager()->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+			}
 		}
+		uv_rwlock_rdunlock(&Shard.m_ClientsMapLock);
 	}
-	uv_rwlock_rdunlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
 
 	return;
 }
 
-// Called by send_keepalive_thread (Adds stClient* to the vector if it is NOT NULL and has no pending requests/responses 
-// also no activity detected for last CommonParams.KeepAliveFrequencyInSeconds period.)
-void ClientsPool::GetIdleClients(ClientHandles& vClientHandles, ClientType paramType) 
+// Called with m_WheelLock held. Puts client in slot of given second (never in the slot which has already been passed).
+void ClientsPool::AddToWheel(stClient* pClient, UINT64 ExpiryTime)
 {
-	typedef std::map<UINT64, stClient*>::iterator it_type;
-	it_type iterator_end =  m_ClientsMap.end();
-	uv_rwlock_rdlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
-	for(it_type iterator = m_ClientsMap.begin(); iterator != iterator_end; iterator++) 
-	{
-		// std::map<UINT64, stClient*> m_ClientsMap;
-		UINT64 ClientRegistrationNumber = iterator->first;
-		stClient* p_stClient = iterator->second;
+	ASSERT (pClient->m_WheelExpiryTime == 0);
+
+	if (ExpiryTime <= m_WheelTime)
+		ExpiryTime = m_WheelTime+1;
+
+	stClient*& pHead = m_pWheelSlots[ExpiryTime & (KEEP_ALIVE_WHEEL_SLOTS-1)];
+
+	pClient->m_WheelExpiryTime = ExpiryTime;
+	pClient->m_pPrevInWheel = NULL;
+	pClient->m_pNextInWheel = pHead;
 
-		ASSERT(p_stClient);
+	if (pHead)
+		pHead->m_pPrevInWheel = pClient;
 
-		uv_rwlock_rdlock(&p_stClient->m_LockRequestsResponses.rwLock); // No other thread should try to change requests/responses/lastactivitytime for the _same_ client
-		int RequestsResponses = p_stClient->m_LockRequestsResponses.Requests + p_stClient->m_LockRequestsResponses.Responses; 
-		time_t CurrentTime;
-		CurrentTime = time (NULL);
+	pHead = pClient;
+}
+
+// Called with m_WheelLock held
+void ClientsPool::RemoveFromWheel(stClient* pClient)
+{
+	if (pClient->m_WheelExpiryTime == 0)
+		return;
+
+	if (pClient->m_pPrevInWheel)
+		pClient->m_pPrevInWheel->m_pNextInWheel = pClient->m_pNextInWheel;
+	else
+		m_pWheelSlots[pClient->m_WheelExpiryTime & (KEEP_ALIVE_WHEEL_SLOTS-1)] = pClient->m_pNextInWheel;
 
-		if ((RequestsResponses == 0) && (RequestProcessor::GetCommonParameters().KeepAliveFrequencyInSeconds <= (CurrentTime - p_stClient->m_LockRequestsResponses.LastActivityTime)))
+	if (pClient->m_pNextInWheel)
+		pClient->m_pNextInWheel->m_pPrevInWheel = pClient->m_pPrevInWheel;
+
+	pClient->m_pNextInWheel = NULL;
+	pClient->m_pPrevInWheel = NULL;
+	pClient->m_WheelExpiryTime = 0;
+}
+
+// Called by main loop (SendKeepAlive) before advancing the wheel. Threads use this time to stamp activity of clients.
+void ClientsPool::SetCurrentTime(UINT64 LoopTime)
+{
+	m_CurrentTime.store(LoopTime, std::memory_order_relaxed);
+}
+
+// Called by main loop (SendKeepAlive). Advances the wheel up to current second and adds clients to the sets which have NO pending requests/responses 
+// and no activity detected for last CommonParams.KeepAliveFrequencyInSeconds period. Rest of the clients of passed slots are moved to slots of their new expiry.
+void ClientsPool::GetIdleClients(ClientHandles& vVersionedClients, ClientHandles& vVersionlessClients) 
+{
+	UINT64 CurrentTime = m_CurrentTime.load(std::memory_order_relaxed);
+	UINT64 CurrentSecond = CurrentTime/1000;
+	UINT64 KeepAliveInSeconds = RequestProcessor::GetCommonParameters().KeepAliveFrequencyInSeconds;
+
+	uv_rwlock_wrlock(&m_WheelLock);
+
+	if (m_WheelTime == 0)
+		m_WheelTime = CurrentSecond;
+
+	// Main loop could have been busy for longer than a round. Every slot needs to be visited only once then.
+	if ((CurrentSecond - m_WheelTime) > KEEP_ALIVE_WHEEL_SLOTS)
+		m_WheelTime = CurrentSecond - KEEP_ALIVE_WHEEL_SLOTS;
+
+	while (m_WheelTime < CurrentSecond)
+	{
+		m_WheelTime++;
+
+		stClient* pClient = m_pWheelSlots[m_WheelTime & (KEEP_ALIVE_WHEEL_SLOTS-1)];
+
+		while (pClient)
 		{
-			try
+			stClient* pNextClient = pClient->m_pNextInWheel;
+
+			if (pClient->m_WheelExpiryTime > CurrentSecond) // Due in one of the next rounds
 			{
-				ClientType clientType = (p_stClient->GetVersion() == UNINITIALIZED_VERSION) ? VersionlessClient : VersionedClient;
+				pClient = pNextClient;
+				continue;
+			}
+
+			RemoveFromWheel(pClient);
+
+			uv_rwlock_wrlock(&pClient->m_LockRequestsResponses.rwLock); // No other thread should try to change requests/responses/lastactivitytime for the _same_ client
+			int RequestsResponses = pClient->m_LockRequestsResponses.Requests + pClient->m_LockRequestsResponses.Responses; 
+			UINT64 LastActivityTime = pClient->m_LockRequestsResponses.LastActivityTime;
+			BOOL bIsIdle = ((RequestsResponses == 0) && ((KeepAliveInSeconds*1000) <= (CurrentTime - LastActivityTime))) ? TRUE : FALSE;
+
+			if (bIsIdle)
+				pClient->m_LockRequestsResponses.LastActivityTime = CurrentTime;
+			uv_rwlock_wrunlock(&pClient->m_LockRequestsResponses.rwLock); 
 
-				if (clientType == paramType)
+			if (bIsIdle)
+			{
+				try
+				{
+					if (pClient->GetVersion() == UNINITIALIZED_VERSION)
+						vVersionlessClients.insert(pClient->GetClientHandle());
+					else
+						vVersionedClients.insert(pClient->GetClientHandle());
+				}
+				catch(std::bad_alloc&)
 				{
-					vClientHandles.insert(p_stClient->GetClientHandle());
-					p_stClient->m_LockRequestsResponses.LastActivityTime = CurrentTime;
+					pClient->GetConnectionsManager()->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
 				}
+
+				AddToWheel(pClient, CurrentSecond + KeepAliveInSeconds);
 			}
-			catch(std::bad_alloc&)
+			else 
 			{
-				p_stClient->GetConnectionsManager()->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+				// Active meanwhile. Due keep alive period after its last activity (or after this check, if request/response is still pending since long).
+				UINT64 ExpiryTime = (LastActivityTime/1000) + KeepAliveInSeconds;
+				AddToWheel(pClient, (ExpiryTime > CurrentSecond) ? ExpiryTime : (CurrentSecond + KeepAliveInSeconds));
 			}
-		}
-		uv_rwlock_rdunlock(&p_stClient->m_LockRequestsResponses.rwLock); 
 
+			pClient = pNextClient;
+		}
 	}
-	uv_rwlock_rdunlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
+
+	uv_rwlock_wrunlock(&m_WheelLock);
 
 	return;
 }
@@ -178,10 +302,19 @@ int ClientsPool::IncreaseCountForClient (ClientHandle* clienthandle, stClient* &
 
 	ASSERT ((RequestORResponse == REQUESTCOUNT) || (RequestORResponse == RESPONSECOUNT));
 
-	uv_rwlock_rdlock(&m_ClientsMapLock); // So that AddClient cannot resize map, but other threads can still access to read elements
-	if ((clienthandle) && (m_ClientsMap.find(clienthandle->m_ClientRegistrationNumber) != m_ClientsMap.end()))
+	if (!clienthandle)
 	{
-		pClient = m_ClientsMap[clienthandle->m_ClientRegistrationNumber]; // m_ClientLockRequestsResponsesArray[clienthandle->m_ClientIndex].pClient;
+		LOG (ERROR, "Invalid clienthandle pointer (NULL) in IncreaseCountForClient for %s", (RequestORResponse == REQUESTCOUNT) ? "REQUESTCOUNT" : "RESPONSECOUNT");
+		return RetVal;
+	}
+
+	ClientsPoolShard& Shard = GetShard(clienthandle->m_ClientRegistrationNumber);
+
+	uv_rwlock_rdlock(&Shard.m_ClientsMapLock); // So that AddClient cannot resize map, but other threads can still access to read elements
+	std::unordered_map<UINT64, stClient*>::iterator it = Shard.m_ClientsMap.find(clienthandle->m_ClientRegistrationNumber);
+	if (it != Shard.m_ClientsMap.end())
+	{
+		pClient = it->second; 
 
 		ASSERT (pClient);
 
@@ -196,23 +329,18 @@ int ClientsPool::IncreaseCountForClient (ClientHandle* clienthandle, stClient* &
 			else
 				pClient->m_LockRequestsResponses.Responses++; 
 
-			pClient->m_LockRequestsResponses.LastActivityTime = time(NULL); 
+			pClient->m_LockRequestsResponses.LastActivityTime = m_CurrentTime.load(std::memory_order_relaxed); 
 
 			uv_rwlock_wrunlock(&pClient->m_LockRequestsResponses.rwLock);
 
 			RetVal = TRUE;
 		}
 	}
-	else
-	{
-		if (!clienthandle)
-			LOG (ERROR, "Invalid clienthandle pointer (NULL) in IncreaseCountForClient for %s", (RequestORResponse == REQUESTCOUNT) ? "REQUESTCOUNT" : "RESPONSECOUNT");
-		/*
-		else // This could happen when request/response intended for a client is already disconnected
-			LOG (ERROR, "ClientRegistrationNumber is not present in m_ClientsMap in IncreaseCountForClient for %s", (RequestORResponse == REQUESTCOUNT) ? "REQUESTCOUNT" : "RESPONSECOUNT");
-		*/
-	}
-	uv_rwlock_rdunlock(&m_ClientsMapLock);
+	/*
+	else // This could happen when request/response intended for a client is already disconnected
+		LOG (ERROR, "ClientRegistrationNumber is not present in m_ClientsMap in IncreaseCountForClient for %s", (RequestORResponse == REQUESTCOUNT) ? "REQUESTCOUNT" : "RESPONSECOUNT");
+	*/
+	uv_rwlock_rdunlock(&Shard.m_ClientsMapLock);
 
 	return RetVal;
 }
@@ -222,10 +350,12 @@ int ClientsPool::DecreaseCountForClient (stClient* pClient, BOOL RequestORRespon
 {
 	int RetVal = FALSE;
 
-	uv_rwlock_rdlock(&m_ClientsMapLock); // So that AddClient cannot resize array, but other threads can still access to read elements
-	
 	ASSERT (pClient);
 
+	ClientsPoolShard& Shard = GetShard(pClient->m_ClientHandle.m_ClientRegistrationNumber);
+
+	uv_rwlock_rdlock(&Shard.m_ClientsMapLock); // So that RemoveClient cannot remove client while we are decreasing its count
+
 	ASSERT ((RequestORResponse == REQUESTCOUNT) || (RequestORResponse == RESPONSECOUNT));
 
 	uv_rwlock_wrlock(&pClient->m_LockRequestsResponses.rwLock);
@@ -235,7 +365,7 @@ int ClientsPool::DecreaseCountForClient (stClient* pClient, BOOL RequestORRespon
 	else
 		pClient->m_LockRequestsResponses.Responses--;
 
-	pClient->m_LockRequestsResponses.LastActivityTime = time(NULL); 
+	pClient->m_LockRequestsResponses.LastActivityTime = m_CurrentTime.load(std::memory_order_relaxed); 
 
 	RetVal = TRUE;
 
@@ -244,7 +374,7 @@ int ClientsPool::DecreaseCountForClient (stClient* pClient, BOOL RequestORRespon
 		
 	uv_rwlock_wrunlock(&pClient->m_LockRequestsResponses.rwLock);
 
-	uv_rwlock_rdunlock(&m_ClientsMapLock);
+	uv_rwlock_rdunlock(&Shard.m_ClientsMapLock);
 
 	return RetVal;
 }
@@ -29,6 +29,9 @@ FunctionProfilerMap structServerStat::FunctionProfiler;
 static ServerStat staticServerStat={};
 #endif
 
+// Index of event loop running on this thread. Main loop (and request processing threads, which never use it) have 0. (THREAD_LOCAL is defined in Pulsar.h)
+static THREAD_LOCAL int m_EventLoopIndex = 0;
+
 CommonComponents::CommonComponents()
 {
 	after_send_response_called_by_send_response = FALSE;
@@ -40,6 +43,9 @@ CommonComponents::CommonComponents()
 	m_stServerStat = staticServerStat;
 #endif
 
+	memset(m_StatCounters, 0, sizeof(m_StatCounters));
+	m_StatInterval = 0;
+
     loop = uv_default_loop();
 
 	ASSERT_THROW(loop, "Error initializing event loop");
@@ -49,16 +55,113 @@ CommonComponents::CommonComponents()
 
 	ValidateCommonParamaters(ComParams);
 
-	// MUST BE called before first call of uv_queue_work
-	uv_set_threadpool_size (RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads + 1 + 1); //  One thread for logger and one for file writer
+	// MUST BE called before first call of uv_queue_work. Requests are processed by threads of Scheduler, not of this pool.
+	uv_set_threadpool_size (1 + 1 + 2); //  One thread for logger, one for file writer and two for libuv's own work (getaddrinfo, getnameinfo)
 }
 
-void CommonComponents::ValidateCommonParamaters(CommonParameters& ComParams)
+// Returns counters block of the thread. Request processing threads pass their index, event loops pass -1.
+// Block must be changed only by thread it belongs to.
+ServerStatCounters& CommonComponents::GetStatCounters(int ThreadIndex)
+{
+	ASSERT ((ThreadIndex >= -1) && (ThreadIndex < MAX_WORK_THREADS));
+
+	return m_StatCounters[(ThreadIndex == -1) ? (EVENT_LOOP_STAT_COUNTERS + m_EventLoopIndex) : ThreadIndex];
+}
+
+void CommonComponents::SetCurrentEventLoopIndex(int EventLoopIndex)
+{
+	ASSERT ((EventLoopIndex >= 0) && (EventLoopIndex < MAX_EVENT_LOOPS));
+	m_EventLoopIndex = EventLoopIndex;
+}
+
+int CommonComponents::GetCurrentEventLoopIndex()
+{
+	return m_EventLoopIndex;
+}
+
+// Adds up counters of all blocks into stServerStat. Blocks are being changed by threads meanwhile, so total could be slightly stale but never locks them.
+void CommonComponents::AddUpStatCounters(ServerStat& stServerStat)
 {
-	int MaxAllowedRequestProcessingThread = (MAX_WORK_THREADS - 2); // At least two threads we need other than request processing threads. One for logger another for file writer.
+	for (int i=0; i<STAT_COUNTERS_BLOCKS; i++)
+	{
+		ServerStatCounters& Counters = m_StatCounters[i];
+
+		stServerStat.RequestsProcesed += Counters.RequestsProcesed;
+		stServerStat.RequestsFailedToProcess += Counters.RequestsFailedToProcess;
+		stServerStat.TotalRequestBytesProcessed += Counters.TotalRequestBytesProcessed;
+		stServerStat.MemoryConsumptionByRequestsInQueue += Counters.MemoryConsumptionByRequestsInQueue;
+		stServerStat.RequestProcessingThreadsStarted += Counters.RequestProcessingThreadsStarted;
+		stServerStat.RequestProcessingThreadsFinished += Counters.RequestProcessingThreadsFinished;
+		stServerStat.TotalRequestProcessingTime += Counters.TotalRequestProcessingTime;
+		stServerStat.ResponsesInPeerServersQueues += (int)Counters.ResponsesInPeerServersQueues;
+		stServerStat.ResponsesInLocalClientsQueues += (int)Counters.ResponsesInLocalClientsQueues;
+		stServerStat.ResponsesFailedToQueue += Counters.ResponsesFailedToQueue;
+		stServerStat.ResponsesBackpressured += Counters.ResponsesBackpressured;
+		stServerStat.PayloadsCompressed += Counters.PayloadsCompressed;
+		stServerStat.PayloadsNotCompressed += Counters.PayloadsNotCompressed;
+		stServerStat.PayloadBytesBeforeCompression += Counters.PayloadBytesBeforeCompression;
+		stServerStat.PayloadBytesAfterCompression += Counters.PayloadBytesAfterCompression;
+		stServerStat.PayloadsDecompressed += Counters.PayloadsDecompressed;
+		stServerStat.PayloadsFailedToDecompress += Counters.PayloadsFailedToDecompress;
+		stServerStat.TotalCompressionTime += Counters.TotalCompressionTime;
+		stServerStat.TotalDecompressionTime += Counters.TotalDecompressionTime;
+		stServerStat.ResponsesWithCompactHandles += Counters.ResponsesWithCompactHandles;
+		stServerStat.HandleBytesSavedByCompactHandles += Counters.HandleBytesSavedByCompactHandles;
+		stServerStat.WorksStolen += Counters.WorksStolen;
+		stServerStat.ResponsesDroppedByBudget += Counters.ResponsesDroppedByBudget;
+		stServerStat.MemoryConsumptionByResponsesInQueue += Counters.MemoryConsumptionByResponsesInQueue;
+
+		if (i < MAX_WORK_THREADS)
+		{
+			stServerStat.RequestsProcessedPerThread[i] = Counters.RequestsProcesed;
+			continue;
+		}
+
+		// Event loops' counters
+		stServerStat.ClientsConnectedCount += Counters.ClientsConnectedCount;
+		stServerStat.ClientsDisconnectedCount += Counters.ClientsDisconnectedCount;
+		stServerStat.DisconnectionsByServer += Counters.DisconnectionsByServer;
+		stServerStat.DisconnectionsByClients += Counters.DisconnectionsByClients;
+		stServerStat.MemoryConsumptionByClients += Counters.MemoryConsumptionByClients;
+		stServerStat.ActiveClientRequestBuffers += Counters.ActiveClientRequestBuffers;
+		stServerStat.ResponsesBeingSent += (int)Counters.ResponsesBeingSent;
+		stServerStat.RequestsArrived += Counters.RequestsArrived;
+		stServerStat.RequestsRejectedByServer += Counters.RequestsRejectedByServer;
+		stServerStat.RequestBytesIgnored += Counters.RequestBytesIgnored;
+		stServerStat.RequestsSuspended += Counters.RequestsSuspended;
+		stServerStat.RequestsResumed += Counters.RequestsResumed;
+		stServerStat.ResponseFlushes += Counters.ResponseFlushes;
+		stServerStat.ClientsDisconnectedByBudget += Counters.ClientsDisconnectedByBudget;
+		stServerStat.RequestsAbandoned += Counters.RequestsAbandoned;
+		stServerStat.ResponsesAcknowledgementsOfForwardedResponses += Counters.ResponsesAcknowledgementsOfForwardedResponses;
+		stServerStat.ResponsesErrors += Counters.ResponsesErrors;
+		stServerStat.ResponsesKeepAlives += Counters.ResponsesKeepAlives;
+		stServerStat.ResponsesFatalErrors += Counters.ResponsesFatalErrors;
+		stServerStat.ResponsesOrdinary += Counters.ResponsesOrdinary;
+		stServerStat.ResponsesForwarded += Counters.ResponsesForwarded;
+		stServerStat.ResponsesMulticasts += Counters.ResponsesMulticasts;
+		stServerStat.ResponsesUpdates += Counters.ResponsesUpdates;
+		stServerStat.ResponsesSent += Counters.ResponsesSent;
+		stServerStat.ResponsesFailedToSend += Counters.ResponsesFailedToSend;
+		stServerStat.TotalResponseBytesSent += Counters.TotalResponseBytesSent;
+		stServerStat.HeaderErrorInPreamble += Counters.HeaderErrorInPreamble;
+		stServerStat.HeaderErrorInVersion += Counters.HeaderErrorInVersion;
+		stServerStat.HeaderErrorInSize += Counters.HeaderErrorInSize;
+
+		// Durations are for current stat interval only
+		if ((Counters.StatInterval == m_StatInterval) && Counters.ResponseQueuedDurationMaximum)
+		{
+			if ((stServerStat.ResponseQueuedDurationMinimum == 0) || (Counters.ResponseQueuedDurationMinimum < stServerStat.ResponseQueuedDurationMinimum))
+				stServerStat.ResponseQueuedDurationMinimum = Counters.ResponseQueuedDurationMinimum;
+			stServerStat.ResponseQueuedDurationMaximum = max (stServerStat.ResponseQueuedDurationMaximum, Counters.ResponseQueuedDurationMaximum);
+		}
+	}
+}
 
+void CommonComponents::ValidateCommonParamaters(CommonParameters& ComParams)
+{
 	ASSERT_MSG ((ComParams.MaxRequestProcessingThreads >= 1), "Invalid value: MaxRequestProcessingThreads"); // At least one reqest processing thread is needed
-	ASSERT_MSG ((ComParams.MaxRequestProcessingThreads < MaxAllowedRequestProcessingThread), "Invalid value: MaxRequestProcessingThreads");
+	ASSERT_MSG ((ComParams.MaxRequestProcessingThreads <= MAX_WORK_THREADS), "Invalid value: MaxRequestProcessingThreads");
 	
     // ComParams.MaxPendingRequests = (ComParams.MaxPendingRequests < 1) ? 1 : ComParams.MaxPendingRequests;
 		
@@ -67,6 +170,15 @@ void CommonComponents::ValidateCommonParamaters(CommonParameters& ComParams)
 
 	ASSERT_MSG ((ComParams.KeepAliveFrequencyInSeconds >= 1), "Invalid value: KeepAliveFrequencyInSeconds");
 	ASSERT_MSG ((ComParams.StatusUpdateFrequencyInSeconds >= 1), "Invalid value: StatusUpdateFrequencyInSeconds");
+	ASSERT_MSG (((ComParams.EventLoops >= 1) && (ComParams.EventLoops <= MAX_EVENT_LOOPS)), "Invalid value: EventLoops");
+	ASSERT_MSG (((ComParams.ReadRingSize == 0) || ((ComParams.ReadRingSize >= MIN_READ_RING_SIZE) && (ComParams.ReadRingSize <= MAX_READ_RING_SIZE))), "Invalid value: ReadRingSize");
+	ASSERT_MSG ((ComParams.PeerCreditResponses >= 1), "Invalid value: PeerCreditResponses");
+	ASSERT_MSG ((ComParams.PeerCreditBytes >= 1), "Invalid value: PeerCreditBytes");
+	ASSERT_MSG ((ComParams.MaxPeerQueueBytes >= 1), "Invalid value: MaxPeerQueueBytes");
+	ASSERT_MSG ((ComParams.PeerCompressionThreshold >= 0), "Invalid value: PeerCompressionThreshold");
+	ASSERT_MSG (((ComParams.FlushLatencyInMilliseconds >= 0) && (ComParams.FlushLatencyInMilliseconds <= TIMER_INTERVAL_IN_MILLISECONDS)), "Invalid value: FlushLatencyInMilliseconds");
+	ASSERT_MSG ((ComParams.FlushBatchResponses >= 1), "Invalid value: FlushBatchResponses");
+	ASSERT_MSG ((ComParams.MaxPendingResponseBytes >= 1), "Invalid value: MaxPendingResponseBytes");
 }
 
 CommonComponents::~CommonComponents()
@@ -30,13 +30,8 @@ ConnectionsManager::ConnectionsManager()
 	retval = uv_rwlock_init(&m_rwlResponseDirectionFlagLock);
 	ASSERT_THROW ((retval >= 0), "Initializing responses direction flag lock failed");
 
-	// LOG (INFO, "Initializing responses counters locks");
-	retval = uv_rwlock_init(&m_rwlResponseCountersLock1);
-	ASSERT_THROW ((retval >= 0), "Initializing responses counters lock1 failed");
-	retval = uv_rwlock_init(&m_rwlResponseCountersLock2);
-	ASSERT_THROW ((retval >= 0), "Initializing responses counters lock2 failed");
-
 	m_bIsServerShutDown = TRUE;
+	m_bIsStdinTTY = FALSE;
 	
 	// Finally let's just call this once first time through event loop so it will initialize its static structures so that next calls will be thread safe.
 	GetHighPrecesionTime();
@@ -51,10 +46,6 @@ ConnectionsManager::~ConnectionsManager()
 
 	// LOG (INFO, "Destroying responses direction flag lock");
 	uv_rwlock_destroy(&m_rwlResponseDirectionFlagLock);
-
-	// LOG (INFO, "Destroying responses counters locks");
-	uv_rwlock_destroy(&m_rwlResponseCountersLock1);
-	uv_rwlock_destroy(&m_rwlResponseCountersLock2);
 }
 
 const char* ConnectionsManager::GetErrorDescription(int errorcode)
@@ -64,6 +55,7 @@ const char* ConnectionsManager::GetErrorDescription(int errorcode)
 // Returns high precesion time in seconds
 double ConnectionsManager::GetHighPrecesionTime()
 {
+#ifdef _WIN32
 	LARGE_INTEGER li;
 	static BOOL QueryPerformanceFrequencyFailed = FALSE;
 	static LONGLONG Freq = 0;
@@ -85,6 +77,15 @@ double ConnectionsManager::GetHighPrecesionTime()
 	QueryPerformanceCounter(&li);
 
 	double TimeElapsed = ((double)li.QuadPart/Freq);
+#else
+	// CLOCK_MONOTONIC is what QueryPerformanceCounter is on Windows: unaffected by system time changes
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	double TimeElapsed = (double)ts.tv_sec + ((double)ts.tv_nsec/1000000000);
+#endif
 
 	return TimeElapsed;
 }
@@ -93,6 +94,7 @@ long long  ConnectionsManager::GetProcessPrivateBytes()
 {
 	long long privatebytes;
 
+#ifdef _WIN32
 	HANDLE current_process;
 	PROCESS_MEMORY_COUNTERS_EX pmc;
 
@@ -104,10 +106,53 @@ long long  ConnectionsManager::GetProcessPrivateBytes()
 	}
 
 	privatebytes = pmc.PrivateUsage;
+#else
+	// Nearest to Windows private bytes is data segment (heap, anonymous mappings and stack) which is sixth field of /proc/self/statm (in pages)
+	long long size, resident, shared, text, lib, data;
+
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if (!fp)
+		return -1;
+
+	int FieldsRead = fscanf(fp, "%lld %lld %lld %lld %lld %lld", &size, &resident, &shared, &text, &lib, &data);
+	fclose(fp);
+
+	if (FieldsRead != 6)
+		return -1;
+
+	privatebytes = data * sysconf(_SC_PAGESIZE);
+#endif
 
 	return privatebytes ;
 }
 
+DWORD ConnectionsManager::GetProcessHandleCount() 
+{
+	DWORD HandleCount = 0;
+
+#ifdef _WIN32
+	::GetProcessHandleCount(GetCurrentProcess(), &HandleCount);
+#else
+	// Handles on Linux are file descriptors. Count entries of /proc/self/fd (except ".", ".." and descriptor used by opendir itself)
+	DIR* dir = opendir("/proc/self/fd");
+	if (!dir)
+		return 0;
+
+	while (struct dirent* entry = readdir(dir))
+	{
+		if (entry->d_name[0] != '.')
+			HandleCount++;
+	}
+
+	closedir(dir);
+
+	if (HandleCount)
+		HandleCount--;
+#endif
+
+	return HandleCount;
+}
+
 void ConnectionsManager::IncreaseExceptionCount(BOOL bType, char* filename, int linenumber) 
 {
 	uv_rwlock_wrlock(&m_rwlMemoryAllocationErrorCounter);
@@ -151,26 +196,32 @@ void ConnectionsManager::IncreaseExceptionCount(BOOL bType, char* filename, int
 } 
 
 // This function runs in threads. Called by StoreMessage after it creates Response object.
-int ConnectionsManager::AddResponseToQueues(Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException)
+int ConnectionsManager::AddResponseToQueues(Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured)
 {
 	int ResponseReferenceCount = 0;
-
-	uv_rwlock_rdlock(&m_rwlResponseDirectionFlagLock);
+	BOOL bIsForward = pResponse->IsForward();
 
 	// Add this response to responses list of all its intended clients
 	// A response has multiple handles and intended for single server (so that it can be forwarded to that server)...
-	if (pResponse->IsForward())
+	if (bIsForward)
 	{
 		// ... Thus, in case when server is peer server we add response to queue of that single server, and ...
-		ResponseReferenceCount += PeerServersManager::AddResponseToQueue(pResponse, bHasEncounteredMemoryAllocationException);
+		// Peer servers still use pair of queues flipped by event loop. So direction flag must not change while we add to it.
+		uv_rwlock_rdlock(&m_rwlResponseDirectionFlagLock);
+		ResponseReferenceCount += PeerServersManager::AddResponseToQueue(pResponse, bHasEncounteredMemoryAllocationException, bIsBackpressured);
+		pResponse->SetReferenceCount(ResponseReferenceCount);  
+		uv_rwlock_rdunlock(&m_rwlResponseDirectionFlagLock);
 	}
 	else
 	{
 		// ... In case when the server is local server we have to add the response to queues of multiple clients.
-		ResponseReferenceCount += LocalClientsManager::AddResponseToClientsQueues(pResponse, pClientHandlePtrs, bHasEncounteredMemoryAllocationException);
+		// Client queues are lock-free. Event loop could see response in queue right away, but it won't send it till it is ready to send.
+		ResponseReferenceCount += LocalClientsManager::AddResponseToClientsQueues(pResponse, pClientHandlePtrs, bHasEncounteredMemoryAllocationException, bIsBackpressured);
+		pResponse->SetReferenceCount(ResponseReferenceCount);  
 	}
 
-	pResponse->SetReferenceCount(ResponseReferenceCount);  
+	if (bIsBackpressured) // Peer server's link or some of local clients had no room for response
+		GetStatCounters(GetCurrentThreadIndex()).ResponsesBackpressured ++;
 
 	if (ResponseReferenceCount == 0)
 	{
@@ -184,36 +235,75 @@ int ConnectionsManager::AddResponseToQueues(Response* pResponse, ClientHandlesPt
 	// Also add statistical details of this response
 	AddResponseDetailsToServerStat(pResponse, ResponseReferenceCount);
 
-	uv_rwlock_rdunlock(&m_rwlResponseDirectionFlagLock);
+	if (ResponseReferenceCount)
+		pResponse->SetReadyToSend(); // Must be last. Event loop can send (and delete) response thereafter.
+
+	// Peer servers are served only by main loop. Request could be of client of other event loop, whose callbacks won't run main loop.
+	if (bIsForward && ResponseReferenceCount)
+		RequestFlush(GetMainEventLoop());
 
 	return ResponseReferenceCount ;
 }
 
-// Called by threads (through AddResponseToQueue). ResponsesInQueues increased and decreased by threads and evennt loop so we need locks.
+// Called by threads (through AddResponseToQueue). ResponsesInQueues increased by threads and decreased by event loop, each in its own counters block (so no locks).
 void ConnectionsManager::AddResponseDetailsToServerStat(Response* pResponse, int ResponseReferenceCount)
 {
-	uv_rwlock_wrlock(&m_rwlResponseCountersLock1);
-	uv_rwlock_wrlock(&m_rwlResponseCountersLock2);
-	
+	ServerStatCounters& Counters = GetStatCounters(GetCurrentThreadIndex());
+
 	if (ResponseReferenceCount)
 	{
 		ASSERT (pResponse->bAddedToStat == FALSE); // Just to ensure response is not being added more than once (when it has reference count)
 
 		if (pResponse->IsForward() == TRUE)
-			m_stServerStat.ResponsesInPeerServersQueues ++ ;
+			Counters.ResponsesInPeerServersQueues ++ ;
 		else
-			m_stServerStat.ResponsesInLocalClientsQueues ++ ;
+			Counters.ResponsesInLocalClientsQueues ++ ;
 
-		m_stServerStat.MemoryConsumptionByResponsesInQueue += (pResponse->GetResponse().len + sizeof (Response)); 
+		Counters.MemoryConsumptionByResponsesInQueue += (pResponse->GetResponseLength() + sizeof (Response)); 
 		pResponse->bAddedToStat = TRUE;
+
+		if (pResponse->HasCompactHandles())
+		{
+			Counters.ResponsesWithCompactHandles ++ ;
+			Counters.HandleBytesSavedByCompactHandles += (INT64)pResponse->GetNumberOfHandles() * sizeof(UINT64) - pResponse->GetHandlesArraySize();
+		}
 	}
 	else
 	{
-		m_stServerStat.ResponsesFailedToQueue ++ ;
+		Counters.ResponsesFailedToQueue ++ ;
 	}
+}
 
-	uv_rwlock_wrunlock(&m_rwlResponseCountersLock2);
-	uv_rwlock_wrunlock(&m_rwlResponseCountersLock1);
+// Called by threads (RequestProcessor::CompressPayload). CompressedLength is zero when payload wasn't worth compressing.
+void ConnectionsManager::AddCompressionDetailsToServerStat(ULONG PayloadLength, ULONG CompressedLength, double CompressionTime)
+{
+	ServerStatCounters& Counters = GetStatCounters(GetCurrentThreadIndex());
+
+	if (CompressedLength)
+	{
+		Counters.PayloadsCompressed ++;
+		Counters.PayloadBytesBeforeCompression += PayloadLength;
+		Counters.PayloadBytesAfterCompression += CompressedLength;
+	}
+	else
+	{
+		Counters.PayloadsNotCompressed ++;
+	}
+
+	Counters.TotalCompressionTime += CompressionTime;
+}
+
+// Called by threads (RequestProcessor_ForwardedResponses) after decompressing payload forwarded by peer server
+void ConnectionsManager::AddDecompressionDetailsToServerStat(BOOL bIsDecompressed, double DecompressionTime)
+{
+	ServerStatCounters& Counters = GetStatCounters(GetCurrentThreadIndex());
+
+	if (bIsDecompressed)
+		Counters.PayloadsDecompressed ++;
+	else
+		Counters.PayloadsFailedToDecompress ++;
+
+	Counters.TotalDecompressionTime += DecompressionTime;
 }
 
 // Main library function to be called by application.
@@ -230,10 +320,11 @@ int ConnectionsManager::StartServer (char* IPAddress, unsigned short int IPv4Por
 
 	ASSERT (sizeof(unsigned short) == 2);
 	ASSERT (sizeof(unsigned int) == 4);
-	ASSERT (sizeof(unsigned long) == 4);
+	ASSERT (sizeof(ULONG) == 4); // Not unsigned long, which is 8 bytes on LP64 (Linux)
 	ASSERT (sizeof(unsigned __int64) == 8);
 	ASSERT (sizeof(long long) == 8); 
 
+#ifdef _WIN32
 	if (bDisableConsoleWindowCloseButton) // Disables console window's close button
 	{
 		// Disable console window close button
@@ -241,23 +332,55 @@ int ConnectionsManager::StartServer (char* IPAddress, unsigned short int IPv4Por
 		HMENU hmenu = GetSystemMenu(hwnd, FALSE);
 		EnableMenuItem(hmenu, SC_CLOSE, MF_DISABLED | MF_GRAYED);
 	}
+#endif
 
 	int SizeOfClientHandle = sizeof(ClientHandle); // This gives 24 bytes
+	int RetVal;
 
-	// Start reading key strokes
-	int RetVal = uv_tty_init(loop, &tty, 0, 1);
-	ASSERT_RETURN(RetVal);
+	// Start reading key strokes. 
+	// Server may have been launched without terminal (e.g. in background or by a service manager on Linux). In that case there are no key strokes to read.
+	tty.data = this;
+	m_bIsStdinTTY = (uv_guess_handle(0) == UV_TTY);
 
-	RetVal = uv_tty_set_mode(&tty, 1);
-	ASSERT_RETURN(RetVal);
+	if (m_bIsStdinTTY)
+	{
+		RetVal = uv_tty_init(loop, &tty, 0, 1);
+		ASSERT_RETURN(RetVal);
 
-	tty.data = this;
-	RetVal = uv_read_start((uv_stream_t*)&tty, ConnectionsManager::alloc_keyboard_buffer, ConnectionsManager::read_stdin);
-	ASSERT_RETURN(RetVal);
-	LOG (NOTE, "Press Ctrl+P to display status. Press Ctrl+S to shutdown server."); 
+		RetVal = uv_tty_set_mode(&tty, 1);
+		ASSERT_RETURN(RetVal);
 
+		RetVal = uv_read_start((uv_stream_t*)&tty, ConnectionsManager::alloc_keyboard_buffer, ConnectionsManager::read_stdin);
+		ASSERT_RETURN(RetVal);
+		LOG (NOTE, "Press Ctrl+P to display status. Press Ctrl+S to shutdown server."); 
+	}
+
+#ifdef _WIN32
 	RetVal = SetConsoleCtrlHandler((PHANDLER_ROUTINE) ConnectionsManager::CtrlHandler, TRUE); // To prevent console being closed after pressing Ctrl+Break
 	ASSERT_RETURN(!RetVal);
+#else
+	// On Linux, SIGINT/SIGTERM initiate graceful shutdown (same as Ctrl+S) and SIGUSR1 displays status (same as Ctrl+P)
+	int Signals[] = {SIGINT, SIGTERM, SIGUSR1};
+
+	for (int i = 0; i < SIGNALS_HANDLED; i++)
+	{
+		RetVal = uv_signal_init(loop, &signals[i]);
+		ASSERT_RETURN(RetVal);
+
+		signals[i].data = this;
+		RetVal = uv_signal_start(&signals[i], ConnectionsManager::on_signal, Signals[i]);
+		ASSERT_RETURN(RetVal);
+
+		uv_unref((uv_handle_t*)&signals[i]); // Signal handlers alone shouldn't keep event loop alive
+	}
+
+	// Writing to connection already closed by peer must fail with EPIPE (handled in after_send_responses) rather than kill the process.
+	// It is more likely with pipelined requests, as responses keep going out after client has sent its last request and closed.
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!m_bIsStdinTTY)
+		LOG (NOTE, "Send SIGUSR1 to display status. Send SIGINT or SIGTERM to shutdown server."); 
+#endif
 
 	// Start timer ticks (These are useful to run some periodic tasks)
 	RetVal = uv_timer_init(loop, &tick);
@@ -347,6 +470,7 @@ void ConnectionsManager::StopServer()
 	LocalClientsManager::InitiateServerShutdown();
 }
 
+#ifdef _WIN32
 // This handles Ctrl+break signal thus protects console from exiting
 BOOL ConnectionsManager::CtrlHandler( DWORD fdwCtrlType ) 
 { 
@@ -360,6 +484,18 @@ BOOL ConnectionsManager::CtrlHandler( DWORD fdwCtrlType )
       return FALSE; 
   } 
 } 
+#else
+// Called by event loop when SIGINT, SIGTERM or SIGUSR1 is received
+void ConnectionsManager::on_signal(uv_signal_t* handle, int signum)
+{
+	ConnectionsManager* pConnectionsManager = (ConnectionsManager*)handle->data;
+
+	if (signum == SIGUSR1)
+		pConnectionsManager->LogStat(FALSE); 
+	else
+		pConnectionsManager->StopServer(); 
+}
+#endif
 
 // This MUST be called only from event loop (Currently it has been called from DoPeriodicActivities and read_stdin)
 void ConnectionsManager::LogStat(BOOL bCheckForRedundancy)
@@ -417,8 +553,7 @@ void ConnectionsManager::LogStat(BOOL bCheckForRedundancy)
 
 
 	/* Reset some counters which we want to evaluate on per interval basis */
-	m_stServerStat.ResponseQueuedDurationMinimum = 0;
-	m_stServerStat.ResponseQueuedDurationMaximum = 0;
+	m_StatInterval++; // Event loops restart their ResponseQueuedDurationMinimum and ResponseQueuedDurationMaximum (See AfterSendingResponse)
 
 #ifdef GENERATE_PROFILE_DATA
 	/* Uncomment this if we want profile data to be reset for each timer interval
@@ -463,12 +598,8 @@ void ConnectionsManager::DoPeriodicActivities()
 		LogStat(TRUE);
 	}
 
-	INT64 KeepAliveInSeconds = RequestProcessor::GetCommonParameters().KeepAliveFrequencyInSeconds;
-	// We deliberately keeping keepalive duration "<" time difference, instead of "<=".
-	// It is better to call SendKeepAlive by a little delay than exact match so that it can make up with last keep alive activity recording time in GetIdleClients of ClientsPool 
-	// (where we do "<=" to compare time difference with keepalive duration). Little difference in timings can skip a cycle of keep alive, that may makes client to think server
-	// is disconnected.
-	if (KeepAliveInSeconds < (CurrentTime - LastKeepAliveTime))
+	// Keep alive wheel has one second slots (See ClientsPool.h). Each client gets keep alive when it's been idle for KeepAliveFrequencyInSeconds.
+	if (CurrentTime != LastKeepAliveTime)
 	{
 		LastKeepAliveTime = CurrentTime;
 		SendKeepAlive();
@@ -480,7 +611,7 @@ void ConnectionsManager::DoPeriodicActivities()
 	if ((bclientsconnected == true) && (GetProcessPrivateBytes() > (1024*1024*1283) /*1.25 GB*/))
 	{
 		LOG (NOTE, "Memory usage went beyond 1 GB. Disconnecting all clients");
-		DisconnectAllClients();
+		DisconnectClientsOfAllEventLoops();
 		bclientsconnected = false;	
 	}
 
@@ -556,7 +687,11 @@ void ConnectionsManager::DoPeriodicActivities()
 							static BOOL b_stdin_close_initiated = FALSE;
 							if (b_stdin_close_initiated == FALSE)
 							{
-								uv_close((uv_handle_t*)&tty, after_close_read_stdin);
+								if (m_bIsStdinTTY)
+									uv_close((uv_handle_t*)&tty, after_close_read_stdin);
+								else
+									after_close_read_stdin((uv_handle_t*)&tty);
+
 								b_stdin_close_initiated = TRUE;
 							}
 						}
@@ -581,6 +716,14 @@ void ConnectionsManager::DoPeriodicActivities()
 void ConnectionsManager::after_close_read_stdin (uv_handle_t* handle)
 {
 	ConnectionsManager* pConnectionsManager = (ConnectionsManager*)handle->data;
+
+	pConnectionsManager->StopEventLoops(); // Other event loops have closed all their clients and listeners by now
+
+#ifndef _WIN32
+	for (int i = 0; i < SIGNALS_HANDLED; i++)
+		uv_close((uv_handle_t*)&pConnectionsManager->signals[i], NULL);
+#endif
+
 	uv_close((uv_handle_t*)&pConnectionsManager->tick, after_timer_closed);
 }
 
@@ -601,11 +744,12 @@ void ConnectionsManager::Shutdown()
 // Called by on_timer before it calls SendResponses and also after it detects "All Clients Disconnected For Shutdown" was set true.
 int ConnectionsManager::GetResponsesInQueue()
 {
-	uv_rwlock_rdlock(&m_rwlResponseCountersLock2);
-	int ResponsesInQueue = m_stServerStat.ResponsesInPeerServersQueues + m_stServerStat.ResponsesInLocalClientsQueues;
-	uv_rwlock_rdunlock(&m_rwlResponseCountersLock2);
+	INT64 ResponsesInQueue = 0;
+
+	for (int i=0; i<STAT_COUNTERS_BLOCKS; i++)
+		ResponsesInQueue += m_StatCounters[i].ResponsesInPeerServersQueues + m_StatCounters[i].ResponsesInLocalClientsQueues;
 
-	return ResponsesInQueue;
+	return (int)ResponsesInQueue;
 }
 
 // Called by ConnectionsManager::DoPeriodicActivities()
@@ -618,7 +762,7 @@ void ConnectionsManager::SendResponses()
 	m_bResponseDirectionFlag = m_bResponseDirectionFlag ? FALSE : TRUE ;
 	uv_rwlock_wrunlock(&m_rwlResponseDirectionFlagLock);
 
-	SendLocalClientsResponses();
+	SendLocalClientsResponses(GetMainEventLoop());
 	SendPeerServersResponses();
 }
 
@@ -648,6 +792,9 @@ void ConnectionsManager::after_send_responses(uv_write_t* write_req, int status)
 		pConnectionsManager->AfterSendingResponse(pResponse, pNode, status);
 	}
 
+	BOOL bIsCalledBySendResponses;
+	stEventLoop* pEventLoop = NULL; // Event loop we are running on
+
 	if (pNode->IsServer()) 
 	{
 		// If it was server responses forwarded to, we must empty responses being sent using swap (otherwise vector keeps memory allocated)
@@ -656,19 +803,25 @@ void ConnectionsManager::after_send_responses(uv_write_t* write_req, int status)
 		stPeerServer* pPeerServer = (stPeerServer*) pNode; 
 		std::vector<uv_buf_t>().swap(pPeerServer->m_pResponsesBuffersBeingForwarded);
 		Responses().swap(*pResponsesSent);
+		bIsCalledBySendResponses = pConnectionsManager->after_send_response_called_by_send_response;
 	}
 	else
 	{
 		// In case of clients, we should not use swap as it affects capacity (reserved in client's constructor). Instead use clear.
 		// This is because clients has fixed limit as to how much response we can queue.
 		(*pResponsesSent).clear();
+		pEventLoop = ((stClient*) pNode)->m_pEventLoop;
+		bIsCalledBySendResponses = pEventLoop->m_bAfterSendCalledBySendResponses;
 	}
 
 	// To avoid recursion, we are calling SendResponses only when we come here via callback
-	if (pConnectionsManager->after_send_response_called_by_send_response == FALSE)
+	if (bIsCalledBySendResponses == FALSE)
 	{
-		pConnectionsManager->m_stServerStat.ResponsesBeingSent -= ResponsesSentCount; // -= ResponseLength ; // pServerConnection->write_queue_size ;
-		pConnectionsManager->DoPeriodicActivities(); // This in turn calls SendResponses and also takes care of logging and other things
+		pConnectionsManager->GetStatCounters(-1).ResponsesBeingSent -= ResponsesSentCount; // -= ResponseLength ; // pServerConnection->write_queue_size ;
+
+		// Client's remaining responses ring flush doorbell of its loop (See AfterSendingLocalClientsResponses). Peer server's are sent right away.
+		if (pEventLoop == NULL)
+			pConnectionsManager->DoPeriodicActivities(); // This in turn calls SendResponses and also takes care of logging and other things
 	}
 
 	return;
@@ -678,7 +831,7 @@ void ConnectionsManager::AfterSendingResponse(Response* pResponse, stNode* pNode
 {
 	ConnectionsManager* pConnectionsManager = pResponse->GetConnectionsManager();
 
-	int ResponseLength = pResponse->GetResponse().len;
+	int ResponseLength = pResponse->GetResponseLength();
 	int ResponseReferenceCount = pResponse->GetReferenceCount();
 
 	if (pNode->IsServer() == false)
@@ -710,23 +863,30 @@ void ConnectionsManager::AfterSendingResponse(Response* pResponse, stNode* pNode
 		// https://groups.google.com/forum/#!topic/libuv/nJa3WeiVs2U
 		// So, it doesn't make sense to keep response pending in queue for connection which is not valid anymore.
 
-		uv_rwlock_wrlock(&pConnectionsManager->m_rwlResponseCountersLock2);
+		ServerStatCounters& Counters = pConnectionsManager->GetStatCounters(-1); // Event loop's counters block
 
 		if (pResponse->IsForward() == TRUE)
-			pConnectionsManager->m_stServerStat.ResponsesInPeerServersQueues -- ;
+			Counters.ResponsesInPeerServersQueues -- ;
 		else
-			pConnectionsManager->m_stServerStat.ResponsesInLocalClientsQueues -- ;
+			Counters.ResponsesInLocalClientsQueues -- ;
 
-		pConnectionsManager->m_stServerStat.MemoryConsumptionByResponsesInQueue -= (ResponseLength + sizeof (Response)); 
-		uv_rwlock_wrunlock(&pConnectionsManager->m_rwlResponseCountersLock2);
+		Counters.MemoryConsumptionByResponsesInQueue -= (ResponseLength + sizeof (Response)); 
 
 		// Before deleting find out how long the response was in queue. Update stat accordingly.
 		if (pResponse->QueuedTime)
 		{
 			double QueuedDuration = pConnectionsManager->GetHighPrecesionTime() - pResponse->QueuedTime ;
-			pConnectionsManager->m_stServerStat.ResponseQueuedDurationMinimum = pConnectionsManager->m_stServerStat.ResponseQueuedDurationMinimum ? pConnectionsManager->m_stServerStat.ResponseQueuedDurationMinimum : 0xFFFFFFFF;
-			pConnectionsManager->m_stServerStat.ResponseQueuedDurationMinimum = min (pConnectionsManager->m_stServerStat.ResponseQueuedDurationMinimum, QueuedDuration);
-			pConnectionsManager->m_stServerStat.ResponseQueuedDurationMaximum = max (pConnectionsManager->m_stServerStat.ResponseQueuedDurationMaximum, QueuedDuration);
+
+			if (Counters.StatInterval != pConnectionsManager->m_StatInterval) // Main loop has logged stat since. Start afresh.
+			{
+				Counters.StatInterval = pConnectionsManager->m_StatInterval;
+				Counters.ResponseQueuedDurationMinimum = 0;
+				Counters.ResponseQueuedDurationMaximum = 0;
+			}
+
+			Counters.ResponseQueuedDurationMinimum = Counters.ResponseQueuedDurationMinimum ? Counters.ResponseQueuedDurationMinimum : 0xFFFFFFFF;
+			Counters.ResponseQueuedDurationMinimum = min (Counters.ResponseQueuedDurationMinimum, QueuedDuration);
+			Counters.ResponseQueuedDurationMaximum = max (Counters.ResponseQueuedDurationMaximum, QueuedDuration);
 		}
 
 		DEL (pResponse); // We MUST delete response _ONLY_ in after_send_response as its being used by uv_write(libuv)
@@ -738,26 +898,25 @@ void ConnectionsManager::AfterSendingResponse(Response* pResponse, stNode* pNode
 // Called by threads (Response::CreateResponse)
 INT64 ConnectionsManager::GetMemoryConsumptionByResponsesInQueue()
 {
-	uv_rwlock_rdlock(&m_rwlResponseCountersLock1);
-	uv_rwlock_rdlock(&m_rwlResponseCountersLock2);
-	INT64 MemoryConsumptionByResponsesInQueue = m_stServerStat.MemoryConsumptionByResponsesInQueue;
-	uv_rwlock_rdunlock(&m_rwlResponseCountersLock2);
-	uv_rwlock_rdunlock(&m_rwlResponseCountersLock1);
+	INT64 MemoryConsumptionByResponsesInQueue = 0;
+
+	for (int i=0; i<STAT_COUNTERS_BLOCKS; i++)
+		MemoryConsumptionByResponsesInQueue += m_StatCounters[i].MemoryConsumptionByResponsesInQueue;
+
 	return MemoryConsumptionByResponsesInQueue;
 }
 
 void ConnectionsManager::GetCopyOfServerStat (ServerStat& stServerStatCopy)
 {
-	// Make sure synchronized counters are updated
-	uv_rwlock_rdlock(&m_rwlResponseCountersLock2);
-	uv_rwlock_rdlock(&m_rwlRequestCountersLock2);
-
 	// First let's copy the statistics to local structure. 
 	// Note that although the ServerStat has std::map, this will copy the map containts also and we don't need to worry about it:
 	stServerStatCopy = m_stServerStat;
 
-	uv_rwlock_rdunlock(&m_rwlRequestCountersLock2);
-	uv_rwlock_rdunlock(&m_rwlResponseCountersLock2);
+	// Then add counters being changed by threads
+	AddUpStatCounters(stServerStatCopy);
+
+	// And occupancy of slab pools
+	SlabAllocator::AddUpStat(stServerStatCopy);
 
 	return;
 }
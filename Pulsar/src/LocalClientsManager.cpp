@@ -19,8 +19,6 @@
 #include "Pulsar.h"
 
 unsigned short int IPv4Address::Port;
-// For thread index we have to use OS specific thread local storage syntax
-static __declspec(thread) int m_ThreadIndex = -1;
 
 int SetInternalTCPBufferSizes(SOCKET& Socket, DWORD NewBuffSize);
 
@@ -28,7 +26,7 @@ structLockRequestsResponses::structLockRequestsResponses()
 {
 	Requests = 0;
 	Responses = 0;
-	LastActivityTime = time(NULL); 
+	LastActivityTime = 0; // Stamped when client is added to pool
 	uv_rwlock_init(&rwLock); 
 }
 
@@ -37,25 +35,42 @@ structLockRequestsResponses::~structLockRequestsResponses()
 	uv_rwlock_destroy(&rwLock); 
 }
 
-stClient::stClient(uv_tcp_t* server, ServerStat& stServerStat, IPv4Address& ServerIPv4Address)
+stClient::stClient(stEventLoop* pEventLoop, UINT64 RegistrationNumber, IPv4Address& ServerIPv4Address)
 {
+	// Before anything else, as it throws std::bad_alloc which fails client creation
+	for (int i=0; i<RESPONSE_PRIORITIES; i++)
+		m_ResponsesQueues[i].Initialize(RequestProcessor::GetCommonParameters().MaxPendingResponses);
+
 	m_bIsServer = false;
 
-	m_server = server;
+	m_pEventLoop = pEventLoop;
+	m_server = &pEventLoop->m_tcp_server;
 
-	m_pLocalClientsManager = (LocalClientsManager*) m_server->data;
+	m_pLocalClientsManager = pEventLoop->m_pLocalClientsManager;
 
 	m_bIsAccepted = FALSE; m_bIsReadStarted = FALSE; m_bIsAddedToPool = FALSE;
-
-	m_bRequestIsBeingProcessed = FALSE;
+	m_bIsReadPaused = FALSE;
+
+	m_RequestsBeingProcessed = 0;
+	m_MaxPipelinedRequests = 0;
+	m_pPipelineSlots = NULL;
+	m_NextRequestSequence = 0;
+	m_OldestRequestSequence = 0;
+	m_DirectResponsesSequence = 0;
+	m_bPipelineQueueingBlocked = FALSE;
+	m_pSuspendedRequests = NULL;
 	m_bToBeDisconnected = FALSE;
 	m_bDisconnectInitiated = false;
 	m_disconnect_work_t.data = this; // used to access stClient instance in after_disconnection_processing_thread
 
-	m_pServerStat = &stServerStat; 
+	m_pStatCounters = pEventLoop->m_pStatCounters; 
 
 	m_pSessionData = NULL;
 
+	m_pNextInWheel = NULL;
+	m_pPrevInWheel = NULL;
+	m_WheelExpiryTime = 0;
+
 	// In on_client_closed, which will be called via Disconnect, we'll use this to destruct the instance
 	m_client.data = this;
 	m_write_req.data = this;
@@ -66,17 +81,11 @@ stClient::stClient(uv_tcp_t* server, ServerStat& stServerStat, IPv4Address& Serv
 		throw ClientCreationException();
 	}
 
-	if (uv_rwlock_init(&m_rwlResponsesQueueLock) < 0)
-	{
-		LOG (ERROR, "Initializing response queue lock failed");
-		throw ClientCreationException();
-	}
-
 	m_Version = UNINITIALIZED_VERSION;
 
-	stServerStat.ClientsConnectedCount++; // We must do this here (before returning anywhere in midst of this c'tor). Because we increase ClientsDisconnectedCount in d'tor
+	m_pStatCounters->ClientsConnectedCount++; // We must do this here (before returning anywhere in midst of this c'tor). Because we increase ClientsDisconnectedCount in d'tor
 
-	m_ClientHandle.m_ClientRegistrationNumber = stServerStat.ClientsConnectedCount;
+	m_ClientHandle.m_ClientRegistrationNumber = RegistrationNumber;
 	m_ClientHandle.m_ServerIPv4Address = ServerIPv4Address; // IP address exist as static member of stClient. Let's copy it here as it is a part of client handle.
 	m_bDeleted = false;
 
@@ -89,15 +98,25 @@ stClient::stClient(uv_tcp_t* server, ServerStat& stServerStat, IPv4Address& Serv
 
 	m_RequestSizeFound = 0;
 
+	m_pReadRing = NULL;
+	m_ReadRingStart = 0;
+	m_ReadRingEnd = 0;
+
 	m_bRejectedPreviousRequestBytes = FALSE;
 	m_bRequestProcessingFinished = TRUE;
 	m_bResponseQueueFull = FALSE;
+	m_PendingResponseBytes = 0;
+	m_MaxPendingResponseBytes = 0;
+	m_BackpressurePolicy = BACKPRESSURE_DROP_NEWEST;
+	m_bOverResponseBytesBudget = FALSE;
+	m_bHasPendingResponses = FALSE;
+	m_pNextPendingClient = NULL;
 
 	int MaxPendingResponses = RequestProcessor::GetCommonParameters().MaxPendingResponses;
 	// m_ResponsesBeingSentCount = 0;
-	int SizeReservedForPendingResponseBuffers = sizeof(uv_buf_t) * MaxPendingResponses;
-	m_pResponsesBuffersBeingSent = new uv_buf_t[MaxPendingResponses];
-	for (int i=0; i<MaxPendingResponses; i++)
+	int SizeReservedForPendingResponseBuffers = sizeof(uv_buf_t) * MaxPendingResponses * BUFFERS_PER_RESPONSE;
+	m_pResponsesBuffersBeingSent = new uv_buf_t[MaxPendingResponses * BUFFERS_PER_RESPONSE]; // Each response is header and payload
+	for (int i=0; i<MaxPendingResponses * BUFFERS_PER_RESPONSE; i++)
 	{
 		m_pResponsesBuffersBeingSent[i].base = NULL;
 		m_pResponsesBuffersBeingSent[i].len = 0;
@@ -107,8 +126,9 @@ stClient::stClient(uv_tcp_t* server, ServerStat& stServerStat, IPv4Address& Serv
 	// Let's keep max memory allocated to vector so that we won't get throw when we add elements to it
 	m_pResponsesBeingSent->reserve (MaxPendingResponses);
 	int SizeReservedForPendingResponsesQueue = sizeof(Responses) + (MaxPendingResponses* sizeof(class Response*));
+	int SizeReservedForResponseQueue = RESPONSE_PRIORITIES * MaxPendingResponses * (sizeof(UINT64) + sizeof(class Response*)); // Slots of m_ResponsesQueues
 
-	m_SizeReservedForResponsesBeingSend = SizeReservedForPendingResponseBuffers + SizeReservedForPendingResponsesQueue ;
+	m_SizeReservedForResponsesBeingSend = SizeReservedForPendingResponseBuffers + SizeReservedForPendingResponsesQueue + SizeReservedForResponseQueue;
 }
 
 // To be called _ONLY FROM_ event loop (Lock is used because value of m_bToBeDisconnected is read in IsMarkedToDisconnect() which is 
@@ -125,9 +145,9 @@ void stClient::MarkToDisconnect(BOOL bIsByServer)
 	m_bToBeDisconnected = TRUE;
 
 	if (bIsByServer)
-		m_pServerStat->DisconnectionsByServer++;
+		m_pStatCounters->DisconnectionsByServer++;
 	else
-		m_pServerStat->DisconnectionsByClients++;
+		m_pStatCounters->DisconnectionsByClients++;
 
 	uv_rwlock_wrunlock(&m_rwlLockForDisconnectionFlag);  
 }
@@ -175,7 +195,7 @@ ConnectionsManager* stClient::GetConnectionsManager()
 stClient::~stClient()
 {
 	m_bDeleted = true ;
-	m_pServerStat->ClientsDisconnectedCount++;
+	m_pStatCounters->ClientsDisconnectedCount++;
 }
 
 LocalClientsManager::LocalClientsManager()
@@ -183,12 +203,18 @@ LocalClientsManager::LocalClientsManager()
 	// Initialize members
 	QueuedDisconnections=0;
 	m_ClientsClosing = 0;
-	m_bServerStopped = FALSE; 
+	m_ServersStopped = 0; 
 	m_bAllClientsDisconnectedForShutdown = FALSE;
+	m_EventLoopsCount = 0;
+	m_ClientRegistrationNumber = 0;
 	m_MaxRequestSizeOfAllVersions = 0; 
 	m_MaxResponseSizeOfAllVersions = 0;
-	memset (&m_keep_alive_work_t, NULL, sizeof(uv_work_t));
-	ThreadIndexCounter = 0;
+	m_FlushLatencyInMilliseconds = 0;
+	m_FlushBatchResponses = 1;
+	m_MaxPendingResponseBytes = 0;
+	m_PendingResponseBytes = 0;
+	memset (m_pVersionPages, 0, sizeof(m_pVersionPages));
+	memset (&m_keep_alive_work_t, NULL, sizeof(stWork));
 	m_ConnectionCallbackError = 0;
 	m_nameinfo_t.data = this ;
 
@@ -198,18 +224,7 @@ LocalClientsManager::LocalClientsManager()
 
 
 	// Initialize locks
-	int retval = uv_rwlock_init(&m_rwlThreadIndexCounterLock);
-	ASSERT_THROW ((retval >= 0), "Initializing request processor use flags lock failed");
-
-	retval = uv_rwlock_init(&m_rwlRequestCountersLock1);
-	ASSERT_THROW ((retval >= 0), "Initializing request counters lock1 failed");
-	retval = uv_rwlock_init(&m_rwlRequestCountersLock2);
-	ASSERT_THROW ((retval >= 0), "Initializing request counters lock2 failed");
-
-	retval = uv_rwlock_init(&m_rwlClientSetLock);
-	ASSERT_THROW ((retval >= 0), "Initializing client set lock failed");
-
-	retval = uv_rwlock_init(&m_rwlWaitTillResponseForClientIsBeingAdded);
+	int retval = uv_rwlock_init(&m_rwlWaitTillResponseForClientIsBeingAdded);
 	ASSERT_THROW ((retval >= 0), "Initializing lock to wait till response is being added to client failed");
 }
 
@@ -217,8 +232,41 @@ int LocalClientsManager::InitiateRequestProcessorsAndValidateParameters()
 {
 	int RetVal = 0;
 
-	// Initialize request processors for all versions and then validate version parameters
-	unsigned short MaxVersionNumber = 0xFFFF;
+	// Initialize request processors for all registered versions and then validate version parameters
+	// Versions having processors are the ones whose global instances registered themselves (See RequestProcessor constructor)
+	try
+	{
+		typedef std::map<USHORT, RequestProcessor*>::iterator it_type;
+		for (it_type iterator = RequestProcessor::m_VersionAndProcessor.begin(); iterator != RequestProcessor::m_VersionAndProcessor.end(); iterator++)
+		{
+			if (iterator->first != UNINITIALIZED_VERSION) // NULL version is reserved by Pulsar framework
+				m_RegisteredVersions.push_back(iterator->first);
+		}
+	}
+	catch(std::bad_alloc&)
+	{
+		return UV_ENOMEM;
+	}
+
+	// Build lookup table. Processors are added to it as they are created.
+	for (size_t v=0; v<m_RegisteredVersions.size(); v++)
+	{
+		USHORT Version = m_RegisteredVersions[v];
+		stVersionProcessors**& pPage = m_pVersionPages[Version / VERSIONS_PER_PAGE];
+
+		if (pPage == NULL)
+		{
+			pPage = new (std::nothrow) stVersionProcessors* [VERSIONS_PER_PAGE](); // Slots are NULL
+
+			if (pPage == NULL)
+				return UV_ENOMEM;
+		}
+
+		pPage[Version % VERSIONS_PER_PAGE] = new (std::nothrow) stVersionProcessors(); // Pointers are NULL
+
+		if (pPage[Version % VERSIONS_PER_PAGE] == NULL)
+			return UV_ENOMEM;
+	}
 
 	// Important: GetNewRequestProcessor calls request processor constructor which is very likely initiate other resources (viz. DB connection)
 	// So we should be using RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads instead of using MAX_WORK_THREADS, 
@@ -226,24 +274,22 @@ int LocalClientsManager::InitiateRequestProcessorsAndValidateParameters()
 	int MaxReqProThreads = RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads;
 	for (int i=0; i<MaxReqProThreads; i++)
 	{
-		for (int j=0; j<=MaxVersionNumber; j++) 
+		for (size_t v=0; v<m_RegisteredVersions.size(); v++) 
 		{
+			USHORT Version = m_RegisteredVersions[v];
 			RequestProcessor* pRequestProcessor = NULL;
-			pRequestProcessor = RequestProcessor::GetNewRequestProcessor(j);
+			pRequestProcessor = RequestProcessor::GetNewRequestProcessor(Version);
 
 			if (pRequestProcessor == NULL) 
 				continue;
 
-			try
-			{
-				m_RequestProcessors[i][j] = pRequestProcessor;
-			}
-			catch(std::bad_alloc&)
-			{
-				continue;
-			}
+			stVersionProcessors* pVersionProcessors = GetVersionProcessors(Version);
+			pVersionProcessors->m_pRequestProcessors[i] = pRequestProcessor;
+
+			if (i == 0)
+				pVersionProcessors->m_pVersionParameters = &pRequestProcessor->GetVersionParameters();
 
-			RetVal = m_RequestProcessors[i][j]->Initialize(loop, (ConnectionsManager*)this, &LocalClientsManager::DoPeriodicActivities, &LocalClientsManager::AddResponseToQueues);
+			RetVal = pRequestProcessor->Initialize(loop, (ConnectionsManager*)this, &ConnectionsManager::DoPeriodicActivities, &ConnectionsManager::AddResponseToQueues);
 			ASSERT_RETURN (RetVal);
 		}
 	}
@@ -255,11 +301,16 @@ int LocalClientsManager::InitiateRequestProcessorsAndValidateParameters()
 	if (m_pReqProcessorToSendKepAlive == NULL)
 		return UV_ENOMEM;
 
-	RetVal = m_pReqProcessorToSendKepAlive->Initialize(loop, (ConnectionsManager*)this, &LocalClientsManager::DoPeriodicActivities, &LocalClientsManager::AddResponseToQueues);
+	RetVal = m_pReqProcessorToSendKepAlive->Initialize(loop, (ConnectionsManager*)this, &ConnectionsManager::DoPeriodicActivities, &ConnectionsManager::AddResponseToQueues);
 	ASSERT_RETURN (RetVal);
 
-	for (int Version=1; Version<MaxVersionNumber; Version++)
+	for (size_t v=0; v<m_RegisteredVersions.size(); v++)
 	{
+		USHORT Version = m_RegisteredVersions[v];
+
+		if (Version == SPECIAL_COMMUNICATION)
+			continue;
+
 		VersionParameters* VersionParams = GetVersionParameters (Version);
 
 		if (!VersionParams)
@@ -268,6 +319,12 @@ int LocalClientsManager::InitiateRequestProcessorsAndValidateParameters()
 		if ((VersionParams->m_MaxRequestSize  <= 0) || (VersionParams->m_MaxResponseSize <= 0))
 			return UV_EINVAL;
 
+		if ((VersionParams->m_MaxPipelinedRequests < 1) || (VersionParams->m_MaxPipelinedRequests > MAX_PIPELINED_REQUESTS))
+			return UV_EINVAL;
+
+		if ((VersionParams->m_MaxPendingResponseBytes < 1) || (VersionParams->m_BackpressurePolicy < BACKPRESSURE_DROP_NEWEST) || (VersionParams->m_BackpressurePolicy > BACKPRESSURE_STOP_READING))
+			return UV_EINVAL;
+
 		m_MaxRequestSizeOfAllVersions = (VersionParams->m_MaxRequestSize > m_MaxRequestSizeOfAllVersions) ? VersionParams->m_MaxRequestSize : m_MaxRequestSizeOfAllVersions;
 		m_MaxResponseSizeOfAllVersions = (VersionParams->m_MaxResponseSize > m_MaxResponseSizeOfAllVersions) ? VersionParams->m_MaxResponseSize : m_MaxResponseSizeOfAllVersions;
 	}
@@ -282,16 +339,6 @@ LocalClientsManager::~LocalClientsManager()
 	// LOG (INFO, "Deleting clients pool");
 	DEL(m_pClientsPool);
 	
-	// LOG (INFO, "Destroying request processor use flag lock");
-	uv_rwlock_destroy(&m_rwlThreadIndexCounterLock);
-
-	// LOG (INFO, "Destroying request counter locks");
-	uv_rwlock_destroy(&m_rwlRequestCountersLock1);
-	uv_rwlock_destroy(&m_rwlRequestCountersLock2);
-
-	// LOG (INFO, "Destroying client set locks");
-	uv_rwlock_destroy(&m_rwlClientSetLock);
-
 	// LOG (INFO, "Destroying lock to wait till response is being added to client");
 	uv_rwlock_destroy(&m_rwlWaitTillResponseForClientIsBeingAdded);
 }
@@ -313,6 +360,9 @@ BOOL LocalClientsManager::DisconnectAndDelete(stClient* pClient, BOOL bIsByServe
 	// Stop reading further requests for this client
 	StopReading(pClient);
 
+	// Requests waiting to be resumed would hold client forever
+	AbandonSuspendedRequests(pClient);
+
 	// This is an additional check to improve performance. RemoveClient already checks if there are any pending requests/responses.
 	// However, we are just trying to lessen the burden over it by having quick check is request is being processed and if request processing has finished.
 	if ((IsRequestBeingProcessed(pClient) == TRUE) || (pClient->m_bRequestProcessingFinished != TRUE))
@@ -321,6 +371,15 @@ BOOL LocalClientsManager::DisconnectAndDelete(stClient* pClient, BOOL bIsByServe
 	// Remove from pool. If successful, disconnect and delete object
 	// We must wait till response gets added to all queues
 	uv_rwlock_wrlock(&m_rwlWaitTillResponseForClientIsBeingAdded);
+
+	// Client still in pending clients list cannot be deleted (Whenever SendLocalClientsResponses takes it out of the list, it calls us again)
+	// No thread can add it to the list meanwhile, as it would be holding m_rwlWaitTillResponseForClientIsBeingAdded.
+	if (pClient->m_bHasPendingResponses)
+	{
+		uv_rwlock_wrunlock(&m_rwlWaitTillResponseForClientIsBeingAdded);
+		return FALSE;
+	}
+
 	if ((pClient->m_bIsAddedToPool == FALSE) || (m_pClientsPool->RemoveClient(pClient) == TRUE)) // Removes if there are no requests and responses pending for this client
 	{
 		if (pClient->m_bIsAccepted != TRUE) 
@@ -332,8 +391,7 @@ BOOL LocalClientsManager::DisconnectAndDelete(stClient* pClient, BOOL bIsByServe
 
 		pClient->m_bIsAddedToPool = FALSE;
 		
-		BOOL RetVal = uv_queue_work (loop, &pClient->m_disconnect_work_t, disconnection_processing_thread, after_disconnection_processing_thread);
-		ASSERT (RetVal == 0); // uv_queue_work returns non-zero only when disconnection_processing_thread is NULL
+		m_Scheduler.QueueWork (&pClient->m_disconnect_work_t, &pClient->m_pEventLoop->m_DoneWorks, disconnection_processing_thread, after_disconnection_processing_thread);
 	
 		QueuedDisconnections++;
 
@@ -352,7 +410,7 @@ IPv4Address LocalClientsManager::GetIPAddressOfLocalServer()
 	return m_ServerIPv4Address;
 }
 
-void LocalClientsManager::disconnection_processing_thread(uv_work_t* work_t)
+void LocalClientsManager::disconnection_processing_thread(stWork* work_t)
 {
 	stClient* pClient = (stClient*)work_t->data;
 	ASSERT (pClient != NULL);
@@ -360,18 +418,8 @@ void LocalClientsManager::disconnection_processing_thread(uv_work_t* work_t)
 	if (pClient->m_Version == UNINITIALIZED_VERSION) // At this stage there is chance that version was not yet initialized
 		return;
 
-	// Let's try to get thread index (if already not) either here or in request processing thread
-	if (m_ThreadIndex == -1)
-	{
-		uv_rwlock_wrlock(&pClient->m_pLocalClientsManager->m_rwlThreadIndexCounterLock);
-		m_ThreadIndex = pClient->m_pLocalClientsManager->ThreadIndexCounter++;
-		uv_rwlock_wrunlock(&pClient->m_pLocalClientsManager->m_rwlThreadIndexCounterLock);
-
-		ASSERT (m_ThreadIndex < RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads);
-	}
-
 	// Get request processor associated with this thread
-	RequestProcessor* pRequestProcessor = pClient->m_pLocalClientsManager->GetRequestProcessor(pClient->m_Version, m_ThreadIndex);
+	RequestProcessor* pRequestProcessor = pClient->m_pLocalClientsManager->GetRequestProcessor(pClient->m_Version, Scheduler::GetCurrentWorkerIndex());
 
 	if (pRequestProcessor == NULL)
 	{
@@ -385,12 +433,13 @@ void LocalClientsManager::disconnection_processing_thread(uv_work_t* work_t)
 	ASSERT (pClient->m_bDeleted == false); // When object is not valid referencing bDeleted _itself_ could become invalid and causes assertion (right here in this line)
 	ASSERT (pRequestProcessor); // There is no reason for request processor to be NULL here. We initialize all processors at start only via LocalClientsManager::StartListening.
 
-	pRequestProcessor->ProcessDisconnection(pClient->GetClientHandle(), pClient->m_pSessionData);
+	ClientHandle clienthandle = pClient->GetClientHandle();
+	pRequestProcessor->ProcessDisconnection(clienthandle, pClient->m_pSessionData);
 
 	pRequestProcessor->m_bDisconnectionIsBeingProcessed = FALSE;
 }
 
-void LocalClientsManager::after_disconnection_processing_thread(uv_work_t* work_t, int status)
+void LocalClientsManager::after_disconnection_processing_thread(stWork* work_t, int status)
 {
 	ADD2PROFILER;
 
@@ -418,13 +467,14 @@ void LocalClientsManager::after_disconnection_processing_thread(uv_work_t* work_
 
 void LocalClientsManager::on_server_stopped(uv_handle_t* server)
 {
-	LocalClientsManager* pLocalClientsManager = (LocalClientsManager*)server->data;
+	stEventLoop* pEventLoop = (stEventLoop*)server->data;
 
-	ASSERT (pLocalClientsManager && (&pLocalClientsManager->m_tcp_server == (uv_tcp_t *)server));
+	ASSERT (pEventLoop && (&pEventLoop->m_tcp_server == (uv_tcp_t *)server));
 
-	pLocalClientsManager->m_bServerStopped = TRUE;
+	int ServersStopped = ++pEventLoop->m_pLocalClientsManager->m_ServersStopped;
 
-	LOG (NOTE, "Server service stopped.");
+	if (ServersStopped == pEventLoop->m_pLocalClientsManager->m_EventLoopsCount)
+		LOG (NOTE, "Server service stopped.");
 }
 
 // This will be called by event loop after it reads keystrokes. 
@@ -437,13 +487,22 @@ void LocalClientsManager::InitiateServerShutdown()
 		// This is one time call by console interactions. 
 		// Hence we printing messages staright to console (Logger might not have intiated at this point) 
 		LOG (INFO, "Stopping server service.");
-		uv_close((uv_handle_t*)&m_tcp_server, on_server_stopped);
 	}
 
 	if (m_pClientsPool)
 		m_pClientsPool->SetServerShuttingDown();
 
-	bShutdownInitiated = DisconnectAllClients();
+	// Clients of other event loops can be disconnected only through their own loops
+	for (int i=1; i<m_EventLoopsCount; i++)
+	{
+		m_EventLoops[i].m_bShutdownRequested = TRUE;
+		WakeUpEventLoop(&m_EventLoops[i]);
+	}
+
+	bShutdownInitiated = DisconnectAllClients(GetMainEventLoop());
+
+	// Stop listening on main loop. (DisconnectAllClients above must have been called before, as it checks if there were any clients at all)
+	ShutdownEventLoop(GetMainEventLoop());
 
 	if (!bShutdownInitiated) // This is true when no client was connected (so no servers were also connected) and we want to shutdown
 	{
@@ -458,22 +517,47 @@ void LocalClientsManager::InitiateServerShutdown()
 	return;
 }
 
-/* Returns 'true' when clients pool exists and at least one client is there in it. 'false' otherwise. */
-bool LocalClientsManager::DisconnectAllClients() 
+// Called by event loop (main loop through InitiateServerShutdown, others through on_event_loop_async). Stops listening and disconnects clients of the loop.
+void LocalClientsManager::ShutdownEventLoop(stEventLoop* pEventLoop)
+{
+	if (pEventLoop->m_bShutdownInitiated == FALSE)
+	{
+		uv_close((uv_handle_t*)&pEventLoop->m_tcp_server, on_server_stopped);
+		pEventLoop->m_bShutdownInitiated = TRUE;
+	}
+
+	if (pEventLoop->m_Index) // Main loop has already disconnected its clients in InitiateServerShutdown
+		DisconnectAllClients(pEventLoop);
+}
+
+// Called by main loop. Like InitiateServerShutdown, clients of other event loops are disconnected only through their own loops.
+void LocalClientsManager::DisconnectClientsOfAllEventLoops()
+{
+	for (int i=1; i<m_EventLoopsCount; i++)
+	{
+		m_EventLoops[i].m_bDisconnectRequested = TRUE;
+		WakeUpEventLoop(&m_EventLoops[i]);
+	}
+
+	DisconnectAllClients(GetMainEventLoop());
+}
+
+/* Returns 'true' when clients pool exists and at least one client (of any event loop) is there in it. 'false' otherwise. */
+// Called by event loop. Only clients of that event loop are disconnected.
+bool LocalClientsManager::DisconnectAllClients(stEventLoop* pEventLoop) 
 {
 	bool RetVal = false;
 
 	if (m_pClientsPool)
 	{
+		RetVal = (m_pClientsPool->GetClientsCount() > 0);
+
 		Clients vClients;
-		m_pClientsPool->GetClients(vClients);
+		m_pClientsPool->GetClients(vClients, pEventLoop);
 		int ClientsCount = (int)vClients.size();
 
 		for (int i=0; i<ClientsCount; i++)
-		{
 			DisconnectAndDelete(vClients[i]);
-			RetVal = true;
-		}
 	}
 	
 	return RetVal;
@@ -487,6 +571,39 @@ void LocalClientsManager::StopReading(stClient* pClient)
 		uv_read_stop((uv_stream_t*)&pClient->m_client);
 		pClient->m_bIsReadStarted = FALSE;
 	}
+
+	pClient->m_bIsReadPaused = FALSE; // Not to be resumed
+}
+
+// Called by event loop whenever client's pipeline may have got full or may have got room, and whenever its pending response bytes
+// may have crossed its budget. Stops reading client till pipeline has room and, for BACKPRESSURE_STOP_READING, till it is within budget.
+// Refusing bytes in GetRequestBuffer isn't enough: libuv doesn't stop reading on UV_ENOBUFS, so on_read would be called over and over
+// for as long as client has bytes waiting (e.g. throughout request suspended for long, or while client doesn't read its responses).
+void LocalClientsManager::PauseOrResumeReading(stClient* pClient)
+{
+	if ((pClient->m_bIsAccepted == FALSE) || pClient->m_bDisconnectInitiated || pClient->IsMarkedToDisconnect()) // Reading is stopped for good then
+		return;
+
+	BOOL bToPause = (IsPipelineFull(pClient) || ((pClient->m_BackpressurePolicy == BACKPRESSURE_STOP_READING) && IsOverResponseBytesBudget(pClient))) ? TRUE : FALSE;
+
+	if (bToPause && pClient->m_bIsReadStarted)
+	{
+		uv_read_stop((uv_stream_t*)&pClient->m_client);
+		pClient->m_bIsReadStarted = FALSE;
+		pClient->m_bIsReadPaused = TRUE;
+	}
+	else if ((bToPause == FALSE) && pClient->m_bIsReadPaused)
+	{
+		if (uv_read_start((uv_stream_t*)&pClient->m_client, alloc_buffer, on_read) != 0)
+		{
+			LOG (ERROR, "Error resuming reading from client. Client (Version 0x%X) is being disconnected.", pClient->m_Version);
+			pClient->MarkToDisconnect(TRUE);
+			return;
+		}
+
+		pClient->m_bIsReadStarted = TRUE;
+		pClient->m_bIsReadPaused = FALSE;
+	}
 }
 
 // To be called ONLY THROUGH after_request_processing_thread after request has been processed
@@ -494,9 +611,9 @@ void LocalClientsManager::ResetRequestBuffer(stClient* pClient)
 {
 	if ((pClient->m_Request.base != pClient->m_Header) && ((pClient->m_bStreaming == false) || (pClient->m_bRequestMemoryAllocatedForStreaming == false)))
 	{
-		DEL_ARRAY (pClient->m_Request.base);
-		m_stServerStat.MemoryConsumptionByClients -= (pClient->m_bRequestMemoryAllocatedForStreaming ? (GetVersionParameters(pClient->m_Version)->m_MaxRequestSize+HEADER_SIZE) : pClient->m_Request.len) ; 
-		m_stServerStat.ActiveClientRequestBuffers -- ;
+		DEL_SLAB (pClient->m_Request.base);
+		pClient->m_pStatCounters->MemoryConsumptionByClients -= (pClient->m_bRequestMemoryAllocatedForStreaming ? (GetVersionParameters(pClient->m_Version)->m_MaxRequestSize+HEADER_SIZE) : pClient->m_Request.len) ; 
+		pClient->m_pStatCounters->ActiveClientRequestBuffers -- ;
 		pClient->m_Request.base = pClient->m_Header; 
 		pClient->m_bRequestMemoryAllocatedForStreaming = false ;
 	}
@@ -508,6 +625,59 @@ void LocalClientsManager::ResetRequestBuffer(stClient* pClient)
 // Called from event loop through alloc_buffer.
 void LocalClientsManager::GetRequestBuffer(stClient* pClient, uv_buf_t& request_buffer)
 {
+	// Don't read further when client has as many requests in pipeline as its version allows (Pipelining is explained in LocalClientsManager.h)
+	// Reading is stopped altogether thereafter (See PauseOrResumeReading)
+	// or when it doesn't read responses and its version wants it to be stopped reading for that (See BACKPRESSURE_STOP_READING)
+	if (IsPipelineFull(pClient) || ((pClient->m_BackpressurePolicy == BACKPRESSURE_STOP_READING) && IsOverResponseBytesBudget(pClient)))
+	{
+		request_buffer.base = &pClient->m_Request.base [pClient->m_Request_Index];
+		request_buffer.len = 0; // Causes libuv calling on_read with nread == UV_ENOBUFS
+		return;
+	}
+
+	// Read into ring unless request bigger than ring (or streaming buffer) is being read into its own buffer (See Module summary)
+	int ReadRingSize = RequestProcessor::GetCommonParameters().ReadRingSize;
+
+	if ((ReadRingSize) && (pClient->m_Request.base == pClient->m_Header) && (pClient->m_Request_Index == 0))
+	{
+		if (pClient->m_pReadRing == NULL)
+		{
+			try
+			{
+				pClient->m_pReadRing = (char*) SlabAllocator::Allocate(ReadRingSize); // Throws std::bad_alloc
+			}
+			catch(std::bad_alloc&)
+			{
+				request_buffer.base = pClient->m_Header;
+				request_buffer.len = 0;
+
+				// Same as failing to allocate request buffer (See below)
+				IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+
+				if (DisconnectAndDelete(pClient, TRUE))
+					LOG (NOTE, "Unable to allocate read ring for client. Disconnected.");
+
+				return;
+			}
+
+			pClient->m_ReadRingStart = 0;
+			pClient->m_ReadRingEnd = 0;
+			pClient->m_pStatCounters->MemoryConsumptionByClients += ReadRingSize;
+		}
+		else if (pClient->m_ReadRingStart) // Move bytes of incomplete request to the front
+		{
+			memmove (pClient->m_pReadRing, &pClient->m_pReadRing[pClient->m_ReadRingStart], pClient->m_ReadRingEnd - pClient->m_ReadRingStart);
+			pClient->m_ReadRingEnd -= pClient->m_ReadRingStart;
+			pClient->m_ReadRingStart = 0;
+		}
+
+		ASSERT (pClient->m_ReadRingEnd < (ULONG)ReadRingSize); // Incomplete request which fills ring is moved to its own buffer (See ExtractRequestsFromReadRing)
+
+		request_buffer.base = &pClient->m_pReadRing[pClient->m_ReadRingEnd];
+		request_buffer.len = ReadRingSize - pClient->m_ReadRingEnd;
+		return;
+	}
+
 	// Check how many bytes remaining after m_Request_index in m_Request.base
 	ULONG SizeAvailable = pClient->m_Request.len - pClient->m_Request_Index;
 
@@ -528,11 +698,11 @@ void LocalClientsManager::GetRequestBuffer(stClient* pClient, uv_buf_t& request_
 				// Hence we don't need to have lock around it.
 				int MemoryToAllocate = pClient->m_bStreaming ? (GetVersionParameters(pClient->m_Version)->m_MaxRequestSize+HEADER_SIZE) : (pClient->m_RequestSizeFound+HEADER_SIZE);
 
-				pClient->m_Request.base = new char [MemoryToAllocate] ; 
+				pClient->m_Request.base = (char*) SlabAllocator::Allocate(MemoryToAllocate); // Throws std::bad_alloc
 				pClient->m_Request.len = pClient->m_RequestSizeFound+HEADER_SIZE;
 
-				m_stServerStat.MemoryConsumptionByClients += MemoryToAllocate;
-				m_stServerStat.ActiveClientRequestBuffers += 1;
+				pClient->m_pStatCounters->MemoryConsumptionByClients += MemoryToAllocate;
+				pClient->m_pStatCounters->ActiveClientRequestBuffers += 1;
 
 				pClient->m_bRequestMemoryAllocatedForStreaming = pClient->m_bStreaming ;
 
@@ -601,8 +771,8 @@ void LocalClientsManager::alloc_buffer(uv_handle_t *client, uv_buf_t* buffer)
 
 	pClient->m_pLocalClientsManager->GetRequestBuffer(pClient, *buffer); 
 
-	// Make sure when buffer is available we shouldn't have request already being processed
-	if ((buffer->len) && (pClient->m_pLocalClientsManager->IsRequestBeingProcessed(pClient) == TRUE))
+	// Make sure when buffer is available we shouldn't have as many requests in pipeline as client is allowed to have
+	if ((buffer->len) && (pClient->m_pLocalClientsManager->IsPipelineFull(pClient) == TRUE))
 		ASSERT(0);
 
 	return;
@@ -625,6 +795,10 @@ void LocalClientsManager::on_read (uv_stream_t *client, ssize_t nread, const uv_
 			LOG (INFO, "Error %d (%s) in on_read. Client (Version 0x%X) is being disconnected.", (int)nread, uv_strerror((int)nread), pClient->m_Version);
 			pClient->m_pLocalClientsManager->DisconnectAndDelete(pClient, FALSE);
 		}
+		else if (nread == UV_ENOBUFS)
+		{
+			pClient->m_pLocalClientsManager->PauseOrResumeReading(pClient); // Else we'd be called again right away
+		}
 
 		return;
     }
@@ -632,13 +806,17 @@ void LocalClientsManager::on_read (uv_stream_t *client, ssize_t nread, const uv_
 	if ((pClient->m_pLocalClientsManager->m_pClientsPool->IsShutdownInitiated() == TRUE) || (pClient->m_bToBeDisconnected == TRUE))
 	{
 		pClient->m_Request_Index = 0;
-		pClient->m_pLocalClientsManager->m_stServerStat.RequestBytesIgnored += nread;
+		pClient->m_pLocalClientsManager->ReleaseReadRing(pClient);
+		pClient->m_pStatCounters->RequestBytesIgnored += nread;
 		pClient->m_bRejectedPreviousRequestBytes = TRUE;
 
 		return;
 	}
 
 	pClient->m_pLocalClientsManager->ExtractRequestOffTheBuffer(pClient, nread);
+
+	// Requests just read might have filled pipeline
+	pClient->m_pLocalClientsManager->PauseOrResumeReading(pClient);
 }
 
 void LocalClientsManager::ExtractRequestOffTheBuffer(stClient* pClient, ssize_t nread)
@@ -663,6 +841,15 @@ void LocalClientsManager::ExtractRequestOffTheBuffer(stClient* pClient, ssize_t
 	If eithr of them is true, we should return from here itself.
 	*/
 
+	if (pClient->m_pReadRing) // Bytes have been read into read ring (See GetRequestBuffer)
+	{
+		pClient->m_ReadRingEnd += (ULONG) nread;
+		ASSERT (pClient->m_ReadRingEnd <= (ULONG)RequestProcessor::GetCommonParameters().ReadRingSize);
+
+		ExtractRequestsFromReadRing(pClient);
+		return;
+	}
+
 	pClient->m_Request_Index += (unsigned int) nread; //  Windows x64 uses the LLP64 programming model, in which int and long remain 32 bit
 
 	uv_buf_t request;
@@ -695,8 +882,8 @@ void LocalClientsManager::ExtractRequestOffTheBuffer(stClient* pClient, ssize_t
 			if (pRequest == NULL)
 			{
 				pClient->m_Request_Index = 0;
-				pClient->m_pLocalClientsManager->m_stServerStat.RequestBytesIgnored += request.len;
-				pClient->m_pLocalClientsManager->m_stServerStat.RequestsRejectedByServer ++;
+				pClient->m_pStatCounters->RequestBytesIgnored += request.len;
+				pClient->m_pStatCounters->RequestsRejectedByServer ++;
 			}
 		}
 		break;
@@ -705,7 +892,7 @@ void LocalClientsManager::ExtractRequestOffTheBuffer(stClient* pClient, ssize_t
 		case INVALID_VERSION:
 		case INVALID_SIZE:
 		{	
-			pClient->m_pLocalClientsManager->m_stServerStat.RequestBytesIgnored += pClient->m_Request_Index;
+			pClient->m_pStatCounters->RequestBytesIgnored += pClient->m_Request_Index;
 			pClient->m_Request_Index=0;
 			if (pClient->m_bRejectedPreviousRequestBytes != TRUE)
 				pClient->m_pLocalClientsManager->ProcessHeaderError(pClient, RetVal);
@@ -748,7 +935,7 @@ void LocalClientsManager::ExtractRequestOffTheBuffer(stClient* pClient, ssize_t
 		{
 			// No need to assert here. pRequest could have been null when cannot allocate memory.
 			LOG (ERROR, "Unknown return code by ValidateProtocolAndExtractRequest OR pRequest was NULL when RetVal was REQUEST_FOUND");
-			pClient->m_pLocalClientsManager->m_stServerStat.RequestBytesIgnored += pClient->m_Request_Index;
+			pClient->m_pStatCounters->RequestBytesIgnored += pClient->m_Request_Index;
 			pClient->m_Request_Index=0;
 		}
 	}
@@ -756,6 +943,104 @@ void LocalClientsManager::ExtractRequestOffTheBuffer(stClient* pClient, ssize_t
 	return;
 }
 
+// Called by event loop (ExtractRequestOffTheBuffer and after_request_processing_thread)
+// Creates requests out of complete requests in read ring, as many as pipeline allows. Rest of them are extracted as pipeline frees up.
+void LocalClientsManager::ExtractRequestsFromReadRing(stClient* pClient)
+{
+	RequestParser* pRequestParser = RequestParser::GetInstance(dynamic_cast<ConnectionsManager*>(this));
+	int ReadRingSize = RequestProcessor::GetCommonParameters().ReadRingSize;
+
+	while ((pClient->m_pReadRing) && (pClient->m_ReadRingStart < pClient->m_ReadRingEnd) && (IsPipelineFull(pClient) == FALSE))
+	{
+		char* pBytes = &pClient->m_pReadRing[pClient->m_ReadRingStart];
+		ULONG BytesAvailable = pClient->m_ReadRingEnd - pClient->m_ReadRingStart;
+
+		// Same as on_read does for bytes arrived after shutdown or after client is marked to disconnect
+		if ((m_pClientsPool->IsShutdownInitiated() == TRUE) || (pClient->m_bToBeDisconnected == TRUE))
+		{
+			pClient->m_pStatCounters->RequestBytesIgnored += BytesAvailable;
+			pClient->m_ReadRingStart = pClient->m_ReadRingEnd;
+			break;
+		}
+
+		uv_buf_t request;
+		request.base = NULL;
+		request.len = 0;
+
+		UCHAR RetVal = pRequestParser->ValidateProtocolAndExtractRequest (pBytes, BytesAvailable, pClient->m_Version, request);
+
+		if (RetVal == REQUEST_FOUND)
+		{
+			pClient->m_bRejectedPreviousRequestBytes = FALSE;
+			pClient->m_ReadRingStart += (HEADER_SIZE + request.len); // Request is copied into its own buffer by CreateRequestAndQueue
+
+			if (CreateRequestAndQueue(&request, pClient) == NULL)
+			{
+				pClient->m_pStatCounters->RequestBytesIgnored += request.len;
+				pClient->m_pStatCounters->RequestsRejectedByServer ++;
+			}
+		}
+		else if (RetVal == WAIT_FOR_MORE_BYTES)
+		{
+			// Header is read and says request doesn't fit in ring. Move its bytes to its own buffer and read rest of it there.
+			if ((BytesAvailable > HEADER_SIZE) && ((HEADER_SIZE + request.len) > (ULONG)ReadRingSize))
+			{
+				ULONG RequestSize = HEADER_SIZE + request.len;
+
+				try
+				{
+					pClient->m_Request.base = (char*) SlabAllocator::Allocate(RequestSize); // Throws std::bad_alloc
+					pClient->m_Request.len = RequestSize;
+					memcpy_s (pClient->m_Request.base, RequestSize, pBytes, BytesAvailable);
+					pClient->m_Request_Index = BytesAvailable;
+
+					pClient->m_pStatCounters->MemoryConsumptionByClients += RequestSize;
+					pClient->m_pStatCounters->ActiveClientRequestBuffers += 1;
+				}
+				catch(std::bad_alloc&)
+				{
+					pClient->m_pStatCounters->RequestBytesIgnored += BytesAvailable;
+					IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+
+					if (DisconnectAndDelete(pClient, TRUE))
+						LOG (NOTE, "Client buffer is full. Unable to read request. Disconnected.");
+				}
+
+				pClient->m_ReadRingStart = pClient->m_ReadRingEnd;
+			}
+
+			break;
+		}
+		else // INVALID_HEADER, INVALID_VERSION or INVALID_SIZE
+		{
+			pClient->m_pStatCounters->RequestBytesIgnored += BytesAvailable;
+			pClient->m_ReadRingStart = pClient->m_ReadRingEnd;
+
+			if (pClient->m_bRejectedPreviousRequestBytes != TRUE)
+				ProcessHeaderError(pClient, RetVal);
+
+			break;
+		}
+	}
+
+	// Idle clients shouldn't hold ring
+	if ((pClient->m_pReadRing) && (pClient->m_ReadRingStart == pClient->m_ReadRingEnd))
+		ReleaseReadRing(pClient);
+}
+
+// Called by event loop
+void LocalClientsManager::ReleaseReadRing(stClient* pClient)
+{
+	if (pClient->m_pReadRing)
+	{
+		DEL_SLAB (pClient->m_pReadRing);
+		pClient->m_pStatCounters->MemoryConsumptionByClients -= RequestProcessor::GetCommonParameters().ReadRingSize;
+	}
+
+	pClient->m_ReadRingStart = 0;
+	pClient->m_ReadRingEnd = 0;
+}
+
 // Called by event loop (on_read)
 void LocalClientsManager::ProcessHeaderError(stClient* pClient, UCHAR ErrorCode)
 {
@@ -765,17 +1050,17 @@ void LocalClientsManager::ProcessHeaderError(stClient* pClient, UCHAR ErrorCode)
 	{
 		case INVALID_HEADER: 
 			LOG (ERROR, "Invalid preamble in header. Disconnecting client.");
-			m_stServerStat.HeaderErrorInPreamble ++; 
+			pClient->m_pStatCounters->HeaderErrorInPreamble ++; 
 			break;
 
 		case INVALID_VERSION : 
 			LOG (ERROR, "Invalid version in header. Disconnecting client.");
-			m_stServerStat.HeaderErrorInVersion ++; 
+			pClient->m_pStatCounters->HeaderErrorInVersion ++; 
 			break;
 
 		case INVALID_SIZE	 : 
 			LOG (ERROR, "Invalid size in header. Disconnecting client.");
-			m_stServerStat.HeaderErrorInSize ++; 
+			pClient->m_pStatCounters->HeaderErrorInSize ++; 
 			break;
 	}
 	
@@ -786,10 +1071,10 @@ VersionParameters* LocalClientsManager::GetVersionParameters(unsigned short Vers
 {
 	ASSERT (Version != UNINITIALIZED_VERSION);
 
-	RequestProcessor* pRequestProcessor = GetRequestProcessor(Version, 0);
+	stVersionProcessors* pVersionProcessors = GetVersionProcessors(Version);
 
-	if (pRequestProcessor)
-		return &pRequestProcessor->GetVersionParameters(); 
+	if (pVersionProcessors)
+		return pVersionProcessors->m_pVersionParameters; 
 
 	return NULL;
 }
@@ -804,13 +1089,25 @@ int LocalClientsManager::GetMaxResponseSizeOfAllVersions()
 	return m_MaxResponseSizeOfAllVersions;
 }
 
-// To be called ONLY FROM event loop
+// To be called ONLY FROM event loop (m_RequestsBeingProcessed is changed only by event loop so no lock needed)
 BOOL LocalClientsManager::IsRequestBeingProcessed(stClient* pClient) 
 { 
-	uv_rwlock_rdlock(&m_rwlRequestCountersLock2);
-	BOOL bIsRequestBeingProcessed = pClient->m_bRequestIsBeingProcessed; 
-	uv_rwlock_rdunlock(&m_rwlRequestCountersLock2);
-	return bIsRequestBeingProcessed;
+	return (pClient->m_RequestsBeingProcessed > 0) ? TRUE : FALSE; 
+}
+
+// Called from event loop. Streaming reuses single request buffer, hence is never pipelined.
+int LocalClientsManager::GetMaxPipelinedRequests(stClient* pClient)
+{
+	if ((pClient->m_pPipelineSlots == NULL) || (pClient->m_bStreaming) || (pClient->m_bRequestMemoryAllocatedForStreaming))
+		return 1;
+
+	return pClient->m_MaxPipelinedRequests;
+}
+
+// Called from event loop. Requests which are processed but whose responses are not yet queued still occupy their pipeline slots.
+BOOL LocalClientsManager::IsPipelineFull(stClient* pClient)
+{
+	return ((pClient->m_NextRequestSequence - pClient->m_OldestRequestSequence) >= (UINT64)GetMaxPipelinedRequests(pClient)) ? TRUE : FALSE;
 }
 
 // Called thru event loop (on_read)
@@ -823,36 +1120,124 @@ Request* LocalClientsManager::CreateRequestAndQueue(uv_buf_t* request, stClient*
 
 	static int RequestCount=0;
 
+	// Request lies either in read ring or in client's request buffer
+	BOOL bIsInReadRing = (pClient->m_pReadRing) ? TRUE : FALSE;
+
 	// Create request object. When nothrow is used as argument for new, it returns a null pointer instead of throwing bad_alloc exception.
-	ASSERT (&request->base[request->len-1] <= &pClient->m_Request.base[pClient->m_Request.len-1]);
+	ASSERT (bIsInReadRing || (&request->base[request->len-1] <= &pClient->m_Request.base[pClient->m_Request.len-1]));
 	ASSERT (pClient->m_Request_Index <= pClient->m_Request.len);
 
 	try
 	{
-		uv_rwlock_rdlock(&m_rwlRequestCountersLock2);
-		INT64 MemoryConsumptionByRequestsInQueue = m_stServerStat.MemoryConsumptionByRequestsInQueue;
-		uv_rwlock_rdunlock(&m_rwlRequestCountersLock2);
+		// Version is known by now. Find out if its requests can be pipelined and if so, allocate slots to order the responses.
+		if (pClient->m_MaxPipelinedRequests == 0)
+		{
+			VersionParameters* pVersionParameters = GetVersionParameters(pClient->m_Version);
+			int MaxPipelinedRequests = pVersionParameters->m_MaxPipelinedRequests;
 
-		pRequest = new Request (request, ConnectionsManager::GetHighPrecesionTime(), m_pClientsPool, &pClient->m_ClientHandle ); // Will be deleted in request_processing_thread
+			// Threads queueing responses to client read policy only after they see budget (See AddResponseToQueue)
+			pClient->m_BackpressurePolicy = pVersionParameters->m_BackpressurePolicy;
+			pClient->m_MaxPendingResponseBytes.store(pVersionParameters->m_MaxPendingResponseBytes, std::memory_order_release);
 
-		m_stServerStat.RequestsArrived ++;  // Total request count till now. Never decreases.
+			if (MaxPipelinedRequests > 1)
+			{
+				pClient->m_pPipelineSlots = new stPipelineSlot[MaxPipelinedRequests];
 
-		// We must get request length here because once thread started it deletes request.base and makes length zero
-		// which could hapen so fast that call to GetRequest().len immidiate after uv_queue_work may return zero
-		uv_rwlock_wrlock(&m_rwlRequestCountersLock2);
+				for (int i=0; i<MaxPipelinedRequests; i++)
+				{
+					pClient->m_pPipelineSlots[i].m_QueuedResponses = 0;
+					pClient->m_pPipelineSlots[i].m_bCompleted = FALSE;
+				}
 
-		// This assertion is very important as it makes sure no two concurrent requests are created for same client
-		ASSERT(pClient->m_bRequestIsBeingProcessed == FALSE);
+				int RetVal = uv_rwlock_init(&pClient->m_rwlPipelineLock);
+				ASSERT (RetVal == 0);
 
-		pClient->m_bRequestIsBeingProcessed = TRUE;
-		m_stServerStat.MemoryConsumptionByRequestsInQueue += (pRequest->GetRequest().len + sizeof(Request));
-		uv_rwlock_wrunlock(&m_rwlRequestCountersLock2);
+				pClient->m_pStatCounters->MemoryConsumptionByClients += (sizeof(stPipelineSlot) * MaxPipelinedRequests);
+			}
 
-		pClient->m_bRequestProcessingFinished = FALSE;
+			pClient->m_MaxPipelinedRequests = MaxPipelinedRequests;
+		}
+
+		// This assertion is very important as it makes sure no more concurrent requests are created for same client than its version allows
+		ASSERT(IsPipelineFull(pClient) == FALSE);
 
-		int RetVal = uv_queue_work (loop, &pRequest->m_work_t, request_processing_thread, after_request_processing_thread);
+		// When pipelining, request takes its bytes along so that client's buffer is free for next request. 
+		// Allocated buffer is handed over as is. Small request which fits in m_Header is copied.
+		// Request read into read ring is always copied, as ring is reused for following bytes.
+		BOOL bPipelined = (GetMaxPipelinedRequests(pClient) > 1) ? TRUE : FALSE;
+		char* pRequestBuffer = NULL;
+		ULONG RequestBufferSize = request->len + HEADER_SIZE;
 
-		ASSERT (RetVal == 0); // uv_queue_work returns non-zero only when request_processing_thread is NULL
+		if (bIsInReadRing)
+		{
+			ASSERT ((request->base - HEADER_SIZE) >= pClient->m_pReadRing);
+
+			pRequestBuffer = (char*) SlabAllocator::Allocate(RequestBufferSize);
+			memcpy_s (pRequestBuffer, RequestBufferSize, request->base - HEADER_SIZE, RequestBufferSize);
+			pClient->m_pStatCounters->MemoryConsumptionByClients += RequestBufferSize;
+			pClient->m_pStatCounters->ActiveClientRequestBuffers += 1;
+		}
+		else if (bPipelined)
+		{
+			ASSERT (request->base == &pClient->m_Request.base[HEADER_SIZE]);
+			ASSERT (pClient->m_Request_Index == RequestBufferSize);
+
+			if (pClient->m_Request.base == pClient->m_Header)
+			{
+				pRequestBuffer = (char*) SlabAllocator::Allocate(RequestBufferSize);
+				memcpy_s (pRequestBuffer, RequestBufferSize, pClient->m_Header, RequestBufferSize);
+				pClient->m_pStatCounters->MemoryConsumptionByClients += RequestBufferSize;
+				pClient->m_pStatCounters->ActiveClientRequestBuffers += 1;
+			}
+			else
+			{
+				ASSERT (pClient->m_Request.len == RequestBufferSize);
+				pRequestBuffer = pClient->m_Request.base;
+			}
+		}
+
+		try
+		{
+			pRequest = new Request (request, ConnectionsManager::GetHighPrecesionTime(), m_pClientsPool, &pClient->m_ClientHandle ); // Will be deleted in request_processing_thread
+		}
+		catch(...)
+		{
+			if ((pRequestBuffer) && (pRequestBuffer != pClient->m_Request.base))
+			{
+				DEL_SLAB (pRequestBuffer);
+				pClient->m_pStatCounters->MemoryConsumptionByClients -= RequestBufferSize;
+				pClient->m_pStatCounters->ActiveClientRequestBuffers -= 1;
+			}
+			throw;
+		}
+
+		pClient->m_pStatCounters->RequestsArrived ++;  // Total request count till now. Never decreases.
+
+		pRequest->SetSequence(pClient->m_NextRequestSequence++);
+		pRequest->SetFollowedByRequests(bIsInReadRing && (pClient->m_ReadRingEnd > pClient->m_ReadRingStart)); // Ring start is already past this request
+
+		if (pRequestBuffer)
+		{
+			pRequest->TakeOverRequestBuffer(pRequestBuffer, RequestBufferSize);
+
+			// Client's buffer is ready for next request
+			if (bIsInReadRing == FALSE)
+			{
+				pClient->m_Request.base = pClient->m_Header; 
+				pClient->m_Request.len = sizeof (pClient->m_Header); 
+				pClient->m_Request_Index = 0; 
+			}
+		}
+
+		// We must get request length here because once thread started it deletes request.base and makes length zero
+		// which could hapen so fast that call to GetRequest().len immidiate after QueueWork may return zero
+
+		pClient->m_RequestsBeingProcessed++;
+		GetStatCounters(-1).MemoryConsumptionByRequestsInQueue += (pRequest->GetRequest().len + sizeof(Request)); // Event loop's counters block
+
+		pClient->m_bRequestProcessingFinished = FALSE;
+
+		m_Scheduler.QueueWork (&pRequest->m_work_t, &pClient->m_pEventLoop->m_DoneWorks, request_processing_thread, after_request_processing_thread);
 	}
 	catch(std::bad_alloc&)
 	{
@@ -869,34 +1254,46 @@ Request* LocalClientsManager::CreateRequestAndQueue(uv_buf_t* request, stClient*
 		IncreaseExceptionCount(REQUST_CREATION_EXCEPTION, __FILE__, __LINE__);
 	}
 
-	// We are calling DoPeriodicActivities here as well. In case when server is bombarded with requests, it may keep calling CreateRequestAndQueue (through on_read) continiously
-	// and LogStat and SendResponses would be hampered, resulting too many responses pending to be sent and no stat update. By calling timet we try to address that situation.
-	DoPeriodicActivities(); // Actually calls ConnectionsManager::SendResponses() which calls SendLocalClientsResponses() and SendPeerServersResponses()
+	// Responses are flushed through flush doorbell of the loop (See RequestFlush), so nothing more to do here
 
 	return pRequest;
 }
 
-// Checks if m_RequestProcessors map has processor exists for version and thread index
+// Returns processor for version and thread index, NULL if there isn't one
 RequestProcessor* LocalClientsManager::GetRequestProcessor(unsigned short Version, int ThreadIndex)
 {
 	ASSERT (ThreadIndex < RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads);
 	RequestProcessor* pRequestProcessor = NULL;
 
-	if (m_RequestProcessors[ThreadIndex].find(Version) != m_RequestProcessors[ThreadIndex].end())
+	stVersionProcessors* pVersionProcessors = GetVersionProcessors(Version);
+
+	if (pVersionProcessors)
 	{
-		pRequestProcessor = m_RequestProcessors[ThreadIndex][Version];
+		pRequestProcessor = pVersionProcessors->m_pRequestProcessors[ThreadIndex];
 	}
 
 	return pRequestProcessor;
 }
 
-// Called by request processor threads. m_ThreadIndex is thread local variable and is assigned value when thread is running first time.
+// Table is built before event loops start and doesn't change till processors are deleted, so it is read without locks
+stVersionProcessors* LocalClientsManager::GetVersionProcessors(unsigned short Version)
+{
+	stVersionProcessors** pPage = m_pVersionPages[Version / VERSIONS_PER_PAGE];
+
+	if (pPage == NULL)
+		return NULL;
+
+	return pPage[Version % VERSIONS_PER_PAGE];
+}
+
+// Called by request processor threads (workers of Scheduler). Index of worker is fixed when it starts and is -1 for any other thread.
+// Index identifies request processors as well as counters block of the thread (See ServerStatCounters)
 int LocalClientsManager::GetCurrentThreadIndex()
 {
-	return m_ThreadIndex;
+	return Scheduler::GetCurrentWorkerIndex();
 }
 
-void LocalClientsManager::request_processing_thread(uv_work_t* work_t)
+void LocalClientsManager::request_processing_thread(stWork* work_t)
 {
 	Request* pRequest = (Request*)work_t->data;
 	ASSERT (pRequest != NULL);
@@ -904,29 +1301,19 @@ void LocalClientsManager::request_processing_thread(uv_work_t* work_t)
 	LocalClientsManager* pLocalClientsManager = pClient->m_pLocalClientsManager;
 	ASSERT (pClient->m_Version != UNINITIALIZED_VERSION); // At this stage there is NO chance that version was not yet initialized
 
-	uv_rwlock_wrlock(&pLocalClientsManager->m_rwlRequestCountersLock1);
-	uv_rwlock_wrlock(&pLocalClientsManager->m_rwlRequestCountersLock2);
-	pLocalClientsManager->m_stServerStat.RequestProcessingThreadsStarted++;
-	uv_rwlock_wrunlock(&pLocalClientsManager->m_rwlRequestCountersLock2);
-	uv_rwlock_wrunlock(&pLocalClientsManager->m_rwlRequestCountersLock1);
+	int ThreadIndex = Scheduler::GetCurrentWorkerIndex();
 
-	// Let's try to get thread index (if already not) either here or in disconnection processing thread
-	if (m_ThreadIndex == -1)
-	{
-		uv_rwlock_wrlock(&pLocalClientsManager->m_rwlThreadIndexCounterLock);
-		m_ThreadIndex = pLocalClientsManager->ThreadIndexCounter++;
-		uv_rwlock_wrunlock(&pLocalClientsManager->m_rwlThreadIndexCounterLock);
+	// Counters of this thread. No other thread changes them, hence no locks needed.
+	ServerStatCounters& Counters = pLocalClientsManager->GetStatCounters(ThreadIndex);
 
-		ASSERT (m_ThreadIndex < RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads);
-	}
+	Counters.RequestProcessingThreadsStarted++;
 
 	// Get request processor associated with this thread
 	// USHORT Version = (pClient->m_Version != FORWARDED_RESPONSE_INDICATOR) ? pClient->m_Version : 0 ;
 	BOOL bRequestProcessed = FALSE;
 	
-	// RequestProcessor* pRequestProcessor = pLocalClientsManager->m_RequestProcessors[m_ThreadIndex][Version];
-	// Get request processor associated with this thread
-	RequestProcessor* pRequestProcessor = pClient->m_pLocalClientsManager->GetRequestProcessor(pClient->m_Version, m_ThreadIndex);
+	// Get request processor associated with this thread (See GetVersionProcessors)
+	RequestProcessor* pRequestProcessor = pClient->m_pLocalClientsManager->GetRequestProcessor(pClient->m_Version, ThreadIndex);
 
 	if (pRequestProcessor)
 	{
@@ -940,7 +1327,8 @@ void LocalClientsManager::request_processing_thread(uv_work_t* work_t)
 		pRequestProcessor->SetRequest(pRequest);
 
 		// Process only if shutdown was not initiated (This helps speeding up shuting down when there are loads of pending requests)
-		if (pLocalClientsManager->m_pClientsPool->IsShutdownInitiated() != TRUE)
+		// Abandoned request (suspended when its client was being disconnected) isn't processed further either.
+		if ((pLocalClientsManager->m_pClientsPool->IsShutdownInitiated() != TRUE) && (pRequest->IsAbandoned() == FALSE))
 		{
 			try
 			{
@@ -962,35 +1350,28 @@ void LocalClientsManager::request_processing_thread(uv_work_t* work_t)
 		LOG (ERROR, "Cannot process request for version 0x%X as processor for the version is not available.", pClient->m_Version);
 	}
 
-	uv_rwlock_wrlock(&pLocalClientsManager->m_rwlRequestCountersLock1);
-	uv_rwlock_wrlock(&pLocalClientsManager->m_rwlRequestCountersLock2);
-	
-	if (pRequest->IsDeferred() == FALSE)
+	if ((pRequest->IsDeferred() == FALSE) && (pRequest->GetContinuation() == NULL))
 	{
 		ULONG RequestLen = pRequest->GetRequest().len;
 		double RequestProcessingTime = ConnectionsManager::GetHighPrecesionTime() - pRequest->GetArrivalTime();
 		// RequestProcessingTime = RequestProcessingTime/(double)RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads;
 
 		if (bRequestProcessed==FALSE)
-			pLocalClientsManager->m_stServerStat.RequestsFailedToProcess++;
+			Counters.RequestsFailedToProcess++;
 
-		pLocalClientsManager->m_stServerStat.RequestsProcesed ++;
-		pLocalClientsManager->m_stServerStat.TotalRequestProcessingTime += RequestProcessingTime;
-		pLocalClientsManager->m_stServerStat.TotalRequestBytesProcessed += RequestLen; // Total request size till now
-		pLocalClientsManager->m_stServerStat.MemoryConsumptionByRequestsInQueue -= RequestLen;
-		pLocalClientsManager->m_stServerStat.RequestsProcessedPerThread[m_ThreadIndex] ++;
+		Counters.RequestsProcesed ++; // Also gives RequestsProcessedPerThread (See AddUpStatCounters)
+		Counters.TotalRequestProcessingTime += RequestProcessingTime;
+		Counters.TotalRequestBytesProcessed += RequestLen; // Total request size till now
+		Counters.MemoryConsumptionByRequestsInQueue -= RequestLen;
 	}
 
-	pLocalClientsManager->m_stServerStat.RequestProcessingThreadsFinished++ ;
-
-	uv_rwlock_wrunlock(&pLocalClientsManager->m_rwlRequestCountersLock2);
-	uv_rwlock_wrunlock(&pLocalClientsManager->m_rwlRequestCountersLock1);
+	Counters.RequestProcessingThreadsFinished++ ;
 }
 
 /*
 This function is called by event loop after 'request_processing_thread' finishes its execution
 */
-void LocalClientsManager::after_request_processing_thread(uv_work_t* work_t, int status)
+void LocalClientsManager::after_request_processing_thread(stWork* work_t, int status)
 {
 	ADD2PROFILER;
 
@@ -1021,20 +1402,42 @@ void LocalClientsManager::after_request_processing_thread(uv_work_t* work_t, int
 		pClient->MarkToDisconnect(TRUE);
 
 	
-	if (pRequest->IsDeferred() == FALSE)
+	if (pRequest->GetContinuation())
+	{
+		pLocalClientsManager->SuspendRequest(pClient, pRequest); // Queued again when resumed
+	}
+	else if (pRequest->IsDeferred() == FALSE)
 	{
-		// Important: Before we turn flag pClient->m_bRequestIsBeingProcessed to FALSE we MUST reset request buffer
+		// Important: Before we decrease pClient->m_RequestsBeingProcessed we MUST reset request buffer (unless request took its own buffer along)
 		// Also, to avoid data race (resulting in garbage value of SizeAvailable in GetRequestBuffer) we must not call this from request_processing_thread
-		pLocalClientsManager->ResetRequestBuffer(pClient); 
-		pClient->m_bRequestIsBeingProcessed = FALSE;
+		if (pRequest->GetRequestBufferSize())
+		{
+			pClient->m_pStatCounters->MemoryConsumptionByClients -= pRequest->GetRequestBufferSize();
+			pClient->m_pStatCounters->ActiveClientRequestBuffers -- ;
+		}
+		else
+		{
+			pLocalClientsManager->ResetRequestBuffer(pClient); 
+		}
+
+		pClient->m_RequestsBeingProcessed--;
+		ASSERT (pClient->m_RequestsBeingProcessed >= 0);
+
+		pClient->m_bRequestProcessingFinished = (pClient->m_RequestsBeingProcessed == 0) ? TRUE : FALSE;
 
-		pClient->m_bRequestProcessingFinished = TRUE;
+		// Queue responses held for this (and following finished) requests 
+		pLocalClientsManager->CompletePipelinedRequest(pClient, pRequest);
 
-		uv_rwlock_wrlock(&pLocalClientsManager->m_rwlRequestCountersLock2);
-		pLocalClientsManager->m_stServerStat.MemoryConsumptionByRequestsInQueue -= (sizeof(Request));
-		uv_rwlock_wrunlock(&pLocalClientsManager->m_rwlRequestCountersLock2);
+		// Requests read along with earlier ones wait in read ring. Socket may have nothing more to read, so extract them right away.
+		if (pClient->m_pReadRing)
+			pLocalClientsManager->ExtractRequestsFromReadRing(pClient);
 
-		// We MUST NOT delete Request object in request_processing_thread because it holds work_t of uv_queue_work
+		// Read further if pipeline has room now
+		pLocalClientsManager->PauseOrResumeReading(pClient);
+
+		pLocalClientsManager->GetStatCounters(-1).MemoryConsumptionByRequestsInQueue -= (sizeof(Request)); // Event loop's counters block
+
+		// We MUST NOT delete Request object in request_processing_thread because it holds work_t queued to Scheduler
 		DEL(pRequest);
 
 		// We should call DecreaseRequestResponseCount here itself and not through request processing thread.
@@ -1056,15 +1459,12 @@ void LocalClientsManager::after_request_processing_thread(uv_work_t* work_t, int
 	{
 		// LOG (NOTE, "Request processing has been deferred. Request being requeued.");
 		pRequest->DeferProcessing(FALSE);
-		int RetVal = uv_queue_work (pLocalClientsManager->loop, &pRequest->m_work_t, request_processing_thread, after_request_processing_thread);
-		ASSERT (RetVal == 0); // uv_queue_work returns non-zero only when request_processing_thread is NULL
+		pLocalClientsManager->m_Scheduler.QueueWork (&pRequest->m_work_t, &pClient->m_pEventLoop->m_DoneWorks, request_processing_thread, after_request_processing_thread);
 	}
-
-	pLocalClientsManager->DoPeriodicActivities();
 }
 
 // This function runs in threads. Called by ConnectionsManager::AddResponseToQueues.
-int LocalClientsManager::AddResponseToClientsQueues(Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException)
+int LocalClientsManager::AddResponseToClientsQueues(Response* pResponse, ClientHandlesPtrs* pClientHandlePtrs, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured)
 {
 	int ResponseReferenceCount = 0;
 	int NumberOfClients = (int) pClientHandlePtrs->size(); 
@@ -1081,7 +1481,7 @@ int LocalClientsManager::AddResponseToClientsQueues(Response* pResponse, ClientH
 		uv_rwlock_rdlock(&m_rwlWaitTillResponseForClientIsBeingAdded);
 		if (m_pClientsPool->IncreaseCountForClient(*it, pClient, RESPONSECOUNT) == TRUE) 
 		{
-			if (AddResponseToQueue(pResponse, pClient, bHasEncounteredMemoryAllocationException) == TRUE)	// Returns TRUE only when response was added to queue and client added to set (if aplicable)
+			if (AddResponseToQueueInOrder(pResponse, pClient, bHasEncounteredMemoryAllocationException, bIsBackpressured) == TRUE)	// Returns TRUE only when response was added to queue (or held to be added) and client added to set (if aplicable)
 			{
 				ResponseReferenceCount++;
 			}
@@ -1096,87 +1496,316 @@ int LocalClientsManager::AddResponseToClientsQueues(Response* pResponse, ClientH
 	return ResponseReferenceCount;
 }
 
-// Called by request processing threads through AddResponseToQueues (protected by m_rwlResponsesQueueLock)
-BOOL LocalClientsManager::AddResponseToQueue(Response* pResponse, stClient* pClient, BOOL& bHasEncounteredMemoryAllocationException)
+// Called by request processing threads through AddResponseToClientsQueues (while holding m_rwlWaitTillResponseForClientIsBeingAdded in read mode)
+// Neither takes lock over client's queue nor over direction flag. So threads adding responses don't wait for each other or for event loop.
+BOOL LocalClientsManager::AddResponseToQueue(Response* pResponse, stClient* pClient, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured)
 {
-	BOOL bAdded = FALSE;
-	std::deque<Response*>* pResponsesQueue;
-	std::set<stClient*>* pClientsSet;
+	INT64 ResponseBytes = pResponse->GetResponseLength();
+	BOOL bToDropOldest;
 
-	if (m_bResponseDirectionFlag)  // This flag is already protected by read lock by caller ConnectionsManager::AddResponseToQueues
-	{
-		pResponsesQueue = &pClient->m_ResponsesQueue1;
-		pClientsSet = &m_RecevingClientsSet1;
-	}
-	else
-	{
-		pResponsesQueue = &pClient->m_ResponsesQueue2;
-		pClientsSet = &m_RecevingClientsSet2;
-	}
+	if (ReserveResponseBytes(pResponse, pClient, bIsBackpressured, bToDropOldest) == FALSE)
+		return FALSE;
 
-	uv_rwlock_wrlock(&pClient->m_rwlResponsesQueueLock);
-	try
+	if (pClient->m_ResponsesQueues[pResponse->GetPriority()].Push(pResponse) == FALSE)
 	{
-		unsigned int ResponseQueueSize = (UINT)pResponsesQueue->size();
-		if (ResponseQueueSize < (UINT)(RequestProcessor::GetCommonParameters().MaxPendingResponses/2)) // Half of limit is available (In one of two queues)
-		{
-			pResponsesQueue->push_front(pResponse);
+		AddPendingResponseBytes(pClient, -ResponseBytes);
 
-			if (AddToClientSet (pClientsSet, pClient, TRUE) == FALSE)
-			{
-				pResponsesQueue->pop_front();
-			}
-			else
+		if (pClient->m_bResponseQueueFull == FALSE) // To reduce overlogging which could result in holding locks in logging
+			LOG (ERROR, "Response queue for a client is full. Cannot add response.");
+		pClient->m_bResponseQueueFull = TRUE;
+		bIsBackpressured = TRUE; // Client has MaxPendingResponses yet to be sent
+
+		return FALSE;
+	}
+
+	pClient->m_bResponseQueueFull = FALSE;
+
+	if (bToDropOldest)
+		pClient->m_bOverResponseBytesBudget = TRUE; // Event loop drops oldest responses when it takes client out of pending list
+
+	// Response must be pushed before client is added to pending list. Otherwise event loop could take client out of the list, 
+	// find its queue empty and never come back for this response.
+	AddToPendingClients(pClient);
+
+	return TRUE;
+}
+
+// Called by request processing threads (AddResponseToQueue and AddResponseToQueueInOrder, for held response too)
+// Lets response in as per byte budgets of client and server and backpressure policy of client, and adds its bytes to pending ones.
+// FALSE when response is dropped. bToDropOldest is set when client is over budget and its policy is BACKPRESSURE_DROP_OLDEST.
+BOOL LocalClientsManager::ReserveResponseBytes(Response* pResponse, stClient* pClient, BOOL& bIsBackpressured, BOOL& bToDropOldest)
+{
+	INT64 ResponseBytes = pResponse->GetResponseLength(); // Whole payload for each recipient of multicast, although it is shared by them
+	INT64 ClientBudget = pClient->m_MaxPendingResponseBytes.load(std::memory_order_acquire);
+	INT64 ClientPendingBytes = pClient->m_PendingResponseBytes.load(std::memory_order_relaxed);
+	INT64 PendingBytes = m_PendingResponseBytes.load(std::memory_order_relaxed);
+
+	// Budgets apply only to bytes already pending, so that response bigger than budget alone is still sent. High priority response isn't
+	// held to client's budget, which bulk responses fill up (its lane is still bounded by MaxPendingResponses).
+	BOOL bIsOverServersBudget = ((PendingBytes > 0) && (PendingBytes + ResponseBytes > m_MaxPendingResponseBytes)) ? TRUE : FALSE;
+	BOOL bIsOverClientsBudget = ((ClientBudget > 0) && (ClientPendingBytes > 0) && (ClientPendingBytes + ResponseBytes > ClientBudget) && (pResponse->GetPriority() == RESPONSE_PRIORITY_NORMAL)) ? TRUE : FALSE;
+	int Policy = bIsOverClientsBudget ? pClient->m_BackpressurePolicy : BACKPRESSURE_DROP_NEWEST;
+
+	if (bIsOverServersBudget || (bIsOverClientsBudget && ((Policy == BACKPRESSURE_DROP_NEWEST) || (Policy == BACKPRESSURE_DISCONNECT))))
+	{
+		GetStatCounters(GetCurrentThreadIndex()).ResponsesDroppedByBudget ++;
+		bIsBackpressured = TRUE;
+
+		// Only event loop can disconnect client. It does so when it takes client out of pending list (See SendLocalClientsResponses).
+		if ((bIsOverClientsBudget) && (Policy == BACKPRESSURE_DISCONNECT) && (pClient->m_bOverResponseBytesBudget.exchange(TRUE) == FALSE))
+			AddToPendingClients(pClient);
+
+		return FALSE;
+	}
+
+	// Bytes are added before response becomes visible to event loop, which releases them when it is done with response
+	AddPendingResponseBytes(pClient, ResponseBytes);
+
+	bToDropOldest = (bIsOverClientsBudget && (Policy == BACKPRESSURE_DROP_OLDEST)) ? TRUE : FALSE;
+
+	return TRUE;
+}
+
+// Called by request processing threads through AddResponseToClientsQueues (while holding m_rwlWaitTillResponseForClientIsBeingAdded in read mode)
+// Response to the client whose request is being processed is held if its earlier requests are still being processed (or their responses are yet 
+// to be queued). Held response counts as added. Event loop queues it in QueueHeldResponses.
+BOOL LocalClientsManager::AddResponseToQueueInOrder(Response* pResponse, stClient* pClient, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured)
+{
+	RequestProcessor* pRequestProcessor = pResponse->GetRequestProcessor();
+	Request* pRequest = pRequestProcessor ? pRequestProcessor->m_pRequest : NULL; // NULL for keep alive
+
+	if ((pRequest == NULL) || (pRequest->GetClient() != pClient))
+		return AddResponseToQueue(pResponse, pClient, bHasEncounteredMemoryAllocationException, bIsBackpressured);
+
+	UINT64 Sequence = pRequest->GetSequence();
+
+	// Always true when client doesn't pipeline requests
+	if (pClient->m_DirectResponsesSequence.load(std::memory_order_acquire) == Sequence)
+		return AddResponseToQueue(pResponse, pClient, bHasEncounteredMemoryAllocationException, bIsBackpressured);
+
+	ASSERT (pClient->m_pPipelineSlots);
+
+	uv_rwlock_wrlock(&pClient->m_rwlPipelineLock);
+
+	stPipelineSlot& Slot = pClient->m_pPipelineSlots[Sequence % pClient->m_MaxPipelinedRequests];
+
+	// Event loop might have queued all earlier responses but not yet published it
+	if ((Sequence == pClient->m_OldestRequestSequence) && (Slot.m_QueuedResponses == Slot.m_HeldResponses.size()))
+	{
+		uv_rwlock_wrunlock(&pClient->m_rwlPipelineLock);
+		return AddResponseToQueue(pResponse, pClient, bHasEncounteredMemoryAllocationException, bIsBackpressured);
+	}
+
+	// Held response counts against budgets as soon as it is held, so that pipelining client can't pile up responses behind slow request
+	BOOL bToDropOldest;
+
+	if (ReserveResponseBytes(pResponse, pClient, bIsBackpressured, bToDropOldest) == FALSE)
+	{
+		uv_rwlock_wrunlock(&pClient->m_rwlPipelineLock);
+		return FALSE;
+	}
+
+	try
+	{
+		Slot.m_HeldResponses.push_back(pResponse);
+	}
+	catch(std::bad_alloc&)
+	{
+		AddPendingResponseBytes(pClient, -pResponse->GetResponseLength());
+		uv_rwlock_wrunlock(&pClient->m_rwlPipelineLock);
+		bHasEncounteredMemoryAllocationException = TRUE;
+		return FALSE;
+	}
+
+	if (bToDropOldest)
+		pClient->m_bOverResponseBytesBudget = TRUE; // Oldest responses are dropped once event loop queues held ones and takes client out of pending list
+
+	uv_rwlock_wrunlock(&pClient->m_rwlPipelineLock);
+
+	return TRUE;
+}
+
+// Called by event loop (after_request_processing_thread)
+void LocalClientsManager::CompletePipelinedRequest(stClient* pClient, Request* pRequest)
+{
+	UINT64 Sequence = pRequest->GetSequence();
+
+	if (pClient->m_pPipelineSlots == NULL) // Requests are processed one by one, so nothing could have been held
+	{
+		ASSERT (Sequence == pClient->m_OldestRequestSequence);
+		pClient->m_OldestRequestSequence = Sequence+1;
+		pClient->m_DirectResponsesSequence.store(Sequence+1, std::memory_order_release);
+		return;
+	}
+
+	uv_rwlock_wrlock(&pClient->m_rwlPipelineLock);
+	pClient->m_pPipelineSlots[Sequence % pClient->m_MaxPipelinedRequests].m_bCompleted = TRUE;
+	uv_rwlock_wrunlock(&pClient->m_rwlPipelineLock);
+
+	QueueHeldResponses(pClient);
+}
+
+// Called by event loop (CompletePipelinedRequest and AfterSendingLocalClientsResponses)
+// Queues held responses starting from oldest request, moving to next request only when previous one is completed and all its responses are queued.
+void LocalClientsManager::QueueHeldResponses(stClient* pClient)
+{
+	ASSERT (pClient->m_pPipelineSlots);
+
+	BOOL bIsQueued = FALSE;
+
+	uv_rwlock_wrlock(&pClient->m_rwlPipelineLock);
+
+	pClient->m_bPipelineQueueingBlocked = FALSE;
+
+	while (pClient->m_OldestRequestSequence < pClient->m_NextRequestSequence)
+	{
+		stPipelineSlot& Slot = pClient->m_pPipelineSlots[pClient->m_OldestRequestSequence % pClient->m_MaxPipelinedRequests];
+
+		while (Slot.m_QueuedResponses < Slot.m_HeldResponses.size())
+		{
+			// Bytes of held response are already pending (See AddResponseToQueueInOrder)
+			if (pClient->m_ResponsesQueues[Slot.m_HeldResponses[Slot.m_QueuedResponses]->GetPriority()].Push(Slot.m_HeldResponses[Slot.m_QueuedResponses]) == FALSE)
 			{
-				bAdded = TRUE;
+				pClient->m_bPipelineQueueingBlocked = TRUE; // Will be retried when responses being sent are done
+				break;
 			}
 
-			pClient->m_bResponseQueueFull = FALSE;
+			Slot.m_QueuedResponses++;
+			bIsQueued = TRUE;
 		}
-		else
+
+		if (pClient->m_bPipelineQueueingBlocked)
+			break;
+
+		if (Slot.m_bCompleted == FALSE) 
 		{
-			if (pClient->m_bResponseQueueFull == FALSE) // To reduce overlogging which could result in holding locks in logging
-				LOG (ERROR, "Response queue for a client is full. Cannot add response.");
-			pClient->m_bResponseQueueFull = TRUE;
+			// Oldest request is still being processed. Thereafter it can queue its responses directly.
+			pClient->m_DirectResponsesSequence.store(pClient->m_OldestRequestSequence, std::memory_order_release);
+			break;
 		}
+
+		Slot.m_HeldResponses.clear();
+		Slot.m_QueuedResponses = 0;
+		Slot.m_bCompleted = FALSE;
+
+		pClient->m_OldestRequestSequence++;
 	}
-	catch(std::bad_alloc&) // Exception will occur only when pResponsesQueue->push
+
+	// No request is being processed. Next request can queue its responses directly.
+	if (pClient->m_OldestRequestSequence == pClient->m_NextRequestSequence)
+		pClient->m_DirectResponsesSequence.store(pClient->m_OldestRequestSequence, std::memory_order_release);
+
+	uv_rwlock_wrunlock(&pClient->m_rwlPipelineLock);
+
+	if (bIsQueued)
+		AddToPendingClients(pClient);
+}
+
+// Called from threads (AddResponseToQueue) as well as from event loop (AfterSendingLocalClientsResponses)
+// Adds client to m_pPendingClients of its event loop unless it is already there. m_bHasPendingResponses makes sure client is in the list at most once.
+void LocalClientsManager::AddToPendingClients(stClient* pClient)
+{
+	stEventLoop* pEventLoop = pClient->m_pEventLoop;
+
+	// When client is already in the list, event loop will send this response too when it takes client out of the list
+	if (pClient->m_bHasPendingResponses.exchange(TRUE) == FALSE)
 	{
-		bHasEncounteredMemoryAllocationException = TRUE;
-		IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+		stClient* pHead = pEventLoop->m_pPendingClients.load(std::memory_order_relaxed);
+
+		do
+		{
+			pClient->m_pNextPendingClient = pHead;
+		}
+		while (pEventLoop->m_pPendingClients.compare_exchange_weak(pHead, pClient, std::memory_order_release, std::memory_order_relaxed) == false);
 	}
-	uv_rwlock_wrunlock(&pClient->m_rwlResponsesQueueLock);
 
-	return bAdded;
+	// Only after client is in the list. Flush which resets count before that would miss the client.
+	RequestFlush(pEventLoop);
 }
 
-// Called from thread (AddResponseToQueue) as well as from event loop (after_send_response)
-BOOL LocalClientsManager::AddToClientSet(std::set<stClient*>* pClientsSet, stClient* pClient, BOOL bTobeLocked)
+// Called from threads (ReserveResponseBytes) as well as from event loop (AfterSendingLocalClientsResponses). Bytes are negative when released.
+void LocalClientsManager::AddPendingResponseBytes(stClient* pClient, INT64 Bytes)
 {
-	BOOL RetVal = TRUE;
+	pClient->m_PendingResponseBytes.fetch_add(Bytes, std::memory_order_relaxed);
+	m_PendingResponseBytes.fetch_add(Bytes, std::memory_order_relaxed);
+}
 
-	// Since this function gets called from threads, checking in client set if client already exists, can happen concurrent. Hence could increase performance. 
-	if (bTobeLocked) uv_rwlock_rdlock(&m_rwlClientSetLock);
-	const bool bIsClientInSet = pClientsSet->find(pClient) != pClientsSet->end();
-	if (bTobeLocked) uv_rwlock_rdunlock(&m_rwlClientSetLock);
+// Called from event loop (GetRequestBuffer)
+BOOL LocalClientsManager::IsOverResponseBytesBudget(stClient* pClient)
+{
+	INT64 ClientBudget = pClient->m_MaxPendingResponseBytes.load(std::memory_order_relaxed);
 
-	if (bIsClientInSet)
-		return TRUE;
+	return ((ClientBudget > 0) && (pClient->m_PendingResponseBytes.load(std::memory_order_relaxed) > ClientBudget)) ? TRUE : FALSE;
+}
 
-	if (bTobeLocked) uv_rwlock_wrlock(&m_rwlClientSetLock);
-	try
+// Called by event loop (SendLocalClientsResponses). Drops oldest responses of normal lane till client is within its budget, always keeping
+// the newest one. High priority responses are never dropped. Responses being sent are libuv's till write completes, so they aren't dropped but their bytes still count (slow client's
+// write may not complete for long). Dropped responses are done with in after_send_responses just as sent ones are.
+void LocalClientsManager::DropOldestResponses(stClient* pClient)
+{
+	Responses DroppedResponses;
+	Response* pResponse;
+	INT64 ClientBudget = pClient->m_MaxPendingResponseBytes.load(std::memory_order_relaxed);
+	INT64 PendingBytes = pClient->m_PendingResponseBytes.load(std::memory_order_relaxed); // Released by AfterSendingLocalClientsResponses
+
+	ResponseQueue& Queue = pClient->m_ResponsesQueues[RESPONSE_PRIORITY_NORMAL];
+
+	while ((PendingBytes > ClientBudget) && (Queue.GetCount() > 1) && ((pResponse = Queue.Peek()) != NULL))
 	{
-		pClientsSet->insert(pClient);
+		// Response not yet ready doesn't know its recipients yet. And fatal error must reach client before it is disconnected.
+		if ((pResponse->IsReadyToSend() == FALSE) || (pResponse->IsFatalErrorForLocallyConnectedClient()))
+			break;
+
+		try
+		{
+			DroppedResponses.push_back(pResponse);
+		}
+		catch(std::bad_alloc&)
+		{
+			break; // Rest are dropped when next response is added beyond budget
+		}
+
+		Queue.Pop();
+		PendingBytes -= pResponse->GetResponseLength();
 	}
-	catch(std::bad_alloc&)
+
+	if (DroppedResponses.size() == 0)
+		return;
+
+	// after_send_responses works on responses being sent, which could be those of write in progress. Let it work on dropped ones instead.
+	// Write request isn't touched, as libuv might still be using it.
+	Responses* pResponsesBeingSent = pClient->m_pResponsesBeingSent;
+	pClient->m_pResponsesBeingSent = &DroppedResponses;
+
+	pClient->m_pEventLoop->m_bAfterSendCalledBySendResponses = TRUE;
+	ConnectionsManager::after_send_responses(&pClient->m_write_req, WRITE_DROPPED);
+	pClient->m_pEventLoop->m_bAfterSendCalledBySendResponses = FALSE;
+
+	pClient->m_pResponsesBeingSent = pResponsesBeingSent;
+}
+
+// Called by event loop
+BOOL LocalClientsManager::AreResponsesQueuesEmpty(stClient* pClient)
+{
+	for (int Lane=0; Lane<RESPONSE_PRIORITIES; Lane++)
+		if (pClient->m_ResponsesQueues[Lane].IsEmpty() == FALSE)
+			return FALSE;
+
+	return TRUE;
+}
+
+// Called by event loop. TRUE when oldest response of any lane is ready to be sent.
+BOOL LocalClientsManager::IsResponseReadyToSend(stClient* pClient)
+{
+	for (int Lane=0; Lane<RESPONSE_PRIORITIES; Lane++)
 	{
-		LOG (NOTE, "Memory error adding client to receivers set. Some responses might remain in queue forever."); 
-		IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
-		RetVal = FALSE;
+		Response* pResponse = pClient->m_ResponsesQueues[Lane].Peek();
+
+		if ((pResponse) && (pResponse->IsReadyToSend()))
+			return TRUE;
 	}
-	if (bTobeLocked) uv_rwlock_wrunlock(&m_rwlClientSetLock);
 
-	return RetVal;
+	return FALSE;
 }
 
 void LocalClientsManager::getnameinfo_cb(uv_getnameinfo_t* req, int status, const char* hostname, const char* service)
@@ -1197,7 +1826,23 @@ int LocalClientsManager::StartListening(char* IPAddress, unsigned short int IPv4
 	int RetVal = InitiateRequestProcessorsAndValidateParameters();
 	ASSERT_RETURN (RetVal);
 
-    uv_tcp_init(loop, (uv_tcp_t *)&m_tcp_server);
+	m_EventLoopsCount = RequestProcessor::GetCommonParameters().EventLoops;
+	m_FlushLatencyInMilliseconds = RequestProcessor::GetCommonParameters().FlushLatencyInMilliseconds;
+	m_FlushBatchResponses = RequestProcessor::GetCommonParameters().FlushBatchResponses;
+	m_MaxPendingResponseBytes = RequestProcessor::GetCommonParameters().MaxPendingResponseBytes;
+
+	// Request buffers and response payloads of all versions fit in slab pools
+	SlabAllocator::SetMaxBlockSize(((m_MaxRequestSizeOfAllVersions > m_MaxResponseSizeOfAllVersions) ? m_MaxRequestSizeOfAllVersions : m_MaxResponseSizeOfAllVersions) + HEADER_SIZE);
+
+	m_pClientsPool->SetCurrentTime(uv_now(loop)); // Clients get activity time stamped right from first connection (See SendKeepAlive)
+
+#ifdef _WIN32
+	if (m_EventLoopsCount > 1)
+	{
+		LOG (NOTE, "Multiple event loops need SO_REUSEPORT which is not available on Windows. Running single event loop.");
+		m_EventLoopsCount = 1;
+	}
+#endif
 
 #if 1
 	if (strcmp (IPAddress, "0.0.0.0") == 0)
@@ -1215,9 +1860,6 @@ int LocalClientsManager::StartListening(char* IPAddress, unsigned short int IPv4
     RetVal = uv_ip4_addr("0.0.0.0", IPv4Port, &bind_addr); // Binding to 0.0.0.0 typically indicates that the process is listening on all configured IPv4 addresses on all interfaces.
 	ASSERT_RETURN (RetVal);
 
-    RetVal = uv_tcp_bind((uv_tcp_t *)&m_tcp_server, (const struct sockaddr*)&bind_addr, 0);
-	ASSERT_RETURN (RetVal);
-
 	// uv_getnameinfo_t 
 
 	RetVal = uv_getnameinfo (loop, &m_nameinfo_t, getnameinfo_cb, (const sockaddr*)&bind_addr, NI_NAMEREQD); 
@@ -1238,22 +1880,385 @@ int LocalClientsManager::StartListening(char* IPAddress, unsigned short int IPv4
 
 	m_ServerIPv4Address.SetAddress(strIPAddressAndPort);
 
-	m_tcp_server.data = this;
+	for (int i=0; i<m_EventLoopsCount; i++)
+	{
+		RetVal = StartEventLoop(&m_EventLoops[i], i, bind_addr);
+		ASSERT_RETURN (RetVal);
+	}
+
+	// Start threads only after all loops are listening (so that a failure above doesn't leave threads running)
+	RetVal = m_Scheduler.Start(RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads, RequestProcessor::GetCommonParameters().RequestProcessingThreadsFirstCPU, m_StatCounters);
+	ASSERT_RETURN (RetVal);
+
+	for (int i=1; i<m_EventLoopsCount; i++)
+	{
+		RetVal = uv_thread_create(&m_EventLoops[i].m_Thread, event_loop_thread, &m_EventLoops[i]);
+		ASSERT_RETURN (RetVal);
+	}
+
+	return 0;
+}
+
+// Called through StartListening. Initializes event loop (main loop is already there) and starts listening on it.
+// With more than one event loops each has its own socket bound to same address with SO_REUSEPORT. 
+int LocalClientsManager::StartEventLoop(stEventLoop* pEventLoop, int Index, struct sockaddr_in& bind_addr)
+{
+	int RetVal;
+
+	pEventLoop->m_Index = Index;
+	pEventLoop->m_pLocalClientsManager = this;
+	pEventLoop->m_pStatCounters = &m_StatCounters[EVENT_LOOP_STAT_COUNTERS + Index];
+	pEventLoop->m_pPendingClients = NULL;
+	pEventLoop->m_pDeferredClients = NULL;
+	pEventLoop->m_ResponsesToFlush = 0;
+	pEventLoop->m_bAfterSendCalledBySendResponses = FALSE;
+	pEventLoop->m_bShutdownRequested = FALSE;
+	pEventLoop->m_bStopRequested = FALSE;
+	pEventLoop->m_bDisconnectRequested = FALSE;
+	pEventLoop->m_bShutdownInitiated = FALSE;
+	pEventLoop->m_pResumedRequests = NULL;
+
+	if (Index == 0)
+	{
+		pEventLoop->m_pLoop = loop;
+	}
+	else
+	{
+		pEventLoop->m_pLoop = new uv_loop_t; // Throws std::bad_alloc which fails server start
+		RetVal = uv_loop_init(pEventLoop->m_pLoop);
+		ASSERT_RETURN (RetVal);
+	}
+
+	uv_tcp_init(pEventLoop->m_pLoop, &pEventLoop->m_tcp_server);
+	pEventLoop->m_tcp_server.data = pEventLoop;
+
+	RetVal = uv_async_init(pEventLoop->m_pLoop, &pEventLoop->m_ResumeHandle, on_requests_resumed);
+	ASSERT_RETURN (RetVal);
+	pEventLoop->m_ResumeHandle.data = pEventLoop;
+
+	RetVal = Scheduler::InitializeDoneWorks(pEventLoop->m_pLoop, &pEventLoop->m_DoneWorks);
+	ASSERT_RETURN (RetVal);
+
+	RetVal = uv_async_init(pEventLoop->m_pLoop, &pEventLoop->m_FlushDoorbell, on_flush_doorbell);
+	ASSERT_RETURN (RetVal);
+	pEventLoop->m_FlushDoorbell.data = pEventLoop;
 
-	RetVal = uv_listen((uv_stream_t*)&m_tcp_server, 256, on_new_client);
+	uv_timer_init(pEventLoop->m_pLoop, &pEventLoop->m_FlushTimer);
+	pEventLoop->m_FlushTimer.data = pEventLoop;
+
+#ifndef _WIN32
+	if (m_EventLoopsCount > 1)
+	{
+		// libuv 1.7.5 doesn't set SO_REUSEPORT. So create socket ourselves and hand it over to libuv before binding.
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			ASSERT_RETURN (-errno);
+
+		int on = 1;
+		if ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) || (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0))
+		{
+			RetVal = -errno;
+			close(fd);
+			ASSERT_RETURN (RetVal);
+		}
+
+		RetVal = uv_tcp_open(&pEventLoop->m_tcp_server, fd);
+		ASSERT_RETURN (RetVal);
+
+		RetVal = uv_async_init(pEventLoop->m_pLoop, &pEventLoop->m_AsyncHandle, on_event_loop_async);
+		ASSERT_RETURN (RetVal);
+		pEventLoop->m_AsyncHandle.data = pEventLoop;
+	}
+#endif
+
+	RetVal = uv_tcp_bind(&pEventLoop->m_tcp_server, (const struct sockaddr*)&bind_addr, 0);
+	ASSERT_RETURN (RetVal);
+
+	RetVal = uv_listen((uv_stream_t*)&pEventLoop->m_tcp_server, 256, on_new_client);
     
 	if (RetVal != 0) 
 	{
-		uv_close((uv_handle_t*) &m_tcp_server, NULL);
+		uv_close((uv_handle_t*) &pEventLoop->m_tcp_server, NULL);
 		ASSERT_RETURN (RetVal);
     }
 
 	return 0;
 }
 
+// Thread of event loop other than main
+void LocalClientsManager::event_loop_thread(void* arg)
+{
+	stEventLoop* pEventLoop = (stEventLoop*) arg;
+
+	SetCurrentEventLoopIndex(pEventLoop->m_Index); // So that GetStatCounters(-1) gives counters block of this loop
+
+	uv_run(pEventLoop->m_pLoop, UV_RUN_DEFAULT); // Returns after on_event_loop_async closes async handle (and all clients and listener are closed)
+}
+
+// Called by event loop when some other thread has woken it up through WakeUpEventLoop
+void LocalClientsManager::on_event_loop_async(uv_async_t* handle)
+{
+	stEventLoop* pEventLoop = (stEventLoop*) handle->data;
+	LocalClientsManager* pLocalClientsManager = pEventLoop->m_pLocalClientsManager;
+
+	if (pEventLoop->m_bShutdownRequested.exchange(FALSE))
+		pLocalClientsManager->ShutdownEventLoop(pEventLoop);
+
+	if (pEventLoop->m_bDisconnectRequested.exchange(FALSE))
+		pLocalClientsManager->DisconnectAllClients(pEventLoop);
+
+	if (pEventLoop->m_bStopRequested)
+	{
+		uv_close((uv_handle_t*)&pEventLoop->m_ResumeHandle, NULL);
+		Scheduler::CloseDoneWorks(&pEventLoop->m_DoneWorks);
+		uv_close((uv_handle_t*)&pEventLoop->m_FlushDoorbell, NULL);
+		uv_close((uv_handle_t*)&pEventLoop->m_FlushTimer, NULL);
+		uv_close((uv_handle_t*)handle, NULL); // Last handles of the loop. uv_run returns thereafter.
+		return;
+	}
+
+	pLocalClientsManager->DoPeriodicActivitiesOfEventLoop(pEventLoop);
+}
+
+// Called by main loop at last stage of shutdown (all clients of all loops have been closed by now)
+void LocalClientsManager::StopEventLoops()
+{
+	m_Scheduler.Stop(); // No request or disconnection is left by now. Keep alive, if still running, is finished first.
+
+	for (int i=1; i<m_EventLoopsCount; i++)
+	{
+		stEventLoop* pEventLoop = &m_EventLoops[i];
+
+		pEventLoop->m_bStopRequested = TRUE;
+		uv_async_send(&pEventLoop->m_AsyncHandle);
+		uv_thread_join(&pEventLoop->m_Thread);
+
+		uv_loop_close(pEventLoop->m_pLoop);
+		DEL (pEventLoop->m_pLoop);
+	}
+
+	if (m_EventLoopsCount > 1)
+		uv_close((uv_handle_t*)&GetMainEventLoop()->m_AsyncHandle, NULL);
+
+	uv_close((uv_handle_t*)&GetMainEventLoop()->m_ResumeHandle, NULL);
+	Scheduler::CloseDoneWorks(&GetMainEventLoop()->m_DoneWorks);
+	uv_close((uv_handle_t*)&GetMainEventLoop()->m_FlushDoorbell, NULL);
+	uv_close((uv_handle_t*)&GetMainEventLoop()->m_FlushTimer, NULL);
+}
+
+stRequestContinuation::stRequestContinuation(Request* pRequest, stClient* pClient)
+{
+	m_pRequest = pRequest;
+	m_pClient = pClient;
+	m_pEventLoop = pClient->m_pEventLoop;
+	m_State.store(CONTINUATION_SUSPENDING, std::memory_order_relaxed);
+	m_References.store(2, std::memory_order_relaxed); // Framework and application
+	m_pNextResumed = NULL;
+	m_pPrevSuspended = NULL;
+	m_pNextSuspended = NULL;
+}
+
+void stRequestContinuation::Release()
+{
+	int References = m_References.fetch_sub(1, std::memory_order_acq_rel);
+	ASSERT (References > 0); // Application must resume request only once
+
+	if (References == 1)
+		delete this;
+}
+
+// Called by event loop (after_request_processing_thread) when processor has suspended request
+void LocalClientsManager::SuspendRequest(stClient* pClient, Request* pRequest)
+{
+	stRequestContinuation* pContinuation = pRequest->GetContinuation();
+	int State = CONTINUATION_SUSPENDING;
+
+	pClient->m_pStatCounters->RequestsSuspended ++;
+
+	// Request could have been resumed even before its processing thread returned
+	if (pContinuation->m_State.compare_exchange_strong(State, CONTINUATION_SUSPENDED, std::memory_order_acq_rel) == false)
+	{
+		QueueResumedRequest(pClient, pRequest);
+		return;
+	}
+
+	pContinuation->m_pNextSuspended = pClient->m_pSuspendedRequests;
+	if (pClient->m_pSuspendedRequests)
+		pClient->m_pSuspendedRequests->m_pPrevSuspended = pContinuation;
+	pClient->m_pSuspendedRequests = pContinuation;
+
+	// Suspended request holds its pipeline slot. Client with full pipeline isn't read for as long as it waits.
+	PauseOrResumeReading(pClient);
+
+	if (pClient->IsMarkedToDisconnect())
+		AbandonSuspendedRequests(pClient);
+}
+
+// Called by event loop. Request counts as being processed all along, so it is just queued to threads again (as deferred request is).
+void LocalClientsManager::QueueResumedRequest(stClient* pClient, Request* pRequest)
+{
+	stRequestContinuation* pContinuation = pRequest->GetContinuation();
+
+	if (pContinuation->m_pPrevSuspended)
+		pContinuation->m_pPrevSuspended->m_pNextSuspended = pContinuation->m_pNextSuspended;
+	else if (pClient->m_pSuspendedRequests == pContinuation)
+		pClient->m_pSuspendedRequests = pContinuation->m_pNextSuspended;
+
+	if (pContinuation->m_pNextSuspended)
+		pContinuation->m_pNextSuspended->m_pPrevSuspended = pContinuation->m_pPrevSuspended;
+
+	pRequest->ReleaseContinuation();
+
+	if (pRequest->IsAbandoned())
+		pClient->m_pStatCounters->RequestsAbandoned ++;
+	else
+		pClient->m_pStatCounters->RequestsResumed ++;
+
+	m_Scheduler.QueueWork (&pRequest->m_work_t, &pClient->m_pEventLoop->m_DoneWorks, request_processing_thread, after_request_processing_thread);
+}
+
+// Called by event loop (through DisconnectAndDelete and SuspendRequest). Requests already resumed are left to be queued by QueueResumedRequests.
+void LocalClientsManager::AbandonSuspendedRequests(stClient* pClient)
+{
+	stRequestContinuation* pContinuation = pClient->m_pSuspendedRequests;
+
+	while (pContinuation)
+	{
+		stRequestContinuation* pNext = pContinuation->m_pNextSuspended;
+
+		if (pContinuation->m_State.exchange(CONTINUATION_RESUMED, std::memory_order_acq_rel) == CONTINUATION_SUSPENDED)
+		{
+			pContinuation->m_pRequest->Abandon();
+			QueueResumedRequest(pClient, pContinuation->m_pRequest);
+		}
+
+		pContinuation = pNext;
+	}
+}
+
+// Called from any thread (through RequestProcessor::ResumeRequestProcessing). Returns FALSE if request was abandoned.
+BOOL LocalClientsManager::ResumeRequest(stRequestContinuation* pContinuation)
+{
+	int State = pContinuation->m_State.exchange(CONTINUATION_RESUMED, std::memory_order_acq_rel);
+
+	if (State == CONTINUATION_SUSPENDED)
+	{
+		stEventLoop* pEventLoop = pContinuation->m_pEventLoop;
+		stRequestContinuation* pHead = pEventLoop->m_pResumedRequests.load(std::memory_order_relaxed);
+
+		do
+		{
+			pContinuation->m_pNextResumed = pHead;
+		}
+		while (pEventLoop->m_pResumedRequests.compare_exchange_weak(pHead, pContinuation, std::memory_order_release, std::memory_order_relaxed) == false);
+
+		if (pHead == NULL) // Loop is woken up once for whole list
+			uv_async_send(&pEventLoop->m_ResumeHandle);
+	}
+
+	// When State is CONTINUATION_SUSPENDING event loop queues request itself once its processing thread returns (See SuspendRequest)
+	pContinuation->Release(); // Application's reference
+
+	return (State != CONTINUATION_RESUMED) ? TRUE : FALSE;
+}
+
+// Called by event loop when some thread has resumed request of its client
+void LocalClientsManager::on_requests_resumed(uv_async_t* handle)
+{
+	stEventLoop* pEventLoop = (stEventLoop*) handle->data;
+	pEventLoop->m_pLocalClientsManager->QueueResumedRequests(pEventLoop);
+}
+
+// Called by event loop. Requests are queued in order they were resumed.
+void LocalClientsManager::QueueResumedRequests(stEventLoop* pEventLoop)
+{
+	stRequestContinuation* pContinuation = pEventLoop->m_pResumedRequests.exchange(NULL, std::memory_order_acquire);
+	stRequestContinuation* pReversed = NULL;
+
+	while (pContinuation)
+	{
+		stRequestContinuation* pNext = pContinuation->m_pNextResumed;
+		pContinuation->m_pNextResumed = pReversed;
+		pReversed = pContinuation;
+		pContinuation = pNext;
+	}
+
+	while (pReversed)
+	{
+		stRequestContinuation* pNext = pReversed->m_pNextResumed;
+		QueueResumedRequest(pReversed->m_pClient, pReversed->m_pRequest); // Might release continuation
+		pReversed = pNext;
+	}
+}
+
+stEventLoop* LocalClientsManager::GetMainEventLoop()
+{
+	return &m_EventLoops[0];
+}
+
+// Called from any thread
+void LocalClientsManager::WakeUpEventLoop(stEventLoop* pEventLoop)
+{
+	if (m_EventLoopsCount > 1) // Single event loop is kept running by its timer and I/O callbacks
+		uv_async_send(&pEventLoop->m_AsyncHandle);
+}
+
+// Called from any thread. Rings doorbell for first response after a flush, and once more when FlushBatchResponses are waiting.
+// Loop flushes (resetting the count) when doorbell rings or its flush timer expires, so count is never left non-zero without one of them pending.
+void LocalClientsManager::RequestFlush(stEventLoop* pEventLoop)
+{
+	int ResponsesToFlush = pEventLoop->m_ResponsesToFlush.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+	if ((ResponsesToFlush == 1) || (ResponsesToFlush == m_FlushBatchResponses))
+		uv_async_send(&pEventLoop->m_FlushDoorbell);
+}
+
+// Called by event loop when its flush doorbell is rung
+void LocalClientsManager::on_flush_doorbell(uv_async_t* handle)
+{
+	stEventLoop* pEventLoop = (stEventLoop*) handle->data;
+	LocalClientsManager* pLocalClientsManager = pEventLoop->m_pLocalClientsManager;
+
+	if ((pLocalClientsManager->m_FlushLatencyInMilliseconds == 0) || (pEventLoop->m_ResponsesToFlush >= pLocalClientsManager->m_FlushBatchResponses))
+		pLocalClientsManager->FlushResponses(pEventLoop);
+	else if (uv_is_active((uv_handle_t*)&pEventLoop->m_FlushTimer) == 0)
+		uv_timer_start(&pEventLoop->m_FlushTimer, on_flush_timer, pLocalClientsManager->m_FlushLatencyInMilliseconds, 0);
+}
+
+void LocalClientsManager::on_flush_timer(uv_timer_t* handle)
+{
+	stEventLoop* pEventLoop = (stEventLoop*) handle->data;
+	pEventLoop->m_pLocalClientsManager->FlushResponses(pEventLoop);
+}
+
+// Called by event loop. Sends responses of clients in pending list (and on main loop, of peer servers too).
+void LocalClientsManager::FlushResponses(stEventLoop* pEventLoop)
+{
+	uv_timer_stop(&pEventLoop->m_FlushTimer);
+
+	// Before sending, so that response queued while we send rings doorbell again
+	pEventLoop->m_ResponsesToFlush.exchange(0, std::memory_order_acq_rel);
+	pEventLoop->m_pStatCounters->ResponseFlushes ++;
+
+	if (pEventLoop->m_Index == 0)
+		SendResponses();
+	else
+		SendLocalClientsResponses(pEventLoop);
+}
+
+// Called by event loop
+void LocalClientsManager::DoPeriodicActivitiesOfEventLoop(stEventLoop* pEventLoop)
+{
+	if (pEventLoop->m_Index == 0)
+		DoPeriodicActivities(); // Main loop also sends responses of peer servers, logs stat, sends keep alive etc.
+	else
+		SendLocalClientsResponses(pEventLoop);
+}
+
 void LocalClientsManager::on_new_client(uv_stream_t* server, int status) 
 {
-	LocalClientsManager* pLocalClientsManager = (LocalClientsManager*) server->data ;
+	stEventLoop* pEventLoop = (stEventLoop*) server->data ; // Event loop whose listening socket got the connection
+	LocalClientsManager* pLocalClientsManager = pEventLoop->m_pLocalClientsManager ;
 
     if (status < 0) 
 	{
@@ -1278,7 +2283,7 @@ void LocalClientsManager::on_new_client(uv_stream_t* server, int status)
 			throw ClientCreationException();
 		}
 
-		pClient = new stClient (&pLocalClientsManager->m_tcp_server, pLocalClientsManager->m_stServerStat, pLocalClientsManager->m_ServerIPv4Address);
+		pClient = new stClient (pEventLoop, ++pLocalClientsManager->m_ClientRegistrationNumber, pLocalClientsManager->m_ServerIPv4Address);
 	}
 	catch(std::bad_alloc&) // stClient has STL queue which could throw bad alloc
 	{
@@ -1308,7 +2313,7 @@ void LocalClientsManager::on_new_client(uv_stream_t* server, int status)
 		return;
 	}
 
-	pLocalClientsManager->m_stServerStat.MemoryConsumptionByClients += (sizeof(stClient) + pClient->m_SizeReservedForResponsesBeingSend);
+	pClient->m_pStatCounters->MemoryConsumptionByClients += (sizeof(stClient) + pClient->m_SizeReservedForResponsesBeingSend);
 
 	if (pLocalClientsManager->AcceptConnection(pClient) == FALSE) // Calls uv_accept (to initialize m_client) and if uv_accept successfull, calls uv_read_start (starts reading)
 											  // returns FALSE if any of these calls fails. Else returns TRUE.
@@ -1348,22 +2353,31 @@ void LocalClientsManager::on_client_closed(uv_handle_t* client)
 	// Handle is closed. Now delete stClient object.
 	stClient * pClient = (stClient*) client->data ;
 	LocalClientsManager* pLocalClientsManager = pClient->m_pLocalClientsManager;
-	pLocalClientsManager->m_stServerStat.MemoryConsumptionByClients -= (sizeof(stClient)+pClient->m_SizeReservedForResponsesBeingSend);
+	pClient->m_pStatCounters->MemoryConsumptionByClients -= (sizeof(stClient)+pClient->m_SizeReservedForResponsesBeingSend);
 
 	if (pClient->m_Request.base != pClient->m_Header)
 	{
-		DEL_ARRAY (pClient->m_Request.base);
+		DEL_SLAB (pClient->m_Request.base);
 		VersionParameters* pVP = pLocalClientsManager->GetVersionParameters(pClient->m_Version);
-		pLocalClientsManager->m_stServerStat.MemoryConsumptionByClients -=  (pClient->m_bRequestMemoryAllocatedForStreaming ? (pVP->m_MaxRequestSize+HEADER_SIZE) : pClient->m_Request.len) ;
-		pLocalClientsManager->m_stServerStat.ActiveClientRequestBuffers -- ;
+		pClient->m_pStatCounters->MemoryConsumptionByClients -=  (pClient->m_bRequestMemoryAllocatedForStreaming ? (pVP->m_MaxRequestSize+HEADER_SIZE) : pClient->m_Request.len) ;
+		pClient->m_pStatCounters->ActiveClientRequestBuffers -- ;
 	}
 
+	pLocalClientsManager->ReleaseReadRing(pClient);
+
 	DEL (pClient->m_pResponsesBeingSent);
 	DEL_ARRAY (pClient->m_pResponsesBuffersBeingSent);
 
+	if (pClient->m_pPipelineSlots)
+	{
+		ASSERT (pClient->m_OldestRequestSequence == pClient->m_NextRequestSequence); // Otherwise client would have responses pending
+		DEL_ARRAY (pClient->m_pPipelineSlots);
+		uv_rwlock_destroy(&pClient->m_rwlPipelineLock);
+		pClient->m_pStatCounters->MemoryConsumptionByClients -= (sizeof(stPipelineSlot) * pClient->m_MaxPipelinedRequests);
+	}
+
 	// Destroy lock for disconnection flag
 	uv_rwlock_destroy(&pClient->m_rwlLockForDisconnectionFlag);
-	uv_rwlock_destroy(&pClient->m_rwlResponsesQueueLock);
 
 	// LOG (INFO, "Deleting client object. stClient #%d", pClient->ClientRegistrationNumber);
 	DEL(pClient);
@@ -1375,9 +2389,9 @@ void LocalClientsManager::on_client_closed(uv_handle_t* client)
 
 int LocalClientsManager::AcceptConnection(stClient* pClient)
 {
-	uv_tcp_init(loop, &pClient->m_client);
+	uv_tcp_init(pClient->m_pEventLoop->m_pLoop, &pClient->m_client);
 
-	if (uv_accept((uv_stream_t*)&m_tcp_server, (uv_stream_t*) &pClient->m_client) == 0) 
+	if (uv_accept((uv_stream_t*)pClient->m_server, (uv_stream_t*) &pClient->m_client) == 0) 
 	{
 		pClient->m_bIsAccepted = TRUE;
 		// By default Nagle's algorithm is used, if you want to disable it you need to call uv_tcp_nodelay(handle, 1). 
@@ -1385,8 +2399,11 @@ int LocalClientsManager::AcceptConnection(stClient* pClient)
 
 		uv_tcp_nodelay(&pClient->m_client, 1); // Disable Nagle
 
+#ifdef _WIN32
 		// Before we start reading, lets set internal buffer size to zero (so it will directly write from our allocated buffers).
 		// This is to avoid internal buffer overflows.
+		// Note: This is applicable only to IOCP (Windows). With epoll (Linux) kernel always copies from our buffers and zero size 
+		// would only be rounded up to minimum socket buffer size causing lot more system calls. So there we keep kernel defaults.
 		DWORD NewBuffSize = 0L;
 		DWORD NewBuffSizeLen = sizeof(DWORD);
 
@@ -1401,6 +2418,7 @@ int LocalClientsManager::AcceptConnection(stClient* pClient)
 			LOG(ERROR, "Error setting new receive buffer size");
 			return FALSE;
 		}
+#endif
 
 		int RetVal = uv_read_start((uv_stream_t*) &pClient->m_client, alloc_buffer, on_read);
 
@@ -1427,53 +2445,57 @@ void LocalClientsManager::DeleteRequestProcessors()
 {
 	// Deleting request processors
 	LOG (INFO, "Deleting request processors");
-	unsigned short MaxVersionNumber= 0xFFFF;
 
-	for (int i=0; i<RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads; i++)
+	// Enumerate all processors against each version and delete them, along with lookup table
+	for (size_t v=0; v<m_RegisteredVersions.size(); v++)
 	{
-		/*
-		for (int j=0; j<=MaxVersionNumber; j++) // m_MaxVersionNumber valid value always >= 1 and at zero index we have forward request processor (version: FORWARDED_RESPONSE_INDICATOR)
+		USHORT Version = m_RegisteredVersions[v];
+		stVersionProcessors* pVersionProcessors = GetVersionProcessors(Version);
+
+		if (pVersionProcessors == NULL) // Initialization had failed
+			continue;
+
+		for (int i=0; i<RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads; i++)
 		{
-			RequestProcessor* pRequestProcessor = GetRequestProcessor(j, i);
+			RequestProcessor* pRequestProcessor = pVersionProcessors->m_pRequestProcessors[i];
 			if (pRequestProcessor)
 				pRequestProcessor->DeleteProcessor();  
 		}
-		*/
 
-		// Enumerate all processors against each thread and delete them
-		m_RequestProcessors[i];
-		typedef std::map<USHORT, RequestProcessor*>::iterator it_type;
-		it_type iterator_end =  m_RequestProcessors[i].end();
-		for(it_type iterator = m_RequestProcessors[i].begin(); iterator != iterator_end; iterator++) 
-		{
-			USHORT version = iterator->first;
-			RequestProcessor* pRequestProcessor = iterator->second;
-			ASSERT(pRequestProcessor);
-			pRequestProcessor->DeleteProcessor();  
-		}
-
-		m_RequestProcessors[i].clear();   
+		DEL (m_pVersionPages[Version / VERSIONS_PER_PAGE][Version % VERSIONS_PER_PAGE]);
 	}
 
+	for (int i=0; i<VERSION_PAGES; i++)
+		DEL_ARRAY (m_pVersionPages[i]);
+
+	m_RegisteredVersions.clear();
+
 	// Finally delete the one we used to send keep alive signals
 	m_pReqProcessorToSendKepAlive->DeleteProcessor();
 }
 
-// Called through DoPeriodicActivities
+// Called through DoPeriodicActivities every second. Advances keep alive wheel and queues keep alive thread only if there are idle clients.
 void LocalClientsManager::SendKeepAlive()
 {
+	// Loop time stamped as activity time by threads
+	m_pClientsPool->SetCurrentTime(uv_now(loop));
+
 	if (m_keep_alive_work_t.data != NULL)
 	{
 		LOG (NOTE, "Couldn't run keep alive. Last one was still in progress."); 
 		return;
 	}
 
+	m_pClientsPool->GetIdleClients(m_IdleClients[VersionedClient], m_IdleClients[VersionlessClient]);
+
+	if (m_IdleClients[VersionedClient].empty() && m_IdleClients[VersionlessClient].empty())
+		return;
+
 	m_keep_alive_work_t.data = this ;
-	int RetVal = uv_queue_work (loop, &m_keep_alive_work_t, send_keepalive_thread, after_send_keepalive_thread);
-	ASSERT (RetVal == 0); // uv_queue_work returns non-zero only when disconnection_processing_thread is NULL
+	m_Scheduler.QueueWork (&m_keep_alive_work_t, &GetMainEventLoop()->m_DoneWorks, send_keepalive_thread, after_send_keepalive_thread);
 }
 
-void LocalClientsManager::send_keepalive_thread(uv_work_t* work_t)
+void LocalClientsManager::send_keepalive_thread(stWork* work_t)
 {
 	ConnectionsManager* pConnectionsManager = (ConnectionsManager*)work_t->data;
 	LocalClientsManager* pLocalClientsManager = (LocalClientsManager*)work_t->data;
@@ -1484,8 +2506,7 @@ void LocalClientsManager::send_keepalive_thread(uv_work_t* work_t)
 	{
 		for (ClientType Type = VersionedClient; Type <= VersionlessClient; Type=(ClientType(1+(int)Type)))
 		{
-			ClientHandles clienthandles;
-			pLocalClientsManager->m_pClientsPool->GetIdleClients(clienthandles, Type);
+			ClientHandles& clienthandles = pLocalClientsManager->m_IdleClients[Type];
 
 			unsigned int RecepientsCount = (UINT)clienthandles.size(); 
 
@@ -1497,7 +2518,8 @@ void LocalClientsManager::send_keepalive_thread(uv_work_t* work_t)
 				response.base = (char *)&response_code;
 				response.len = 1;
 
-				pLocalClientsManager->m_pReqProcessorToSendKepAlive->SendResponse (&clienthandles, &response);
+				// Keep alive is to be sent even when client has lot of bulk responses pending
+				pLocalClientsManager->m_pReqProcessorToSendKepAlive->SendResponse (&clienthandles, &response, DEFAULT_VERSION, RESPONSE_PRIORITY_HIGH);
 
 				// for (unsigned int i=0; i<RecepientsCount; i++) // Let's avoid log in iteration as it could hold write lock which can hamper event loop performance.
 				if (response_code == RESPONSE_KEEP_ALIVE) 
@@ -1513,9 +2535,14 @@ void LocalClientsManager::send_keepalive_thread(uv_work_t* work_t)
 	}
 }
 
-void LocalClientsManager::after_send_keepalive_thread(uv_work_t* m_keep_alive_work_t, int status)
+void LocalClientsManager::after_send_keepalive_thread(stWork* m_keep_alive_work_t, int status)
 {
 	LOG (NOTE, "Done with keep alive thread");
+
+	LocalClientsManager* pLocalClientsManager = (LocalClientsManager*)m_keep_alive_work_t->data;
+	pLocalClientsManager->m_IdleClients[VersionedClient].clear();
+	pLocalClientsManager->m_IdleClients[VersionlessClient].clear();
+
 	m_keep_alive_work_t->data = NULL ;
 }
 
@@ -1526,7 +2553,7 @@ unsigned int LocalClientsManager::GetClientsConnectedCount()
 
 BOOL LocalClientsManager::IsServerStopped ()
 {
-	return m_bServerStopped;
+	return (m_ServersStopped == m_EventLoopsCount) ? TRUE : FALSE;
 }
 
 BOOL LocalClientsManager::HasAllClientsDisconnectedForShutdown()
@@ -1550,102 +2577,139 @@ int LocalClientsManager::GetActiveProcessors()
 // 1. uv_write returns negative error code
 // 2. uv_write returns 0 but fails afterwards (calls callback with negative error code)
 // 3. uv_write returns 0 and succeeds
-void LocalClientsManager::SendLocalClientsResponses() 
+void LocalClientsManager::SendLocalClientsResponses(stEventLoop* pEventLoop) 
 {
 	ADD2PROFILER;
 
-	/* Get client set and check size */
-	std::set<stClient*>* pClientsSet;
+	// Take whole list of pending clients at once. Threads keep adding clients to (new) list meanwhile without waiting for us.
+	stClient* pPendingClients = pEventLoop->m_pPendingClients.exchange(NULL, std::memory_order_acquire);
 
-	if (m_bResponseDirectionFlag)
-	{
-		pClientsSet = &m_RecevingClientsSet2;
-	}
-	else
+	if ((pPendingClients == NULL) && (pEventLoop->m_pDeferredClients == NULL))
+		return;
+
+	// Clients deferred in last pass are served first (they are still marked as having pending responses)
+	stClient* pClientsInOrder = pEventLoop->m_pDeferredClients;
+	pEventLoop->m_pDeferredClients = NULL;
+
+	// Clients are pushed at head of the list. Let's reverse it so that clients are served in order they got responses.
+
+	while (pPendingClients)
 	{
-		pClientsSet = &m_RecevingClientsSet1;
+		stClient* pNext = pPendingClients->m_pNextPendingClient;
+		pPendingClients->m_pNextPendingClient = pClientsInOrder;
+		pClientsInOrder = pPendingClients;
+		pPendingClients = pNext;
 	}
 
-	// While threads are adding clients to set1, SendLocalClientsResponses will busy sending responses from set2 (and vice versa) so we don't need lock here. 
-	// uv_rwlock_rdlock(&m_rwlClientSetLock); 
-	int clients_count = (int)pClientsSet->size(); 
-	// uv_rwlock_rdunlock(&m_rwlClientSetLock);
+	/* Send responses for local Clients */
+	while (pClientsInOrder)
+	{
+		stClient* pClient = pClientsInOrder;
+		pClientsInOrder = pClient->m_pNextPendingClient;
 
-	if (clients_count == 0)
-		return;
+		ASSERT (pClient && (pClient->m_pEventLoop == pEventLoop));
 
-	/* Send responses for local Clients */
-	std::set<stClient*>::iterator itClientsSet = pClientsSet->begin();
-	std::set<stClient*>::iterator itClientsSetEnd = pClientsSet->end();
+		pClient->m_pNextPendingClient = NULL;
 
-	while (itClientsSet != itClientsSetEnd)
-	{
-		std::set<stClient*>::iterator current = itClientsSet++;
+		// Client is out of the list now. Any response pushed hereafter will add it back to the list. 
+		// (exchange, unlike plain store, makes sure we see responses pushed by thread which had set this flag)
+		pClient->m_bHasPendingResponses.exchange(FALSE);
 
-		stClient* pClient = *current;
+		// Thread refusing response beyond client's budget can't disconnect client itself (See AddResponseToQueue)
+		if ((pClient->m_BackpressurePolicy == BACKPRESSURE_DISCONNECT) && (pClient->m_bOverResponseBytesBudget.exchange(FALSE) == TRUE) && (pClient->IsMarkedToDisconnect() == FALSE))
+		{
+			LOG (ERROR, "Client has exceeded its budget of pending response bytes. Marking client for disconnect (Version 0x%X)", pClient->GetVersion());
+			pClient->MarkToDisconnect(TRUE);
+			pClient->m_pStatCounters->ClientsDisconnectedByBudget ++;
+		}
 
-		ASSERT (pClient);
+		if ((pClient->m_bOverResponseBytesBudget.exchange(FALSE) == TRUE) && (pClient->IsMarkedToDisconnect() == FALSE))
+			DropOldestResponses(pClient);
 
 		if (pClient->m_pResponsesBeingSent->size()) // Response for this client was already queued (m_write_req.data (aka m_pResponseBeingSent))
 		{
-			pClientsSet->erase(current); // By using direction flag, we are erasing from different set than that is being added to by threads. So no need of m_rwlClientSetLock here.
+			continue; // AfterSendingLocalClientsResponses will add client back to the list if its queue has responses 
+		}
+
+		if (AreResponsesQueuesEmpty(pClient)) // Responses were sent in earlier pass (client was added to list again meanwhile)
+		{
+			// DisconnectAndDelete might have skipped deleting this client as it was in the list. 
+			if (pClient->IsMarkedToDisconnect() == TRUE)
+				DisconnectAndDelete(pClient);
 			continue;
 		}
 
-		for (int i=0; (i<RequestProcessor::GetCommonParameters().MaxPendingResponses) && (pClient->m_pResponsesBuffersBeingSent[i].base); i++)
+		if (IsResponseReadyToSend(pClient) == FALSE) // Threads are still adding these responses to queues of other clients
+		{
+			// Retry in next pass. Keep client in deferred list unless some thread has added it back to pending list meanwhile.
+			if (pClient->m_bHasPendingResponses.exchange(TRUE) == FALSE)
+			{
+				pClient->m_pNextPendingClient = pEventLoop->m_pDeferredClients;
+				pEventLoop->m_pDeferredClients = pClient;
+			}
+			continue;
+		}
+
+		for (int i=0; (i<RequestProcessor::GetCommonParameters().MaxPendingResponses * BUFFERS_PER_RESPONSE) && (pClient->m_pResponsesBuffersBeingSent[i].base); i++)
 		{
 			pClient->m_pResponsesBuffersBeingSent[i].base = NULL;
 			pClient->m_pResponsesBuffersBeingSent[i].len = 0;
 		}
 
-		std::deque<Response*>* pResponsesQueue = (m_bResponseDirectionFlag) ? (&pClient->m_ResponsesQueue2)	: (&pClient->m_ResponsesQueue1);
-
-		// There must be responses in queue
-		const int ResponseQueueSize = (int)pResponsesQueue->size();
-		ASSERT (ResponseQueueSize > 0);
-
 		// Make sure we haven't changed capacity of responses being sent. Because we don't want it to throw bad_alloc when we add elements to it.
-		ASSERT (pClient->m_pResponsesBeingSent->capacity() >= RequestProcessor::GetCommonParameters().MaxPendingResponses);
-		// Also make sure responses in queue aren't exceeding limit
-		ASSERT (ResponseQueueSize <=  RequestProcessor::GetCommonParameters().MaxPendingResponses);
-
-		for (int i=0; pResponsesQueue->size(); i++)
+		const int MaxPendingResponses = RequestProcessor::GetCommonParameters().MaxPendingResponses;
+		ASSERT (pClient->m_pResponsesBeingSent->capacity() >= MaxPendingResponses);
+		// Each lane can hold MaxPendingResponses. Write takes as many of them, rest are sent after it (AfterSendingLocalClientsResponses adds client back to the list).
+		Response* pResponse;
+		BOOL bIsFatalErrorNext = FALSE; // Goes as first response of next write
+
+		int i = 0; // Index in responses being sent
+		for (int Lane=RESPONSE_PRIORITIES-1; (Lane >= 0) && (bIsFatalErrorNext == FALSE); Lane--)
 		{
-			Response* pResponse = pResponsesQueue->back();
+			for (; (i < MaxPendingResponses) && ((pResponse = pClient->m_ResponsesQueues[Lane].Peek()) != NULL); i++)
+			{
+				ASSERT (pResponse); 
 
-			ASSERT (pResponse); 
-			ASSERT (pResponse->GetReferenceCount()); //  There must be references to responses
-			ASSERT (pResponse->IsForward() == FALSE); // We MUST NOT receive here response being forwarded 
+				if (pResponse->IsReadyToSend() == FALSE) // Rest of lane will be sent after this write (AfterSendingLocalClientsResponses adds client back to the list)
+					break;
 
-			if (pResponse->IsFatalErrorForLocallyConnectedClient()) // FATAL_ERROR signifies client to be disconnected
-			{
-				if (i==0)
-				{
-					LOG (ERROR, "Client disconnection requested. Marking client for disconnect (Version 0x%X)", pClient->GetVersion());
-					pClient->MarkToDisconnect(TRUE);
-				}
-				else
+				ASSERT (pResponse->GetReferenceCount()); //  There must be references to responses
+				ASSERT (pResponse->IsForward() == FALSE); // We MUST NOT receive here response being forwarded 
+
+				if (pResponse->IsFatalErrorForLocallyConnectedClient()) // FATAL_ERROR signifies client to be disconnected
 				{
-					if (pClient->IsMarkedToDisconnect() == FALSE)
-						break;
+					if (i==0)
+					{
+						LOG (ERROR, "Client disconnection requested. Marking client for disconnect (Version 0x%X)", pClient->GetVersion());
+						pClient->MarkToDisconnect(TRUE);
+					}
+					else
+					{
+						if (pClient->IsMarkedToDisconnect() == FALSE)
+						{
+							bIsFatalErrorNext = TRUE;
+							break;
+						}
+					}
 				}
-			}
 
-			pResponse->QueuedTime = ConnectionsManager::GetHighPrecesionTime();
+				pResponse->QueuedTime = ConnectionsManager::GetHighPrecesionTime();
 
-			pClient->m_pResponsesBeingSent->push_back(pResponse); // This won't throw std:bad_alloc as max response memory is already allocated in stClient c'tor
-			pClient->m_pResponsesBuffersBeingSent[i] = pResponse->GetResponse(); 
+				pClient->m_pResponsesBeingSent->push_back(pResponse); // This won't throw std:bad_alloc as max response memory is already allocated in stClient c'tor
+				const uv_buf_t* pResponseBuffers = pResponse->GetResponseBuffers(); // Header and payload. Payload is shared by all recipients and is never copied here.
+				for (int j=0; j<BUFFERS_PER_RESPONSE; j++)
+					pClient->m_pResponsesBuffersBeingSent[(i*BUFFERS_PER_RESPONSE)+j] = pResponseBuffers[j]; 
 
-			pResponsesQueue->pop_back();
+				pClient->m_ResponsesQueues[Lane].Pop();
+			}
 		}
 
 		// If one of the response at middle of queue has indicated "fatal error" we won't have it in "being sent" responses,
-		// resulting in response queue still having some responses pending
-		if (pResponsesQueue->size() == 0)
-			std::deque<class Response*>().swap(*pResponsesQueue);
+		// resulting in response queue still having some responses pending (AfterSendingLocalClientsResponses will add client back to the list)
 
 		int RetVal_uv_write = 0 ;
-		const int NumberOfBuffers = (int)pClient->m_pResponsesBeingSent->size();
+		const int NumberOfResponses = (int)pClient->m_pResponsesBeingSent->size();
+		const int NumberOfBuffers = NumberOfResponses * BUFFERS_PER_RESPONSE;
 
 #ifndef NO_WRITE
 		if ((RetVal_uv_write == 0) && (pClient->IsMarkedToDisconnect() == FALSE))
@@ -1662,23 +2726,23 @@ void LocalClientsManager::SendLocalClientsResponses()
 
 		if (RetVal_uv_write >= 0)
 		{
-			m_stServerStat.ResponsesBeingSent += NumberOfBuffers;
+			pClient->m_pStatCounters->ResponsesBeingSent += NumberOfResponses;
 		}
 		else
 		{
-			after_send_response_called_by_send_response = TRUE;
+			pEventLoop->m_bAfterSendCalledBySendResponses = TRUE;
 			// In case when uv_write succeeds, libuv assigns handle to req.handle so tht we get it in callback
 			// But in case of failure we've to assign it on our own
 			pClient->m_write_req.handle = (uv_stream_t*) &pClient->m_client; 
 			ConnectionsManager::after_send_responses(&pClient->m_write_req, RetVal_uv_write);
-			after_send_response_called_by_send_response = FALSE;
+			pEventLoop->m_bAfterSendCalledBySendResponses = FALSE;
 		}
-
-		// We come here when there is no response left in client's queue or response written was successful.
-		// In either case we must remove client from set. It will be added back to the set in after_send_response or in AddResponseToQueue
-		pClientsSet->erase(current); // By using direction flag, we are erasing from different set than that is being added to by threads. So no need of m_rwlClientSetLock here.
 	}
 
+	// Retry deferred clients in next iteration of the loop. Their responses will be ready by then mostly.
+	if (pEventLoop->m_pDeferredClients)
+		RequestFlush(pEventLoop);
+
 	return ;
 }
 
@@ -1686,10 +2750,12 @@ void LocalClientsManager::AfterSendingLocalClientsResponses(stClient* pClient, R
 {
 	ADD2PROFILER;
 
-	int ResponseLength = pResponse->GetResponse().len;
+	int ResponseLength = pResponse->GetResponseLength();
 
 	ASSERT (pResponse->IsForward() == FALSE); // We must receive here only local clients responses
 
+	AddPendingResponseBytes(pClient, -ResponseLength); // Added when response was queued (See AddResponseToQueue)
+
 	switch (status)
 	{
 		case WRITE_OK: // LIBUV calls after_send_response with 0 as status when send is successful
@@ -1701,26 +2767,37 @@ void LocalClientsManager::AfterSendingLocalClientsResponses(stClient* pClient, R
 			// Before we delete the pResponse, to know statistics let's find out how many responses sent and of what type
 			switch(ResponseType)
 			{
-				case RESPONSE_KEEP_ALIVE	: m_stServerStat.ResponsesKeepAlives ++; break;
-				case RESPONSE_ERROR			: m_stServerStat.ResponsesErrors ++; break;
-				case RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP	: m_stServerStat.ResponsesAcknowledgementsOfForwardedResponses ++; break;
-				case RESPONSE_FATAL_ERROR	: m_stServerStat.ResponsesFatalErrors ++; break;
-				case RESPONSE_ORDINARY		: m_stServerStat.ResponsesOrdinary ++; break;
+				case RESPONSE_KEEP_ALIVE	: pClient->m_pStatCounters->ResponsesKeepAlives ++; break;
+				case RESPONSE_ERROR			: pClient->m_pStatCounters->ResponsesErrors ++; break;
+				case RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP	:
+				case RESPONSE_ACKNOWLEDGEMENTS_OF_FORWARDED_RESPS	:
+				case RESPONSE_CUMULATIVE_ACKNOWLEDGEMENT	:
+				case RESPONSE_CREDIT_GRANT	:
+				case RESPONSE_COMPRESSION_SUPPORTED	:
+				case RESPONSE_COMPACT_HANDLES_SUPPORTED	: pClient->m_pStatCounters->ResponsesAcknowledgementsOfForwardedResponses ++; break;
+				case RESPONSE_FATAL_ERROR	: pClient->m_pStatCounters->ResponsesFatalErrors ++; break;
+				case RESPONSE_ORDINARY		: pClient->m_pStatCounters->ResponsesOrdinary ++; break;
 				default						: ASSERT(0); break;
 			}
 
 			if (pResponse->IsForward()) 
-				m_stServerStat.ResponsesForwarded ++;
+				pClient->m_pStatCounters->ResponsesForwarded ++;
 
 			if (pResponse->IsMulticast())
-				m_stServerStat.ResponsesMulticasts ++; 
+				pClient->m_pStatCounters->ResponsesMulticasts ++; 
 
 			if (pResponse->IsUpdate())
-				m_stServerStat.ResponsesUpdates ++;
+				pClient->m_pStatCounters->ResponsesUpdates ++;
 
-			m_stServerStat.ResponsesSent ++; // Total responses sent for all clients
-			m_stServerStat.TotalResponseBytesSent += ResponseLength;
-			ASSERT(m_stServerStat.TotalResponseBytesSent > 0);
+			pClient->m_pStatCounters->ResponsesSent ++; // Total responses sent for all clients
+			pClient->m_pStatCounters->TotalResponseBytesSent += ResponseLength;
+			ASSERT(pClient->m_pStatCounters->TotalResponseBytesSent > 0);
+		}
+		break;
+
+		case WRITE_DROPPED: // Client's budget of pending response bytes was exceeded (See DropOldestResponses)
+		{
+			pClient->m_pStatCounters->ResponsesDroppedByBudget ++;
 		}
 		break;
 
@@ -1728,12 +2805,12 @@ void LocalClientsManager::AfterSendingLocalClientsResponses(stClient* pClient, R
 		{
 			// According to this thread we MUST disconnect connection for which uv_write is not successful
 			// https://groups.google.com/forum/#!topic/libuv/nJa3WeiVs2U
-			m_stServerStat.ResponsesFailedToSend++; // Total responses (local) failed to send
+			pClient->m_pStatCounters->ResponsesFailedToSend++; // Total responses (local) failed to send
 
 #ifndef NO_WRITE
 			if (pClient->IsMarkedToDisconnect() == FALSE) // To avoid overlogging
 			{
-				LOG (ERROR, "Unable to send response. Marking client for disconnect. Error code %d (%s) (Version 0x%X Is called by SendResponse %d)", status, uv_strerror(status), pClient->GetVersion(), pClient->m_pLocalClientsManager->after_send_response_called_by_send_response);
+				LOG (ERROR, "Unable to send response. Marking client for disconnect. Error code %d (%s) (Version 0x%X Is called by SendResponse %d)", status, uv_strerror(status), pClient->GetVersion(), pClient->m_pEventLoop->m_bAfterSendCalledBySendResponses);
 				pClient->MarkToDisconnect(TRUE); 
 			}
 #endif
@@ -1744,44 +2821,41 @@ void LocalClientsManager::AfterSendingLocalClientsResponses(stClient* pClient, R
 	// It's appropriate to call DecreaseCountForClient here. Because if we call it in SendResponse it could enable stClient to be deleted. 
 	// Before event loop calls after_send_response if client gets deleted (through DisconnectClient) from somewhere else, 
 	// then the stClient pointer we receive in after_send_response won't be valid anymore.
-	std::deque<class Response*> *pResponseQueueLocked, *pResponseQueueUnlocked;
-
 	m_pClientsPool->DecreaseCountForClient(pClient, RESPONSECOUNT); 
 
+	// Dropped response is done with while client is being served by SendLocalClientsResponses, which sends rest of its queue itself.
+	// Client isn't freed by DecreaseCountForClient above as newest response is always kept in queue.
+	if (status == WRITE_DROPPED)
+	{
+		if (pClient->m_bPipelineQueueingBlocked)
+			QueueHeldResponses(pClient);
+
+		PauseOrResumeReading(pClient); // Bytes of dropped response are released above
+		return;
+	}
+
 	// aAlthough response was not deleted, we should make pClient->m_pResponseBeingSent (aka m_write_req.data) NULL so SendResponse next time can learn it was sent.
 	// pClient->m_pResponseBeingSent = NULL;
 
-	// Add pClient to client sets
-	std::set <stClient*> *pClientsSetUnlocked, *pClientsSetLocked;
+	// Queue was full while queueing responses held for pipelined requests. Now that it has room, try again.
+	if (pClient->m_bPipelineQueueingBlocked)
+		QueueHeldResponses(pClient);
 
-	pResponseQueueLocked = m_bResponseDirectionFlag ? &pClient->m_ResponsesQueue1 : &pClient->m_ResponsesQueue2;
-	pResponseQueueUnlocked = m_bResponseDirectionFlag ? &pClient->m_ResponsesQueue2 : &pClient->m_ResponsesQueue1;
-	pClientsSetLocked = m_bResponseDirectionFlag ? &m_RecevingClientsSet1 : &m_RecevingClientsSet2;
-	pClientsSetUnlocked = m_bResponseDirectionFlag ? &m_RecevingClientsSet2 : &m_RecevingClientsSet1;
+	PauseOrResumeReading(pClient); // Pipeline might have room now, or client might be within its budget again
 
-	int UnlockedQueueSize = (int)pResponseQueueUnlocked->size();
+	// Responses added while this write was in progress were skipped by SendLocalClientsResponses. Add client back to pending list for them.
+	BOOL bIsResponseQueueEmpty = AreResponsesQueuesEmpty(pClient);
 
-	if (UnlockedQueueSize != 0)
-	{
-		AddToClientSet (pClientsSetUnlocked, pClient, FALSE); //pClientsSetUnlocked->insert(pClient);
-	}
-
-	uv_rwlock_rdlock(&pClient->m_rwlResponsesQueueLock);
-	int LockedQueueSize = (int)pResponseQueueLocked->size();
-	if (LockedQueueSize != 0)
-	{
-		AddToClientSet (pClientsSetLocked, pClient, TRUE); // pClientsSetLocked->insert(pClient);
-	}
-	uv_rwlock_rdunlock(&pClient->m_rwlResponsesQueueLock);
+	if (bIsResponseQueueEmpty == FALSE)
+		AddToPendingClients(pClient);
 
 	// If stClient was marked for deletion. If yes, call DisconnectAndDelete
 	if (pClient->IsMarkedToDisconnect() == TRUE) // pClient is NULL for FORWARDED response
 	{
 		// stClient has been marked for deletion. And MarkToDelete has been called only from event loop.
-		// Hence, client was already marked for deletion before we get values of UnlockedQueueSize & LockedQueueSize.
-		// So there is no chance that the values could get incremented thereafter (as marked to delete client cannot be added responses to).
-		int Responses = UnlockedQueueSize + LockedQueueSize;
-		if ((Responses == 0)) // We are putting this additional check just for performance improvement. DisconnectAndDelete call is safe without this also.
+		// Hence, client was already marked for deletion before we checked its queue.
+		// So there is no chance that responses could get added thereafter (as marked to delete client cannot be added responses to).
+		if (bIsResponseQueueEmpty) // We are putting this additional check just for performance improvement. DisconnectAndDelete call is safe without this also.
 		{
 			if (DisconnectAndDelete(pClient)) // DisconnectAndDelete tries to remove stClient from CL pool. If successful, proceeds disconnect and deleting stClient object.
 				LOG (NOTE, "Client is being disconnected through AfterSendingLocalClientsResponses (bIsByServer TRUE)");
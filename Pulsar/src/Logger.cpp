@@ -22,36 +22,45 @@
 // This is how logger is planned to work:
 //
 // Log will be called throughout server code as and when needed
-// Log keeps populating info/note/error maps
+// Log formats message into log ring of calling thread (See Logger.h). It takes no lock and allocates no memory.
 //
 // LogStat will be called by event loop at predefined interval
 // LogStat keeps appending stat queue with stats
 //
 // Logger thread keeps contineously running (It starts when ConnectionsManager::StartServer calls Logger::Start). 
-// When it sees new element in stat map, it will call log processing function with stat structure and other maps (info/note/errors)
+// It drains log rings into info/note/error maps. When it sees new element in stat queue, it will call log processing function with stat
+// structure and other maps (info/note/errors)
 //
 // Once processing is done, Logger thread erases info map, and deletes the stat structure from stat queue. 
 // It then gets next stat from queue and calls again log processing function
-// If there is nothing in stat queue, it waits for 100 millisecond
+// If there is nothing in stat queue (and no ring has many records pending or records spilled), it sleeps till LogStat (or Log) wakes it up
 //
 // Called from GetInstance (which is called through ConnectionsManager c'tor)
 
 Logger* Logger::m_LoggerInstance=NULL;
 
+static THREAD_LOCAL stLogRing* m_pThreadsLogRing = NULL; // Assigned by each thread when it logs first time
+
 Logger::Logger()
 {
 	ASSERT(m_LoggerInstance == NULL); // Only one instance allowed. Logger is having single instance. (Because we cannot run uv_queue_work from threads)
 	m_LoggerInstance = this;
 
 	uv_rwlock_init(&m_rwlStatQueue);
-	uv_rwlock_init(&m_rwlErrorsMap);
-	uv_rwlock_init(&m_rwlExceptionsMap);
-	uv_rwlock_init(&m_rwlNotesMap);
-	uv_rwlock_init(&m_rwlDebugMap);
-	uv_rwlock_init(&m_rwlInfoMap  );
+	uv_rwlock_init(&m_rwlCallSitesMap);
+	uv_mutex_init(&m_SleepLock);
+	uv_cond_init(&m_WakeUpCondition);
 
 	m_log_work_t.data = m_LoggerInstance;
 
+	m_pLogRings = NULL;
+	m_bSleeping = FALSE;
+	m_RecordsDropped = 0;
+
+	m_pBinaryLogFile = NULL;
+	m_bBinaryLog = FALSE;
+	m_BinaryLogRecordsDropped = 0;
+
 	m_bStopLoggerThread = FALSE;
 	m_bLoggerThreadStopped = TRUE;
 }
@@ -69,6 +78,7 @@ int Logger::Start(uv_loop_t* loop)
 BOOL Logger::Stop()
 {
 	m_bStopLoggerThread = TRUE;
+	WakeUpLogProcessingThread();
 
 	if (m_bLoggerThreadStopped) 
 		return TRUE;
@@ -81,11 +91,26 @@ Logger::~Logger()
 	ASSERT (m_bLoggerThreadStopped == TRUE); // Application should call Stop() before deleting logger
 
 	uv_rwlock_destroy(&m_rwlStatQueue);
-	uv_rwlock_destroy(&m_rwlErrorsMap);
-	uv_rwlock_destroy(&m_rwlExceptionsMap);
-	uv_rwlock_destroy(&m_rwlNotesMap);
-	uv_rwlock_destroy(&m_rwlDebugMap);
-	uv_rwlock_destroy(&m_rwlInfoMap  );
+	uv_rwlock_destroy(&m_rwlCallSitesMap);
+	uv_mutex_destroy(&m_SleepLock);
+	uv_cond_destroy(&m_WakeUpCondition);
+
+	stLogRing* pLogRing = m_pLogRings.exchange(NULL);
+
+	while (pLogRing)
+	{
+		stLogRing* pNext = pLogRing->m_pNext;
+		uv_mutex_destroy(&pLogRing->m_SpillLock);
+		DEL_ARRAY (pLogRing->m_pRecords);
+		DEL (pLogRing);
+		pLogRing = pNext;
+	}
+
+	for (InternedLogCallSitesMap::iterator it = m_CallSitesMap.begin(); it != m_CallSitesMap.end(); it++)
+		DEL (it->second);
+
+	if (m_pBinaryLogFile) // Logger was never started
+		fclose (m_pBinaryLogFile);
 }
 
 // Called from ConnectionsManager c'tor
@@ -102,53 +127,63 @@ When it sees new element in stat map, it will call log processing function with
 
 Once processing is done, Logger thread erases info map, and deletes the stat structure from stat queue. 
 	It then gets next stat from queue and calls again log processing function
-	If there is nothing in stat queue, it waits for 100 millisecond
+	If there is nothing to process, it sleeps on m_WakeUpCondition. It sets m_bSleeping before it checks for work under m_SleepLock,
+	and threads check m_bSleeping after they have added work, so either it sees the work or they see it sleeping and signal.
 */
 void Logger::log_processing_thread (uv_work_t* log_work_t)
 {
 	Logger * pLogger = (Logger*) log_work_t->data;
-	BOOL bToQuitAfterQueueCheck = FALSE;
 
 	while(1)
 	{
-		// Get size. If non zero, get next element in the queue and remove it from queue.
-		// We MUST do all three in single lock to avoid writer to modify the queue causing inconsistancy
-		uv_rwlock_wrlock(&pLogger->m_rwlStatQueue);
-		int QSize = static_cast<int> (pLogger->m_StatQueue.size());
+		uv_mutex_lock(&pLogger->m_SleepLock);
+		pLogger->m_bSleeping = TRUE;
 
-		if ((!QSize) && (bToQuitAfterQueueCheck == FALSE))
-		{
-			// If no elements in queue, shrink the queue (or it may keep large amount of memory occupied unnecessarily)
-			std::queue<ServerStat>(pLogger->m_StatQueue).swap(pLogger->m_StatQueue);
-
-			uv_rwlock_wrunlock(&pLogger->m_rwlStatQueue);
+		while (pLogger->HasWorkToProcess() == FALSE)
+			uv_cond_wait(&pLogger->m_WakeUpCondition, &pLogger->m_SleepLock);
 
-			Sleep(333); // When all the elements in queue are done, take a little pause...
-			if (pLogger->m_bStopLoggerThread == TRUE)
-				bToQuitAfterQueueCheck = TRUE;
+		pLogger->m_bSleeping = FALSE;
+		uv_mutex_unlock(&pLogger->m_SleepLock);
 
-			continue;
-		}
+		BOOL bToQuitAfterQueueCheck = pLogger->m_bStopLoggerThread; // Stats logged before stop are processed first
 
-		ServerStat stServerStat;
+		pLogger->DrainLogRings();
 
-		if (QSize)
+		while (1)
 		{
-			stServerStat = pLogger->m_StatQueue.front();  
+			// Get size. If non zero, get next element in the queue and remove it from queue.
+			// We MUST do all three in single lock to avoid writer to modify the queue causing inconsistancy
+			uv_rwlock_wrlock(&pLogger->m_rwlStatQueue);
+
+			if (pLogger->m_StatQueue.empty())
+			{
+				// If no elements in queue, shrink the queue (or it may keep large amount of memory occupied unnecessarily)
+				std::queue<ServerStat>(pLogger->m_StatQueue).swap(pLogger->m_StatQueue);
+				uv_rwlock_wrunlock(&pLogger->m_rwlStatQueue);
+				break;
+			}
+
+			ServerStat stServerStat = pLogger->m_StatQueue.front();  
 			pLogger->m_StatQueue.pop();
-		}
-		uv_rwlock_wrunlock(&pLogger->m_rwlStatQueue);
+			uv_rwlock_wrunlock(&pLogger->m_rwlStatQueue);
 
-		if (QSize)
-		{
 			// Compute some additional stat (based on existing statistical data)
 			pLogger->ComputeAdditionalStat(stServerStat);
 			pLogger->GetCopyAndProcessLog(stServerStat); 
+
+			// Rather than at every drain, as drains are frequent under load
+			if (pLogger->m_pBinaryLogFile)
+				fflush (pLogger->m_pBinaryLogFile);
 		}
-		else if (bToQuitAfterQueueCheck == TRUE) // No element in queue and its time to quit
-		{
+
+		if (bToQuitAfterQueueCheck == TRUE) // No element in queue and its time to quit
 			break;
-		}
+	}
+
+	if (pLogger->m_pBinaryLogFile)
+	{
+		fclose (pLogger->m_pBinaryLogFile);
+		pLogger->m_pBinaryLogFile = NULL;
 	}
 }
 
@@ -158,6 +193,133 @@ void Logger::after_log_processing_thread (uv_work_t* log_work_t, int status)
 	pLogger->m_bLoggerThreadStopped = TRUE;
 }
 
+// Called by log processing thread under m_SleepLock. Ring having many records pending (or having spilled) is drained without waiting for
+// next stat, so that it doesn't get full (or spill grow).
+BOOL Logger::HasWorkToProcess ()
+{
+	if (m_bStopLoggerThread)
+		return TRUE;
+
+	uv_rwlock_rdlock(&m_rwlStatQueue);
+	BOOL bIsStatQueued = (m_StatQueue.empty() == false) ? TRUE : FALSE;
+	uv_rwlock_rdunlock(&m_rwlStatQueue);
+
+	if (bIsStatQueued)
+		return TRUE;
+
+	for (stLogRing* pLogRing = m_pLogRings.load(); pLogRing; pLogRing = pLogRing->m_pNext)
+	{
+		if (((pLogRing->m_Head.load() - pLogRing->m_Tail.load(std::memory_order_relaxed)) >= pLogRing->m_WakeUp) || pLogRing->m_bSpilling.load())
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Called by logging threads, LogStatistics and Stop
+void Logger::WakeUpLogProcessingThread ()
+{
+	if (m_bSleeping)
+	{
+		uv_mutex_lock(&m_SleepLock);
+		uv_cond_signal(&m_WakeUpCondition);
+		uv_mutex_unlock(&m_SleepLock);
+	}
+}
+
+// Called by log processing thread. Records are moved to maps (and written to binary log) in order each thread logged them.
+void Logger::DrainLogRings ()
+{
+	INT64 RecordsDropped = 0;
+
+	for (stLogRing* pLogRing = m_pLogRings.load(std::memory_order_acquire); pLogRing; pLogRing = pLogRing->m_pNext)
+	{
+		UINT Tail = pLogRing->m_Tail.load(std::memory_order_relaxed);
+		UINT Head = pLogRing->m_Head.load(std::memory_order_acquire);
+
+		for (; Tail != Head; Tail++)
+			ProcessLogRecord (pLogRing->m_pRecords[Tail & (pLogRing->m_Size-1)]);
+
+		pLogRing->m_Tail.store(Tail, std::memory_order_release); // Logging thread can reuse the records now
+
+		// Spilled records are newer than those in ring, as thread doesn't use ring till they are taken over
+		if (pLogRing->m_bSpilling.load())
+		{
+			std::deque<stLogRecord> Spilled;
+
+			uv_mutex_lock(&pLogRing->m_SpillLock);
+			Spilled.swap(pLogRing->m_Spilled);
+			pLogRing->m_bSpilling = FALSE;
+			uv_mutex_unlock(&pLogRing->m_SpillLock);
+
+			for (std::deque<stLogRecord>::iterator it = Spilled.begin(); it != Spilled.end(); it++)
+				ProcessLogRecord (*it);
+		}
+
+		RecordsDropped += pLogRing->m_Dropped.load(std::memory_order_relaxed);
+	}
+
+	m_RecordsDropped = RecordsDropped;
+
+	if (m_pBinaryLogFile)
+	{
+		if (m_BinaryLogRecordsDropped != m_RecordsDropped)
+		{
+			UCHAR Kind = BINARY_LOG_DROPPED;
+			UINT64 Time = uv_hrtime();
+
+			fwrite (&Kind, sizeof(Kind), 1, m_pBinaryLogFile);
+			fwrite (&Time, sizeof(Time), 1, m_pBinaryLogFile);
+			fwrite (&m_RecordsDropped, sizeof(m_RecordsDropped), 1, m_pBinaryLogFile);
+
+			m_BinaryLogRecordsDropped = m_RecordsDropped;
+		}
+	}
+}
+
+// Called by log processing thread (through DrainLogRings)
+void Logger::ProcessLogRecord (stLogRecord& Record)
+{
+	if (m_pBinaryLogFile)
+		WriteToBinaryLog (Record);
+
+	switch (Record.m_Type)
+	{
+		case ASSERTION:
+		case ERROR:
+			IncreaseMapCounter (m_ErrorsMap, Record);
+			break;
+
+		case EXCEPTION:
+			IncreaseMapCounter (m_ExceptionsMap, Record);
+			break;
+
+		case NOTE:
+			// Note need not have to maintain counter. Insert only once in map.
+			try
+			{
+				std::string Message, Note;
+				DecodeMessage (Record.m_pCallSite->m_Format, Record.m_Arguments, Record.m_ArgumentsLength, Message);
+				ComposeMessage (Record.m_pCallSite, NOTE, Message.c_str(), Note);
+				if (m_NotesMap.find(Note) == m_NotesMap.end())
+					m_NotesMap[Note]++;
+			}
+			catch(std::bad_alloc&)
+			{
+			}
+			break;
+
+		case DEBUG:
+			if (PROCESS_DEBUG_LOGS) // Else it was recorded only for binary log
+				IncreaseMapCounter (m_DebugMap, Record);
+			break;
+
+		default:
+			IncreaseMapCounter (m_InfoMap, Record);
+			break;
+	}
+}
+
 // Called by log processing thread
 void Logger::ComputeAdditionalStat (ServerStat& stServerStat)
 {
@@ -190,7 +352,7 @@ void Logger::ComputeAdditionalStat (ServerStat& stServerStat)
 
 	
 	/* Compute actual and max estimated handle count */
-	::GetProcessHandleCount(GetCurrentProcess(), &stServerStat.ActualHandleCount);
+	stServerStat.ActualHandleCount = ConnectionsManager::GetProcessHandleCount();
 
 	int NumberOfConnections = stServerStat.ClientsConnectionsActive; 
 	static int NumberOfMaxConnections = 0;
@@ -224,23 +386,26 @@ void Logger::GetCopyAndProcessLog(ServerStat& stServerStat)
 {
 	try
 	{
-		/* Lock and get copies of each map. So that we won't hold any thread while logging when log is being processed */
+		/* Maps are touched only by this thread. Copies (with call sites turned into messages) are passed to ProcessLog. */
 		LoggerMap InfoMapCopy, NotesMapCopy, ErrorsMapCopy, ExceptionsMapCopy, DebugMapCopy;
 
 		// Get copy of info map
-		GetMapCopy (m_InfoMap, InfoMapCopy, m_rwlInfoMap, TRUE);
+		GetMapCopy (m_InfoMap, INFO, InfoMapCopy, TRUE);
 
 		// Get copy of notes map
-		GetMapCopy (m_NotesMap, NotesMapCopy, m_rwlNotesMap);
+		NotesMapCopy = m_NotesMap;
 
 		// Get copy of errors map
-		GetMapCopy (m_ErrorsMap, ErrorsMapCopy, m_rwlErrorsMap);
+		GetMapCopy (m_ErrorsMap, ERROR, ErrorsMapCopy);
+
+		if (m_RecordsDropped)
+			ErrorsMapCopy["[Logger] Log records dropped as log ring of logging thread was full (debug) or they couldn't be spilled"] = m_RecordsDropped;
 
 		// Get copy of exceptions map
-		GetMapCopy (m_ExceptionsMap, ExceptionsMapCopy, m_rwlExceptionsMap);
+		GetMapCopy (m_ExceptionsMap, EXCEPTION, ExceptionsMapCopy);
 
 		// Get copy of debug map
-		GetMapCopy (m_DebugMap, DebugMapCopy, m_rwlDebugMap, TRUE);
+		GetMapCopy (m_DebugMap, DEBUG, DebugMapCopy, TRUE);
 
 		ProcessLog (stServerStat, InfoMapCopy, NotesMapCopy, ErrorsMapCopy, ExceptionsMapCopy, DebugMapCopy);    
 	}
@@ -252,13 +417,20 @@ void Logger::GetCopyAndProcessLog(ServerStat& stServerStat)
 }
 
 // Called by log processing thread (through GetCopyAndProcessLog)
-void Logger::GetMapCopy (LoggerMap& Map, LoggerMap& MapCopy, uv_rwlock_t& Lock, BOOL bEraseOriginalMap)
+void Logger::GetMapCopy (CallSiteLogMap& Map, int Type, LoggerMap& MapCopy, BOOL bEraseOriginalMap)
 {
-	// Get copy of Info map and erase all elements of the original map
-	uv_rwlock_wrlock(&Lock);
+	// Get copy of map (latest message of each call site with its count) and erase all elements of the original map if asked
 	try
 	{
-		MapCopy = Map;
+		std::string Message, ComposedMessage;
+
+		for (CallSiteLogMap::iterator it = Map.begin(); it != Map.end(); it++)
+		{
+			DecodeMessage (it->first->m_Format, it->second.m_LastArguments.data(), (int) it->second.m_LastArguments.size(), Message);
+			ComposeMessage (it->first, Type, Message.c_str(), ComposedMessage);
+			MapCopy[ComposedMessage] += it->second.m_Count;
+		}
+
 		if(bEraseOriginalMap)
 			Map.clear(); 
 	}
@@ -266,7 +438,6 @@ void Logger::GetMapCopy (LoggerMap& Map, LoggerMap& MapCopy, uv_rwlock_t& Lock,
 	{
 		std::cout << "\nEXCEPTION bad_alloc in log processing thread." ;
 	}
-	uv_rwlock_wrunlock(&Lock);
 }
 
 
@@ -286,6 +457,8 @@ void Logger::LogStatistics (ServerStat& stServerStat)
 	}
 
 	uv_rwlock_wrunlock(&m_rwlStatQueue); 
+
+	WakeUpLogProcessingThread();
 }
 
 void Logger::getClassName(const char* fullFuncName, std::string& csClassName)
@@ -310,138 +483,700 @@ void Logger::getClassName(const char* fullFuncName, std::string& csClassName)
 	}
 }
 
+// Called by log processing thread and by LogMessage for assertions. Throws bad_alloc.
+void Logger::ComposeMessage (const stLogCallSite* pCallSite, int Type, const char* Message, std::string& ComposedMessage)
+{
+	std::string Component="";
+	if (pCallSite->m_FunctionName)
+	{
+		// Only class name as component for info and notes
+		if ((Type == INFO) || (Type == NOTE))
+			getClassName(pCallSite->m_FunctionName, Component);
+		else
+			Component = pCallSite->m_FunctionName;
+	}
+
+	ComposedMessage = (std::string)"[" + Component + (std::string)"] ";
+	ComposedMessage += Message; 
+
+	if (((Type == ERROR) || (Type == EXCEPTION)) && pCallSite->m_FileName)
+		ComposedMessage += (std::string)" (In " + pCallSite->m_FileName + (std::string)", at line " + std::to_string(pCallSite->m_LineNumber)+ (std::string)")";
+}
+
+// Called by logging thread when it logs first time
+stLogRing* Logger::GetLogRing ()
+{
+	if (m_pThreadsLogRing)
+		return m_pThreadsLogRing;
+
+	stLogRing* pLogRing = NULL;
+
+	try
+	{
+		pLogRing = new stLogRing;
+		pLogRing->m_Size = (m_bBinaryLog) ? BINARY_LOG_RING_SIZE : LOG_RING_SIZE;
+		pLogRing->m_pRecords = new stLogRecord[pLogRing->m_Size];
+	}
+	catch(std::bad_alloc&)
+	{
+		DEL (pLogRing);
+		return NULL; // Thread will try again when it logs next time
+	}
+
+	pLogRing->m_WakeUp = pLogRing->m_Size / LOG_RING_WAKE_UP_DIVISOR;
+	pLogRing->m_Head = 0;
+	pLogRing->m_Tail = 0;
+	pLogRing->m_Dropped = 0;
+	pLogRing->m_bSpilling = FALSE;
+	uv_mutex_init(&pLogRing->m_SpillLock);
+	pLogRing->m_pNext = m_pLogRings.load(std::memory_order_relaxed);
+
+	while (m_pLogRings.compare_exchange_weak(pLogRing->m_pNext, pLogRing, std::memory_order_release, std::memory_order_relaxed) == false);
+
+	m_pThreadsLogRing = pLogRing;
+
+	return pLogRing;
+}
 
 /*------------------------------------------------------------------------------------------------------------------------------------*/
-// Called by event loop as well as request processing threads
-void Logger::LogMessage (int Type, char* FileName, int LineNumber,  char* Function, char* LogFormatMsg, ...)
+// Called by event loop as well as request processing threads (through LOG). Message isn't formatted here (See EncodeArguments).
+void Logger::LogMessage (int Type, const stLogCallSite* pCallSite, const char* LogFormatMsg, ...)
 {
-	if (((Type == DEBUG) && (PROCESS_DEBUG_LOGS == FALSE)) || (Type == IGNORE) || (LogFormatMsg == NULL)) 
+	if (((Type == DEBUG) && (PROCESS_DEBUG_LOGS == FALSE) && (m_bBinaryLog == FALSE)) || (Type == IGNORE) || (LogFormatMsg == NULL))
+		return ;
+
+	stLogRing* pLogRing = GetLogRing();
+
+	if (pLogRing == NULL) // for any reason
 		return ;
 
-	char* LogMessage = NULL;
-	int LogMsgLen = DEFAULT_LOG_MSG_LENGTH;
-	int characters_written = -1;
+	UINT Head = pLogRing->m_Head.load(std::memory_order_relaxed);
+	UINT Tail = pLogRing->m_Tail.load(std::memory_order_acquire);
 
-	while(characters_written < 0)
+	// Only this thread sets m_bSpilling, so it is never seen reset while its spilled records are still there
+	BOOL bToSpill = (pLogRing->m_bSpilling.load(std::memory_order_relaxed) || ((Head - Tail) >= pLogRing->m_Size)) ? TRUE : FALSE;
+
+	if (bToSpill && (Type == DEBUG) && (m_bBinaryLog == FALSE))
 	{
-		va_list args;
-		va_start(args, LogFormatMsg);
+		pLogRing->m_Dropped.store(pLogRing->m_Dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); // Only this thread writes it
+		return ;
+	}
+
+	stLogRecord SpilledRecord;
+	stLogRecord& Record = (bToSpill) ? SpilledRecord : pLogRing->m_pRecords[Head & (pLogRing->m_Size-1)];
+	Record.m_pCallSite = pCallSite;
+	Record.m_Type = Type;
+	Record.m_Time = (m_bBinaryLog) ? uv_hrtime() : 0;
 
+	va_list args;
+	va_start(args, LogFormatMsg);
+	Record.m_ArgumentsLength = (USHORT) EncodeArguments (LogFormatMsg, args, Record.m_Arguments, DEFAULT_LOG_MSG_LENGTH);
+	va_end(args);
+
+	if (Type == ASSERTION)
+	{
 		try
 		{
-			LogMessage = new char [LogMsgLen];
+			std::string Message, logmessage;
+			DecodeMessage (pCallSite->m_Format, Record.m_Arguments, Record.m_ArgumentsLength, Message);
+			ComposeMessage (pCallSite, Type, Message.c_str(), logmessage);
+			std::cout << "\n\n\n" << logmessage;
 		}
 		catch(std::bad_alloc&)
 		{
-			break;
 		}
+	}
 
-		// If the storage required to store the data and a terminating null exceeds sizeOfBuffer, and count is _TRUNCATE, 
-		// as much of the string as will fit in buffer is written and -1 returned.
-		characters_written = vsnprintf_s(LogMessage, LogMsgLen, _TRUNCATE, LogFormatMsg, args);
-
-		va_end(args);
+	if (bToSpill)
+	{
+		uv_mutex_lock(&pLogRing->m_SpillLock);
 
-		if (characters_written < 0)
+		try
 		{
-			DEL_ARRAY (LogMessage);
-			LogMsgLen += LOG_MSG_INCREMENT;
+			if ((Type == DEBUG) && (pLogRing->m_Spilled.size() >= BINARY_LOG_SPILL_LIMIT)) // Debug records are many, not to grow without bound
+				pLogRing->m_Dropped.store(pLogRing->m_Dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			else
+			{
+				pLogRing->m_Spilled.push_back(Record);
+				pLogRing->m_bSpilling = TRUE; // Sequentially consistent, so that it is ordered before m_bSleeping is checked
+			}
 		}
+		catch(std::bad_alloc&)
+		{
+			pLogRing->m_Dropped.store(pLogRing->m_Dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		uv_mutex_unlock(&pLogRing->m_SpillLock);
+
+		WakeUpLogProcessingThread();
+		return ;
 	}
 
-	if (LogMessage == NULL) // for any reason
-	{
-		// std::cout << "\n[" << Component << "]" << LogFormatMsg ;
+	pLogRing->m_Head.store(Head + 1); // Sequentially consistent, so that it is ordered before m_bSleeping is checked (See log_processing_thread)
+
+	if ((Head + 1 - Tail) >= pLogRing->m_WakeUp)
+		WakeUpLogProcessingThread();
+}
+
+// Called by server application which logs without LOG. Message is formatted here, as format need not be string literal.
+// Call site is looked up by file name and line number.
+void Logger::LogMessage (int Type, const char* FileName, int LineNumber, const char* Function, const char* LogFormatMsg, ...)
+{
+	if (((Type == DEBUG) && (PROCESS_DEBUG_LOGS == FALSE) && (m_bBinaryLog == FALSE)) || (Type == IGNORE) || (LogFormatMsg == NULL))
 		return ;
+
+	const stLogCallSite* pCallSite = NULL;
+
+	try
+	{
+		std::pair<std::string, int> Key((FileName) ? FileName : "", LineNumber);
+
+		uv_rwlock_rdlock(&m_rwlCallSitesMap);
+		InternedLogCallSitesMap::iterator it = m_CallSitesMap.find(Key);
+		if (it != m_CallSitesMap.end())
+			pCallSite = &it->second->m_CallSite;
+		uv_rwlock_rdunlock(&m_rwlCallSitesMap);
+
+		if (pCallSite == NULL)
+		{
+			uv_rwlock_wrlock(&m_rwlCallSitesMap);
+			try
+			{
+				stInternedLogCallSite*& pMappedCallSite = m_CallSitesMap[Key];
+
+				if (pMappedCallSite == NULL)
+				{
+					stInternedLogCallSite* pInternedCallSite = new stInternedLogCallSite;
+
+					try
+					{
+						pInternedCallSite->m_FileName = Key.first;
+						pInternedCallSite->m_FunctionName = (Function) ? Function : "";
+					}
+					catch(std::bad_alloc&)
+					{
+						DEL (pInternedCallSite);
+						throw;
+					}
+
+					pInternedCallSite->m_CallSite.m_FileName = (FileName) ? pInternedCallSite->m_FileName.c_str() : NULL;
+					pInternedCallSite->m_CallSite.m_LineNumber = LineNumber;
+					pInternedCallSite->m_CallSite.m_FunctionName = (Function) ? pInternedCallSite->m_FunctionName.c_str() : NULL;
+					pInternedCallSite->m_CallSite.m_Format = "%s";
+
+					pMappedCallSite = pInternedCallSite;
+				}
+
+				pCallSite = &pMappedCallSite->m_CallSite;
+			}
+			catch(std::bad_alloc&)
+			{
+				m_CallSitesMap.erase(Key); // Entry might have been inserted without call site
+			}
+			uv_rwlock_wrunlock(&m_rwlCallSitesMap);
+		}
 	}
+	catch(std::bad_alloc&)
+	{
+	}
+
+	if (pCallSite == NULL)
+		return;
+
+	char LogMessage[DEFAULT_LOG_MSG_LENGTH];
+
+	va_list args;
+	va_start(args, LogFormatMsg);
+	// If the storage required to store the data and a terminating null exceeds sizeOfBuffer, and count is _TRUNCATE, 
+	// as much of the string as will fit in buffer is written and -1 returned.
+	int characters_written = vsnprintf_s(LogMessage, DEFAULT_LOG_MSG_LENGTH, _TRUNCATE, LogFormatMsg, args);
+	va_end(args);
+
+	if ((characters_written < 0) && (LogMessage[0] == 0)) // Message couldn't be formatted
+		return ;
+
+	this->LogMessage (Type, pCallSite, "%s", LogMessage);
+}
 
-	// Convert Component and LogMessage to std::string
+// Called by log processing thread (through DrainLogRings)
+void Logger::IncreaseMapCounter (CallSiteLogMap& Map, stLogRecord& Record)
+{
+	// As per standards, map value gets initialized when we insert new key
+	// So we can safely assume here that counter value of call site will be zero when we insert new info/error
 	try
 	{
-		std::string Component="";
-		if (Function)
+		stCallSiteLog& CallSiteLog = Map[Record.m_pCallSite];
+		CallSiteLog.m_Count++ ;
+		CallSiteLog.m_LastArguments.assign(Record.m_Arguments, Record.m_ArgumentsLength);
+	}
+	catch(std::bad_alloc&)
+	{
+	}
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------------*/
+// Called by logging threads (through LogMessage) and by DecodeMessage. pFormat points to '%'. Returns pointer past the conversion.
+const char* Logger::ParseConversion (const char* pFormat, stLogConversion& Conversion)
+{
+	const char* p = pFormat + 1;
+	int Flags = 0;
+
+	while (*p && strchr("-+ #0", *p) && (Flags < (int)sizeof(Conversion.m_Flags)-1))
+		Conversion.m_Flags[Flags++] = *p++;
+
+	Conversion.m_Flags[Flags] = 0;
+
+	Conversion.m_Width = -1;
+	if (*p == '*')
+	{
+		Conversion.m_Width = LOG_ARGUMENT_FROM_LIST;
+		p++;
+	}
+	else if ((*p >= '0') && (*p <= '9'))
+	{
+		for (Conversion.m_Width = 0; (*p >= '0') && (*p <= '9'); p++)
+			Conversion.m_Width = (Conversion.m_Width * 10) + (*p - '0');
+	}
+
+	Conversion.m_Precision = -1;
+	if (*p == '.')
+	{
+		p++;
+
+		if (*p == '*')
 		{
-			// Only class name as component for info and notes
-			if ((Type == INFO) || (Type == NOTE))
-				getClassName(Function, Component);
-			else
-				Component = Function;
+			Conversion.m_Precision = LOG_ARGUMENT_FROM_LIST;
+			p++;
+		}
+		else
+		{
+			for (Conversion.m_Precision = 0; (*p >= '0') && (*p <= '9'); p++)
+				Conversion.m_Precision = (Conversion.m_Precision * 10) + (*p - '0');
 		}
+	}
+
+	Conversion.m_Length = stLogConversion::LENGTH_DEFAULT;
 
-		std::string logmessage;
-		logmessage = (std::string)"[" + (std::string)Component + (std::string)"] ";
-		logmessage += LogMessage; 
+	if ((p[0] == 'h') && (p[1] == 'h'))			{ Conversion.m_Length = stLogConversion::LENGTH_HH; p += 2; }
+	else if (p[0] == 'h')						{ Conversion.m_Length = stLogConversion::LENGTH_H; p += 1; }
+	else if ((p[0] == 'l') && (p[1] == 'l'))	{ Conversion.m_Length = stLogConversion::LENGTH_LL; p += 2; }
+	else if (p[0] == 'l')						{ Conversion.m_Length = stLogConversion::LENGTH_L; p += 1; }
+	else if ((p[0] == 'q') || (p[0] == 'j'))	{ Conversion.m_Length = stLogConversion::LENGTH_LL; p += 1; }
+	else if ((p[0] == 'z') || (p[0] == 't'))	{ Conversion.m_Length = stLogConversion::LENGTH_SIZE; p += 1; }
+	else if (p[0] == 'L')						{ Conversion.m_Length = stLogConversion::LENGTH_LONG_DOUBLE; p += 1; }
+	else if ((p[0] == 'I') && (p[1] == '6') && (p[2] == '4'))	{ Conversion.m_Length = stLogConversion::LENGTH_LL; p += 3; } // Microsoft specific
+	else if ((p[0] == 'I') && (p[1] == '3') && (p[2] == '2'))	{ p += 3; }
+	else if (p[0] == 'I')						{ Conversion.m_Length = stLogConversion::LENGTH_SIZE; p += 1; }
 
-		if ((Type == ERROR) || (Type == EXCEPTION))
-			logmessage += (std::string)" (In " + FileName + (std::string)", at line " + std::to_string(LineNumber)+ (std::string)")";
+	Conversion.m_Conversion = *p;
 
-		LoggerMap* pLoggerMap;
-		uv_rwlock_t* pLock;
+	if (*p)
+		p++;
+
+	return p;
+}
 
-		switch(Type)
+// Called by logging threads (through LogMessage). Each argument format string asks for is copied as it is, in order:
+// Integers (including '*' width and precision and characters) as INT64, floating points as double, pointers as UINT64 and strings as
+// USHORT length followed by characters (without null). Arguments that don't fit in Size are left out, along with the ones after them.
+int Logger::EncodeArguments (const char* Format, va_list args, char* pArguments, int Size)
+{
+	char* p = pArguments;
+	char* pEnd = pArguments + Size;
+	BOOL bIsFull = FALSE;
+
+	for (const char* pFormat = strchr(Format, '%'); pFormat && (bIsFull == FALSE); pFormat = strchr(pFormat, '%'))
+	{
+		stLogConversion Conversion;
+		pFormat = ParseConversion (pFormat, Conversion);
+
+		INT64 Integer;
+		double Double;
+		UINT64 Pointer;
+		const char* String = NULL;
+		size_t StringLength = 0;
+		int ArgumentSize = 0;
+		void* pArgument = NULL;
+
+		if (Conversion.m_Width == LOG_ARGUMENT_FROM_LIST)
 		{
-			case ASSERTION:
-				std::cout << "\n\n\n" << logmessage;
-				// No break here intentionally
+			Integer = va_arg(args, int);
 
-			case ERROR:
-				pLoggerMap = &m_ErrorsMap;
-				pLock = &m_rwlErrorsMap;
+			if ((p + sizeof(Integer)) > pEnd)
 				break;
 
-			case EXCEPTION:
-				pLoggerMap = &m_ExceptionsMap;
-				pLock = &m_rwlExceptionsMap;
+			memcpy (p, &Integer, sizeof(Integer));
+			p += sizeof(Integer);
+		}
+
+		if (Conversion.m_Precision == LOG_ARGUMENT_FROM_LIST)
+		{
+			Integer = va_arg(args, int);
+			Conversion.m_Precision = (int) Integer;
+
+			if ((p + sizeof(Integer)) > pEnd)
 				break;
 
-			case NOTE:
-				pLoggerMap = &m_NotesMap;
-				pLock = &m_rwlNotesMap;
+			memcpy (p, &Integer, sizeof(Integer));
+			p += sizeof(Integer);
+		}
+
+		switch (Conversion.m_Conversion)
+		{
+			case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': case 'C':
+				if (Conversion.m_Length == stLogConversion::LENGTH_L)
+					Integer = va_arg(args, long);
+				else if (Conversion.m_Length == stLogConversion::LENGTH_LL)
+					Integer = va_arg(args, long long);
+				else if (Conversion.m_Length == stLogConversion::LENGTH_SIZE)
+					Integer = (INT64) va_arg(args, size_t);
+				else
+					Integer = va_arg(args, int); // Shorter ones are promoted to int
+
+				pArgument = &Integer;
+				ArgumentSize = sizeof(Integer);
 				break;
 
-			case DEBUG:
-				pLoggerMap = &m_DebugMap;
-				pLock = &m_rwlDebugMap;
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				if (Conversion.m_Length == stLogConversion::LENGTH_LONG_DOUBLE)
+					Double = (double) va_arg(args, long double);
+				else
+					Double = va_arg(args, double);
+
+				pArgument = &Double;
+				ArgumentSize = sizeof(Double);
 				break;
 
-			default:
-				pLoggerMap = &m_InfoMap;
-				pLock = &m_rwlInfoMap;
+			case 'p':
+				Pointer = (UINT64) (uintptr_t) va_arg(args, void*);
+				pArgument = &Pointer;
+				ArgumentSize = sizeof(Pointer);
+				break;
+
+			case 's': case 'S':
+				String = va_arg(args, const char*);
+
+				if ((Conversion.m_Conversion == 'S') || (Conversion.m_Length == stLogConversion::LENGTH_L))
+					String = ""; // Wide strings aren't recorded
+				else if (String == NULL)
+					String = "(null)";
+
+				StringLength = (Conversion.m_Precision >= 0) ? strnlen(String, Conversion.m_Precision) : strlen(String);
+				break;
+
+			case 'n':
+				va_arg(args, void*);
+				break;
+
+			default: // "%%" or invalid conversion takes no argument
 				break;
 		}
 
-		IncreaseMapCounter (*pLoggerMap, Type, logmessage, *pLock);
+		if (String)
+		{
+			USHORT Length;
+
+			if ((p + sizeof(Length)) > pEnd)
+				break;
+
+			if (StringLength > (size_t)(pEnd - p - sizeof(Length)))
+			{
+				StringLength = (size_t)(pEnd - p - sizeof(Length)); // Truncated, and nothing after it fits
+				bIsFull = TRUE;
+			}
+
+			Length = (USHORT) StringLength;
+			memcpy (p, &Length, sizeof(Length));
+			p += sizeof(Length);
+			memcpy (p, String, StringLength);
+			p += StringLength;
+		}
+		else if (pArgument)
+		{
+			if ((p + ArgumentSize) > pEnd)
+				break;
+
+			memcpy (p, pArgument, ArgumentSize);
+			p += ArgumentSize;
+		}
 	}
-	catch(std::bad_alloc&)
+
+	return (int)(p - pArguments);
+}
+
+// Called by DecodeMessage
+void Logger::AppendFormatted (std::string& Message, const char* Format, ...)
+{
+	char Formatted[DEFAULT_LOG_MSG_LENGTH];
+
+	va_list args;
+	va_start(args, Format);
+	int characters_written = vsnprintf_s(Formatted, DEFAULT_LOG_MSG_LENGTH, _TRUNCATE, Format, args);
+	va_end(args);
+
+	if ((characters_written >= 0) || Formatted[0])
+		Message += Formatted;
+}
+
+// Called by log processing thread (for latest message of each call site), by LogMessage for assertions and by Pulsar_LogDecoder.
+// Formats message from arguments copied by EncodeArguments. Message ends with "..." when arguments were left out.
+void Logger::DecodeMessage (const char* Format, const char* pArguments, int ArgumentsLength, std::string& Message)
+{
+	const char* p = pArguments;
+	const char* pEnd = pArguments + ArgumentsLength;
+	const char* pFormat = Format;
+
+	Message.clear();
+
+	while (*pFormat)
 	{
+		const char* pConversion = strchr(pFormat, '%');
+
+		if (pConversion == NULL)
+		{
+			Message += pFormat;
+			break;
+		}
+
+		Message.append(pFormat, pConversion - pFormat);
+
+		stLogConversion Conversion;
+		pFormat = ParseConversion (pConversion, Conversion);
+
+		if (Conversion.m_Conversion == '%')
+		{
+			Message += '%';
+			continue;
+		}
+
+		INT64 Integer;
+		BOOL bIsTruncated = FALSE;
+
+		if (Conversion.m_Width == LOG_ARGUMENT_FROM_LIST)
+		{
+			if ((p + sizeof(Integer)) > pEnd)
+				bIsTruncated = TRUE;
+			else
+			{
+				memcpy (&Integer, p, sizeof(Integer));
+				p += sizeof(Integer);
+				Conversion.m_Width = (int) Integer;
+			}
+		}
+
+		if ((Conversion.m_Precision == LOG_ARGUMENT_FROM_LIST) && (bIsTruncated == FALSE))
+		{
+			if ((p + sizeof(Integer)) > pEnd)
+				bIsTruncated = TRUE;
+			else
+			{
+				memcpy (&Integer, p, sizeof(Integer));
+				p += sizeof(Integer);
+				Conversion.m_Precision = (int) Integer;
+			}
+		}
+
+		// Conversion specification without length (length is given as per type argument is passed with)
+		std::string Specification = (std::string)"%" + Conversion.m_Flags;
+		if (Conversion.m_Width >= 0)
+			Specification += std::to_string(Conversion.m_Width);
+		if (Conversion.m_Precision >= 0)
+			Specification += "." + std::to_string(Conversion.m_Precision);
+
+		char ConversionCharacter = Conversion.m_Conversion;
+
+		switch (ConversionCharacter)
+		{
+			case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': case 'C':
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			case 'p':
+			{
+				if (bIsTruncated || ((p + sizeof(Integer)) > pEnd))
+				{
+					bIsTruncated = TRUE;
+					break;
+				}
+
+				memcpy (&Integer, p, sizeof(Integer)); // All of them are 8 bytes
+				p += sizeof(Integer);
+
+				if ((ConversionCharacter == 'c') || (ConversionCharacter == 'C'))
+				{
+					AppendFormatted (Message, (Specification + "c").c_str(), (int) Integer);
+				}
+				else if ((ConversionCharacter == 'd') || (ConversionCharacter == 'i'))
+				{
+					long long Signed;
+
+					switch (Conversion.m_Length)
+					{
+						case stLogConversion::LENGTH_HH: Signed = (signed char) Integer; break;
+						case stLogConversion::LENGTH_H: Signed = (short) Integer; break;
+						case stLogConversion::LENGTH_L: Signed = (long) Integer; break;
+						case stLogConversion::LENGTH_LL: case stLogConversion::LENGTH_SIZE: Signed = Integer; break;
+						default: Signed = (int) Integer; break;
+					}
+
+					AppendFormatted (Message, (Specification + "ll" + ConversionCharacter).c_str(), Signed);
+				}
+				else if ((ConversionCharacter == 'o') || (ConversionCharacter == 'u') || (ConversionCharacter == 'x') || (ConversionCharacter == 'X'))
+				{
+					unsigned long long Unsigned;
+
+					switch (Conversion.m_Length)
+					{
+						case stLogConversion::LENGTH_HH: Unsigned = (unsigned char) Integer; break;
+						case stLogConversion::LENGTH_H: Unsigned = (unsigned short) Integer; break;
+						case stLogConversion::LENGTH_L: Unsigned = (unsigned long) Integer; break;
+						case stLogConversion::LENGTH_LL: Unsigned = (UINT64) Integer; break;
+						case stLogConversion::LENGTH_SIZE: Unsigned = (size_t) Integer; break;
+						default: Unsigned = (unsigned int) Integer; break;
+					}
+
+					AppendFormatted (Message, (Specification + "ll" + ConversionCharacter).c_str(), Unsigned);
+				}
+				else if (ConversionCharacter == 'p')
+				{
+					AppendFormatted (Message, (Specification + "p").c_str(), (void*) (uintptr_t) (UINT64) Integer);
+				}
+				else
+				{
+					double Double;
+					memcpy (&Double, &Integer, sizeof(Double));
+					AppendFormatted (Message, (Specification + ConversionCharacter).c_str(), Double);
+				}
+				break;
+			}
+
+			case 's': case 'S':
+			{
+				USHORT Length;
+
+				if (bIsTruncated || ((p + sizeof(Length)) > pEnd))
+				{
+					bIsTruncated = TRUE;
+					break;
+				}
+
+				memcpy (&Length, p, sizeof(Length));
+				p += sizeof(Length);
+
+				if ((p + Length) > pEnd)
+				{
+					bIsTruncated = TRUE;
+					break;
+				}
+
+				std::string String(p, Length);
+				p += Length;
+
+				AppendFormatted (Message, (Specification + "s").c_str(), String.c_str());
+				break;
+			}
+
+			case 'n':
+				break;
+
+			default: // Invalid conversion is kept as it is
+				Message.append(pConversion, pFormat - pConversion);
+				break;
+		}
+
+		if (bIsTruncated)
+		{
+			Message += "...";
+			break;
+		}
 	}
+}
 
-	// We are done with LogMessage
-	DEL_ARRAY (LogMessage); 
+/*------------------------------------------------------------------------------------------------------------------------------------*/
+// Called by application before Start
+BOOL Logger::SetBinaryLogFile (const char* FilePathName)
+{
+	ASSERT ((m_bLoggerThreadStopped == TRUE) && (m_pBinaryLogFile == NULL) && FilePathName); // Log processing thread would be reading it
+
+	FILE* pFile = NULL;
+
+#ifdef _WIN32
+	if (fopen_s(&pFile, FilePathName, "wb") != 0)
+		pFile = NULL;
+#else
+	pFile = fopen(FilePathName, "wb");
+#endif
+
+	if (pFile == NULL)
+		return FALSE;
+
+	UINT Version = BINARY_LOG_VERSION;
+	INT64 StartTime = (INT64) time(NULL);
+	UINT64 StartHRTime = uv_hrtime();
+
+	fwrite (BINARY_LOG_MAGIC, 1, sizeof(BINARY_LOG_MAGIC)-1, pFile);
+	fwrite (&Version, sizeof(Version), 1, pFile);
+	fwrite (&StartTime, sizeof(StartTime), 1, pFile);
+	fwrite (&StartHRTime, sizeof(StartHRTime), 1, pFile);
+
+	m_pBinaryLogFile = pFile;
+	m_bBinaryLog = TRUE;
+
+	return TRUE;
 }
 
-// Called by event loop as well as request processing threads (through LogMessage)
-void Logger::IncreaseMapCounter (LoggerMap& Map, int Type, std::string& Message, uv_rwlock_t& Lock)
+// Called by log processing thread (through DrainLogRings). Call site is written before its first record.
+void Logger::WriteToBinaryLog (stLogRecord& Record)
 {
-	// Add logmessage to map
-	// As per standards, map value gets initialized when we insert new key
-	// So we can safely assume here that counter value (long) of LoggerMap will be zero when we insert new info/note/error
+	UINT CallSiteID;
+	UCHAR Kind;
 
-	uv_rwlock_wrlock(&Lock);
 	try
 	{
-		if (Type == NOTE)
+		std::map<const stLogCallSite*, UINT>::iterator it = m_BinaryLogCallSiteIDs.find(Record.m_pCallSite);
+
+		if (it != m_BinaryLogCallSiteIDs.end())
 		{
-			if (Map.find(Message) == Map.end())  // Note need not have to maintain counter. Insert only once in map.
-				Map[Message]++ ;
+			CallSiteID = it->second;
 		}
 		else
 		{
-			Map[Message]++ ;
+			CallSiteID = (UINT) m_BinaryLogCallSiteIDs.size() + 1;
+			m_BinaryLogCallSiteIDs[Record.m_pCallSite] = CallSiteID;
+
+			Kind = BINARY_LOG_CALL_SITE;
+			fwrite (&Kind, sizeof(Kind), 1, m_pBinaryLogFile);
+			fwrite (&CallSiteID, sizeof(CallSiteID), 1, m_pBinaryLogFile);
+			fwrite (&Record.m_pCallSite->m_LineNumber, sizeof(Record.m_pCallSite->m_LineNumber), 1, m_pBinaryLogFile);
+			WriteToBinaryLog (Record.m_pCallSite->m_FileName);
+			WriteToBinaryLog (Record.m_pCallSite->m_FunctionName);
+			WriteToBinaryLog (Record.m_pCallSite->m_Format);
 		}
 	}
 	catch(std::bad_alloc&)
 	{
+		return; // Record isn't written as its call site couldn't be
 	}
-	uv_rwlock_wrunlock(&Lock); 
+
+	UCHAR Type = (UCHAR) Record.m_Type;
+	UINT64 Time = (Record.m_Time) ? Record.m_Time : uv_hrtime(); // Logged before binary log was set
+
+	Kind = BINARY_LOG_RECORD;
+	fwrite (&Kind, sizeof(Kind), 1, m_pBinaryLogFile);
+	fwrite (&CallSiteID, sizeof(CallSiteID), 1, m_pBinaryLogFile);
+	fwrite (&Type, sizeof(Type), 1, m_pBinaryLogFile);
+	fwrite (&Time, sizeof(Time), 1, m_pBinaryLogFile);
+	fwrite (&Record.m_ArgumentsLength, sizeof(Record.m_ArgumentsLength), 1, m_pBinaryLogFile);
+	fwrite (Record.m_Arguments, 1, Record.m_ArgumentsLength, m_pBinaryLogFile);
+}
+
+// Called by log processing thread (through WriteToBinaryLog)
+void Logger::WriteToBinaryLog (const char* String)
+{
+	if (String == NULL)
+		String = "";
+
+	size_t StringLength = strlen(String);
+	USHORT Length = (StringLength > USHRT_MAX) ? USHRT_MAX : (USHORT) StringLength;
+
+	fwrite (&Length, sizeof(Length), 1, m_pBinaryLogFile);
+	fwrite (String, 1, Length, m_pBinaryLogFile);
 }
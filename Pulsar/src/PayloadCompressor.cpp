@@ -0,0 +1,225 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Pulsar.h"
+
+/*
+Please refer PayloadCompressor.h
+
+LZ4 block is sequence of: token | literal length (if >= 15) | literals | offset (2 bytes, little endian) | match length (if >= 19).
+Token has literal length in upper 4 bits and (match length - LZ4_MIN_MATCH) in lower 4 bits. Field value 15 means length continues in
+following bytes, each added to it till byte other than 255. Last sequence has literals only.
+*/
+
+static UINT Read32(const UCHAR* p)
+{
+	UINT Value;
+	memcpy (&Value, p, sizeof(UINT));
+	return Value;
+}
+
+static int Hash(UINT Sequence)
+{
+	return (int) ((Sequence * 2654435761U) >> (32 - LZ4_HASH_LOG));
+}
+
+static UCHAR* WriteLength(UCHAR* p, int Length)
+{
+	while (Length >= 255)
+	{
+		*p++ = 255;
+		Length -= 255;
+	}
+
+	*p++ = (UCHAR) Length;
+	return p;
+}
+
+// Writes literals followed by match as single sequence (literals only when MatchLength is zero). Returns NULL if it doesn't fit.
+static UCHAR* WriteSequence(UCHAR* p, UCHAR* pEnd, const UCHAR* pLiterals, int LiteralLength, int Offset, int MatchLength)
+{
+	INT64 SizeNeeded = 1 /* token */ + (LiteralLength/255 + 1) + LiteralLength + 2 /* offset */ + (MatchLength/255 + 1);
+
+	if (SizeNeeded > (pEnd - p))
+		return NULL;
+
+	UCHAR* pToken = p++;
+
+	*pToken = (UCHAR) (((LiteralLength < 15) ? LiteralLength : 15) << 4);
+	if (LiteralLength >= 15)
+		p = WriteLength(p, LiteralLength - 15);
+
+	memcpy (p, pLiterals, LiteralLength);
+	p += LiteralLength;
+
+	if (MatchLength == 0)
+		return p;
+
+	*p++ = (UCHAR) (Offset & 0xFF);
+	*p++ = (UCHAR) (Offset >> 8);
+
+	int MatchCode = MatchLength - LZ4_MIN_MATCH;
+
+	*pToken |= (UCHAR) ((MatchCode < 15) ? MatchCode : 15);
+	if (MatchCode >= 15)
+		p = WriteLength(p, MatchCode - 15);
+
+	return p;
+}
+
+// Adds bytes following token to Length when its 4 bit field is 15. Returns FALSE if they run past source or Length exceeds MaxLength.
+static BOOL ReadLength(const UCHAR* pIn, int SourceLength, int& InIndex, int& Length, int MaxLength)
+{
+	if (Length != 15)
+		return TRUE;
+
+	UCHAR Byte;
+
+	do
+	{
+		if (InIndex >= SourceLength)
+			return FALSE;
+
+		Byte = pIn[InIndex++];
+		Length += Byte;
+
+		if (Length > MaxLength)
+			return FALSE;
+	}
+	while (Byte == 255);
+
+	return TRUE;
+}
+
+int PayloadCompressor::Compress(const char* pSource, int SourceLength, char* pDestination, int DestinationCapacity)
+{
+	const UCHAR* pIn = (const UCHAR*) pSource;
+	UCHAR* pOut = (UCHAR*) pDestination;
+	UCHAR* pOutEnd = pOut + DestinationCapacity;
+
+	int HashTable[1 << LZ4_HASH_LOG]; // Position (+1, so zero means none) of last sequence of 4 bytes having the hash
+	memset (HashTable, 0, sizeof(HashTable));
+
+	const int MatchFindLimit = SourceLength - LZ4_MATCH_FIND_LIMIT;
+	const int MatchEndLimit = SourceLength - LZ4_LAST_LITERALS;
+	int Anchor = 0; // Literals from here are not yet written
+	int Position = 0;
+
+	while (Position < MatchFindLimit)
+	{
+		UINT Sequence = Read32(&pIn[Position]);
+		int HashValue = Hash(Sequence);
+		int Candidate = HashTable[HashValue] - 1;
+		HashTable[HashValue] = Position + 1;
+
+		if ((Candidate < 0) || ((Position - Candidate) > LZ4_MAX_OFFSET) || (Read32(&pIn[Candidate]) != Sequence))
+		{
+			Position += 1 + ((Position - Anchor) >> 6); // Longer nothing matches, faster we skip
+			continue;
+		}
+
+		int MatchLength = LZ4_MIN_MATCH;
+
+		while (((Position + MatchLength) < MatchEndLimit) && (pIn[Position + MatchLength] == pIn[Candidate + MatchLength]))
+			MatchLength++;
+
+		// Match could have started before
+		while ((Position > Anchor) && (Candidate > 0) && (pIn[Position - 1] == pIn[Candidate - 1]))
+		{
+			Position--;
+			Candidate--;
+			MatchLength++;
+		}
+
+		pOut = WriteSequence(pOut, pOutEnd, &pIn[Anchor], Position - Anchor, Position - Candidate, MatchLength);
+
+		if (pOut == NULL)
+			return 0;
+
+		Position += MatchLength;
+		Anchor = Position;
+	}
+
+	pOut = WriteSequence(pOut, pOutEnd, &pIn[Anchor], SourceLength - Anchor, 0, 0);
+
+	if (pOut == NULL)
+		return 0;
+
+	return (int) (pOut - (UCHAR*) pDestination);
+}
+
+int PayloadCompressor::Decompress(const char* pSource, int SourceLength, char* pDestination, int DestinationCapacity)
+{
+	const UCHAR* pIn = (const UCHAR*) pSource;
+	UCHAR* pOut = (UCHAR*) pDestination;
+	int InIndex = 0, OutIndex = 0;
+
+	while (InIndex < SourceLength)
+	{
+		int Token = pIn[InIndex++];
+		int LiteralLength = Token >> 4;
+
+		if (ReadLength(pIn, SourceLength, InIndex, LiteralLength, DestinationCapacity) == FALSE)
+			return -1;
+
+		if ((LiteralLength > (SourceLength - InIndex)) || (LiteralLength > (DestinationCapacity - OutIndex)))
+			return -1;
+
+		memcpy (&pOut[OutIndex], &pIn[InIndex], LiteralLength);
+		InIndex += LiteralLength;
+		OutIndex += LiteralLength;
+
+		if (InIndex == SourceLength) // Last sequence
+			return OutIndex;
+
+		if ((SourceLength - InIndex) < 2)
+			return -1;
+
+		int Offset = pIn[InIndex] | (pIn[InIndex + 1] << 8);
+		InIndex += 2;
+
+		if ((Offset == 0) || (Offset > OutIndex))
+			return -1;
+
+		int MatchLength = Token & 15;
+
+		if (ReadLength(pIn, SourceLength, InIndex, MatchLength, DestinationCapacity) == FALSE)
+			return -1;
+
+		MatchLength += LZ4_MIN_MATCH;
+
+		if (MatchLength > (DestinationCapacity - OutIndex))
+			return -1;
+
+		const UCHAR* pMatch = &pOut[OutIndex - Offset];
+
+		if (Offset >= MatchLength)
+		{
+			memcpy (&pOut[OutIndex], pMatch, MatchLength);
+		}
+		else // Match overlaps bytes being written (repeating pattern)
+		{
+			for (int i=0; i<MatchLength; i++)
+				pOut[OutIndex + i] = pMatch[i];
+		}
+
+		OutIndex += MatchLength;
+	}
+
+	return -1; // Block must end with literals
+}
@@ -76,11 +76,19 @@ void stPeerServer::Construct(IPv4Address& oServerIPv4Address)
 	m_connection = NULL ;
 	m_connect_req.data = NULL;
 	m_write_req.data = this;
+	m_control_write_req.data = this;
+	m_AcknowledgedSequence = 0;
+	m_ControlAcknowledgementsPending = 0;
 
-	m_ResponseBuffer.base = m_response_buffer;
-	m_ResponseBuffer.len = sizeof(m_response_buffer);
+	m_QueuedBytes = 0;
+	m_UnacknowledgedBytes = 0;
+	m_CreditResponses = RequestProcessor::GetCommonParameters().PeerCreditResponses;
+	m_CreditBytes = RequestProcessor::GetCommonParameters().PeerCreditBytes;
+	m_bIsCompressionSupported = FALSE;
+	m_bIsCompactHandlesSupported = FALSE;
 
-	m_ResponseBufferIndex = 0;
+	m_ResponseRingHead = 0;
+	m_ResponseRingTail = 0;
 
 	m_Version = DEFAULT_VERSION;
 
@@ -115,7 +123,7 @@ stPeerServer::stPeerServer(stPeerServer& oOriginalInfo)
 	// (*this).stPeerServer();
 	// this->stPeerServer();
 	// *this = oOriginalInfo;
-	// m_ResponseBuffer.base = response_buffer;
+	// m_ResponseRing = ...;
 }
 #endif
 
@@ -168,6 +176,20 @@ int PeerServersManager::AreServersConnecting()
 	return m_ServersConnecting; 
 } // Called by event loop
 
+// Peer server not known yet would be connected first, so its first responses have handles as they are
+BOOL PeerServersManager::IsCompactHandlesSupported(IPv4Address& ServerIPv4Address)
+{
+	BOOL bIsSupported = FALSE;
+
+	uv_rwlock_rdlock(&m_rwlServersInfoLock);
+	std::map<IPv4Address, stPeerServer*>::iterator it = m_ServersInfo.find(ServerIPv4Address);
+	if (it != m_ServersInfo.end())
+		bIsSupported = it->second->m_bIsCompactHandlesSupported.load(std::memory_order_relaxed);
+	uv_rwlock_rdunlock(&m_rwlServersInfoLock);
+
+	return bIsSupported;
+}
+
 int PeerServersManager::GetServersConnectedCount() 
 { 
 	return m_ServersConnected; // Called by event loop
@@ -192,8 +214,17 @@ void PeerServersManager::on_server_closed(uv_handle_t* handle)
 	PeerSvr->Status = CONNECTION_DISCONNECTED;
 	PeerSvr->DisconnectedTime = time(&PeerSvr->DisconnectedTime);
 	PeerSvr->ResponsesForwarded = 0;
-	PeerSvr->m_ResponseBufferIndex = 0;
+	PeerSvr->m_ResponseRingHead = 0;
+	PeerSvr->m_ResponseRingTail = 0;
+	PeerSvr->m_AcknowledgedSequence = 0;
+	PeerSvr->m_bIsCompressionSupported = FALSE;
+	PeerSvr->m_bIsCompactHandlesSupported.store(FALSE, std::memory_order_relaxed); // Till new connection's RESPONSE_CREDIT_GRANT says so
 	PeerSvr->m_connection = NULL;
+	PeerSvr->m_pPeerServersManager->ResetCredit(PeerSvr);
+
+	// Responses waiting for credit would fail (or go on new connection) like ones in queues
+	if (PeerSvr->m_ResponsesWaitingForCredit.size())
+		PeerSvr->m_pPeerServersManager->AddToRecevingServersSet(PeerSvr);
 
 	LOG (DEBUG, "Calling SendResponses by on_server_closed");
 	PeerSvr->m_pPeerServersManager->m_ServersClosing --;
@@ -229,26 +260,43 @@ void PeerServersManager::alloc_buffer(uv_handle_t* connection, uv_buf_t* buffer)
 {
 	stPeerServer* PeerSvr = (stPeerServer*) connection->data ;
 
-	ASSERT (PeerSvr->m_ResponseBuffer.base == PeerSvr->m_response_buffer);
+	// Unlike in LocalClientManager, here we strip off responses in on_read itself as soon as we found them in ring.
+	// So ring can have at most one incomplete response, which is always smaller than ring. If it's not, there is something wrong in logic somewhere.
+	unsigned int BytesInRing = PeerSvr->m_ResponseRingTail - PeerSvr->m_ResponseRingHead;
+	ASSERT (BytesInRing < PEER_RESPONSE_RING_SIZE);
 
-	// Here, index should always be less than length. 
-	// If it's equal or greater, there is something wrong in logic somewhere.
-	ASSERT (PeerSvr->m_ResponseBufferIndex < PeerSvr->m_ResponseBuffer.len);
+	// Read into free space from tail till end of ring (or till head if it has wrapped around)
+	unsigned int TailOffset = PeerSvr->m_ResponseRingTail & (PEER_RESPONSE_RING_SIZE-1);
+	unsigned int SizeAvailable = PEER_RESPONSE_RING_SIZE - TailOffset;
 
-	// Check how many bytes remaining after m_Request_index in m_ResponseBuffer.base
-	size_t SizeAvailable = PeerSvr->m_ResponseBuffer.len - PeerSvr->m_ResponseBufferIndex;
+	if (SizeAvailable > (PEER_RESPONSE_RING_SIZE - BytesInRing))
+		SizeAvailable = PEER_RESPONSE_RING_SIZE - BytesInRing;
 
-	buffer->base = &PeerSvr->m_ResponseBuffer.base[PeerSvr->m_ResponseBufferIndex];
-	buffer->len = (ULONG)SizeAvailable;
+	buffer->base = &PeerSvr->m_ResponseRing[TailOffset];
+	buffer->len = SizeAvailable;
 
-	// Unlike in LocalClientManager, here we strip off response in on_read itself as soon as we found it in buffer.
-	// Thus, we have no reason for not doing that (unlike in local client case we don't do it if request is already being processed in threads).
-	// Hence we must have some room available next time libuv calls alloc_buffer (Else we've set buffer too less than response size).
 	ASSERT (SizeAvailable); 
 
 	return;
 }
 
+// Returns first Length bytes of ring (from head) contiguously. Those are in ring itself unless they wrap around its end.
+char* PeerServersManager::GetResponseFromRing(stPeerServer* PeerSvr, unsigned int Length)
+{
+	ASSERT (Length <= sizeof(PeerSvr->m_WrappedResponse));
+
+	unsigned int HeadOffset = PeerSvr->m_ResponseRingHead & (PEER_RESPONSE_RING_SIZE-1);
+
+	if ((HeadOffset + Length) <= PEER_RESPONSE_RING_SIZE)
+		return &PeerSvr->m_ResponseRing[HeadOffset];
+
+	unsigned int FirstPart = PEER_RESPONSE_RING_SIZE - HeadOffset;
+	memcpy (PeerSvr->m_WrappedResponse, &PeerSvr->m_ResponseRing[HeadOffset], FirstPart);
+	memcpy (&PeerSvr->m_WrappedResponse[FirstPart], PeerSvr->m_ResponseRing, Length - FirstPart);
+
+	return PeerSvr->m_WrappedResponse;
+}
+
 // When there is data in socket, libuv calls this with read data in write_req.base, 'nread' as number of bytes read and write_req.len as max size write_req.base
 // PeerServerManager::on_read gets called when server (to which this server is connected to, unlike as in LocalClientsManager::on_read where it receves clinets 
 // to which it is listening to) sends back acknowledgement RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP (indicating it received forwarded response) or KEEP_ALIVE 
@@ -259,8 +307,6 @@ void PeerServersManager::on_read(uv_stream_t* connection, ssize_t nread, const u
 
 	stPeerServer* PeerSvr = (stPeerServer*) connection->data ;
 
-	ASSERT (PeerSvr->m_ResponseBuffer.base == PeerSvr->m_response_buffer);
-
 	if (nread < 0)
 	{
 		// if (nread == UV_ECONNRESET)
@@ -273,61 +319,60 @@ void PeerServersManager::on_read(uv_stream_t* connection, ssize_t nread, const u
 		}
 		return;
 	}
-	else
+
+	PeerSvr->m_ResponseRingTail += (unsigned int) nread; //  Windows x64 uses the LLP64 programming model, in which int and long remain 32 bit
+
+	// Acknowledgements of all responses read this time are applied at once (See AcknowledgeForwardedResponses)
+	int Acknowledgements = 0;
+
+	while(1) // Extract off all possible responses from ring
 	{
-		PeerSvr->m_ResponseBufferIndex += (unsigned int) nread; //  Windows x64 uses the LLP64 programming model, in which int and long remain 32 bit
+		unsigned int BytesInRing = PeerSvr->m_ResponseRingTail - PeerSvr->m_ResponseRingHead;
 
-		while(1) // Extract off all possible requests from incoming buffer
-		{
-			uv_buf_t response;
-			response.base = NULL;
+		if (BytesInRing < (HEADER_SIZE+1))
+			break;
 
-			// Let's use same method for parsing and validating master protocol, that we've used for stClient communication
-			// UCHAR RetVal = PeerSvr->m_pPeerServersManager->ValidateProtocolAndExtractRequest (PeerSvr->m_ResponseBuffer.base, PeerSvr->m_ResponseBufferIndex, PeerSvr->m_ResponseBuffer.len, PeerSvr->m_Version, response);
-			UCHAR RetVal = RequestParser::GetInstance(dynamic_cast<ConnectionsManager*>(PeerSvr->m_pPeerServersManager))->ValidateProtocolAndExtractRequest (PeerSvr->m_ResponseBuffer.base, PeerSvr->m_ResponseBufferIndex, PeerSvr->m_Version, response);
-			
+		// Parser needs at most one complete response to be contiguous
+		unsigned int Length = (BytesInRing < sizeof(PeerSvr->m_WrappedResponse)) ? BytesInRing : sizeof(PeerSvr->m_WrappedResponse);
+		char* pResponse = GetResponseFromRing(PeerSvr, Length);
 
-			if ((RetVal == REQUEST_FOUND) && (response.base != NULL))
-			{
-				if (RetVal == REQUEST_FOUND)
-				{
-					PeerSvr->m_pPeerServersManager->ProcessResponse (&response, PeerSvr);
-				}
+		uv_buf_t response;
+		response.base = NULL;
+		response.len = 0;
 
-				// Remove first (ReqSize + HEADER_SIZE) bytes from the request buffer
-				for (unsigned int i=(response.len + HEADER_SIZE); i<PeerSvr->m_ResponseBufferIndex; i++)
-				{
-					PeerSvr->m_ResponseBuffer.base[i-(response.len + HEADER_SIZE)] = PeerSvr->m_ResponseBuffer.base[i];
-				}
+		// Let's use same method for parsing and validating master protocol, that we've used for stClient communication
+		UCHAR RetVal = RequestParser::GetInstance(dynamic_cast<ConnectionsManager*>(PeerSvr->m_pPeerServersManager))->ValidateProtocolAndExtractRequest (pResponse, Length, PeerSvr->m_Version, response);
 
-				// Adjust request index acordingly. Remember, we might have got much more bytes than request size. 
-				// Hence m_ResponseBufferIndex might have been greater than (ReqSize + HEADER_SIZE).
-				// So m_ResponseBufferIndex not necessarily will be zero after stripping off the request. 
-				PeerSvr->m_ResponseBufferIndex -= (response.len + HEADER_SIZE);
+		// Parser allows size as big as forwarded response. Responses by peer server can't be that big.
+		if (((RetVal == REQUEST_FOUND) || (RetVal == WAIT_FOR_MORE_BYTES)) && (response.len > MAX_PEER_RESPONSE_SIZE))
+			RetVal = INVALID_SIZE;
 
-				ASSERT (PeerSvr->m_ResponseBufferIndex >= 0);
-			}
-			else if ((RetVal == INVALID_HEADER) || (RetVal == INVALID_VERSION) || (RetVal == INVALID_SIZE)) 
-			{	
-				PeerSvr->m_ResponseBufferIndex=0;
-				LOG (ERROR, "Error in header in the acknowledgement received from other server.");
-			}
-			else if (RetVal == WAIT_FOR_MORE_BYTES)
-			{
-				break;
-			}
-			else
-			{
-				// It could be memory allocation caused we came here. No need to assert.
-				LOG (ERROR, "Unknown return code by ValidateProtocolAndExtractRequest OR pRequest was NULL when RetVal was REQUEST_FOUND");
-			}
+		if (RetVal == REQUEST_FOUND)
+		{
+			Acknowledgements += PeerSvr->m_pPeerServersManager->ProcessResponse (&response, PeerSvr);
+
+			// Remove response off the ring. We might have got much more bytes than response size, so ring not necessarily will be empty.
+			PeerSvr->m_ResponseRingHead += (response.len + HEADER_SIZE);
+		}
+		else if ((RetVal == INVALID_HEADER) || (RetVal == INVALID_VERSION) || (RetVal == INVALID_SIZE)) 
+		{	
+			PeerSvr->m_ResponseRingHead = PeerSvr->m_ResponseRingTail;
+			LOG (ERROR, "Error in header in the acknowledgement received from other server.");
+			break;
+		}
+		else // WAIT_FOR_MORE_BYTES
+		{
+			break;
 		}
 	}
 
-	ASSERT (PeerSvr->m_ResponseBufferIndex < PeerSvr->m_ResponseBuffer.len);
+	if ((Acknowledgements) || (PeerSvr->m_ResponsesWaitingForCredit.size())) // Credit might have been granted too
+		PeerSvr->m_pPeerServersManager->AcknowledgeForwardedResponses (PeerSvr, Acknowledgements);
+
+	ASSERT ((PeerSvr->m_ResponseRingTail - PeerSvr->m_ResponseRingHead) < PEER_RESPONSE_RING_SIZE);
 }
 
-void PeerServersManager::ProcessResponse(uv_buf_t* response, stPeerServer* pPeerSvr)
+int PeerServersManager::ProcessResponse(uv_buf_t* response, stPeerServer* pPeerSvr)
 {
 	switch(response->base[0])
 	{
@@ -340,20 +385,177 @@ void PeerServersManager::ProcessResponse(uv_buf_t* response, stPeerServer* pPeer
 			break;
 
 		case RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP:
+			return 1;
+
+		case RESPONSE_ACKNOWLEDGEMENTS_OF_FORWARDED_RESPS:
 			{
-				pPeerSvr->ResponsesForwarded --;
-				if (pPeerSvr->ResponsesForwarded < 1 /*RequestProcessor::GetCommonParameters().MaxPendingRequests*/)
+				if (response->len < (1 + sizeof(UINT)))
 				{
-					pPeerSvr->Status = CONNECTION_CONNECTED ; // Change status from CONNECTION_OVERFLOWED to CONNECTION_CONNECTED
-					pPeerSvr->m_pPeerServersManager->DoPeriodicActivities(); // Whenever we set PeerSvr->Status value in callback, we have to call SendResponses. So that it can run with updated status info.
+					LOG (ERROR, "Batch of acknowledgements received has too short length");
+					break;
 				}
+
+				UINT Acknowledgements_n;
+				memcpy (&Acknowledgements_n, &response->base[1], sizeof(UINT));
+				UINT Acknowledgements = ntohl (Acknowledgements_n);
+
+				if (Acknowledgements > (UINT) pPeerSvr->ResponsesForwarded) // More than forwarded, from faulty peer server
+				{
+					LOG (ERROR, "Batch of acknowledgements received exceeds responses forwarded");
+					Acknowledgements = (UINT) pPeerSvr->ResponsesForwarded;
+				}
+
+				return (int) Acknowledgements;
+			}
+
+		case RESPONSE_CUMULATIVE_ACKNOWLEDGEMENT:
+			{
+				if (response->len < (1 + sizeof(UINT64)))
+				{
+					LOG (ERROR, "Cumulative acknowledgement received has too short length");
+					break;
+				}
+
+				UINT64 Sequence_n;
+				memcpy (&Sequence_n, &response->base[1], sizeof(UINT64));
+				UINT64 Sequence = ntohll (Sequence_n);
+
+				if (Sequence <= pPeerSvr->m_AcknowledgedSequence) // Stale or repeated
+					break;
+
+				UINT64 Acknowledgements = Sequence - pPeerSvr->m_AcknowledgedSequence;
+				pPeerSvr->m_AcknowledgedSequence = Sequence;
+
+				if (Acknowledgements > (UINT64) pPeerSvr->ResponsesForwarded) // More than forwarded, from faulty peer server
+				{
+					LOG (ERROR, "Cumulative acknowledgement received exceeds responses forwarded");
+					Acknowledgements = (UINT64) pPeerSvr->ResponsesForwarded;
+				}
+
+				return (int) Acknowledgements;
+			}
+
+		case RESPONSE_CREDIT_GRANT:
+			{
+				if (response->len < (1 + sizeof(UINT) + sizeof(UINT)))
+				{
+					LOG (ERROR, "Credit grant received has too short length");
+					break;
+				}
+
+				UINT CreditResponses_n, CreditBytes_n;
+				memcpy (&CreditResponses_n, &response->base[1], sizeof(UINT));
+				memcpy (&CreditBytes_n, &response->base[1+sizeof(UINT)], sizeof(UINT));
+
+				UINT CreditResponses = ntohl (CreditResponses_n), CreditBytes = ntohl (CreditBytes_n);
+
+				// Zero would stall forwarding for good. Values beyond INT_MAX are taken as INT_MAX.
+				pPeerSvr->m_CreditResponses = (CreditResponses == 0) ? 1 : ((CreditResponses > INT_MAX) ? INT_MAX : (int) CreditResponses);
+				pPeerSvr->m_CreditBytes = (CreditBytes == 0) ? 1 : ((CreditBytes > INT_MAX) ? INT_MAX : (int) CreditBytes);
+
+				// What peer server supports follows the grant. Compact handles are cleared only here (See module summary).
+				pPeerSvr->m_bIsCompactHandlesSupported.store(FALSE, std::memory_order_relaxed);
+				break;
+			}
+
+		case RESPONSE_COMPRESSION_SUPPORTED:
+			{
+				if (response->len < 2)
+				{
+					LOG (ERROR, "Compression support received has too short length");
+					break;
+				}
+
+				// Method we don't know is ignored, payloads are then forwarded as they are
+				if (response->base[1] == COMPRESSION_LZ4_BLOCK)
+					pPeerSvr->m_bIsCompressionSupported = TRUE;
+				break;
+			}
+
+		case RESPONSE_COMPACT_HANDLES_SUPPORTED:
+			{
+				pPeerSvr->m_bIsCompactHandlesSupported.store(TRUE, std::memory_order_relaxed);
+				break;
 			}
-			break;
 
 		default:
 			LOG (ERROR, "Unnown response received");
 			break;
 	}
+
+	return 0;
+}
+
+// Called by event loop (on_read) once for all acknowledgements read at a time
+void PeerServersManager::AcknowledgeForwardedResponses(stPeerServer* pPeerSvr, int Acknowledgements)
+{
+	if (Acknowledgements > pPeerSvr->ResponsesForwarded) // Responses read at a time may each be within limit but not together
+		Acknowledgements = pPeerSvr->ResponsesForwarded;
+
+	pPeerSvr->ResponsesForwarded -= Acknowledgements;
+
+	// Give credit back. Acknowledgements come in order responses were forwarded.
+	int ControlAcknowledgements = (Acknowledgements < pPeerSvr->m_ControlAcknowledgementsPending) ? Acknowledgements : pPeerSvr->m_ControlAcknowledgementsPending;
+	pPeerSvr->m_ControlAcknowledgementsPending -= ControlAcknowledgements;
+
+	for (int i=ControlAcknowledgements; (i<Acknowledgements) && (pPeerSvr->m_UnacknowledgedSizes.size()); i++)
+	{
+		pPeerSvr->m_UnacknowledgedBytes -= pPeerSvr->m_UnacknowledgedSizes.front();
+		pPeerSvr->m_UnacknowledgedSizes.pop_front();
+	}
+
+	if (pPeerSvr->m_ResponsesWaitingForCredit.size())
+	{
+		if (Acknowledgements)
+			pPeerSvr->OverflowedTime = 0; // Peer server is consuming
+
+		AddToRecevingServersSet(pPeerSvr);
+		DoPeriodicActivities(); // Forward responses credit allows now
+	}
+	else if (pPeerSvr->ResponsesForwarded < 1 /*RequestProcessor::GetCommonParameters().MaxPendingRequests*/)
+	{
+		pPeerSvr->Status = CONNECTION_CONNECTED ; // Change status from CONNECTION_OVERFLOWED to CONNECTION_CONNECTED
+		DoPeriodicActivities(); // Whenever we set PeerSvr->Status value in callback, we have to call SendResponses. So that it can run with updated status info.
+	}
+}
+
+// Called by event loop (SendPeerServersResponses). Number of responses (in order) waiting for credit, which credit allows to forward now.
+int PeerServersManager::GetResponsesAllowedByCredit(stPeerServer* pPeerSvr)
+{
+	INT64 Responses = (INT64) pPeerSvr->m_UnacknowledgedSizes.size();
+	INT64 Bytes = pPeerSvr->m_UnacknowledgedBytes;
+	int ResponsesAllowed = 0;
+
+	for (std::deque<Response*>::iterator it = pPeerSvr->m_ResponsesWaitingForCredit.begin(); it != pPeerSvr->m_ResponsesWaitingForCredit.end(); ++it)
+	{
+		Bytes += (*it)->GetResponseLength(pPeerSvr->m_bIsCompressionSupported); // As it would be forwarded
+
+		// Response bigger than whole credit still goes when nothing is unacknowledged, otherwise it would never go
+		if ((Responses >= pPeerSvr->m_CreditResponses) || ((Bytes > pPeerSvr->m_CreditBytes) && (Responses > 0)))
+			break;
+
+		Responses++;
+		ResponsesAllowed++;
+	}
+
+	return ResponsesAllowed;
+}
+
+// Called by event loop when connection is closed. Credit granted belongs to connection.
+void PeerServersManager::ResetCredit(stPeerServer* pPeerSvr)
+{
+	std::deque<int>().swap(pPeerSvr->m_UnacknowledgedSizes);
+	pPeerSvr->m_UnacknowledgedBytes = 0;
+	pPeerSvr->m_ControlAcknowledgementsPending = 0;
+	pPeerSvr->m_CreditResponses = RequestProcessor::GetCommonParameters().PeerCreditResponses;
+	pPeerSvr->m_CreditBytes = RequestProcessor::GetCommonParameters().PeerCreditBytes;
+	pPeerSvr->OverflowedTime = 0;
+}
+
+// Called by event loop. Adds server to set which threads add to (so that next SendPeerServersResponses goes through it).
+void PeerServersManager::AddToRecevingServersSet(stPeerServer* pPeerSvr)
+{
+	AddToServerSet(m_bResponseDirectionFlag ? &m_RecevingServersSet1 : &m_RecevingServersSet2, pPeerSvr, TRUE);
 }
 
 void PeerServersManager::after_connect(uv_connect_t* connect_req, int status)
@@ -383,8 +585,9 @@ void PeerServersManager::after_connect(uv_connect_t* connect_req, int status)
 	{
 		PeerSvr->Status = CONNECTION_CONNECTED; 
 
+#ifdef _WIN32
 		// Before we accept start reading, lets set internal buffer size to zero (so it will directly write from our allocated buffers).
-		// This is to avoid internal buffer overflows.
+		// This is to avoid internal buffer overflows. (Applicable only to IOCP. See AcceptConnection in LocalClientsManager.cpp)
 		DWORD NewBuffSize = 0L;
 		DWORD NewBuffSizeLen = sizeof(DWORD);
 
@@ -401,17 +604,56 @@ void PeerServersManager::after_connect(uv_connect_t* connect_req, int status)
 			return;
 		}
 */
+#endif
 		PeerSvr->m_pPeerServersManager->m_ServersConnected ++ ;
 
 		int RetVal = uv_read_start(PeerSvr->m_connection, alloc_buffer, on_read);
 		if (RetVal == -1)
 			PeerSvr->m_pPeerServersManager->DisconnectServer(PeerSvr);
+		else
+			RequestCumulativeAcknowledgements(PeerSvr);
 
 		LOG (DEBUG, "Calling SendResponses by after_connect");
 		PeerSvr->m_pPeerServersManager->DoPeriodicActivities(); // Whenever we set PeerSvr->Status value in callback, we have to call SendResponses. So that it can run with updated status info.
 	}
 }
 
+// Called by after_connect. Written before any forwarded response, so that peer server's sequence counts from the one following it.
+void PeerServersManager::RequestCumulativeAcknowledgements(stPeerServer* pPeerSvr)
+{
+	// Header | version (SPECIAL_COMMUNICATION) | number of handles (0) | REQUEST_CUMULATIVE_ACKNOWLEDGEMENTS
+	char* pRequest = pPeerSvr->m_ControlRequest;
+	USHORT Version_n = htons (SPECIAL_COMMUNICATION);
+	UINT Length_n = (UINT) htonl (VERSION_BYTES+HANDLE_BYTES+1);
+	UINT NumberOfHandles_n = 0;
+
+	memcpy (pRequest, MSG_PREAMBLE, PREAMBLE_BYTES);
+	memcpy (&pRequest[PREAMBLE_BYTES], &Version_n, VERSION_BYTES);
+	memcpy (&pRequest[PREAMBLE_BYTES+VERSION_BYTES], &Length_n, SIZE_BYTES);
+	memcpy (&pRequest[HEADER_SIZE], &Version_n, VERSION_BYTES);
+	memcpy (&pRequest[HEADER_SIZE+VERSION_BYTES], &NumberOfHandles_n, HANDLE_BYTES);
+	pRequest[HEADER_SIZE+VERSION_BYTES+HANDLE_BYTES] = REQUEST_CUMULATIVE_ACKNOWLEDGEMENTS;
+
+	pPeerSvr->m_AcknowledgedSequence = 0;
+
+	uv_buf_t buffer = uv_buf_init(pRequest, sizeof(pPeerSvr->m_ControlRequest));
+
+	if (uv_write(&pPeerSvr->m_control_write_req, pPeerSvr->m_connection, &buffer, 1, after_control_request) < 0)
+	{
+		LOG (ERROR, "Sending control request to peer server failed");
+		return;
+	}
+
+	pPeerSvr->ResponsesForwarded ++; // Peer server acknowledges control request as single forwarded response (whether or not it supports it)
+	pPeerSvr->m_ControlAcknowledgementsPending ++;
+}
+
+void PeerServersManager::after_control_request(uv_write_t* write_req, int status)
+{
+	if (status < 0)
+		LOG (ERROR, "Writing control request to peer server failed"); // Connection would be closed by on_read
+}
+
 void PeerServersManager::after_getaddrinfo(uv_getaddrinfo_t* gai_req, int status, struct addrinfo* ai) 
 {
 	stPeerServer* PeerSvr = (stPeerServer*)gai_req->data;
@@ -528,7 +770,7 @@ BOOL PeerServersManager::AddToServerSet (std::set <stPeerServer*>* pServersSet,
 }
 
 // This function runs in threads. Called by ConnectionsManager::AddResponseToQueues.
-BOOL PeerServersManager::AddResponseToQueue(Response* pResponse, BOOL& bHasEncounteredMemoryAllocationException)
+BOOL PeerServersManager::AddResponseToQueue(Response* pResponse, BOOL& bHasEncounteredMemoryAllocationException, BOOL& bIsBackpressured)
 {
 	BOOL bAdded = FALSE;
 	std::deque<Response*>* pResponsesQueue;
@@ -599,7 +841,15 @@ BOOL PeerServersManager::AddResponseToQueue(Response* pResponse, BOOL& bHasEncou
 
 		/* Please read comment above to know why line below has been commented out */
 		// if (pResponsesQueue->size() < (UINT)(RequestProcessor::GetCommonParameters().MaxPendingResponses/2)) // Half of limit is available (In one of two queues) 
-		if (/* (RequestProcessor::GetCommonParameters().MaxPendingRequests) && */ (RequestProcessor::GetCommonParameters().MaxPendingResponses))
+		// Instead, bytes waiting for the server are limited. Single response is always taken (else response bigger than limit would never go).
+		INT64 QueuedBytes = pPeerServer->m_QueuedBytes.load(std::memory_order_relaxed);
+		INT64 ResponseLength = pResponse->GetResponseLength();
+
+		if ((QueuedBytes) && ((QueuedBytes + ResponseLength) > RequestProcessor::GetCommonParameters().MaxPeerQueueBytes))
+		{
+			bIsBackpressured = TRUE; // Not logged. Thread storing response gets UPDATE_BACKPRESSURED and stat counts it.
+		}
+		else if (/* (RequestProcessor::GetCommonParameters().MaxPendingRequests) && */ (RequestProcessor::GetCommonParameters().MaxPendingResponses))
 		{
 			pResponsesQueue->push_front(pResponse);
 
@@ -609,6 +859,7 @@ BOOL PeerServersManager::AddResponseToQueue(Response* pResponse, BOOL& bHasEncou
 			}
 			else
 			{
+				pPeerServer->m_QueuedBytes.fetch_add(ResponseLength, std::memory_order_relaxed);
 				bAdded = TRUE;
 			}
 		}
@@ -781,15 +1032,58 @@ void PeerServersManager::SendPeerServersResponses()
 		}
 
 		std::deque<Response*>* pResponsesQueue = (m_bResponseDirectionFlag) ? (pPeerServer->m_ResponsesQueue2) : (pPeerServer->m_ResponsesQueue1);
+		std::deque<Response*>& ResponsesWaitingForCredit = pPeerServer->m_ResponsesWaitingForCredit;
+
+		// Responses are forwarded in order they were queued. So whole queue goes after responses already waiting for credit.
+		try
+		{
+			while (pResponsesQueue->size())
+			{
+				ResponsesWaitingForCredit.push_back(pResponsesQueue->back());
+				pResponsesQueue->pop_back();
+			}
+		}
+		catch(std::bad_alloc&)
+		{
+			IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+			continue; // Rest of queue stays after ones moved, so order is kept
+		}
 
-		// There must be responses in queue and there must be references to responses
-		const int ResponseQueueSize = (int)pResponsesQueue->size();
-		ASSERT (ResponseQueueSize > 0);
+		std::deque<class Response*>().swap(*pResponsesQueue);
+
+		if (ResponsesWaitingForCredit.size() == 0) // Server was added back to set after its responses had been forwarded
+		{
+			pServersSet->erase(current);
+			continue;
+		}
+
+		// When not connected all responses go (to fail), otherwise as many as credit allows
+		const BOOL bUseCompressedPayload = ((ConnStatus == CONNECTION_CONNECTED) && (pPeerServer->m_bIsCompressionSupported));
+		const int ResponsesToSend = (ConnStatus == CONNECTION_CONNECTED) ? GetResponsesAllowedByCredit(pPeerServer) : (int)ResponsesWaitingForCredit.size();
+
+		if (ResponsesToSend == 0)
+		{
+			// Server stays in set till acknowledgements give credit back, so that it is checked for giving no credit back for too long
+			time_t CurrentTime = time(&CurrentTime);
+
+			if (pPeerServer->OverflowedTime == 0)
+			{
+				pPeerServer->OverflowedTime = CurrentTime;
+			}
+			else if ((CurrentTime - pPeerServer->OverflowedTime) > MAX_OVERFLOWED_TIME)
+			{
+				LOG (NOTE, "Server %d.%d.%d.%d gave no credit back for %d seconds. Disconnecting.", pPeerServer->m_ServerIPv4Address[0], pPeerServer->m_ServerIPv4Address[1], pPeerServer->m_ServerIPv4Address[2], pPeerServer->m_ServerIPv4Address[3], MAX_OVERFLOWED_TIME); 
+				DisconnectServer(pPeerServer); // Waiting responses fail once connection is closed (See on_server_closed)
+				pServersSet->erase(current);
+			}
+
+			continue;
+		}
 
 		try
 		{
-			pPeerServer->m_pResponsesBeingSent->reserve(ResponseQueueSize);
-			pPeerServer->m_pResponsesBuffersBeingForwarded.reserve(ResponseQueueSize);
+			pPeerServer->m_pResponsesBeingSent->reserve(ResponsesToSend);
+			pPeerServer->m_pResponsesBuffersBeingForwarded.reserve(ResponsesToSend * BUFFERS_PER_RESPONSE); // Each response is header and payload
 		}
 		catch(std::bad_alloc&)
 		{
@@ -797,9 +1091,9 @@ void PeerServersManager::SendPeerServersResponses()
 			continue;
 		}
 
-		for (int i=0; pResponsesQueue->size(); i++)
+		for (int i=0; i<ResponsesToSend; i++)
 		{
-			Response* pResponse = pResponsesQueue->back();
+			Response* pResponse = ResponsesWaitingForCredit.front();
 
 			ASSERT (pResponse); 
 			ASSERT (pResponse->GetReferenceCount()); // There must be references to responses
@@ -809,23 +1103,44 @@ void PeerServersManager::SendPeerServersResponses()
 			{
 				pResponse->ForwardError = ConnStatus ;
 			}
+			else
+			{
+				const int ForwardedLength = pResponse->GetResponseLength(bUseCompressedPayload);
+
+				try
+				{
+					pPeerServer->m_UnacknowledgedSizes.push_back(ForwardedLength);
+				}
+				catch(std::bad_alloc&)
+				{
+					IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+					break; // Rest wait
+				}
+
+				pPeerServer->m_UnacknowledgedBytes += ForwardedLength;
+
+				if (bUseCompressedPayload)
+					pResponse->UseCompressedPayload();
+			}
 
 			pResponse->QueuedTime = ConnectionsManager::GetHighPrecesionTime();
 
 			pPeerServer->m_pResponsesBeingSent->push_back(pResponse); // This won't throw std:bad_alloc as max response memory is already reserved above
-			pPeerServer->m_pResponsesBuffersBeingForwarded.push_back(pResponse->GetResponse());  // This won't throw std:bad_alloc as max response memory is already reserved above
+			const uv_buf_t* pResponseBuffers = pResponse->GetResponseBuffers(); // Header (with handles) and payload. Payload is never copied here.
+			pPeerServer->m_pResponsesBuffersBeingForwarded.insert(pPeerServer->m_pResponsesBuffersBeingForwarded.end(), pResponseBuffers, pResponseBuffers+BUFFERS_PER_RESPONSE);  // This won't throw std:bad_alloc as max response memory is already reserved above
 
-			pResponsesQueue->pop_back();
+			ResponsesWaitingForCredit.pop_front();
+			pPeerServer->m_QueuedBytes.fetch_sub(pResponse->GetResponseLength(), std::memory_order_relaxed);
 		}
 
-		// Unlike in LocalClientsManager::SendLocalClientsResponses here we must always have response queue size zero
-		ASSERT (pResponsesQueue->size() == 0);
-		std::deque<class Response*>().swap(*pResponsesQueue);
-
 		int RetVal_uv_write = 0 ;
 		const int NumberOfBuffers = (int)pPeerServer->m_pResponsesBuffersBeingForwarded.size();
+		const int NumberOfResponses = (int)pPeerServer->m_pResponsesBeingSent->size();
 
-		ASSERT ((int)pPeerServer->m_pResponsesBeingSent->size() == NumberOfBuffers);
+		if (NumberOfResponses == 0)
+			continue;
+
+		ASSERT (NumberOfResponses * BUFFERS_PER_RESPONSE == NumberOfBuffers);
 
 #ifndef NO_WRITE
 		if (ConnStatus == CONNECTION_CONNECTED)
@@ -841,7 +1156,7 @@ void PeerServersManager::SendPeerServersResponses()
 
 		if (RetVal_uv_write >= 0)
 		{
-			m_stServerStat.ResponsesBeingSent += NumberOfBuffers;
+			GetStatCounters(-1).ResponsesBeingSent += NumberOfResponses; // Main loop's counters block (See after_send_responses)
 		}
 		else
 		{
@@ -864,7 +1179,7 @@ void PeerServersManager::AfterSendingPeerServersResponses(stPeerServer* pPeerSer
 {
 	ADD2PROFILER;
 
-	int ResponseLength = pResponse->GetResponse().len;
+	int ResponseLength = pResponse->GetResponseLength(pResponse->IsPayloadCompressed()); // As forwarded
 
 	ASSERT ((pResponse) && (pResponse->IsForward() == TRUE)); // We must receive here only forwarded responses
 
@@ -891,6 +1206,12 @@ void PeerServersManager::AfterSendingPeerServersResponses(stPeerServer* pPeerSer
 	
 			m_stServerStat.ResponsesForwarded ++;
 
+			if (pResponse->IsPayloadCompressed())
+			{
+				m_stServerStat.ResponsesForwardedCompressed ++;
+				m_stServerStat.ForwardedBytesSavedByCompression += (pResponse->GetResponseLength() - ResponseLength);
+			}
+
 			m_stServerStat.ResponsesSent ++; // Total responses sent for all clients
 			m_stServerStat.TotalResponseBytesSent += ResponseLength;
 			ASSERT(m_stServerStat.TotalResponseBytesSent > 0);
@@ -954,7 +1275,7 @@ void PeerServersManager::AfterSendingPeerServersResponses(stPeerServer* pPeerSer
 				// NO MAN'S LAND. DO NOT WRITE ANY CODE HERE.
 			}
 
-			if (bResponseForwardingSucceededLastTime) LOG (ERROR, strServerError);
+			if (bResponseForwardingSucceededLastTime) LOG (ERROR, "%s", strServerError);
 
 			break;
 		}
@@ -981,7 +1302,7 @@ void PeerServersManager::AfterSendingPeerServersResponses(stPeerServer* pPeerSer
 	}
 
 	uv_rwlock_rdlock(&pPeerServer->m_rwlResponsesQueueLock);
-	if (pResponseQueueLocked->size() != 0)
+	if ((pResponseQueueLocked->size() != 0) || (pPeerServer->m_ResponsesWaitingForCredit.size() != 0))
 	{
 		AddToServerSet (pServersSetLocked, pPeerServer, TRUE);// pServersSetLocked->insert(TargetServerIPv4Address);
 	}
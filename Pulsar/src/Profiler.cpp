@@ -18,7 +18,7 @@
 
 #include "Pulsar.h"
 
-Profiler::Profiler(char* strFunctionName)
+Profiler::Profiler(const char* strFunctionName)
 {
 #ifdef GENERATE_PROFILE_DATA
 	m_dblStartTime = ConnectionsManager::GetHighPrecesionTime(); 
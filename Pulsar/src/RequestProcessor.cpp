@@ -23,14 +23,16 @@ std::map <USHORT, RequestProcessor*> RequestProcessor::m_VersionAndProcessor;
 CommonParameters RequestProcessor::m_CommonParameters;
 
 // IMPORTANT NOTE: We MUST initialize request processor through EVENT LOOP ONLY
-RequestProcessor::RequestProcessor(USHORT version, VersionParameters& versionparameters)
+RequestProcessor::RequestProcessor(USHORT version, const VersionParameters& versionparameters)
 {
 	// NOTE: COMES HERE ONLY WHILE INITIALIZING GLOBAL OBJECTS JUST AFTER WE RUN SERVER APPLICATION
 	m_pRequest = NULL;
 	m_bRequestIsBeingProcessed = FALSE; 
 	m_bDisconnectionIsBeingProcessed = FALSE;
+	m_bHasEncounteredBackpressure = FALSE;
 	m_AsyncHandle.data = NULL ;
-	m_Barrier.reference_count = 0;
+	memset(&m_Barrier, 0, sizeof(m_Barrier)); // Barrier is initialized in Initialize(). Its layout differs across platforms.
+	m_bIsWaitingOnBarrier.store(FALSE, std::memory_order_relaxed);
 	m_Version = version;
 	m_VersionParameters = versionparameters;
 
@@ -213,8 +215,8 @@ void RequestProcessor::SetRequest (Request* pRequest)
 	m_ResponseCountPerThread = 0;
 }
 
-// Returns NumberOfReeferences to response if successful. FALSE if fails.
-void RequestProcessor::CreateResponseAndAddToQueues(const Buffer* response, ClientHandlesPtrs& Clienthandle_ptrs, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, double RequestArrivalTime)
+// Returns FALSE if it fails to create response. Responses peer server's queue had no room for are flagged in m_bHasEncounteredBackpressure.
+BOOL RequestProcessor::CreateResponseAndAddToQueues(const SharedBuffer& pPayload, ULONG PayloadLength, const SharedBuffer& pCompressedPayload, ULONG CompressedPayloadLength, ClientHandlesPtrs& Clienthandle_ptrs, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, stUpdateCompletion* pUpdateCompletion, double RequestArrivalTime, int priority)
 {
 	ClientHandlesPtrsIterator StartIt;
 	ClientHandlesPtrsIterator EndIt;
@@ -223,15 +225,28 @@ void RequestProcessor::CreateResponseAndAddToQueues(const Buffer* response, Clie
 
 	size_t HandleCount = Clienthandle_ptrs.size(), SplitCount = 0;
 
+	// Forwarded responses have compact handles when peer server supports them. Each of them can have far more handles then.
+	// (Handles are all of same server, see Response constructor)
+	BOOL bCompactHandles = FALSE;
+	size_t MaxNumberOfHandles = MAX_HANDLES_IN_FORWARDED_RESPONSE;
+
+	if ((HandleCount) && (m_pConnectionsManager->GetIPAddressOfLocalServer() != (*Clienthandle_ptrs.begin())->m_ServerIPv4Address))
+	{
+		bCompactHandles = m_pConnectionsManager->IsCompactHandlesSupported((*Clienthandle_ptrs.begin())->m_ServerIPv4Address);
+
+		if (bCompactHandles)
+			MaxNumberOfHandles = MAX_COMPACT_HANDLES_IN_FORWARDED_RESPONSE;
+	}
+
 	while(Clienthandle_ptrs.size())
 	{
 		StartIt = Clienthandle_ptrs.begin();
 		
 		if ((m_pConnectionsManager->GetIPAddressOfLocalServer() != (*StartIt)->m_ServerIPv4Address) /*Response is for clients connected to another server*/ \
-			&& (Clienthandle_ptrs.size() > MAX_HANDLES_IN_FORWARDED_RESPONSE))
+			&& (Clienthandle_ptrs.size() > MaxNumberOfHandles))
 		{
 			EndIt = StartIt;
-			std::advance(EndIt, MAX_HANDLES_IN_FORWARDED_RESPONSE);
+			std::advance(EndIt, MaxNumberOfHandles);
 		}
 		else
 		{
@@ -242,20 +257,29 @@ void RequestProcessor::CreateResponseAndAddToQueues(const Buffer* response, Clie
 
 		try
 		{
-			pResponse = new Response (response, StartIt, EndIt, version, bIsUpdate, this, RequestArrivalTime, m_pConnectionsManager);  
+			pResponse = new Response (pPayload, PayloadLength, StartIt, EndIt, version, bIsUpdate, bCompactHandles, this, RequestArrivalTime, m_pConnectionsManager);  
 			SplitCount++;
+
+			if ((pCompressedPayload.get()) && (pResponse->IsForward()))
+				pResponse->SetCompressedPayload(pCompressedPayload, CompressedPayloadLength);
+
+			if (pUpdateCompletion)
+				pResponse->SetUpdateCompletion(pUpdateCompletion);
+
+			if (pResponse->IsForward() == FALSE)
+				pResponse->SetPriority(priority);
 		}
 		catch(ResponseCreationException&)
 		{
 			m_pConnectionsManager->IncreaseExceptionCount(RESPONSE_CREATION_EXCEPTION, __FILE__, __LINE__);
-			return;
+			return FALSE;
 		}
 		catch(std::bad_alloc&)
 		{
 			if (m_pRequest) // The purpose of setting exception flag is to disconnect the client who has sent the request. If no request means no client was associated (e.g. keep alive processing)
 				m_pRequest->SetMemoryAllocationExceptionFlag();
 			m_pConnectionsManager->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
-			return;
+			return FALSE;
 		}
 
 		//
@@ -269,22 +293,53 @@ void RequestProcessor::CreateResponseAndAddToQueues(const Buffer* response, Clie
 		// WARNING: It is very likely that the moment we add pResponse to response queues, it was picked up by event loop, 
 		// sent and deleted. Hence we shouldn't refer to pResponse hereafter in this function.
 		//
-		BOOL bHasEncounteredMemoryAllocationException = FALSE;
-		(m_pConnectionsManager->*m_pAddResponseToQueuesFunction) (pResponse, &Clienthandle_ptrs, bHasEncounteredMemoryAllocationException); 
+		BOOL bHasEncounteredMemoryAllocationException = FALSE, bIsBackpressured = FALSE;
+		(m_pConnectionsManager->*m_pAddResponseToQueuesFunction) (pResponse, &Clienthandle_ptrs, bHasEncounteredMemoryAllocationException, bIsBackpressured); 
 
 		if ((bHasEncounteredMemoryAllocationException) && (m_pRequest))
 			m_pRequest->SetMemoryAllocationExceptionFlag();
 
-		Clienthandle_ptrs.erase (StartIt, EndIt);
+		if (bIsBackpressured)
+			m_bHasEncounteredBackpressure = TRUE;
+
+		Clienthandle_ptrs.erase (StartIt, EndIt); // Response with compact handles might have moved EndIt back (when they didn't fit)
 	}
 
 	// LOG (INFO, "Response handles %d split %d times.", HandleCount, SplitCount); 
 
-	return;
+	return TRUE;
+}
+
+// Called by StoreMessage. Compressed payload is original payload length followed by payload compressed (See PayloadCompressor).
+// It isn't worth when it (along with length field) wouldn't be shorter than payload.
+SharedBuffer RequestProcessor::CompressPayload(const SharedBuffer& pPayload, ULONG PayloadLength, ULONG& CompressedPayloadLength)
+{
+	double StartTime = ConnectionsManager::GetHighPrecesionTime();
+
+	// Compressed into scratch block first, so that compressed payload held by responses takes only as much memory as it needs
+	SharedBuffer pScratch ((char*) SlabAllocator::Allocate(PayloadLength), SlabAllocator::Free); // Throws std::bad_alloc
+	int Length = PayloadCompressor::Compress(pPayload.get(), (int)PayloadLength, &pScratch.get()[SIZE_BYTES], (int)(PayloadLength - SIZE_BYTES - 1));
+
+	CompressedPayloadLength = Length ? (Length + SIZE_BYTES) : 0;
+
+	SharedBuffer pCompressedPayload;
+
+	if (CompressedPayloadLength)
+	{
+		UINT PayloadLength_n = (UINT) htonl (PayloadLength);
+		memcpy (pScratch.get(), &PayloadLength_n, SIZE_BYTES);
+
+		pCompressedPayload.reset ((char*) SlabAllocator::Allocate(CompressedPayloadLength), SlabAllocator::Free); // Throws std::bad_alloc
+		memcpy_s (pCompressedPayload.get(), CompressedPayloadLength, pScratch.get(), CompressedPayloadLength);
+	}
+
+	m_pConnectionsManager->AddCompressionDetailsToServerStat(PayloadLength, CompressedPayloadLength, ConnectionsManager::GetHighPrecesionTime() - StartTime);
+
+	return pCompressedPayload;
 }
 
 // This function is called by LocalClientsManager::InitiateRequestProcessorsAndValidateParameters() 
-// for RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads * MaxVersionNumber(0xFFFF) times.
+// for RequestProcessor::GetCommonParameters().MaxRequestProcessingThreads * (number of registered versions) times.
 RequestProcessor* RequestProcessor::GetNewRequestProcessor(USHORT version)
 {
 	RequestProcessor* pRequestProcessor = NULL ;
@@ -326,6 +381,43 @@ void RequestProcessor::DeferRequestProcessing()
 	return m_pRequest->DeferProcessing(TRUE);
 }
 
+// Event loop finds continuation in request after ProcessRequest returns (See LocalClientsManager::SuspendRequest)
+RequestContinuation RequestProcessor::SuspendRequestProcessing(void* pState)
+{
+	ASSERT(m_pRequest!=NULL); 
+	ASSERT(m_pRequest->IsDeferred() == FALSE); // Request is either deferred or suspended
+
+	stRequestContinuation* pContinuation = NULL;
+
+	try
+	{
+		pContinuation = new stRequestContinuation(m_pRequest, m_pRequest->GetClient());
+	}
+	catch(std::bad_alloc&)
+	{
+		m_pConnectionsManager->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+		LOG (ERROR, "Exception while allocating memory in SuspendRequestProcessing"); 
+		return NULL;
+	}
+
+	m_pRequest->Suspend(pContinuation, pState);
+
+	return pContinuation;
+}
+
+// Called from any thread
+bool RequestProcessor::ResumeRequestProcessing(RequestContinuation Continuation)
+{
+	ASSERT(Continuation!=NULL); 
+	return LocalClientsManager::ResumeRequest(Continuation) ? true : false;
+}
+
+void* RequestProcessor::GetContinuationState()
+{
+	ASSERT(m_pRequest!=NULL); 
+	return m_pRequest->GetContinuationState();
+}
+
 ClientHandle RequestProcessor::GetRequestSendingClientsHandle() 
 { 
 	ASSERT(m_pRequest!=NULL); 
@@ -344,6 +436,12 @@ USHORT RequestProcessor::GetClientProtocolVersion()
 	return m_Version;
 }
 
+bool RequestProcessor::AreMoreRequestsPending()
+{
+	ASSERT(m_pRequest!=NULL); 
+	return m_pRequest->IsFollowedByRequests() ? true : false;
+}
+
 void RequestProcessor::SetSessionData (void* pData)
 {
 	ASSERT(m_pRequest!=NULL); 
@@ -408,13 +506,13 @@ void RequestProcessor::StoreError (ClientHandle* clienthandle, UCHAR ErrorCode)
 	return SendResponse (clienthandle, &response, SPECIAL_COMMUNICATION);
 }
 
-void RequestProcessor::SendResponse (ClientHandle* clienthandle, const Buffer* response, USHORT version)
+void RequestProcessor::SendResponse (ClientHandle* clienthandle, const Buffer* response, USHORT version, int priority)
 {
 	try
 	{
 		ClientHandles clienthandles;
 		clienthandles.insert(*clienthandle); // This could throw bad_alloc
-		SendResponse (&clienthandles, response, version);
+		SendResponse (&clienthandles, response, version, priority);
 	}
 	catch(std::bad_alloc&)
 	{
@@ -426,7 +524,7 @@ void RequestProcessor::SendResponse (ClientHandle* clienthandle, const Buffer* r
 	return;
 }
 
-void RequestProcessor::SendResponse (ClientHandles* clienthandles, const Buffer* response, USHORT version)
+void RequestProcessor::SendResponse (ClientHandles* clienthandles, const Buffer* response, USHORT version, int priority)
 {
 	USHORT Version ;
 
@@ -435,7 +533,7 @@ void RequestProcessor::SendResponse (ClientHandles* clienthandles, const Buffer*
 	else
 		Version = version;
 
-	StoreMessage(clienthandles, response, Version, FALSE);
+	StoreMessage(clienthandles, response, Version, FALSE, NULL, priority);
 
 	return;
 }
@@ -448,20 +546,22 @@ void RequestProcessor::send_update_callback (uv_async_t* handle)
 	TimerFunction pTimerFunction = pReqProcessor->m_pTimerFunction;
 	(pReqProcessor->m_pConnectionsManager->*pTimerFunction)();
 
-	pReqProcessor->WaitOnBarrier(); 
+	// Asynchronous updates wake us up too (and async sends can coalesce). Only thread of SendUpdate/MulticastUpdate waits to be released.
+	if (pReqProcessor->m_bIsWaitingOnBarrier.exchange(FALSE))
+		pReqProcessor->WaitOnBarrier(); 
 }
 
 // If request processing thread wants to send intermittent updates to client(s) they can call these.
 // It calls uv_async_send which results in getting callback from libuv 
 // Value of version equal to DEFAULT_VERSION is treated as version of client who is storing this response
 // Called from request processing threads
-void RequestProcessor::SendUpdate (ClientHandle* clienthandle, const Buffer* update, USHORT version) 
+int RequestProcessor::SendUpdate (ClientHandle* clienthandle, const Buffer* update, USHORT version, int priority) 
 {
 	try
 	{
 		ClientHandles clienthandles;
 		clienthandles.insert(*clienthandle); // This could throw bad_alloc
-		MulticastUpdate (&clienthandles, update, version);
+		return MulticastUpdate (&clienthandles, update, version, priority);
 	}
 	catch(std::bad_alloc&)
 	{
@@ -470,10 +570,10 @@ void RequestProcessor::SendUpdate (ClientHandle* clienthandle, const Buffer* upd
 		LOG (ERROR, "Exception while allocating memory in SendUpdate"); 
 	}
 
-	return;
+	return UPDATE_NOT_QUEUED;
 }
 
-void RequestProcessor::MulticastUpdate (ClientHandles* clienthandles, const Buffer* update, USHORT version)
+int RequestProcessor::MulticastUpdate (ClientHandles* clienthandles, const Buffer* update, USHORT version, int priority)
 {
 	ASSERT (m_pRequest!=NULL);
 
@@ -486,9 +586,64 @@ void RequestProcessor::MulticastUpdate (ClientHandles* clienthandles, const Buff
 	else
 		Version = version;
 
-	StoreMessage(clienthandles, update, Version, TRUE);
+	return StoreMessage(clienthandles, update, Version, TRUE, NULL, priority);
+}
+
+// Called from request processing threads. See RequestProcessor.h
+int RequestProcessor::SendUpdateAsync (ClientHandle* clienthandle, const Buffer* update, UpdateCompletionFunction pCompletionFunction, void* pContext, USHORT version, int priority)
+{
+	try
+	{
+		ClientHandles clienthandles;
+		clienthandles.insert(*clienthandle); // This could throw bad_alloc
+		return MulticastUpdateAsync (&clienthandles, update, pCompletionFunction, pContext, version, priority);
+	}
+	catch(std::bad_alloc&)
+	{
+		m_pRequest->SetMemoryAllocationExceptionFlag();
+		m_pConnectionsManager->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+		LOG (ERROR, "Exception while allocating memory in SendUpdateAsync");
+	}
+
+	if (pCompletionFunction)
+		pCompletionFunction(pContext);
+
+	return UPDATE_NOT_QUEUED;
+}
+
+int RequestProcessor::MulticastUpdateAsync (ClientHandles* clienthandles, const Buffer* update, UpdateCompletionFunction pCompletionFunction, void* pContext, USHORT version, int priority)
+{
+	ASSERT (m_pRequest!=NULL);
+
+	USHORT Version ;
+
+	if (version == DEFAULT_VERSION)
+		Version = m_Version;
+	else
+		Version = version;
+
+	stUpdateCompletion* pUpdateCompletion = NULL;
 
-	return;
+	try
+	{
+		pUpdateCompletion = new stUpdateCompletion (pCompletionFunction, pContext);
+	}
+	catch(std::bad_alloc&)
+	{
+		m_pRequest->SetMemoryAllocationExceptionFlag();
+		m_pConnectionsManager->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
+
+		if (pCompletionFunction)
+			pCompletionFunction(pContext);
+
+		return UPDATE_NOT_QUEUED;
+	}
+
+	int RetVal = StoreMessage(clienthandles, update, Version, TRUE, pUpdateCompletion, priority);
+
+	pUpdateCompletion->Release(); // Completes update right away if its responses are already done with (or none was queued)
+
+	return RetVal;
 }
 
 /*
@@ -497,9 +652,9 @@ StoreMessage actually constructs response object and adds it to responses list o
 		Hence we cannot really return if write fails for the response. Regardless, there is no gurantee that even if uv_write is successful response
 		delivery to client is successful (Ref: https://groups.google.com/forum/#!topic/libuv/hbvMnWOnDV4) Hence, we cannot rely on uv_write return value. 
 		Requests processors have to have employ their own mechanism to chk if client was connected (e.g. thru disconnection handler) and to ensure response
-		delivery is successful (e.g. ack from client) Hence we keeping return value as void.
+		delivery is successful (e.g. ack from client) Hence we return only whether message could be queued (see UPDATE_QUEUED etc).
 */
-void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffer* response, USHORT version, BOOL bIsUpdate)
+int RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffer* response, USHORT version, BOOL bIsUpdate, stUpdateCompletion* pUpdateCompletion, int priority)
 {
 	double ArrivalTime = m_pRequest ? m_pRequest->GetArrivalTime() : ConnectionsManager::GetHighPrecesionTime();
 
@@ -517,11 +672,14 @@ void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffe
 	m_ResponseObjectsQueued = 0;
 	m_TotalResponseObjectsQueued = 0;
 	m_ResponseObjectsSent = 0;
+	m_bHasEncounteredBackpressure = FALSE;
 
-	if ((pVersionParams == NULL) || (clienthandles.size() == NULL) || (response->base == NULL) || (response->len == 0) || (response->len  > MaxResponseSize))  
+	BOOL bAllResponsesCreated = TRUE;
+
+	if ((pVersionParams == NULL) || (clienthandles.size() == NULL) || (response->base == NULL) || (response->len == 0) || (response->len  > MaxResponseSize) || (priority < 0) || (priority >= RESPONSE_PRIORITIES))  
 	{
 		LOG (ERROR, "Cannot store message. Either no client(s) to store message to OR message attributes are invalid.");
-		return;
+		return UPDATE_NOT_QUEUED;
 	}
 
 	try
@@ -529,6 +687,10 @@ void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffe
 		// clienthandles could have many handles which are for other servers. We got to first create map <ServerIPv4Address, ClientHandles> to get consolidated handles for server.
 		// (Using unsorted_map could increase performance but its complicated when vector is key)
 		mapServersAndHandles ServersAndHandles;
+
+		// Copy response only once. All the Response objects (one or more per server) share this copy and add only their own header to it while sending.
+		SharedBuffer pPayload ((char*) SlabAllocator::Allocate(response->len), SlabAllocator::Free);
+		memcpy_s (pPayload.get(), response->len, response->base, response->len);
 		// unsigned int handlecount = (UINT)clienthandles.size();
 
 		//for (unsigned int i=0; i<handlecount; i++)
@@ -543,6 +705,15 @@ void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffe
 			pClientHandlesPtrs->insert(pClientHandle);
 		}
 
+		// Payload forwarded to peer servers is compressed once for all of them. Each peer server gets it only if it supports compression.
+		SharedBuffer pCompressedPayload;
+		ULONG CompressedPayloadLength = 0;
+		const ULONG CompressionThreshold = (ULONG) GetCommonParameters().PeerCompressionThreshold;
+
+		if ((CompressionThreshold) && (response->len >= CompressionThreshold) && (response->len > (SIZE_BYTES + 1)) \
+			&& (ServersAndHandles.size() > ServersAndHandles.count(m_pConnectionsManager->GetIPAddressOfLocalServer()))) // Some of clients are on peer servers
+			pCompressedPayload = CompressPayload(pPayload, (ULONG)response->len, CompressedPayloadLength);
+
 		// At this point, against IPv4Address in map we have vector of clienthandle pointers. 
 		// Traverse through map and construct Response object with pClient only for current server, and with clienthandles for remote server (response to be forwarded to)
 		for(mapServersAndHandles::iterator iterator = (ServersAndHandles).begin(); iterator != (ServersAndHandles).end(); iterator++)
@@ -557,7 +728,8 @@ void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffe
 			//for (unsigned int i=0; i<clienthandle_ptrs.size(); i++)
 			//	clienthandle_ptrs[i]->m_ServerIPv4Address.SetPort(GetClientHandle().m_ServerIPv4Address.GetPort());
 
-			CreateResponseAndAddToQueues(response, clienthandle_ptrs, version, bIsUpdate, ArrivalTime);
+			if (CreateResponseAndAddToQueues(pPayload, (ULONG)response->len, pCompressedPayload, CompressedPayloadLength, clienthandle_ptrs, version, bIsUpdate, pUpdateCompletion, ArrivalTime, priority) == FALSE)
+				bAllResponsesCreated = FALSE;
 		}
 
 		//if ((!bIsUpdate) && (++m_ResponseCountPerThread) > 1)
@@ -569,13 +741,18 @@ void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffe
 			m_pRequest->SetMemoryAllocationExceptionFlag();
 
 		m_pConnectionsManager->IncreaseExceptionCount(MEMORY_ALLOCATION_EXCEPTION, __FILE__, __LINE__);
-		return;
+		return UPDATE_NOT_QUEUED;
 	}
 
 
 #if 1
-	if (bIsUpdate)
+	if ((bIsUpdate) && (pUpdateCompletion))
+	{
+		uv_async_send (&m_AsyncHandle); // Asynchronous update: send_update_callback sends it but this thread doesn't wait for it
+	}
+	else if (bIsUpdate)
 	{
+		m_bIsWaitingOnBarrier.store(TRUE); // Must be set before waking up event loop, so that send_update_callback releases us
 		uv_async_send (&m_AsyncHandle); // send_update_callback will call SendResponse
 		WaitOnBarrier();
 	}
@@ -618,5 +795,9 @@ void RequestProcessor::StoreMessage (ClientHandles* p_clienthandles, const Buffe
 	// Even if all recepients are local, having ReferenceCount equal to all number of recepient doesn't mean they have received the response. It only means response has been queued 
 	// up successfully. But for application it doesn't have any significance.
 	// return ReferenceCount;
-	return;
+	// Backpressure however is something application can act upon (e.g. hold further updates for a while), hence it is returned.
+	if (bAllResponsesCreated == FALSE)
+		return UPDATE_NOT_QUEUED;
+
+	return m_bHasEncounteredBackpressure ? UPDATE_BACKPRESSURED : UPDATE_QUEUED;
 }
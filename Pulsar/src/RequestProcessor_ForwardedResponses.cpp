@@ -62,6 +62,108 @@ BOOL RequestProcessor_ForwardedResponses::ProcessRequest ()
 	// First, lets turn on streaming for forwarded responses
 	SetStreamingMode(true);
 
+	uv_buf_t forwarded_response = GetRequest();
+	ClientHandle clienthandle = GetRequestSendingClientsHandle();
+
+	// Control request (no handles) asking to acknowledge cumulatively. It is acknowledged as usual.
+	if ((forwarded_response.len == (VERSION_BYTES + HANDLE_BYTES + 1)) && (*((UINT*) &forwarded_response.base[VERSION_BYTES]) == 0) && (forwarded_response.base[VERSION_BYTES + HANDLE_BYTES] == REQUEST_CUMULATIVE_ACKNOWLEDGEMENTS))
+	{
+		if (GetSessionData() == NULL)
+		{
+			stForwardingSession* pSession = new (std::nothrow) stForwardingSession; // Without it peer server simply gets acknowledgement per forwarded response
+
+			if (pSession)
+			{
+				pSession->m_ReceivedSequence = 0;
+				pSession->m_AcknowledgedSequence = 0;
+				SetSessionData(pSession);
+			}
+		}
+
+		char acknowledgement = RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP;
+		uv_buf_t response;
+		response.base = &acknowledgement;
+		response.len = 1;
+
+		SendResponse (&clienthandle, &response, SPECIAL_COMMUNICATION);
+
+		// Then credit peer server may use for forwarding to this server (Acknowledgements give it back)
+		char grant[1 + sizeof(UINT) + sizeof(UINT)];
+		UINT CreditResponses_n = htonl ((UINT) GetCommonParameters().PeerCreditResponses);
+		UINT CreditBytes_n = htonl ((UINT) GetCommonParameters().PeerCreditBytes);
+
+		grant[0] = RESPONSE_CREDIT_GRANT;
+		memcpy (&grant[1], &CreditResponses_n, sizeof(UINT));
+		memcpy (&grant[1+sizeof(UINT)], &CreditBytes_n, sizeof(UINT));
+
+		response.base = grant;
+		response.len = sizeof(grant);
+
+		SendResponse (&clienthandle, &response, SPECIAL_COMMUNICATION);
+
+		// And that payloads forwarded to this server may be compressed
+		char compression[2] = {RESPONSE_COMPRESSION_SUPPORTED, COMPRESSION_LZ4_BLOCK};
+
+		response.base = compression;
+		response.len = sizeof(compression);
+
+		SendResponse (&clienthandle, &response, SPECIAL_COMMUNICATION);
+
+		// And that responses forwarded to this server may have compact handles
+		char compacthandles = RESPONSE_COMPACT_HANDLES_SUPPORTED;
+
+		response.base = &compacthandles;
+		response.len = 1;
+
+		SendResponse (&clienthandle, &response, SPECIAL_COMMUNICATION);
+		return TRUE;
+	}
+
+	stForwardingSession* pSession = (stForwardingSession*) GetSessionData();
+
+	if (pSession == NULL)
+		return ProcessForwardedResponse(); // Acknowledges each forwarded response
+
+	// Every forwarded response (even malformed one) is acknowledged, as peer server counts each of them it has sent.
+	// Acknowledgement is sent once batch is full or when no more forwarded responses are already waiting behind this one.
+	pSession->m_ReceivedSequence++;
+
+	BOOL RetVal = ProcessForwardedResponse();
+
+	if (((pSession->m_ReceivedSequence - pSession->m_AcknowledgedSequence) >= CUMULATIVE_ACKNOWLEDGEMENT_BATCH) || (AreMoreRequestsPending() == false))
+		AcknowledgeCumulatively(pSession);
+
+	return RetVal;
+}
+
+void RequestProcessor_ForwardedResponses::AcknowledgeCumulatively (stForwardingSession* pSession)
+{
+	char acknowledgement[1 + sizeof(UINT64)];
+	acknowledgement[0] = RESPONSE_CUMULATIVE_ACKNOWLEDGEMENT;
+
+	UINT64 Sequence_n = htonll (pSession->m_ReceivedSequence);
+	memcpy (&acknowledgement[1], &Sequence_n, sizeof(UINT64));
+
+	uv_buf_t response;
+	response.base = acknowledgement;
+	response.len = sizeof(acknowledgement);
+
+	ClientHandle clienthandle = GetRequestSendingClientsHandle();
+
+	try
+	{
+		SendResponse (&clienthandle, &response, SPECIAL_COMMUNICATION);
+		pSession->m_AcknowledgedSequence = pSession->m_ReceivedSequence;
+	}
+	catch(std::bad_alloc&)
+	{
+		LOG (EXCEPTION, "Exception bad_alloc while acknowledging forwarded responses"); // Next cumulative acknowledgement covers these too
+	}
+}
+
+// Sends forwarded response to its clients. Acknowledges it too unless peer server has asked for cumulative acknowledgements.
+BOOL RequestProcessor_ForwardedResponses::ProcessForwardedResponse ()
+{
 	// Forwarded response received by client connected to other server:
 	//                      version (SenderClientVersion)   |   number of handles   |   handles | response
 	//						version (SenderClientVersion)	|	number of handles	|	handles
@@ -79,7 +181,18 @@ BOOL RequestProcessor_ForwardedResponses::ProcessRequest ()
 	UINT NumberOfHandles_n = *((UINT*) &forwarded_response.base[sizeof(USHORT)]);
 	UINT NumberOfHandles = ntohl (NumberOfHandles_n);
 
-	ULONG MinimumLength = VERSION_BYTES /* version */ + HANDLE_BYTES /* number of handles */ + (NumberOfHandles * sizeof(UINT64)) /* Handles */ + 1 /* at least a byte of response */;
+	BOOL bIsPayloadCompressed = (NumberOfHandles & FORWARDED_PAYLOAD_COMPRESSED) ? TRUE : FALSE;
+	BOOL bHasCompactHandles = (NumberOfHandles & FORWARDED_HANDLES_COMPACT) ? TRUE : FALSE;
+	NumberOfHandles &= ~(FORWARDED_PAYLOAD_COMPRESSED | FORWARDED_HANDLES_COMPACT);
+
+	if (NumberOfHandles > ((bHasCompactHandles) ? MAX_COMPACT_HANDLES_IN_FORWARDED_RESPONSE : MAX_HANDLES_IN_FORWARDED_RESPONSE))
+	{
+		LOG (ERROR, "Error: Forwarded response received has too many handles");
+		return FALSE;
+	}
+
+	// Compact handle takes at least a byte
+	ULONG MinimumLength = VERSION_BYTES /* version */ + HANDLE_BYTES /* number of handles */ + (NumberOfHandles * ((bHasCompactHandles) ? 1 : sizeof(UINT64))) /* Handles */ + 1 /* at least a byte of response */;
 
 	// Response should have minimum size to store version, number of handles and actual handles (remaining size is actual response to be forwarded)
 	// Else we might not have received complete response forwarded
@@ -95,23 +208,32 @@ BOOL RequestProcessor_ForwardedResponses::ProcessRequest ()
 		ClientHandles clienthandles;
 
 		ULONG index=sizeof(USHORT)+sizeof(UINT); // Initial index is after skipping bytes used to store 'version' and 'number of handles'
-		for (UINT handle_count=0; handle_count<NumberOfHandles; handle_count++) 
+
+		if (bHasCompactHandles)
 		{
-			// We should have enough room ahead to read first/next Registration number. Else we might have not received complete response forwarded.
-			if ((index+sizeof (UINT64)) >= forwarded_response.len)
-			{
-				LOG (ERROR, "Error: Forwarded response received doesn't have all indices and registration numbers");
+			if (ReadCompactHandles(forwarded_response, index, NumberOfHandles, clienthandles) == FALSE)
 				return FALSE;
-			}
+		}
+		else
+		{
+			for (UINT handle_count=0; handle_count<NumberOfHandles; handle_count++) 
+			{
+				// We should have enough room ahead to read first/next Registration number. Else we might have not received complete response forwarded.
+				if ((index+sizeof (UINT64)) >= forwarded_response.len)
+				{
+					LOG (ERROR, "Error: Forwarded response received doesn't have all indices and registration numbers");
+					return FALSE;
+				}
 
-			ClientHandle clienthandle;
-			UINT64* ClientRegistrationNumber = (UINT64*) &forwarded_response.base[index];
-			index += sizeof (UINT64);
+				ClientHandle clienthandle;
+				UINT64* ClientRegistrationNumber = (UINT64*) &forwarded_response.base[index];
+				index += sizeof (UINT64);
 
-			clienthandle.m_ClientRegistrationNumber = ntohll(*ClientRegistrationNumber);
-			clienthandle.m_ServerIPv4Address = GetRequestSendingClientsHandle().m_ServerIPv4Address; // Assign local ip address and port
+				clienthandle.m_ClientRegistrationNumber = ntohll(*ClientRegistrationNumber);
+				clienthandle.m_ServerIPv4Address = GetRequestSendingClientsHandle().m_ServerIPv4Address; // Assign local ip address and port
 
-			clienthandles.insert(clienthandle); 
+				clienthandles.insert(clienthandle); 
+			}
 		}
 
 		uv_buf_t response;
@@ -119,8 +241,16 @@ BOOL RequestProcessor_ForwardedResponses::ProcessRequest ()
 		response.base = &forwarded_response.base[index]; 
 		response.len = forwarded_response.len - index;
 
+		SharedBuffer pPayload; // Holds decompressed payload till it is sent
+
+		if ((bIsPayloadCompressed) && (DecompressPayload(response, pPayload) == FALSE))
+			return FALSE;
+
 		SendResponse(&clienthandles, &response, Version);
 
+		if (GetSessionData()) // Acknowledged cumulatively
+			return TRUE;
+
 		char acknowledgement = RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP;
 		ClientHandle clienthandle =	GetRequestSendingClientsHandle();
 		response.base = &acknowledgement;
@@ -136,6 +266,80 @@ BOOL RequestProcessor_ForwardedResponses::ProcessRequest ()
 	return TRUE;
 }
 
+// Collects compact handles (See FORWARDED_HANDLES_COMPACT) and moves index past them
+BOOL RequestProcessor_ForwardedResponses::ReadCompactHandles (const uv_buf_t& forwarded_response, ULONG& index, UINT NumberOfHandles, ClientHandles& clienthandles)
+{
+	ClientHandle clienthandle;
+	clienthandle.m_ClientRegistrationNumber = 0;
+	clienthandle.m_ServerIPv4Address = GetRequestSendingClientsHandle().m_ServerIPv4Address; // Assign local ip address and port
+
+	for (UINT handle_count=0; handle_count<NumberOfHandles; handle_count++)
+	{
+		UINT64 Difference = 0;
+		UCHAR Byte;
+		int Shift = 0;
+
+		do
+		{
+			// Handle must end before response (which is at least a byte) and can't be more than 64 bits
+			if (((index+1) >= forwarded_response.len) || (Shift > 63))
+			{
+				LOG (ERROR, "Error: Forwarded response received has malformed compact handles");
+				return FALSE;
+			}
+
+			Byte = (UCHAR) forwarded_response.base[index++];
+			Difference |= ((UINT64) (Byte & 0x7F)) << Shift;
+			Shift += 7;
+		}
+		while (Byte & 0x80);
+
+		clienthandle.m_ClientRegistrationNumber += Difference;
+		clienthandles.insert(clienthandle);
+	}
+
+	return TRUE;
+}
+
+// Replaces compressed payload (original length followed by compressed payload) by decompressed one, held by pPayload
+BOOL RequestProcessor_ForwardedResponses::DecompressPayload (uv_buf_t& payload, SharedBuffer& pPayload)
+{
+	if (payload.len <= SIZE_BYTES)
+	{
+		LOG (ERROR, "Error: Compressed payload of forwarded response received has too short length");
+		return FALSE;
+	}
+
+	UINT PayloadLength_n;
+	memcpy (&PayloadLength_n, payload.base, SIZE_BYTES);
+	UINT PayloadLength = ntohl (PayloadLength_n);
+
+	if ((PayloadLength == 0) || (PayloadLength > MAX_POSSIBLE_REQUEST_RESPONSE_SIZE))
+	{
+		LOG (ERROR, "Error: Compressed payload of forwarded response received has invalid original length");
+		return FALSE;
+	}
+
+	double StartTime = ConnectionsManager::GetHighPrecesionTime();
+
+	pPayload.reset ((char*) SlabAllocator::Allocate(PayloadLength), SlabAllocator::Free); // Throws std::bad_alloc
+	int Length = PayloadCompressor::Decompress(&payload.base[SIZE_BYTES], (int)(payload.len - SIZE_BYTES), pPayload.get(), (int)PayloadLength);
+
+	BOOL bIsDecompressed = (Length == (int)PayloadLength) ? TRUE : FALSE;
+	m_pConnectionsManager->AddDecompressionDetailsToServerStat(bIsDecompressed, ConnectionsManager::GetHighPrecesionTime() - StartTime);
+
+	if (bIsDecompressed == FALSE)
+	{
+		LOG (ERROR, "Error: Compressed payload of forwarded response received is malformed");
+		return FALSE;
+	}
+
+	payload.base = pPayload.get();
+	payload.len = PayloadLength;
+
+	return TRUE;
+}
+
 // Disconnection of client will be processed here. This is invoked by thread  
 // Just before stClient object is deleted after disconnection (ProcessDisconnect)
 void RequestProcessor_ForwardedResponses::ProcessDisconnection (ClientHandle& clienthandle, void* ptr)
@@ -146,6 +350,9 @@ void RequestProcessor_ForwardedResponses::ProcessDisconnection (ClientHandle& cl
 		So there is nothing much to do here.
 	*/
 
+	stForwardingSession* pSession = (stForwardingSession*) ptr;
+	DEL (pSession);
+
 	return;
 }
 
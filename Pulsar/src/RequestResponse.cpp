@@ -44,6 +44,13 @@ Request::Request(uv_buf_t* request, double ArrivalTime, ClientsPool* pClientsPoo
 	}
 
 	m_bIsDeferred = FALSE;
+	m_Sequence = 0;
+	m_pRequestBuffer = NULL;
+	m_RequestBufferSize = 0;
+	m_bIsFollowedByRequests = FALSE;
+	m_pContinuation = NULL;
+	m_pContinuationState = NULL;
+	m_bIsAbandoned = FALSE;
 
 	// ASSERT (m_Client == pClient ); // Object got from the handle obtained from pClient must be equal to pClient
 }
@@ -58,6 +65,43 @@ BOOL Request::IsDeferred()
 	return m_bIsDeferred;
 }
 
+// Called by RequestProcessor::SuspendRequestProcessing. Event loop finds continuation once processing thread is done with request.
+void Request::Suspend(stRequestContinuation* pContinuation, void* pContinuationState)
+{
+	ASSERT (m_pContinuation == NULL); // Request can be suspended only once per processing
+
+	m_pContinuation = pContinuation;
+	m_pContinuationState = pContinuationState;
+}
+
+stRequestContinuation* Request::GetContinuation()
+{
+	return m_pContinuation;
+}
+
+void Request::ReleaseContinuation()
+{
+	ASSERT (m_pContinuation);
+
+	m_pContinuation->Release(); // Framework's reference
+	m_pContinuation = NULL;
+}
+
+void* Request::GetContinuationState()
+{
+	return m_pContinuationState;
+}
+
+void Request::Abandon()
+{
+	m_bIsAbandoned = TRUE;
+}
+
+BOOL Request::IsAbandoned()
+{
+	return m_bIsAbandoned;
+}
+
 void Request::SetMemoryAllocationExceptionFlag()
 {
 	m_bHasEncounteredMemoryAllocationException = TRUE;
@@ -83,11 +127,74 @@ double Request::GetArrivalTime()
 	return m_ArrivalTime; 
 }
 
+void Request::SetSequence(UINT64 Sequence)
+{
+	m_Sequence = Sequence;
+}
+
+UINT64 Request::GetSequence()
+{
+	return m_Sequence;
+}
+
+// Called thru event loop (CreateRequestAndQueue) before request is queued
+void Request::TakeOverRequestBuffer(char* pBuffer, ULONG BufferSize)
+{
+	ASSERT ((pBuffer) && (m_pRequestBuffer == NULL));
+	ASSERT (BufferSize == (m_Request.len + HEADER_SIZE));
+
+	m_pRequestBuffer = pBuffer;
+	m_RequestBufferSize = BufferSize;
+	m_Request.base = &pBuffer[HEADER_SIZE];
+}
+
+ULONG Request::GetRequestBufferSize()
+{
+	return m_RequestBufferSize;
+}
+
+void Request::SetFollowedByRequests(BOOL bFlag)
+{
+	m_bIsFollowedByRequests = bFlag ? TRUE : FALSE;
+}
+
+BOOL Request::IsFollowedByRequests()
+{
+	return m_bIsFollowedByRequests;
+}
+
 Request::~Request()
 {
+	DEL_SLAB (m_pRequestBuffer);
+}
+
+// Bytes compact handle takes: 7 bits per byte (See FORWARDED_HANDLES_COMPACT)
+static unsigned int CompactHandleLength(UINT64 Difference)
+{
+	unsigned int Length = 1;
+
+	while (Difference >>= 7)
+		Length++;
+
+	return Length;
 }
 
-Response::Response(const uv_buf_t* response, ClientHandlesPtrsIterator& StartIt, ClientHandlesPtrsIterator& EndIt, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, RequestProcessor* pRequestProcessor, double RequestArrivalTime, ConnectionsManager* pConnectionsManager)
+static unsigned int WriteCompactHandle(char* p, UINT64 Difference)
+{
+	unsigned int Length = 0;
+
+	while (Difference >= 0x80)
+	{
+		p[Length++] = (char) ((Difference & 0x7F) | 0x80);
+		Difference >>= 7;
+	}
+
+	p[Length++] = (char) Difference;
+	return Length;
+}
+
+// EndIt is moved back when compact handles of all clients don't fit in one forwarded response (Rest are for next response)
+Response::Response(const SharedBuffer& pPayload, ULONG PayloadLength, ClientHandlesPtrsIterator& StartIt, ClientHandlesPtrsIterator& EndIt, USHORT version /* Version of client who is creating/storing the Response */, BOOL bIsUpdate, BOOL bCompactHandles, RequestProcessor* pRequestProcessor, double RequestArrivalTime, ConnectionsManager* pConnectionsManager)
 {
 	// Verify that there are handles and that the server in all handles is same
 	ASSERT (StartIt != EndIt);
@@ -117,18 +224,19 @@ Response::Response(const uv_buf_t* response, ClientHandlesPtrsIterator& StartIt,
 
 	m_bIsMulticast = (m_NumberOfHandles == 1) ? FALSE : TRUE;
 
-	// Construct response. It essentially adds header to the response before copying to m_Response.
+	// Construct response. It essentially constructs header for the payload. Payload itself is not copied, it is shared.
 	// It doesn't make any sense to add header to NULL or zero-length response. If at all we send 'only header' response, it will be of no use to client.
 	// Also, in case if this is 'to be forwarded' type of response, it will be received as request by other server and on_read rejects such 'only header' requests.
-	// Hence, m_Response remains NULL and zero-lengthed in such case, which uv_write doesn't fail on, but at the same time it doesn't send also anything across the wire.
-	if ((response == NULL) || (response->base == NULL) || (response->len == 0)) 
+	if ((pPayload.get() == NULL) || (PayloadLength == 0)) 
 	{
 		throw ResponseCreationException();
 	}
 
+	m_pPayload = pPayload;
+
 	if (m_pConnectionsManager->GetIPAddressOfLocalServer() == m_ServerIPv4Address) // Response was for clients connected to this server
 	{
-		ConstructResponseForLocalClients(response, m_NumberOfHandles, version);
+		ConstructResponseForLocalClients(PayloadLength, m_NumberOfHandles, version);
 	}
 	else
 	{
@@ -137,21 +245,33 @@ Response::Response(const uv_buf_t* response, ClientHandlesPtrsIterator& StartIt,
 		// Hence, this is actually a number that represents maximum multicasts being forwarded to a single server.
 		// That's why we validate number of handles here just before creating response for remote client (and not in SendMulticast).
 		// (This limitation is not applicable for local clients as KEEP_ALIVE and FATAL_ERROR are sent by send_keepalive_thread to limitless number of local clients)
-		if (m_NumberOfHandles > MAX_HANDLES_IN_FORWARDED_RESPONSE)
+		m_bHasCompactHandles = bCompactHandles;
+
+		const unsigned int MaxNumberOfHandles = (m_bHasCompactHandles) ? MAX_COMPACT_HANDLES_IN_FORWARDED_RESPONSE : MAX_HANDLES_IN_FORWARDED_RESPONSE;
+
+		if (m_NumberOfHandles > MaxNumberOfHandles)
 		{
-			LOG (ERROR, "Cannot create multicast response which is to be forwarded. Handles exceed max limit (which imposes forwarded response size limit). Please consider multicasting in batches with max handles MAX_HANDLES_IN_FORWARDED_RESPONSE (%d) in each.", MAX_HANDLES_IN_FORWARDED_RESPONSE); 
+			LOG (ERROR, "Cannot create multicast response which is to be forwarded. Handles exceed max limit (which imposes forwarded response size limit). Please consider multicasting in batches with max handles MAX_HANDLES_IN_FORWARDED_RESPONSE (%d) in each.", MaxNumberOfHandles); 
 			throw ResponseCreationException();
 		}
 
-		ConstructResponseForRemoteClients(response, version);
+		ConstructResponseForRemoteClients(PayloadLength, version);
+
+		// Compact handles might have been trimmed
+		EndIt = m_EndIt;
+		m_bIsMulticast = (m_NumberOfHandles == 1) ? FALSE : TRUE;
 	}
 
+	// Second segment is payload, common for all responses created out of it
+	m_ResponseBuffers[1] = uv_buf_init(m_pPayload.get(), PayloadLength);
+	m_ResponseLength += PayloadLength;
+
 	// In craete response we verify response length etc. so lets find out response type here
 	switch(version)
 	{
 		case SPECIAL_COMMUNICATION:
 		{
-			m_ResponseType = response->base[0]; // m_ResponseType would be either RESPONSE_KEEP_ALIVE, RESPONSE_ERROR, RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP, RESPONSE_FATAL_ERROR
+			m_ResponseType = m_pPayload.get()[0]; // m_ResponseType would be either RESPONSE_KEEP_ALIVE, RESPONSE_ERROR, RESPONSE_ACKNOWLEDGEMENT_OF_FORWARDED_RESP, RESPONSE_FATAL_ERROR
 			break;
 		} 
 
@@ -164,18 +284,17 @@ Response::Response(const uv_buf_t* response, ClientHandlesPtrsIterator& StartIt,
 }
 
 // When response is for client(s) connected to this server, we use this constructor. This helps constructing same response intended for multiple clients (e.g. chatrooms. multicast messages etc.)
-void Response::ConstructResponseForLocalClients(const uv_buf_t* response, int NumberOfClients, USHORT version) // : bIsResponseWrittenToClient((*pClients).size(), FALSE), m_write_req((*pClients).size(), write_t)
+void Response::ConstructResponseForLocalClients(ULONG PayloadLength, int NumberOfClients, USHORT version) // : bIsResponseWrittenToClient((*pClients).size(), FALSE), m_write_req((*pClients).size(), write_t)
 {
 	// Initially plate should be clean
-	ASSERT (m_Response.base == NULL);
+	ASSERT (m_ResponseBuffers[0].base == NULL);
 
 	// At least one client has to be there
 	ASSERT (NumberOfClients > 0);
 
 	// If its response to client connected to this server:
 	// preamble | version (SenderClientVersion) | size of response | response
-		
-	m_Response.len = response->len + HEADER_SIZE;
+	// Header (first three fields) goes in m_LocalHeader. Response is the shared payload.
 
 	VersionParameters* pVersionParams = m_pConnectionsManager->GetVersionParameters(version);
 
@@ -188,42 +307,38 @@ void Response::ConstructResponseForLocalClients(const uv_buf_t* response, int Nu
 
 	UINT MaxResponseSize = pVersionParams->m_MaxResponseSize;  
 		
-	if ((m_Response.len-HEADER_SIZE) > MaxResponseSize) // Response length (excluding header size) shouldn't exceed MaxResponseSize 
+	if (PayloadLength > MaxResponseSize) // Response length (excluding header size) shouldn't exceed MaxResponseSize 
 	{
 		LOG (ERROR, "Cannot create response. Response is too long."); 
 		throw ResponseCreationException();
 	}
 
-	m_Response.base = new char [m_Response.len]; // Will be freed in destructor
-
-	base.reset (m_Response.base); // This will be automatically destructed in case of exception or response deletion
-
 	// Convert version and length to network byte order
 	USHORT version_n = htons(version);
-	UINT len_n = (UINT) htonl (response->len);
+	UINT len_n = (UINT) htonl (PayloadLength);
 
 	// First put preamble
-	memcpy_s (m_Response.base, m_Response.len, MSG_PREAMBLE, PREAMBLE_BYTES);
+	memcpy_s (m_LocalHeader, HEADER_SIZE, MSG_PREAMBLE, PREAMBLE_BYTES);
 
 	// Then version
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES], m_Response.len-PREAMBLE_BYTES, (UCHAR*)&version_n, VERSION_BYTES);
+	memcpy_s (&m_LocalHeader[PREAMBLE_BYTES], HEADER_SIZE-PREAMBLE_BYTES, (UCHAR*)&version_n, VERSION_BYTES);
 
 	// Then  size
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES+VERSION_BYTES], m_Response.len-(PREAMBLE_BYTES+VERSION_BYTES), (UCHAR*)&len_n, SIZE_BYTES);
+	memcpy_s (&m_LocalHeader[PREAMBLE_BYTES+VERSION_BYTES], HEADER_SIZE-(PREAMBLE_BYTES+VERSION_BYTES), (UCHAR*)&len_n, SIZE_BYTES);
 
-	// Finally copy the response
-	memcpy_s (&m_Response.base[HEADER_SIZE], m_Response.len-HEADER_SIZE, response->base, response->len);
+	m_ResponseBuffers[0] = uv_buf_init(m_LocalHeader, HEADER_SIZE);
+	m_ResponseLength = HEADER_SIZE;
 
 	return;
 }
 
 // When response is for client(s) connected to other server, we use this constructor. 
-void Response::ConstructResponseForRemoteClients(const uv_buf_t* response, USHORT version /* Version of client who is creating/storing the Response */)  // : bIsResponseWrittenToClient(1, FALSE), m_write_req(1, write_t)
+void Response::ConstructResponseForRemoteClients(ULONG PayloadLength, USHORT version /* Version of client who is creating/storing the Response */)  // : bIsResponseWrittenToClient(1, FALSE), m_write_req(1, write_t)
 {
 	m_bIsForward = TRUE;
 
 	// Initially plate should be clean
-	ASSERT (m_Response.base == NULL);
+	ASSERT (m_ResponseBuffers[0].base == NULL);
 
 	// If its response (to be forwarded) to client connected to other server:
 	// preamble | version (FFFF) | size (of response+additional fields) | version (SenderClientVersion) | number of handles | handles | response
@@ -231,27 +346,20 @@ void Response::ConstructResponseForRemoteClients(const uv_buf_t* response, USHOR
 	// So additional fields (other than standard HEADER_SIZE for local response) are: 
 	//						version (SenderClientVersion)	|	number of handles	|	handles
 	// Size:						short 2 bytes			+     int 4 bytes		+ (number of handles * 8 bytes m_ClientRegistrationNumber)
+	// Everything except response goes in m_pForwardHeader. Response is the shared payload.
+	// Compact handles take 1 to 10 bytes each instead (See FORWARDED_HANDLES_COMPACT).
 
-	// First let's store handles in an array
+	std::vector<UINT64> RegistrationNumbers; // Of compact handles, in ascending order
 
-	unsigned int HandlesArraySize = m_NumberOfHandles * sizeof(ClientHandle().m_ClientRegistrationNumber);
+	if (m_bHasCompactHandles)
+		m_HandlesArraySize = SortCompactHandles(RegistrationNumbers);
+	else
+		m_HandlesArraySize = m_NumberOfHandles * sizeof(ClientHandle().m_ClientRegistrationNumber);
 
-	std::unique_ptr <unsigned char[]> Handles (new unsigned char [HandlesArraySize]); 
-
-	unsigned int j=0;
-	// for (unsigned int i=0, j=0; i<NumberOfHandles; i++)
-	for (ClientHandlesPtrsIterator It = m_StartIt; It != m_EndIt; ++It)
-	{
-		UINT64 ClientRegistrationNumber = (*It)->m_ClientRegistrationNumber;
-		UINT64 ClientRegistrationNumber_n = htonll (ClientRegistrationNumber);
-		memcpy_s (&Handles.get()[j], HandlesArraySize-j, &ClientRegistrationNumber_n, sizeof(UINT64));
-		j += sizeof(UINT64);
-	}
+	unsigned int HandlesArraySize = m_HandlesArraySize;
 
 	unsigned int AdditionalFieldsSize = VERSION_BYTES /* 2 bytes version (SenderClientVersion) */  + HANDLE_BYTES /* 4 bytes to store number of handles */ + HandlesArraySize;
-	ULONG ResponseLengthWithAdditionalFields = response->len+AdditionalFieldsSize;
-
-	m_Response.len = response->len + HEADER_SIZE + AdditionalFieldsSize;
+	ULONG ResponseLengthWithAdditionalFields = PayloadLength+AdditionalFieldsSize;
 
 	VersionParameters* pVersionParams = m_pConnectionsManager->GetVersionParameters(SPECIAL_COMMUNICATION);
 
@@ -263,54 +371,123 @@ void Response::ConstructResponseForRemoteClients(const uv_buf_t* response, USHOR
 
 	UINT MaxResponseSize = pVersionParams->m_MaxResponseSize;  
 		
-	if ((m_Response.len-HEADER_SIZE) > MaxResponseSize) // Response length (excluding header size) shouldn't exceed MaxResponseSize 
+	if (ResponseLengthWithAdditionalFields > MaxResponseSize) // Response length (excluding header size) shouldn't exceed MaxResponseSize 
 	{
 		LOG (ERROR, "Cannot create forwardable response. Response is too long."); 
 		throw ResponseCreationException();
 	}
 
-	m_Response.base = new char [m_Response.len]; // Will be freed in destructor
+	const unsigned int ForwardHeaderSize = HEADER_SIZE + AdditionalFieldsSize;
+
+	m_pForwardHeader.reset (new char [ForwardHeaderSize]); // This will be automatically destructed in case of exception or response deletion
 
-	base.reset (m_Response.base); // This will be automatically destructed in case of exception or response deletion
+	char* pHeader = m_pForwardHeader.get();
 
 	// Convert version, length and number of handles to network byte order
 	USHORT ForwardResponseVersion_n = htons (SPECIAL_COMMUNICATION);
 	UINT ResponseLengthWithAdditionalFields_n = (UINT) htonl (ResponseLengthWithAdditionalFields);
 	USHORT version_n = htons (version);
-	UINT NumberOfHandles_n = (UINT) htonl (m_NumberOfHandles);
+	UINT NumberOfHandles_n = (UINT) htonl (m_NumberOfHandles | ((m_bHasCompactHandles) ? FORWARDED_HANDLES_COMPACT : 0));
 
 	// First put preamble
-	memcpy_s (m_Response.base, m_Response.len, MSG_PREAMBLE, PREAMBLE_BYTES);
+	memcpy_s (pHeader, ForwardHeaderSize, MSG_PREAMBLE, PREAMBLE_BYTES);
 
 	// Then version ('FFFF' indicating it's forwarded message)
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES], m_Response.len-PREAMBLE_BYTES, (UCHAR*)&ForwardResponseVersion_n, VERSION_BYTES);
+	memcpy_s (&pHeader[PREAMBLE_BYTES], ForwardHeaderSize-PREAMBLE_BYTES, (UCHAR*)&ForwardResponseVersion_n, VERSION_BYTES);
 
 	// Then  size (of response+additional fields)
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES+VERSION_BYTES], m_Response.len-(PREAMBLE_BYTES+VERSION_BYTES), (UCHAR*)&ResponseLengthWithAdditionalFields_n, SIZE_BYTES);
+	memcpy_s (&pHeader[PREAMBLE_BYTES+VERSION_BYTES], ForwardHeaderSize-(PREAMBLE_BYTES+VERSION_BYTES), (UCHAR*)&ResponseLengthWithAdditionalFields_n, SIZE_BYTES);
 
 	// Then  version (SenderClientVersion)
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES], m_Response.len-(PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES), (UCHAR*)&version_n, VERSION_BYTES);
+	memcpy_s (&pHeader[PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES], ForwardHeaderSize-(PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES), (UCHAR*)&version_n, VERSION_BYTES);
 
 	// Then  number of handles
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES], m_Response.len-(PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES), (UCHAR*)&NumberOfHandles_n, HANDLE_BYTES);
+	memcpy_s (&pHeader[PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES], ForwardHeaderSize-(PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES), (UCHAR*)&NumberOfHandles_n, HANDLE_BYTES);
+
+	// Finally handles
+	unsigned int j = HEADER_SIZE + VERSION_BYTES + HANDLE_BYTES;
+	if (m_bHasCompactHandles)
+	{
+		UINT64 PreviousRegistrationNumber = 0;
+
+		for (size_t i=0; i<RegistrationNumbers.size(); i++)
+		{
+			j += WriteCompactHandle(&pHeader[j], RegistrationNumbers[i] - PreviousRegistrationNumber);
+			PreviousRegistrationNumber = RegistrationNumbers[i];
+		}
+	}
+	else
+	{
+		for (ClientHandlesPtrsIterator It = m_StartIt; It != m_EndIt; ++It)
+		{
+			UINT64 ClientRegistrationNumber = (*It)->m_ClientRegistrationNumber;
+			UINT64 ClientRegistrationNumber_n = htonll (ClientRegistrationNumber);
+			memcpy_s (&pHeader[j], ForwardHeaderSize-j, &ClientRegistrationNumber_n, sizeof(UINT64));
+			j += sizeof(UINT64);
+		}
+	}
 
-	// Then handles
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES+HANDLE_BYTES], m_Response.len-(PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES+HANDLE_BYTES), (UCHAR*)Handles.get(), HandlesArraySize);
+	ASSERT (j == ForwardHeaderSize);
 
-	// Finally copy the response
-	memcpy_s (&m_Response.base[PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES+HANDLE_BYTES+HandlesArraySize], m_Response.len-(PREAMBLE_BYTES+VERSION_BYTES+SIZE_BYTES+VERSION_BYTES+HANDLE_BYTES+HandlesArraySize), response->base, response->len);
+	m_ResponseBuffers[0] = uv_buf_init(pHeader, ForwardHeaderSize);
+	m_ResponseLength = ForwardHeaderSize;
 
 	return;
 }
 
+// Registration numbers of clients are collected in ascending order, so that compact handles are differences between them. Those differences are
+// bigger for fewer clients, so when compact handles don't fit in the buffer for handles response is trimmed to proportionally fewer clients, with some room.
+unsigned int Response::SortCompactHandles(std::vector<UINT64>& RegistrationNumbers)
+{
+	const UINT64 MaxHandlesArraySize = 1024*BUFFER_SIZE_IN_KILOBYTES_FOR_HANDLES_IN_SPECIAL_COMMUNICATION;
+
+	RegistrationNumbers.reserve(m_NumberOfHandles); // Throws std::bad_alloc
+
+	for (;;)
+	{
+		RegistrationNumbers.clear();
+
+		for (ClientHandlesPtrsIterator It = m_StartIt; It != m_EndIt; ++It)
+			RegistrationNumbers.push_back((*It)->m_ClientRegistrationNumber);
+
+		std::sort(RegistrationNumbers.begin(), RegistrationNumbers.end());
+
+		UINT64 HandlesArraySize = 0, PreviousRegistrationNumber = 0;
+
+		for (size_t i=0; i<RegistrationNumbers.size(); i++)
+		{
+			HandlesArraySize += CompactHandleLength(RegistrationNumbers[i] - PreviousRegistrationNumber);
+			PreviousRegistrationNumber = RegistrationNumbers[i];
+		}
+
+		if (HandlesArraySize <= MaxHandlesArraySize)
+			return (unsigned int) HandlesArraySize;
+
+		// Single handle always fits, so this ends
+		unsigned int NumberOfHandles = (unsigned int) (((m_NumberOfHandles * MaxHandlesArraySize) / HandlesArraySize) * 9 / 10);
+		m_NumberOfHandles = (NumberOfHandles) ? NumberOfHandles : 1;
+
+		m_EndIt = m_StartIt;
+		std::advance(m_EndIt, m_NumberOfHandles);
+	}
+}
+
 void Response::Initialize()
 {
 	// Initialize response to null
-	m_Response.base = NULL ;
-	m_Response.len = NULL ;
+	for (int i=0; i<BUFFERS_PER_RESPONSE; i++)
+		m_ResponseBuffers[i] = uv_buf_init(NULL, 0);
+	m_ResponseLength = 0;
+	m_CompressedPayloadLength = 0;
+	m_bIsPayloadCompressed = FALSE;
+	m_bHasCompactHandles = FALSE;
+	m_HandlesArraySize = 0;
+	m_pUpdateCompletion = NULL;
+	m_Priority = RESPONSE_PRIORITY_NORMAL;
 
 	// Initialize other variables
 	m_ReferenceCount = 0 ;
+	m_bIsReadyToSend.store(FALSE, std::memory_order_relaxed);
 	ForwardError = 0 ; // Enables SendResponses to set error codes related to forward response (to other server)
 	bAddedToStat = FALSE ; 
 	ResponseSentCount = 0;
@@ -333,6 +510,19 @@ int Response::GetReferenceCount()
 	return m_ReferenceCount;
 }
 
+// Called by ConnectionsManager::AddResponseToQueues after setting reference count. 
+// Responses are pushed to client queues before reference count is known, so event loop must not send them till this is called.
+void Response::SetReadyToSend()
+{
+	m_bIsReadyToSend.store(TRUE, std::memory_order_release); // Makes reference count visible to event loop
+}
+
+// Called by event loop
+BOOL Response::IsReadyToSend()
+{
+	return m_bIsReadyToSend.load(std::memory_order_acquire);
+}
+
 RequestProcessor* Response::GetRequestProcessor()
 {
 	return m_pRequestProcessor;
@@ -340,6 +530,55 @@ RequestProcessor* Response::GetRequestProcessor()
 
 Response::~Response()
 {
+	if (m_pUpdateCompletion)
+		m_pUpdateCompletion->Release();
+}
+
+// Called by RequestProcessor::CreateResponseAndAddToQueues. Update is complete only after this response is deleted (sent, failed or not queued).
+void Response::SetUpdateCompletion(stUpdateCompletion* pUpdateCompletion)
+{
+	ASSERT (m_pUpdateCompletion == NULL);
+
+	m_pUpdateCompletion = pUpdateCompletion;
+	m_pUpdateCompletion->AddResponse();
+}
+
+// Called by RequestProcessor::CreateResponseAndAddToQueues
+void Response::SetPriority(int Priority)
+{
+	ASSERT ((Priority >= 0) && (Priority < RESPONSE_PRIORITIES));
+
+	m_Priority = Priority;
+}
+
+// Called by threads queueing response to local clients and by event loop (held responses)
+int Response::GetPriority()
+{
+	return m_Priority;
+}
+
+stUpdateCompletion::stUpdateCompletion(UpdateCompletionFunction pCompletionFunction, void* pContext)
+{
+	m_pCompletionFunction = pCompletionFunction;
+	m_pContext = pContext;
+	m_PendingResponses.store(1, std::memory_order_relaxed); // Held by StoreMessage
+}
+
+void stUpdateCompletion::AddResponse()
+{
+	m_PendingResponses.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Called from threads (StoreMessage, or when response couldn't be queued) as well as from event loops (after sending or forwarding response)
+void stUpdateCompletion::Release()
+{
+	if (m_PendingResponses.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	if (m_pCompletionFunction)
+		m_pCompletionFunction(m_pContext);
+
+	delete this;
 }
 
 BOOL Response::IsFatalErrorForLocallyConnectedClient()
@@ -366,9 +605,68 @@ int Response::GetResponseType()
 	return m_ResponseType; 
 } 
 
-const uv_buf_t Response::GetResponse() 
+const uv_buf_t* Response::GetResponseBuffers() 
 { 
-	return m_Response ;  // Returns copy of uv_buf_t structure containing response
+	return m_ResponseBuffers ;  // Header and (shared) payload. uv_write copies these structures (not the data) so caller may copy them too.
+}
+
+// Length with payload is what queues and memory consumption account for, even after response switches to compressed payload
+ULONG Response::GetResponseLength(BOOL bWithCompressedPayload) 
+{ 
+	if ((bWithCompressedPayload) && (m_pCompressedPayload.get()))
+		return m_ResponseBuffers[0].len + m_CompressedPayloadLength;
+
+	return m_ResponseLength ;
+}
+
+// Called by RequestProcessor::CreateResponseAndAddToQueues for forwarded response. Compressed payload is shared by all responses created out of payload.
+void Response::SetCompressedPayload(const SharedBuffer& pCompressedPayload, ULONG CompressedPayloadLength)
+{
+	ASSERT ((m_bIsForward) && (m_bIsPayloadCompressed == FALSE));
+
+	m_pCompressedPayload = pCompressedPayload;
+	m_CompressedPayloadLength = CompressedPayloadLength;
+}
+
+// Called by event loop (SendPeerServersResponses) when peer server supports compression. Forward header is of this response only, so it is changed in place.
+BOOL Response::UseCompressedPayload()
+{
+	if ((m_pCompressedPayload.get() == NULL) || (m_bIsPayloadCompressed))
+		return m_bIsPayloadCompressed;
+
+	char* pHeader = m_pForwardHeader.get();
+	const ULONG ForwardHeaderSize = m_ResponseBuffers[0].len;
+
+	UINT ResponseLengthWithAdditionalFields_n = (UINT) htonl ((ForwardHeaderSize - HEADER_SIZE) + m_CompressedPayloadLength);
+	UINT NumberOfHandles_n = (UINT) htonl (m_NumberOfHandles | FORWARDED_PAYLOAD_COMPRESSED | ((m_bHasCompactHandles) ? FORWARDED_HANDLES_COMPACT : 0));
+
+	memcpy (&pHeader[PREAMBLE_BYTES+VERSION_BYTES], &ResponseLengthWithAdditionalFields_n, SIZE_BYTES);
+	memcpy (&pHeader[HEADER_SIZE+VERSION_BYTES], &NumberOfHandles_n, HANDLE_BYTES);
+
+	m_ResponseBuffers[1] = uv_buf_init(m_pCompressedPayload.get(), m_CompressedPayloadLength);
+	m_bIsPayloadCompressed = TRUE;
+
+	return TRUE;
+}
+
+BOOL Response::IsPayloadCompressed()
+{
+	return m_bIsPayloadCompressed;
+}
+
+BOOL Response::HasCompactHandles()
+{
+	return m_bHasCompactHandles;
+}
+
+unsigned int Response::GetNumberOfHandles()
+{
+	return m_NumberOfHandles;
+}
+
+unsigned int Response::GetHandlesArraySize()
+{
+	return m_HandlesArraySize;
 }
 
 BOOL Response::IsMulticast()
@@ -0,0 +1,123 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Pulsar.h"
+
+/*
+Please refer ResponseQueue.h
+*/
+
+ResponseQueue::ResponseQueue()
+{
+	m_pSlots = NULL;
+	m_Capacity = 0;
+	m_PushPosition.store(0, std::memory_order_relaxed);
+	m_PopPosition = 0;
+}
+
+// Called through event loop (stClient c'tor), once for each priority lane of client
+void ResponseQueue::Initialize(int Capacity)
+{
+	ASSERT ((Capacity > 0) && (m_pSlots == NULL));
+
+	m_Capacity = Capacity;
+	m_pSlots = new stSlot[Capacity]; // Throws std::bad_alloc which fails client creation
+
+	for (int i=0; i<Capacity; i++)
+	{
+		m_pSlots[i].m_Sequence.store(i, std::memory_order_relaxed);
+		m_pSlots[i].m_pResponse = NULL;
+	}
+
+	m_PushPosition.store(0, std::memory_order_relaxed);
+	m_PopPosition = 0;
+}
+
+ResponseQueue::~ResponseQueue()
+{
+	DEL_ARRAY (m_pSlots);
+}
+
+// Called by request processing threads (through LocalClientsManager::AddResponseToQueue)
+BOOL ResponseQueue::Push(Response* pResponse)
+{
+	UINT64 Position = m_PushPosition.load(std::memory_order_relaxed);
+	stSlot* pSlot;
+
+	for (;;)
+	{
+		pSlot = &m_pSlots[Position % m_Capacity];
+		UINT64 Sequence = pSlot->m_Sequence.load(std::memory_order_acquire);
+
+		if (Sequence == Position) // Slot is free. Try to claim it.
+		{
+			if (m_PushPosition.compare_exchange_weak(Position, Position+1, std::memory_order_relaxed))
+				break;
+			// Another thread claimed it. compare_exchange_weak has loaded latest position, so try again.
+		}
+		else if (Sequence < Position) // Slot still holds response which event loop hasn't popped. Queue is full.
+		{
+			return FALSE;
+		}
+		else // Another thread has already pushed at this position
+		{
+			Position = m_PushPosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	pSlot->m_pResponse = pResponse;
+	pSlot->m_Sequence.store(Position+1, std::memory_order_release); // Makes response visible to event loop
+
+	return TRUE;
+}
+
+// Called by event loop
+Response* ResponseQueue::Peek()
+{
+	stSlot* pSlot = &m_pSlots[m_PopPosition % m_Capacity];
+
+	if (pSlot->m_Sequence.load(std::memory_order_acquire) != m_PopPosition+1)
+		return NULL; // Either empty or producer has claimed the slot but not yet stored response
+
+	return pSlot->m_pResponse;
+}
+
+// Called by event loop. Must be called only after Peek returned response.
+void ResponseQueue::Pop()
+{
+	stSlot* pSlot = &m_pSlots[m_PopPosition % m_Capacity];
+
+	ASSERT (pSlot->m_Sequence.load(std::memory_order_relaxed) == m_PopPosition+1);
+
+	pSlot->m_pResponse = NULL;
+	pSlot->m_Sequence.store(m_PopPosition+m_Capacity, std::memory_order_release); // Slot is free for the position one round ahead
+
+	m_PopPosition++;
+}
+
+// Called by event loop
+BOOL ResponseQueue::IsEmpty()
+{
+	return (Peek() == NULL) ? TRUE : FALSE;
+}
+
+// Called by event loop
+UINT64 ResponseQueue::GetCount()
+{
+	return m_PushPosition.load(std::memory_order_relaxed) - m_PopPosition;
+}
@@ -0,0 +1,303 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Pulsar.h"
+
+/*
+Please refer Scheduler.h
+
+Worker sleeps only after it has found all deques empty. To not to miss work queued meanwhile, it counts itself in m_SleepingWorkers and
+checks m_QueuedWorks again under m_SleepLock before waiting. Event loop queueing work increases m_QueuedWorks before it checks
+m_SleepingWorkers, and signals under same lock. So either worker sees the work or event loop sees sleeping worker.
+*/
+
+static THREAD_LOCAL int m_WorkerIndex = -1; // Assigned once by each worker when it starts
+
+Scheduler::Scheduler()
+{
+	m_WorkersCount = 0;
+	m_FirstCPU = -1;
+	m_NextWorker = 0;
+	m_QueuedWorks = 0;
+	m_SleepingWorkers = 0;
+	m_bStopRequested = FALSE;
+}
+
+int Scheduler::Start(int WorkersCount, int FirstCPU, ServerStatCounters* pStatCounters)
+{
+	int RetVal;
+
+	ASSERT ((WorkersCount >= 1) && (WorkersCount <= MAX_WORK_THREADS));
+
+	m_FirstCPU = FirstCPU;
+
+	RetVal = uv_mutex_init(&m_SleepLock);
+	ASSERT_RETURN (RetVal);
+
+	RetVal = uv_cond_init(&m_WakeUpCondition);
+	ASSERT_RETURN (RetVal);
+
+	// All deques must be there before first worker starts stealing
+	for (int i=0; i<WorkersCount; i++)
+	{
+		stWorker* pWorker = &m_Workers[i];
+
+		pWorker->m_pScheduler = this;
+		pWorker->m_Index = i;
+		pWorker->m_pStatCounters = &pStatCounters[i];
+		pWorker->m_pFirstWork = NULL;
+		pWorker->m_pLastWork = NULL;
+
+		RetVal = uv_mutex_init(&pWorker->m_Lock);
+		ASSERT_RETURN (RetVal);
+	}
+
+	m_WorkersCount = WorkersCount;
+
+	for (int i=0; i<WorkersCount; i++)
+	{
+		RetVal = uv_thread_create(&m_Workers[i].m_Thread, worker_thread, &m_Workers[i]);
+		ASSERT_RETURN (RetVal);
+	}
+
+	return 0;
+}
+
+void Scheduler::Stop()
+{
+	if (m_WorkersCount) // Else Start never ran and lock and condition were never initialized
+	{
+		uv_mutex_lock(&m_SleepLock);
+		m_bStopRequested = TRUE;
+		uv_cond_broadcast(&m_WakeUpCondition);
+		uv_mutex_unlock(&m_SleepLock);
+	}
+
+	for (int i=0; i<m_WorkersCount; i++)
+	{
+		uv_thread_join(&m_Workers[i].m_Thread);
+		uv_mutex_destroy(&m_Workers[i].m_Lock);
+	}
+
+	if (m_WorkersCount)
+	{
+		uv_cond_destroy(&m_WakeUpCondition);
+		uv_mutex_destroy(&m_SleepLock);
+	}
+
+	m_WorkersCount = 0;
+}
+
+// Called by event loop. pWorkFunction runs on some worker and thereafter pAfterWorkFunction on event loop owning pDoneWorks.
+void Scheduler::QueueWork(stWork* work_t, stDoneWorks* pDoneWorks, WorkFunction pWorkFunction, AfterWorkFunction pAfterWorkFunction)
+{
+	ASSERT (pWorkFunction && pAfterWorkFunction && m_WorkersCount);
+
+	work_t->m_pWorkFunction = pWorkFunction;
+	work_t->m_pAfterWorkFunction = pAfterWorkFunction;
+	work_t->m_pDoneWorks = pDoneWorks;
+	work_t->m_pNextDone = NULL;
+	work_t->m_pNext = NULL;
+
+	stWorker* pWorker = &m_Workers[m_NextWorker.fetch_add(1, std::memory_order_relaxed) % m_WorkersCount];
+
+	uv_mutex_lock(&pWorker->m_Lock);
+	work_t->m_pPrevious = pWorker->m_pLastWork;
+	if (pWorker->m_pLastWork)
+		pWorker->m_pLastWork->m_pNext = work_t;
+	else
+		pWorker->m_pFirstWork = work_t;
+	pWorker->m_pLastWork = work_t;
+	uv_mutex_unlock(&pWorker->m_Lock);
+
+	m_QueuedWorks ++;
+
+	if (m_SleepingWorkers > 0)
+	{
+		uv_mutex_lock(&m_SleepLock);
+		uv_cond_signal(&m_WakeUpCondition);
+		uv_mutex_unlock(&m_SleepLock);
+	}
+}
+
+// Called by worker. Works of own deque are taken from front (in order they were queued) and works of others from back.
+stWork* Scheduler::TakeWork(stWorker* pWorker)
+{
+	stWork* work_t = NULL;
+
+	uv_mutex_lock(&pWorker->m_Lock);
+	work_t = pWorker->m_pFirstWork;
+	if (work_t)
+	{
+		pWorker->m_pFirstWork = work_t->m_pNext;
+		if (pWorker->m_pFirstWork)
+			pWorker->m_pFirstWork->m_pPrevious = NULL;
+		else
+			pWorker->m_pLastWork = NULL;
+	}
+	uv_mutex_unlock(&pWorker->m_Lock);
+
+	for (int i=1; (work_t == NULL) && (i<m_WorkersCount); i++)
+	{
+		stWorker* pVictim = &m_Workers[(pWorker->m_Index + i) % m_WorkersCount];
+
+		uv_mutex_lock(&pVictim->m_Lock);
+		work_t = pVictim->m_pLastWork;
+		if (work_t)
+		{
+			pVictim->m_pLastWork = work_t->m_pPrevious;
+			if (pVictim->m_pLastWork)
+				pVictim->m_pLastWork->m_pNext = NULL;
+			else
+				pVictim->m_pFirstWork = NULL;
+		}
+		uv_mutex_unlock(&pVictim->m_Lock);
+
+		if (work_t)
+			pWorker->m_pStatCounters->WorksStolen ++;
+	}
+
+	if (work_t)
+		m_QueuedWorks --;
+
+	return work_t;
+}
+
+void Scheduler::worker_thread(void* arg)
+{
+	stWorker* pWorker = (stWorker*) arg;
+	Scheduler* pScheduler = pWorker->m_pScheduler;
+
+	m_WorkerIndex = pWorker->m_Index;
+	pScheduler->PinToCPU(pWorker);
+
+	while (TRUE)
+	{
+		stWork* work_t = pScheduler->TakeWork(pWorker);
+
+		if (work_t == NULL)
+		{
+			BOOL bStop;
+
+			uv_mutex_lock(&pScheduler->m_SleepLock);
+			pScheduler->m_SleepingWorkers ++;
+
+			while ((pScheduler->m_QueuedWorks <= 0) && (pScheduler->m_bStopRequested == FALSE))
+				uv_cond_wait(&pScheduler->m_WakeUpCondition, &pScheduler->m_SleepLock);
+
+			pScheduler->m_SleepingWorkers --;
+			bStop = ((pScheduler->m_QueuedWorks <= 0) && pScheduler->m_bStopRequested); // Works queued before stop are finished first
+			uv_mutex_unlock(&pScheduler->m_SleepLock);
+
+			if (bStop)
+				break;
+
+			continue;
+		}
+
+		work_t->m_pWorkFunction(work_t);
+
+		// Hand work back to its event loop. Work must not be touched thereafter as event loop might free it anytime.
+		stDoneWorks* pDoneWorks = work_t->m_pDoneWorks;
+		stWork* pHead = pDoneWorks->m_pHead.load(std::memory_order_relaxed);
+
+		do
+		{
+			work_t->m_pNextDone = pHead;
+		}
+		while (pDoneWorks->m_pHead.compare_exchange_weak(pHead, work_t, std::memory_order_release, std::memory_order_relaxed) == false);
+
+		if (pHead == NULL) // Loop is woken up once for whole list
+			uv_async_send(&pDoneWorks->m_AsyncHandle);
+	}
+}
+
+// Called by worker when it starts. Failure to pin is logged and worker keeps running unpinned.
+void Scheduler::PinToCPU(stWorker* pWorker)
+{
+	if (m_FirstCPU < 0)
+		return;
+
+	uv_cpu_info_t* pCPUInfos;
+	int CPUs;
+
+	if ((uv_cpu_info(&pCPUInfos, &CPUs) != 0) || (CPUs < 1))
+	{
+		LOG (ERROR, "Could not get CPU count. Request processing thread %d is not pinned.", pWorker->m_Index);
+		return;
+	}
+
+	uv_free_cpu_info(pCPUInfos, CPUs);
+
+	int CPU = (m_FirstCPU + pWorker->m_Index) % CPUs;
+	int RetVal;
+
+#ifdef _WIN32
+	RetVal = (SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << (CPU % (sizeof(DWORD_PTR)*8))) == 0) ? -1 : 0;
+#else
+	cpu_set_t CPUSet;
+	CPU_ZERO(&CPUSet);
+	CPU_SET(CPU, &CPUSet);
+	RetVal = pthread_setaffinity_np(pthread_self(), sizeof(CPUSet), &CPUSet);
+#endif
+
+	if (RetVal != 0)
+		LOG (ERROR, "Request processing thread %d could not be pinned to CPU %d", pWorker->m_Index, CPU);
+}
+
+int Scheduler::InitializeDoneWorks(uv_loop_t* pLoop, stDoneWorks* pDoneWorks)
+{
+	pDoneWorks->m_pHead = NULL;
+	pDoneWorks->m_AsyncHandle.data = pDoneWorks;
+
+	return uv_async_init(pLoop, &pDoneWorks->m_AsyncHandle, on_works_done);
+}
+
+void Scheduler::CloseDoneWorks(stDoneWorks* pDoneWorks)
+{
+	uv_close((uv_handle_t*)&pDoneWorks->m_AsyncHandle, NULL);
+}
+
+// Called by event loop when workers have finished its works. After functions are called in order works were done.
+void Scheduler::on_works_done(uv_async_t* handle)
+{
+	stDoneWorks* pDoneWorks = (stDoneWorks*) handle->data;
+	stWork* work_t = pDoneWorks->m_pHead.exchange(NULL, std::memory_order_acquire);
+	stWork* pReversed = NULL;
+
+	while (work_t)
+	{
+		stWork* pNext = work_t->m_pNextDone;
+		work_t->m_pNextDone = pReversed;
+		pReversed = work_t;
+		work_t = pNext;
+	}
+
+	while (pReversed)
+	{
+		stWork* pNext = pReversed->m_pNextDone; // After function might free the work
+		pReversed->m_pAfterWorkFunction(pReversed, 0);
+		pReversed = pNext;
+	}
+}
+
+// Called by request processors (through LocalClientsManager::GetCurrentThreadIndex) and their statistics
+int Scheduler::GetCurrentWorkerIndex()
+{
+	return m_WorkerIndex;
+}
@@ -0,0 +1,193 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Pulsar.h"
+
+/*
+Please refer SlabAllocator.h
+*/
+
+THREAD_LOCAL SlabAllocator::stThreadPools* SlabAllocator::m_pThreadPools = NULL;
+std::atomic<SlabAllocator::stThreadPools*> SlabAllocator::m_pAllThreadPools(NULL);
+int SlabAllocator::m_MaxSizeClass = 11; // 64 KB blocks, till SetMaxBlockSize is called
+
+static int GetBlockSize(int SizeClass)
+{
+	return (SLAB_MIN_BLOCK_SIZE << SizeClass);
+}
+
+// Called through LocalClientsManager::StartListening with size of largest request/response (header included) of all versions
+void SlabAllocator::SetMaxBlockSize(int MaxBlockSize)
+{
+	int SizeClass = 0;
+
+	while ((SizeClass < (SLAB_SIZE_CLASSES-1)) && (GetBlockSize(SizeClass) < (int)(MaxBlockSize + sizeof(stBlockHeader))))
+		SizeClass++;
+
+	m_MaxSizeClass = SizeClass;
+}
+
+// Called by each thread at its first allocation
+SlabAllocator::stThreadPools* SlabAllocator::CreateThreadPools()
+{
+	// Pools are cache aligned, which plain new doesn't guarantee (before C++17). Memory is never freed (See stThreadPools), else it would
+	// have to be through _aligned_free / free.
+	void* pMemory = NULL;
+
+#ifdef _WIN32
+	pMemory = _aligned_malloc(sizeof(stThreadPools), CACHE_LINE_SIZE);
+#else
+	if (posix_memalign(&pMemory, CACHE_LINE_SIZE, sizeof(stThreadPools)) != 0)
+		pMemory = NULL;
+#endif
+
+	if (pMemory == NULL)
+		throw std::bad_alloc();
+
+	stThreadPools* pThreadPools = new (pMemory) stThreadPools;
+
+	for (int i=0; i<SLAB_SIZE_CLASSES; i++)
+	{
+		stSlabPool& Pool = pThreadPools->m_Pools[i];
+
+		Pool.m_SizeClass = i;
+		Pool.m_pFreeList = NULL;
+		Pool.m_pRemoteFreeList = NULL;
+		Pool.m_BlocksReserved = 0;
+		Pool.m_Allocations = 0;
+		Pool.m_LocalFrees = 0;
+		Pool.m_RemoteFrees = 0;
+	}
+
+	stThreadPools* pHead = m_pAllThreadPools.load(std::memory_order_relaxed);
+
+	do
+	{
+		pThreadPools->m_pNext = pHead;
+	}
+	while (m_pAllThreadPools.compare_exchange_weak(pHead, pThreadPools, std::memory_order_release, std::memory_order_relaxed) == false);
+
+	return pThreadPools;
+}
+
+// Called by owner thread when its free list is empty. Takes over blocks freed by other threads, if none then carves new chunk.
+void SlabAllocator::Refill(stSlabPool* pPool)
+{
+	pPool->m_pFreeList = pPool->m_pRemoteFreeList.exchange(NULL, std::memory_order_acquire);
+
+	if (pPool->m_pFreeList)
+		return;
+
+	int BlockSize = GetBlockSize(pPool->m_SizeClass);
+	int Blocks = (BlockSize < SLAB_SIZE) ? (SLAB_SIZE / BlockSize) : 1;
+	char* pChunk = new char [BlockSize * Blocks]; // Throws std::bad_alloc
+
+	for (int i=Blocks-1; i>=0; i--)
+	{
+		stBlockHeader* pBlock = (stBlockHeader*)&pChunk[i * BlockSize];
+		pBlock->m_pPool = pPool;
+		pBlock->m_pNext = pPool->m_pFreeList;
+		pPool->m_pFreeList = pBlock;
+	}
+
+	pPool->m_BlocksReserved.store(pPool->m_BlocksReserved.load(std::memory_order_relaxed) + Blocks, std::memory_order_relaxed);
+}
+
+void* SlabAllocator::Allocate(size_t Size)
+{
+	size_t SizeNeeded = Size + sizeof(stBlockHeader);
+	int SizeClass = 0;
+
+	while ((SizeClass <= m_MaxSizeClass) && ((size_t)GetBlockSize(SizeClass) < SizeNeeded))
+		SizeClass++;
+
+	if (SizeClass > m_MaxSizeClass) // Too big for slabs
+	{
+		stBlockHeader* pBlock = (stBlockHeader*) new char [SizeNeeded]; // Throws std::bad_alloc
+		pBlock->m_pPool = NULL;
+		return &pBlock[1];
+	}
+
+	if (m_pThreadPools == NULL)
+		m_pThreadPools = CreateThreadPools();
+
+	stSlabPool* pPool = &m_pThreadPools->m_Pools[SizeClass];
+
+	if (pPool->m_pFreeList == NULL)
+		Refill(pPool);
+
+	stBlockHeader* pBlock = pPool->m_pFreeList;
+	pPool->m_pFreeList = pBlock->m_pNext;
+	ASSERT (pBlock->m_pPool == pPool);
+
+	pPool->m_Allocations.store(pPool->m_Allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	return &pBlock[1];
+}
+
+void SlabAllocator::Free(void* pMemory)
+{
+	if (pMemory == NULL)
+		return;
+
+	stBlockHeader* pBlock = &((stBlockHeader*)pMemory)[-1];
+	stSlabPool* pPool = pBlock->m_pPool;
+
+	if (pPool == NULL)
+	{
+		delete[] (char*)pBlock;
+		return;
+	}
+
+	if ((m_pThreadPools) && (pPool >= &m_pThreadPools->m_Pools[0]) && (pPool < &m_pThreadPools->m_Pools[SLAB_SIZE_CLASSES])) // Block of this thread
+	{
+		pBlock->m_pNext = pPool->m_pFreeList;
+		pPool->m_pFreeList = pBlock;
+		pPool->m_LocalFrees.store(pPool->m_LocalFrees.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+
+	stBlockHeader* pHead = pPool->m_pRemoteFreeList.load(std::memory_order_relaxed);
+
+	do
+	{
+		pBlock->m_pNext = pHead;
+	}
+	while (pPool->m_pRemoteFreeList.compare_exchange_weak(pHead, pBlock, std::memory_order_release, std::memory_order_relaxed) == false);
+
+	pPool->m_RemoteFrees.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Called by main loop (LogStat). Pools are being changed meanwhile, so occupancy could be slightly stale.
+void SlabAllocator::AddUpStat(ServerStat& stServerStat)
+{
+	for (stThreadPools* pThreadPools = m_pAllThreadPools.load(std::memory_order_acquire); pThreadPools; pThreadPools = pThreadPools->m_pNext)
+	{
+		for (int i=0; i<SLAB_SIZE_CLASSES; i++)
+		{
+			stSlabPool& Pool = pThreadPools->m_Pools[i];
+
+			INT64 BlocksReserved = Pool.m_BlocksReserved.load(std::memory_order_relaxed);
+			INT64 BlocksInUse = Pool.m_Allocations.load(std::memory_order_relaxed) - Pool.m_LocalFrees.load(std::memory_order_relaxed) - Pool.m_RemoteFrees.load(std::memory_order_relaxed);
+
+			stServerStat.SlabBlocksReserved[i] += BlocksReserved;
+			stServerStat.SlabBlocksInUse[i] += BlocksInUse;
+			stServerStat.MemoryReservedBySlabs += BlocksReserved * GetBlockSize(i);
+		}
+	}
+}
@@ -79,6 +79,7 @@ void WriteToFile::DeleteAllFiles(std::string folderPath)
 {
 	char fileFound[1024];
 
+#ifdef _WIN32
 	WIN32_FIND_DATA info;
 	HANDLE hp; 
 	sprintf(fileFound, "%s\\*.*", folderPath.c_str());
@@ -91,6 +92,21 @@ void WriteToFile::DeleteAllFiles(std::string folderPath)
 	}while(FindNextFile(hp, &info)); 
 
 	FindClose(hp);
+#else
+	DIR* dir = opendir(folderPath.c_str());
+	if (!dir)
+		return;
+
+	while (struct dirent* entry = readdir(dir))
+	{
+		sprintf(fileFound, "%s/%s", folderPath.c_str(), entry->d_name);
+
+		// Like DeleteFile, unlink fails for ".", ".." and sub folders. Those are left as they are.
+		unlink(fileFound);
+	}
+
+	closedir(dir);
+#endif
 }
 
 /* ----------------------------------------------------------------------------------------------------------------------------------
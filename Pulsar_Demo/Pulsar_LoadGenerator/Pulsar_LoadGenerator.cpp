@@ -0,0 +1,845 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Load generator for Pulsar_SampleServer (Linux only). Speaks MAI protocol and demo protocol of RequestProcessor_v1.
+
+Opens given number of connections. Out of them 'active' connections REGISTER and keep sending ECHO requests, rest stay idle
+(they only add up to connections server has to handle). Since server echoes to all registered clients, each ECHO results
+in as many responses as there are active connections. Keep active connections low to keep the fan-out in control.
+
+Each ECHO carries id of sending connection and time it was scheduled to be sent. When sender receives its own echo back,
+latency is recorded. Open loop (-r rate) schedules requests at fixed rate regardless of responses, and latency is taken from
+scheduled time so that stalls of server are not hidden (coordinated omission). Closed loop (-r 0) sends next ECHO from a
+connection as soon as previous one is echoed back.
+
+Connections are spread over worker threads, each having its own epoll. After connecting and warm up, measurement runs
+for given duration and then throughput and latency percentiles (p50/p99/p999) are reported.
+*/
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// RELATED TO MASTER PROTOCOL (Same as in SimpleWinsockClient)
+#define MSG_PREAMBLE "MAI" // Message And Information
+#define PREAMBLE_BYTES_SIZE (sizeof(MSG_PREAMBLE)-1) // -1 because sizeof returns length including last null character
+#define VERSION_BYTES_SIZE sizeof(uint16_t)
+#define SIZE_BYTES_SIZE sizeof(uint32_t)
+#define HEADER_SIZE (PREAMBLE_BYTES_SIZE + VERSION_BYTES_SIZE + SIZE_BYTES_SIZE)
+#define SPECIAL_COMMUNICATION		(0xFFFF) // Reserved version value
+#define RESPONSE_KEEP_ALIVE 0 // 00: Keep Alive (Communicated by Server to Client when version is SPECIAL_COMMUNICATION)
+#define RESPONSE_ERROR		1 // 01: Error (Communicated by Server to Client when version is SPECIAL_COMMUNICATION)
+
+// REQUESTS AND RESPONSES FOR DEMO PROTOCOL (RequestProcessor_v1)
+#define PROTOCOL_VERSION 1
+#define REGISTER	1
+#define ECHO		2
+#define REGISTERED	3
+#define ECHOED		4
+
+#define MAX_BUFFER_SIZE (128*1024) // MAX_REQUEST_SIZE (and MAX_RESPONSE_SIZE) of RequestProcessor_v1
+
+// ECHO request/response body: Code, id of sending connection and scheduled send time (in nanoseconds). Rest is padding.
+#define ECHO_STAMP_SIZE (1 + sizeof(uint32_t) + sizeof(uint64_t))
+
+#define CONNECTS_IN_PROGRESS_PER_THREAD 64 // Listen backlog of server is 256. Don't let SYNs overflow it.
+#define RESPONSE_TIMEOUT_IN_NANOSECONDS (1000000000ULL) // Closed loop: Echo not received by then is considered lost (server drops responses when client's queue is full)
+#define EPOLL_EVENTS_PER_WAIT 256
+#define READ_BUFFER_SIZE (64*1024)
+
+enum LoadPhase { PHASE_CONNECTING, PHASE_WARMING_UP, PHASE_MEASURING, PHASE_DONE };
+enum ConnectionState { NOT_CONNECTED, CONNECTING, REGISTERING, READY, CLOSED };
+
+struct LoadParameters
+{
+	const char* IPAddress;
+	unsigned short int Port;
+	int Connections; // Total connections
+	int ActiveConnections; // Connections which register and send echoes
+	int Rate; // Total ECHO requests per second. 0 for closed loop.
+	int PayloadSize; // Size of ECHO request body
+	int DurationInSeconds;
+	int WarmupInSeconds;
+	int Threads;
+};
+
+struct stConnection
+{
+	int m_Socket;
+	uint32_t m_Id;
+	int m_State;
+	bool m_bIsActive;
+	bool m_bIsWaitingToWrite; // EPOLLOUT is registered
+	std::string m_Partial; // Bytes of incomplete response
+	std::string m_Pending; // Bytes not yet accepted by socket
+	uint64_t m_OutstandingSince; // Closed loop: scheduled time of echo not yet received. 0 when none.
+};
+
+struct stWorker
+{
+	int m_Index;
+	int m_Epoll;
+	std::vector<stConnection> m_Connections;
+	int m_NextToConnect;
+	int m_Connecting;
+	int m_NextToSend; // Open loop: round robin position among connections
+	uint64_t m_NextSendTime; // Open loop: scheduled time of next echo
+	uint64_t m_SendInterval; // Open loop: nanoseconds between two echoes of this worker
+	std::thread m_Thread;
+
+	// Progress (read by main thread)
+	std::atomic<int> m_ConnectionsReady, m_ConnectionsFailed, m_Disconnections;
+
+	// Counted only while measuring
+	std::atomic<uint64_t> m_RequestsSent, m_OwnEchoesReceived, m_ResponsesReceived, m_BytesReceived;
+	uint64_t m_RequestsSkipped, m_RequestsLost, m_Errors, m_KeepAlives;
+	std::vector<uint32_t> m_Latencies; // Microseconds
+
+	char m_ReadBuffer[READ_BUFFER_SIZE];
+	std::vector<char> m_SendBuffer;
+};
+
+static LoadParameters g_Params;
+static struct sockaddr_in g_ServerAddress;
+static std::atomic<int> g_Phase(PHASE_CONNECTING);
+static std::atomic<uint64_t> g_MeasureStartTime(0);
+static std::atomic<bool> g_bStopRequested(false);
+
+static uint64_t GetTimeInNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static bool IsMeasuring(uint64_t Time)
+{
+	uint64_t MeasureStartTime = g_MeasureStartTime.load(std::memory_order_relaxed);
+	return (g_Phase.load(std::memory_order_relaxed) == PHASE_MEASURING) && MeasureStartTime && (Time >= MeasureStartTime);
+}
+
+static void CloseConnection(stWorker* pWorker, stConnection* pConn)
+{
+	if (pConn->m_State == CLOSED)
+		return;
+
+	if (pConn->m_State == CONNECTING)
+		pWorker->m_Connecting--;
+	else
+		pWorker->m_Disconnections++;
+
+	if (pConn->m_State == READY)
+		pWorker->m_ConnectionsReady--;
+
+	close(pConn->m_Socket); // Also removes it from epoll
+	pConn->m_Socket = -1;
+	pConn->m_State = CLOSED;
+	std::string().swap(pConn->m_Partial);
+	std::string().swap(pConn->m_Pending);
+}
+
+static void WatchForWrite(stWorker* pWorker, stConnection* pConn, bool bWatch)
+{
+	if (pConn->m_bIsWaitingToWrite == bWatch)
+		return;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (bWatch ? EPOLLOUT : 0);
+	ev.data.u64 = pConn - &pWorker->m_Connections[0];
+	epoll_ctl(pWorker->m_Epoll, EPOLL_CTL_MOD, pConn->m_Socket, &ev);
+	pConn->m_bIsWaitingToWrite = bWatch;
+}
+
+// Writes whatever socket accepts. Rest stays in m_Pending and is written when socket becomes writable.
+static bool FlushPending(stWorker* pWorker, stConnection* pConn)
+{
+	while (pConn->m_Pending.size())
+	{
+		ssize_t nwritten = send(pConn->m_Socket, pConn->m_Pending.data(), pConn->m_Pending.size(), MSG_NOSIGNAL);
+
+		if (nwritten < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			if (errno == EINTR)
+				continue;
+			CloseConnection(pWorker, pConn);
+			return false;
+		}
+
+		pConn->m_Pending.erase(0, nwritten);
+	}
+
+	WatchForWrite(pWorker, pConn, pConn->m_Pending.size() != 0);
+	return true;
+}
+
+static bool SendRequest(stWorker* pWorker, stConnection* pConn, const char* pBody, uint32_t BodySize)
+{
+	uint16_t Version_n = htons(PROTOCOL_VERSION);
+	uint32_t BodySize_n = htonl(BodySize);
+
+	char Header[HEADER_SIZE];
+	memcpy(Header, MSG_PREAMBLE, PREAMBLE_BYTES_SIZE);
+	memcpy(&Header[PREAMBLE_BYTES_SIZE], &Version_n, VERSION_BYTES_SIZE);
+	memcpy(&Header[PREAMBLE_BYTES_SIZE+VERSION_BYTES_SIZE], &BodySize_n, SIZE_BYTES_SIZE);
+
+	pConn->m_Pending.append(Header, HEADER_SIZE);
+	pConn->m_Pending.append(pBody, BodySize);
+
+	return FlushPending(pWorker, pConn);
+}
+
+static bool SendEcho(stWorker* pWorker, stConnection* pConn, uint64_t ScheduledTime)
+{
+	char* pBody = &pWorker->m_SendBuffer[0];
+
+	pBody[0] = ECHO;
+	memcpy(&pBody[1], &pConn->m_Id, sizeof(uint32_t));
+	memcpy(&pBody[1+sizeof(uint32_t)], &ScheduledTime, sizeof(uint64_t));
+
+	if (IsMeasuring(ScheduledTime))
+		pWorker->m_RequestsSent++;
+
+	pConn->m_OutstandingSince = ScheduledTime;
+
+	return SendRequest(pWorker, pConn, pBody, g_Params.PayloadSize);
+}
+
+static void OnResponse(stWorker* pWorker, stConnection* pConn, uint16_t Version, const char* pBody, uint32_t BodySize)
+{
+	uint64_t Now = GetTimeInNanoseconds();
+	bool bIsMeasuring = IsMeasuring(Now);
+
+	if (Version == SPECIAL_COMMUNICATION)
+	{
+		if (bIsMeasuring && BodySize && (pBody[0] == RESPONSE_KEEP_ALIVE))
+			pWorker->m_KeepAlives++;
+		else if (bIsMeasuring && BodySize && (pBody[0] == RESPONSE_ERROR))
+			pWorker->m_Errors++;
+		return;
+	}
+
+	if (BodySize == 0)
+		return;
+
+	if (pBody[0] == REGISTERED)
+	{
+		if (pConn->m_State == REGISTERING)
+		{
+			pConn->m_State = READY;
+			pWorker->m_ConnectionsReady++;
+		}
+		return;
+	}
+
+	if (pBody[0] != ECHOED)
+		return;
+
+	if (bIsMeasuring)
+	{
+		pWorker->m_ResponsesReceived++;
+		pWorker->m_BytesReceived += HEADER_SIZE + BodySize;
+	}
+
+	if (BodySize < ECHO_STAMP_SIZE)
+		return;
+
+	uint32_t Id;
+	uint64_t ScheduledTime;
+	memcpy(&Id, &pBody[1], sizeof(uint32_t));
+	memcpy(&ScheduledTime, &pBody[1+sizeof(uint32_t)], sizeof(uint64_t));
+
+	if (Id != pConn->m_Id) // Echo of some other connection
+		return;
+
+	if (IsMeasuring(ScheduledTime))
+	{
+		pWorker->m_OwnEchoesReceived++;
+		pWorker->m_Latencies.push_back((uint32_t)std::min<uint64_t>((Now - ScheduledTime) / 1000, UINT32_MAX));
+	}
+
+	if (ScheduledTime == pConn->m_OutstandingSince)
+		pConn->m_OutstandingSince = 0;
+
+	// Closed loop: Next echo goes as soon as previous is back
+	if ((g_Params.Rate == 0) && (pConn->m_OutstandingSince == 0) && (g_Phase.load(std::memory_order_relaxed) >= PHASE_WARMING_UP) && (g_Phase.load(std::memory_order_relaxed) != PHASE_DONE))
+		SendEcho(pWorker, pConn, Now);
+}
+
+// Extracts complete responses. Incomplete bytes at the end are kept in m_Partial. Returns false on protocol error.
+static bool ProcessBytes(stWorker* pWorker, stConnection* pConn, const char* pBytes, size_t Length)
+{
+	if (pConn->m_Partial.size())
+	{
+		pConn->m_Partial.append(pBytes, Length);
+		pBytes = pConn->m_Partial.data();
+		Length = pConn->m_Partial.size();
+	}
+
+	size_t Index = 0;
+
+	while ((Length - Index) >= HEADER_SIZE)
+	{
+		const char* pHeader = &pBytes[Index];
+
+		if (memcmp(pHeader, MSG_PREAMBLE, PREAMBLE_BYTES_SIZE) != 0)
+			return false;
+
+		uint16_t Version_n;
+		uint32_t BodySize_n;
+		memcpy(&Version_n, &pHeader[PREAMBLE_BYTES_SIZE], VERSION_BYTES_SIZE);
+		memcpy(&BodySize_n, &pHeader[PREAMBLE_BYTES_SIZE+VERSION_BYTES_SIZE], SIZE_BYTES_SIZE);
+		uint16_t Version = ntohs(Version_n);
+		uint32_t BodySize = ntohl(BodySize_n);
+
+		if (((Version != PROTOCOL_VERSION) && (Version != SPECIAL_COMMUNICATION)) || (BodySize > MAX_BUFFER_SIZE))
+			return false;
+
+		if ((Length - Index) < (HEADER_SIZE + BodySize))
+			break; // Wait for more bytes
+
+		OnResponse(pWorker, pConn, Version, &pHeader[HEADER_SIZE], BodySize);
+
+		if (pConn->m_State == CLOSED) // Send in OnResponse has failed
+			return true;
+
+		Index += HEADER_SIZE + BodySize;
+	}
+
+	if (pConn->m_Partial.size())
+		pConn->m_Partial.erase(0, Index);
+	else
+		pConn->m_Partial.assign(&pBytes[Index], Length - Index);
+
+	return true;
+}
+
+static void OnReadable(stWorker* pWorker, stConnection* pConn)
+{
+	for (;;)
+	{
+		ssize_t nread = recv(pConn->m_Socket, pWorker->m_ReadBuffer, READ_BUFFER_SIZE, 0);
+
+		if (nread > 0)
+		{
+			if (ProcessBytes(pWorker, pConn, pWorker->m_ReadBuffer, nread) == false)
+			{
+				fprintf(stderr, "\nERROR: Invalid response received on connection %u. Disconnecting.", pConn->m_Id);
+				CloseConnection(pWorker, pConn);
+				return;
+			}
+
+			if (pConn->m_State == CLOSED)
+				return;
+
+			if (nread < READ_BUFFER_SIZE)
+				return;
+		}
+		else if ((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+		{
+			return;
+		}
+		else if ((nread < 0) && (errno == EINTR))
+		{
+			continue;
+		}
+		else // Closed by server or error
+		{
+			CloseConnection(pWorker, pConn);
+			return;
+		}
+	}
+}
+
+static void OnConnected(stWorker* pWorker, stConnection* pConn)
+{
+	int Error = 0;
+	socklen_t ErrorLen = sizeof(Error);
+	getsockopt(pConn->m_Socket, SOL_SOCKET, SO_ERROR, &Error, &ErrorLen);
+
+	if (Error)
+	{
+		pWorker->m_ConnectionsFailed++;
+		CloseConnection(pWorker, pConn);
+		return;
+	}
+
+	pWorker->m_Connecting--;
+	WatchForWrite(pWorker, pConn, false);
+
+	if (pConn->m_bIsActive)
+	{
+		char Register = REGISTER;
+		pConn->m_State = REGISTERING; // Becomes READY when REGISTERED is received
+		SendRequest(pWorker, pConn, &Register, 1);
+	}
+	else
+	{
+		pConn->m_State = READY;
+		pWorker->m_ConnectionsReady++;
+	}
+}
+
+// Starts non-blocking connects keeping at most CONNECTS_IN_PROGRESS_PER_THREAD in progress
+static void StartConnecting(stWorker* pWorker)
+{
+	while ((pWorker->m_Connecting < CONNECTS_IN_PROGRESS_PER_THREAD) && (pWorker->m_NextToConnect < (int)pWorker->m_Connections.size()))
+	{
+		stConnection* pConn = &pWorker->m_Connections[pWorker->m_NextToConnect++];
+
+		pConn->m_Socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		if (pConn->m_Socket < 0)
+		{
+			pWorker->m_ConnectionsFailed++;
+			pConn->m_State = CLOSED;
+			continue;
+		}
+
+		int On = 1;
+		setsockopt(pConn->m_Socket, IPPROTO_TCP, TCP_NODELAY, &On, sizeof(On)); // Disable Nagle (as server does)
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT;
+		ev.data.u64 = pConn - &pWorker->m_Connections[0];
+		epoll_ctl(pWorker->m_Epoll, EPOLL_CTL_ADD, pConn->m_Socket, &ev);
+		pConn->m_bIsWaitingToWrite = true;
+
+		pConn->m_State = CONNECTING;
+		pWorker->m_Connecting++;
+
+		if ((connect(pConn->m_Socket, (struct sockaddr*)&g_ServerAddress, sizeof(g_ServerAddress)) < 0) && (errno != EINPROGRESS))
+		{
+			pWorker->m_ConnectionsFailed++;
+			CloseConnection(pWorker, pConn);
+		}
+	}
+}
+
+// Open loop: sends echoes scheduled till now. Returns milliseconds to wait for next one.
+static int SendScheduledEchoes(stWorker* pWorker, uint64_t Now)
+{
+	int Count = (int)pWorker->m_Connections.size();
+
+	if (pWorker->m_NextSendTime == 0)
+		pWorker->m_NextSendTime = Now;
+
+	while (pWorker->m_NextSendTime <= Now)
+	{
+		stConnection* pConn = NULL;
+
+		// Pick next active connection which is ready and isn't backed up by unsent bytes
+		for (int i=0; i<Count; i++)
+		{
+			stConnection* pCandidate = &pWorker->m_Connections[pWorker->m_NextToSend];
+			pWorker->m_NextToSend = (pWorker->m_NextToSend + 1) % Count;
+
+			if (pCandidate->m_bIsActive && (pCandidate->m_State == READY) && (pCandidate->m_Pending.size() == 0))
+			{
+				pConn = pCandidate;
+				break;
+			}
+		}
+
+		if (pConn)
+			SendEcho(pWorker, pConn, pWorker->m_NextSendTime);
+		else if (IsMeasuring(pWorker->m_NextSendTime))
+			pWorker->m_RequestsSkipped++; // Server isn't keeping up (or all connections are gone)
+
+		pWorker->m_NextSendTime += pWorker->m_SendInterval;
+	}
+
+	return (int)((pWorker->m_NextSendTime - Now) / 1000000);
+}
+
+// Closed loop: starts echoes on connections having none outstanding, and gives up on those not echoed back in time
+static void SendClosedLoopEchoes(stWorker* pWorker, uint64_t Now)
+{
+	for (size_t i=0; i<pWorker->m_Connections.size(); i++)
+	{
+		stConnection* pConn = &pWorker->m_Connections[i];
+
+		if ((pConn->m_bIsActive == false) || (pConn->m_State != READY))
+			continue;
+
+		if (pConn->m_OutstandingSince && ((Now - pConn->m_OutstandingSince) < RESPONSE_TIMEOUT_IN_NANOSECONDS))
+			continue;
+
+		if (pConn->m_OutstandingSince && IsMeasuring(pConn->m_OutstandingSince))
+			pWorker->m_RequestsLost++;
+
+		SendEcho(pWorker, pConn, Now);
+	}
+}
+
+static void RunWorker(stWorker* pWorker)
+{
+	struct epoll_event Events[EPOLL_EVENTS_PER_WAIT];
+	uint64_t LastClosedLoopCheck = 0;
+
+	while ((g_Phase.load(std::memory_order_relaxed) != PHASE_DONE) && (g_bStopRequested == false))
+	{
+		StartConnecting(pWorker);
+
+		int Timeout = 10;
+		uint64_t Now = GetTimeInNanoseconds();
+		int Phase = g_Phase.load(std::memory_order_relaxed);
+
+		if (Phase >= PHASE_WARMING_UP)
+		{
+			if (g_Params.Rate)
+			{
+				Timeout = std::min(Timeout, SendScheduledEchoes(pWorker, Now));
+			}
+			else if ((Now - LastClosedLoopCheck) >= (RESPONSE_TIMEOUT_IN_NANOSECONDS / 10))
+			{
+				LastClosedLoopCheck = Now;
+				SendClosedLoopEchoes(pWorker, Now);
+			}
+		}
+
+		int Count = epoll_wait(pWorker->m_Epoll, Events, EPOLL_EVENTS_PER_WAIT, Timeout);
+
+		for (int i=0; i<Count; i++)
+		{
+			stConnection* pConn = &pWorker->m_Connections[Events[i].data.u64];
+
+			if (pConn->m_State == CLOSED)
+				continue;
+
+			if (pConn->m_State == CONNECTING)
+			{
+				if (Events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+					OnConnected(pWorker, pConn);
+				continue;
+			}
+
+			if ((Events[i].events & EPOLLOUT) && (FlushPending(pWorker, pConn) == false))
+				continue;
+
+			if (Events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				OnReadable(pWorker, pConn);
+		}
+	}
+
+	for (size_t i=0; i<pWorker->m_Connections.size(); i++)
+		if (pWorker->m_Connections[i].m_State != CLOSED)
+			close(pWorker->m_Connections[i].m_Socket);
+
+	close(pWorker->m_Epoll);
+}
+
+static uint32_t GetPercentile(std::vector<uint32_t>& vLatencies, double Percentile)
+{
+	if (vLatencies.empty())
+		return 0;
+
+	size_t Index = (size_t)(Percentile * vLatencies.size());
+	return vLatencies[std::min(Index, vLatencies.size() - 1)];
+}
+
+static void on_signal(int signum)
+{
+	g_bStopRequested = true;
+}
+
+static void PrintUsage(char* argv0)
+{
+	printf("\nSyntax: %s <IP Address> <Port> [-c connections] [-a active connections] [-r echoes per second] [-s echo size] [-d duration] [-w warm up] [-t threads]\n", argv0);
+	printf("\n\t-c Total connections to open (Default 1000)");
+	printf("\n\t-a Connections which register and send echoes. Rest stay idle. (Default 100) Each echo is sent to all active connections.");
+	printf("\n\t-r Echo requests per second in total. 0 for closed loop (next echo as soon as previous is received). (Default 0)");
+	printf("\n\t-s Size of echo request body in bytes (Default and minimum %d, maximum %d)", (int)ECHO_STAMP_SIZE, MAX_BUFFER_SIZE);
+	printf("\n\t-d Duration of measurement in seconds (Default 10)");
+	printf("\n\t-w Warm up in seconds before measurement starts (Default 2)");
+	printf("\n\t-t Worker threads (Default number of cores)");
+	printf("\n\nExample: %s 127.0.0.1 27015 -c 20000 -a 200 -r 2000 -s 64 -d 30\n\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+	printf("\nPulsar Server Framework: Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com) \
+			\nThis program comes with ABSOLUTELY NO WARRANTY;\nThis is free software, and you are welcome to redistribute it under certain conditions;\n");
+
+	if (argc < 3)
+	{
+		printf("\nERROR: Invalid command line.\n");
+		PrintUsage(argv[0]);
+		return -1;
+	}
+
+	g_Params.IPAddress = argv[1];
+	g_Params.Port = (unsigned short int)atoi(argv[2]);
+	g_Params.Connections = 1000;
+	g_Params.ActiveConnections = 100;
+	g_Params.Rate = 0;
+	g_Params.PayloadSize = ECHO_STAMP_SIZE;
+	g_Params.DurationInSeconds = 10;
+	g_Params.WarmupInSeconds = 2;
+	g_Params.Threads = (int)std::thread::hardware_concurrency();
+
+	for (int i=3; i<argc; i++)
+	{
+		if ((argv[i][0] != '-') || (strlen(argv[i]) != 2) || ((i+1) >= argc))
+		{
+			printf("\nERROR: Invalid option %s\n", argv[i]);
+			PrintUsage(argv[0]);
+			return -1;
+		}
+
+		int Value = atoi(argv[++i]);
+
+		switch (argv[i-1][1])
+		{
+			case 'c': g_Params.Connections = Value; break;
+			case 'a': g_Params.ActiveConnections = Value; break;
+			case 'r': g_Params.Rate = Value; break;
+			case 's': g_Params.PayloadSize = Value; break;
+			case 'd': g_Params.DurationInSeconds = Value; break;
+			case 'w': g_Params.WarmupInSeconds = Value; break;
+			case 't': g_Params.Threads = Value; break;
+			default:
+				printf("\nERROR: Invalid option %s\n", argv[i-1]);
+				PrintUsage(argv[0]);
+				return -1;
+		}
+	}
+
+	g_Params.ActiveConnections = std::min(g_Params.ActiveConnections, g_Params.Connections);
+	g_Params.Threads = std::max(1, std::min(g_Params.Threads, g_Params.Connections));
+
+	if ((g_Params.Connections < 1) || (g_Params.ActiveConnections < 1) || (g_Params.Rate < 0) || (g_Params.DurationInSeconds < 1) || (g_Params.WarmupInSeconds < 0)
+		|| (g_Params.PayloadSize < (int)ECHO_STAMP_SIZE) || (g_Params.PayloadSize > MAX_BUFFER_SIZE))
+	{
+		printf("\nERROR: Invalid parameters\n");
+		PrintUsage(argv[0]);
+		return -1;
+	}
+
+	memset(&g_ServerAddress, 0, sizeof(g_ServerAddress));
+	g_ServerAddress.sin_family = AF_INET;
+	g_ServerAddress.sin_port = htons(g_Params.Port);
+
+	if (inet_pton(AF_INET, g_Params.IPAddress, &g_ServerAddress.sin_addr) != 1)
+	{
+		printf("\nERROR: Invalid IP address %s\n", g_Params.IPAddress);
+		return -1;
+	}
+
+	// Each connection needs a descriptor. Raise the limit as far as we are allowed to.
+	struct rlimit Limit;
+	if (getrlimit(RLIMIT_NOFILE, &Limit) == 0)
+	{
+		Limit.rlim_cur = Limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &Limit);
+		getrlimit(RLIMIT_NOFILE, &Limit);
+
+		if (Limit.rlim_cur < (rlim_t)(g_Params.Connections + g_Params.Threads + 16))
+			printf("\nWARNING: Open files limit %llu is lower than connections requested. Some connections will fail.", (unsigned long long)Limit.rlim_cur);
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("\nINFO: Server %s:%hu Connections %d (Active %d) Rate %d/s (%s) Echo size %d Duration %ds (Warm up %ds) Threads %d\n",
+		g_Params.IPAddress, g_Params.Port, g_Params.Connections, g_Params.ActiveConnections, g_Params.Rate, g_Params.Rate ? "open loop" : "closed loop",
+		g_Params.PayloadSize, g_Params.DurationInSeconds, g_Params.WarmupInSeconds, g_Params.Threads);
+
+	// Distribute connections (and active ones among them) evenly over workers
+	std::vector<stWorker*> vWorkers;
+
+	for (int w=0; w<g_Params.Threads; w++)
+	{
+		stWorker* pWorker = new stWorker;
+
+		pWorker->m_Index = w;
+		pWorker->m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+		pWorker->m_NextToConnect = 0;
+		pWorker->m_Connecting = 0;
+		pWorker->m_NextToSend = 0;
+		pWorker->m_NextSendTime = 0;
+		pWorker->m_SendInterval = g_Params.Rate ? ((1000000000ULL * g_Params.Threads) / g_Params.Rate) : 0;
+		pWorker->m_ConnectionsReady = 0; pWorker->m_ConnectionsFailed = 0; pWorker->m_Disconnections = 0;
+		pWorker->m_RequestsSent = 0; pWorker->m_OwnEchoesReceived = 0; pWorker->m_ResponsesReceived = 0; pWorker->m_BytesReceived = 0;
+		pWorker->m_RequestsSkipped = 0; pWorker->m_RequestsLost = 0; pWorker->m_Errors = 0; pWorker->m_KeepAlives = 0;
+		pWorker->m_SendBuffer.assign(g_Params.PayloadSize, 'x');
+
+		if (pWorker->m_Epoll < 0)
+		{
+			printf("\nERROR: epoll_create1 failed (%s)\n", strerror(errno));
+			return -1;
+		}
+
+		vWorkers.push_back(pWorker);
+	}
+
+	for (int i=0; i<g_Params.Connections; i++)
+	{
+		stConnection Conn;
+		Conn.m_Socket = -1;
+		Conn.m_Id = i;
+		Conn.m_State = NOT_CONNECTED;
+		Conn.m_bIsActive = (i < g_Params.ActiveConnections);
+		Conn.m_bIsWaitingToWrite = false;
+		Conn.m_OutstandingSince = 0;
+
+		vWorkers[i % g_Params.Threads]->m_Connections.push_back(Conn);
+	}
+
+	for (size_t w=0; w<vWorkers.size(); w++)
+		vWorkers[w]->m_Thread = std::thread(RunWorker, vWorkers[w]);
+
+	// Connect. Give up waiting when no progress is made for a while.
+	uint64_t StartTime = GetTimeInNanoseconds();
+	int LastReady = -1;
+	uint64_t LastProgressTime = StartTime;
+
+	while (g_bStopRequested == false)
+	{
+		int Ready = 0, Failed = 0;
+		for (size_t w=0; w<vWorkers.size(); w++)
+		{
+			Ready += vWorkers[w]->m_ConnectionsReady;
+			Failed += vWorkers[w]->m_ConnectionsFailed;
+		}
+
+		uint64_t Now = GetTimeInNanoseconds();
+
+		if (Ready != LastReady)
+		{
+			printf("\rConnecting: Ready %d Failed %d of %d", Ready, Failed, g_Params.Connections);
+			fflush(stdout);
+			LastReady = Ready;
+			LastProgressTime = Now;
+		}
+
+		if ((Ready + Failed) >= g_Params.Connections)
+			break;
+
+		if ((Now - LastProgressTime) > (10 * 1000000000ULL))
+		{
+			printf("\nWARNING: No progress in connecting since 10 seconds. Proceeding with %d connections.", Ready);
+			break;
+		}
+
+		usleep(100000);
+	}
+
+	printf("\nConnected in %.2f seconds. Warming up...\n", (GetTimeInNanoseconds() - StartTime) / 1e9);
+
+	g_Phase = PHASE_WARMING_UP;
+
+	for (int s=0; (s < (g_Params.WarmupInSeconds * 10)) && (g_bStopRequested == false); s++)
+		usleep(100000);
+
+	g_MeasureStartTime = GetTimeInNanoseconds();
+	g_Phase = PHASE_MEASURING;
+
+	// Progress of every second while measuring
+	uint64_t LastSent = 0, LastReceived = 0;
+
+	for (int s=1; (s <= g_Params.DurationInSeconds) && (g_bStopRequested == false); s++)
+	{
+		for (int i=0; (i < 10) && (g_bStopRequested == false); i++)
+			usleep(100000);
+
+		uint64_t Sent = 0, Received = 0;
+		for (size_t w=0; w<vWorkers.size(); w++)
+		{
+			Sent += vWorkers[w]->m_RequestsSent;
+			Received += vWorkers[w]->m_ResponsesReceived;
+		}
+
+		printf("\r[%3ds] Echoes sent %llu/s Responses received %llu/s   ", s, (unsigned long long)(Sent - LastSent), (unsigned long long)(Received - LastReceived));
+		fflush(stdout);
+
+		LastSent = Sent;
+		LastReceived = Received;
+	}
+
+	double Duration = (GetTimeInNanoseconds() - g_MeasureStartTime) / 1e9;
+
+	g_Phase = PHASE_DONE;
+
+	for (size_t w=0; w<vWorkers.size(); w++)
+		vWorkers[w]->m_Thread.join();
+
+	// Add up
+	uint64_t RequestsSent = 0, OwnEchoesReceived = 0, ResponsesReceived = 0, BytesReceived = 0, RequestsSkipped = 0, RequestsLost = 0, Errors = 0, KeepAlives = 0;
+	int Ready = 0, Failed = 0, Disconnections = 0;
+	std::vector<uint32_t> vLatencies;
+
+	for (size_t w=0; w<vWorkers.size(); w++)
+	{
+		stWorker* pWorker = vWorkers[w];
+
+		RequestsSent += pWorker->m_RequestsSent;
+		OwnEchoesReceived += pWorker->m_OwnEchoesReceived;
+		ResponsesReceived += pWorker->m_ResponsesReceived;
+		BytesReceived += pWorker->m_BytesReceived;
+		RequestsSkipped += pWorker->m_RequestsSkipped;
+		RequestsLost += pWorker->m_RequestsLost;
+		Errors += pWorker->m_Errors;
+		KeepAlives += pWorker->m_KeepAlives;
+		Ready += pWorker->m_ConnectionsReady;
+		Failed += pWorker->m_ConnectionsFailed;
+		Disconnections += pWorker->m_Disconnections;
+
+		vLatencies.insert(vLatencies.end(), pWorker->m_Latencies.begin(), pWorker->m_Latencies.end());
+		delete pWorker;
+	}
+
+	std::sort(vLatencies.begin(), vLatencies.end());
+
+	printf("\n\nResults (measured for %.2f seconds):", Duration);
+	printf("\nConnections: Connected at end %d Failed to connect %d Disconnected %d", Ready, Failed, Disconnections);
+	printf("\nEchoes: Sent %llu (%.0f/s) Own echoes received %llu (%.0f/s) Not received %llu Skipped (connection backed up) %llu",
+		(unsigned long long)RequestsSent, RequestsSent / Duration, (unsigned long long)OwnEchoesReceived, OwnEchoesReceived / Duration,
+		(unsigned long long)((RequestsSent > OwnEchoesReceived) ? (RequestsSent - OwnEchoesReceived) : 0), (unsigned long long)RequestsSkipped);
+	if (g_Params.Rate == 0)
+		printf(" Timed out %llu", (unsigned long long)RequestsLost);
+	printf("\nResponses (including fan-out to all active connections): %llu (%.0f/s, %.2f MB/s)", (unsigned long long)ResponsesReceived, ResponsesReceived / Duration, BytesReceived / Duration / (1024*1024));
+	printf("\nErrors from server %llu Keep alives %llu", (unsigned long long)Errors, (unsigned long long)KeepAlives);
+	printf("\nLatency of own echoes (microseconds): Samples %zu Min %u p50 %u p90 %u p99 %u p999 %u Max %u\n\n",
+		vLatencies.size(), vLatencies.empty() ? 0 : vLatencies.front(), GetPercentile(vLatencies, 0.50), GetPercentile(vLatencies, 0.90),
+		GetPercentile(vLatencies, 0.99), GetPercentile(vLatencies, 0.999), vLatencies.empty() ? 0 : vLatencies.back());
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+    Pulsar Server Framework: Framework to develop your high performance heavy duty server in C++
+    Copyright (c) 2013-2019 Atul D. Patil (atuldpatil@gmail.com),
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Module summary:
+
+Decoder of binary log written by Logger (See Logger::SetBinaryLogFile and file format in Logger.h). Prints one line per record:
+
+	<Local time> <Type> [<Function>] <Message> (In <File>, at line <Line>)
+
+Messages are formatted by Logger::DecodeMessage, same as server formats them for ProcessLog.
+*/
+
+#include "Pulsar.h"
+
+struct stCallSite
+{
+	std::string m_FileName;
+	int m_LineNumber;
+	std::string m_FunctionName;
+	std::string m_Format;
+};
+
+static bool Read (FILE* pFile, void* pData, size_t Size)
+{
+	return (fread(pData, 1, Size, pFile) == Size);
+}
+
+static bool ReadString (FILE* pFile, std::string& String)
+{
+	USHORT Length;
+
+	if (Read(pFile, &Length, sizeof(Length)) == false)
+		return false;
+
+	String.resize(Length);
+
+	return (Length == 0) || Read(pFile, &String[0], Length);
+}
+
+static const char* GetTypeName (int Type)
+{
+	switch (Type)
+	{
+		case INFO: return "INFO";
+		case NOTE: return "NOTE";
+		case ERROR: return "ERROR";
+		case EXCEPTION: return "EXCEPTION";
+		case DEBUG: return "DEBUG";
+		case ASSERTION: return "ASSERTION";
+		default: return "LOG";
+	}
+}
+
+// Prints time (local) at which record was logged, given uv_hrtime of it and of start of the log
+static void PrintTime (INT64 StartTime, UINT64 StartHRTime, UINT64 Time)
+{
+	INT64 Nanoseconds = (Time > StartHRTime) ? (INT64)(Time - StartHRTime) : 0;
+	time_t Seconds = (time_t)(StartTime + (Nanoseconds / 1000000000));
+	struct tm LocalTime;
+
+	localtime_s(&LocalTime, &Seconds);
+
+	char strTime[32];
+	strftime(strTime, sizeof(strTime), "%Y-%m-%d %H:%M:%S", &LocalTime);
+	printf("%s.%03d ", strTime, (int)((Nanoseconds % 1000000000) / 1000000));
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("\nSyntax: %s <Binary log file>\n\n", argv[0]);
+		return -1;
+	}
+
+	FILE* pFile = fopen(argv[1], "rb");
+
+	if (pFile == NULL)
+	{
+		printf("\nERROR: Could not open %s\n\n", argv[1]);
+		return -1;
+	}
+
+	char Magic[sizeof(BINARY_LOG_MAGIC)-1];
+	UINT Version;
+	INT64 StartTime;
+	UINT64 StartHRTime;
+
+	if ((Read(pFile, Magic, sizeof(Magic)) == false) || (memcmp(Magic, BINARY_LOG_MAGIC, sizeof(Magic)) != 0) ||
+		(Read(pFile, &Version, sizeof(Version)) == false) || (Version != BINARY_LOG_VERSION) ||
+		(Read(pFile, &StartTime, sizeof(StartTime)) == false) || (Read(pFile, &StartHRTime, sizeof(StartHRTime)) == false))
+	{
+		printf("\nERROR: %s is not binary log of version %d\n\n", argv[1], BINARY_LOG_VERSION);
+		fclose(pFile);
+		return -1;
+	}
+
+	std::map<UINT, stCallSite> CallSites;
+	std::string Message;
+	char Arguments[DEFAULT_LOG_MSG_LENGTH];
+	bool bIsComplete = true;
+	UCHAR Kind;
+
+	while (Read(pFile, &Kind, sizeof(Kind)))
+	{
+		bIsComplete = false;
+
+		if (Kind == BINARY_LOG_CALL_SITE)
+		{
+			UINT CallSiteID;
+			stCallSite CallSite;
+
+			if ((Read(pFile, &CallSiteID, sizeof(CallSiteID)) == false) || (Read(pFile, &CallSite.m_LineNumber, sizeof(CallSite.m_LineNumber)) == false) ||
+				(ReadString(pFile, CallSite.m_FileName) == false) || (ReadString(pFile, CallSite.m_FunctionName) == false) || (ReadString(pFile, CallSite.m_Format) == false))
+				break;
+
+			CallSites[CallSiteID] = CallSite;
+		}
+		else if (Kind == BINARY_LOG_RECORD)
+		{
+			UINT CallSiteID;
+			UCHAR Type;
+			UINT64 Time;
+			USHORT ArgumentsLength;
+
+			if ((Read(pFile, &CallSiteID, sizeof(CallSiteID)) == false) || (Read(pFile, &Type, sizeof(Type)) == false) ||
+				(Read(pFile, &Time, sizeof(Time)) == false) || (Read(pFile, &ArgumentsLength, sizeof(ArgumentsLength)) == false) ||
+				(ArgumentsLength > sizeof(Arguments)) || (Read(pFile, Arguments, ArgumentsLength) == false))
+				break;
+
+			std::map<UINT, stCallSite>::iterator it = CallSites.find(CallSiteID);
+
+			if (it == CallSites.end())
+			{
+				printf("\nERROR: Record of unknown call site %u\n\n", CallSiteID);
+				fclose(pFile);
+				return -1;
+			}
+
+			stCallSite& CallSite = it->second;
+
+			Logger::DecodeMessage (CallSite.m_Format.c_str(), Arguments, ArgumentsLength, Message);
+
+			PrintTime (StartTime, StartHRTime, Time);
+			printf("%s [%s] %s (In %s, at line %d)\n", GetTypeName(Type), CallSite.m_FunctionName.c_str(), Message.c_str(), CallSite.m_FileName.c_str(), CallSite.m_LineNumber);
+		}
+		else if (Kind == BINARY_LOG_DROPPED)
+		{
+			UINT64 Time;
+			INT64 RecordsDropped;
+
+			if ((Read(pFile, &Time, sizeof(Time)) == false) || (Read(pFile, &RecordsDropped, sizeof(RecordsDropped)) == false))
+				break;
+
+			PrintTime (StartTime, StartHRTime, Time);
+			printf("ERROR [Logger] %lld log records dropped since start as log ring of logging thread was full\n", (long long)RecordsDropped);
+		}
+		else
+		{
+			printf("\nERROR: Unknown entry %d\n\n", Kind);
+			fclose(pFile);
+			return -1;
+		}
+
+		bIsComplete = true;
+	}
+
+	if (bIsComplete == false)
+		printf("\nWARNING: Log ends with incomplete entry (server might still be writing it)\n");
+
+	fclose(pFile);
+
+	return 0;
+}
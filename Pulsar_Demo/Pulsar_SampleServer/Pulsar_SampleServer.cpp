@@ -26,7 +26,7 @@ int main(int argc, char** argv)
 
 	if (argc < 3)
 	{
-		std::cout << "\n\nERROR: Invalid command line. \n\nSyntax: " << argv[0] << " <IP Address> <Port>\n\nExample: " << argv[0] << " 192.168.1.100 8000\n\n";
+		std::cout << "\n\nERROR: Invalid command line. \n\nSyntax: " << argv[0] << " <IP Address> <Port> [<Binary log file>]\n\nExample: " << argv[0] << " 192.168.1.100 8000\n\n";
 		return -1;
 	}
 	else
@@ -35,6 +35,10 @@ int main(int argc, char** argv)
 		static char* IPAddress = argv[1];
 		std::cout << "\nINFO: Command line parameters: IPAddress " << IPAddress << " Port " << IPv4Port;
 
+		// Logs are also recorded in binary (unformatted) to given file, which Pulsar_LogDecoder can turn into text
+		if ((argc > 3) && (Logger::GetInstance()->SetBinaryLogFile(argv[3]) == FALSE))
+			std::cout << "\nERROR: Could not create binary log file " << argv[3];
+
 		// Instantiate ConnectionManager
 		ConnectionsManager* pConnectionsManager = NULL;
 
@@ -23,6 +23,7 @@
 #define MAX_PENDING_RESPONSES_PER_CLIENT 16	  // At least equal to NUMBER_OF_REQUESTPROCESSING_THREADS
 #define KEEP_ALIVE_IN_SECONDS 30
 #define STATUS_INTERVAL_IN_SECONDS 5 // Interval in seconds to send server stat to screen/log
+#define NUMBER_OF_EVENT_LOOPS 1 // Event loops doing clients' I/O (Linux only). Can be up to number of cores.
 
 #define VERSION_1 1
 #define VERSION_2 2
@@ -45,13 +45,18 @@ void PulsarSampleServerLogger::ProcessLog (ServerStat& stServerStat, LoggerMap&
 	std::cout << "\n#RequestsArrivedPerSecond " << stServerStat.RequestsArrivedPerSecond << " #RequestsProcessedPerSecond " << stServerStat.RequestsProcessedPerSecond << " (For average request size " << stServerStat.AverageRequestsSize << " in last " << (int) stServerStat.Interval << " seconds) AverageRequestProcessingTime " << stServerStat.AverageRequestProcessingTime << " seconds";
 	std::cout << "\n#HeaderErrorInPreamble " << stServerStat.HeaderErrorInPreamble << " #HeaderErrorInVersion " << stServerStat.HeaderErrorInVersion << " #HeaderErrorInSize " << stServerStat.HeaderErrorInSize ;
 	std::cout << "\n#RequestsNotAdvicedToProcess " << stServerStat.RequestsNotAdvicedToProcess << " #RequestsFailedToProcess " << stServerStat.RequestsFailedToProcess << " #RequestsRejectedByServer " << stServerStat.RequestsRejectedByServer << " #RequestBytesIgnored " << stServerStat.RequestBytesIgnored/1024 << " KB";
-	std::cout << "\n#RequestProcessingThreadsStarted " << stServerStat.RequestProcessingThreadsStarted << " #RequestProcessingThreadsFinished " << stServerStat.RequestProcessingThreadsFinished ;
+	std::cout << "\n#RequestsSuspended " << stServerStat.RequestsSuspended << " #RequestsResumed " << stServerStat.RequestsResumed << " #RequestsAbandoned " << stServerStat.RequestsAbandoned;
+	std::cout << "\n#RequestProcessingThreadsStarted " << stServerStat.RequestProcessingThreadsStarted << " #RequestProcessingThreadsFinished " << stServerStat.RequestProcessingThreadsFinished << " #WorksStolen " << stServerStat.WorksStolen;
 	std::cout << "\n" ;
-	std::cout << "\n#TotalResponsesSent " << stServerStat.ResponsesSent ;
+	std::cout << "\n#TotalResponsesSent " << stServerStat.ResponsesSent << " #ResponseFlushes " << stServerStat.ResponseFlushes;
 	std::cout << "\n(#ResponsesOrdinary " << stServerStat.ResponsesOrdinary << " #ResponsesMulticasts  " << stServerStat.ResponsesMulticasts << " #ResponsesUpdates " << stServerStat.ResponsesUpdates << " #ResponsesForwarded " << stServerStat.ResponsesForwarded << " #ResponsesErrors " << stServerStat.ResponsesErrors << " #ResponsesKeepAlives " << stServerStat.ResponsesKeepAlives << ") ";
 	std::cout << "\nResponseQueuedDurationMinimum " << stServerStat.ResponseQueuedDurationMinimum << " ResponseQueuedDurationMaximum " << stServerStat.ResponseQueuedDurationMaximum << " #ResponsesInClientsQueues "  << stServerStat.ResponsesInLocalClientsQueues << " #ResponsesInServersQueues " << stServerStat.ResponsesInPeerServersQueues << " TotalResponseBytesSent " << stServerStat.TotalResponseBytesSent/1024 << " KB #ResponsesBeingSent " << stServerStat.ResponsesBeingSent;
 
+	std::cout << "\n#ResponsesFailedToQueue " << stServerStat.ResponsesFailedToQueue << " (#ResponsesBackpressured " << stServerStat.ResponsesBackpressured << ") #ResponsesDroppedByBudget " << stServerStat.ResponsesDroppedByBudget << " #ClientsDisconnectedByBudget " << stServerStat.ClientsDisconnectedByBudget;
 	std::cout << "\n#ResponsesFailedToSend " << stServerStat.ResponsesFailedToSend << " #ResponsesFailedToForward " <<  stServerStat.ResponsesFailedToForward << " (#ForwardErrorWritingServer " << stServerStat.ForwardErrorWritingServer << ", #ForwardErrorConnectingTimedout " << stServerStat.ForwardErrorConnectingTimedout << ", #ForwardErrorOverflowed " << stServerStat.ForwardErrorOverflowed << ", #ForwardErrorDisconnecting " << stServerStat.ForwardErrorDisconnecting << ", #ForwardErrorDisconnected " << stServerStat.ForwardErrorDisconnected << ")";
+	std::cout << "\n#PayloadsCompressed " << stServerStat.PayloadsCompressed << " (" << stServerStat.PayloadBytesBeforeCompression/1024 << " KB to " << stServerStat.PayloadBytesAfterCompression/1024 << " KB) #PayloadsNotCompressed " << stServerStat.PayloadsNotCompressed << " TotalCompressionTime " << stServerStat.TotalCompressionTime << " seconds";
+	std::cout << "\n#ResponsesForwardedCompressed " << stServerStat.ResponsesForwardedCompressed << " (" << stServerStat.ForwardedBytesSavedByCompression/1024 << " KB saved) #PayloadsDecompressed " << stServerStat.PayloadsDecompressed << " #PayloadsFailedToDecompress " << stServerStat.PayloadsFailedToDecompress << " TotalDecompressionTime " << stServerStat.TotalDecompressionTime << " seconds";
+	std::cout << "\n#ResponsesWithCompactHandles " << stServerStat.ResponsesWithCompactHandles << " (" << stServerStat.HandleBytesSavedByCompactHandles/1024 << " KB saved)";
 	std::cout << "\n" ;
 	std::cout << "\nErrors & Exceptions stat:";
 	std::cout << "\n#MemoryAllocationExceptionCount " << stServerStat.MemoryAllocationExceptionCount << " #RequestCreationExceptionCount " << stServerStat.RequestCreationExceptionCount << " #ResponseCreationExceptionCount " << stServerStat.ResponseCreationExceptionCount ;
@@ -65,6 +70,11 @@ void PulsarSampleServerLogger::ProcessLog (ServerStat& stServerStat, LoggerMap&
 	std::cout << "\nMemory consumed by responses in queue " << stServerStat.MemoryConsumptionByResponsesInQueue/1024 << " KB" ; // << " (" << (stServerStat.MemoryConsumptionByResponsesInQueue*100)/RequestProcessor::GetCommonParameters().MaxMemoryConsumptionByResponses << "% of allowed MaxMemoryConsumptionByResponses)";
 	std::cout << "\nTotal memory consumption " << stServerStat.TotalMemoryConsumption/1024 << " KB";
 	std::cout << "\nActual memory consumption " << stServerStat.ActualMemoryConsumption/1024 << " KB";
+	std::cout << "\nMemory reserved by slabs " << stServerStat.MemoryReservedBySlabs/1024 << " KB";
+	std::cout << "\nSlab blocks in use/reserved:";
+	for (int i=0; i<SLAB_SIZE_CLASSES; i++)
+		if (stServerStat.SlabBlocksReserved[i])
+			std::cout << " #" << (SLAB_MIN_BLOCK_SIZE << i) << "B " << stServerStat.SlabBlocksInUse[i] << "/" << stServerStat.SlabBlocksReserved[i];
 
 	// Print all elements of WarningsMap, ErrorsMap and DebugMap
 	// First print all elements of InfoMap
@@ -51,6 +51,7 @@ RequestProcessor_v1::RequestProcessor_v1(USHORT version) : RequestProcessor(vers
 	commonparams.MaxPendingResponses = MAX_PENDING_RESPONSES_PER_CLIENT;
 	commonparams.MaxRequestProcessingThreads = NUMBER_OF_REQUESTPROCESSING_THREADS;
 	commonparams.StatusUpdateFrequencyInSeconds = STATUS_INTERVAL_IN_SECONDS;
+	commonparams.EventLoops = NUMBER_OF_EVENT_LOOPS;
 
 	// Note persists in server status updates. Unlike INFO it doesn't vanish.
 	LOG (NOTE, "Request processing threads: %d", commonparams.MaxRequestProcessingThreads);
@@ -134,8 +135,9 @@ int RequestProcessor_v1::ProcessRegister()
 
 	// After successful registration let's respond to client accordingly.
 	// As per our protocol, first byte is RESPONSE code. So let's here modify the request itself (where we've request code: REGISTER), as rest all is same.
-	GetRequest().base[0] = REGISTERED;
-	SendResponse (&clienthandle, &GetRequest());
+	const Buffer request_buffer = GetRequest();
+	request_buffer.base[0] = REGISTERED;
+	SendResponse (&clienthandle, &request_buffer);
 
 	return TRUE;
 }
@@ -36,6 +36,7 @@
 
 // Demo requests
 #define REGISTER		1
+#undef ECHO // Defined by termios.h on Linux
 #define ECHO			2
 
 // Demo responses